@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 import json
 import os
+import re
 import time
 from argparse import ArgumentParser
 
@@ -21,7 +22,19 @@ def parse_args():
     parser.add_argument("-w", "--warmup", type=int, default=2)
     parser.add_argument("-i", "--iterations", type=int, default=20)
     parser.add_argument("-f", "--output", type=str, default=None)
+    parser.add_argument(
+        "-e",
+        "--engines",
+        type=str,
+        default="duckdb",
+        help="comma-separated engines to benchmark: duckdb, whippet "
+        "(default: %(default)s)",
+    )
     args = parser.parse_args()
+    args.engines = [e for e in args.engines.split(",") if e]
+    for engine in args.engines:
+        if engine not in ("duckdb", "whippet"):
+            parser.error(f"unknown engine {engine}")
     # Set default output filename if not specified
     if args.output is None:
         args.output = f"duckdb_bench_res_{args.scale}.json"
@@ -68,6 +81,27 @@ def duckdb_sort(sort_query, conn):
     return res
 
 
+# The ORDER BY list and LIMIT of a sort query, for the Whippet Sort engine,
+# which takes them instead of SQL. Column names are lower case as
+# gen_tpc_data.py writes them; DuckDB ignores the case, the engine does not.
+def parse_sort_query(sort_query):
+    match = re.search(r"ORDER BY (.+?)(?: LIMIT (\d+))?$", sort_query)
+    return match.group(1).lower(), int(match.group(2) or 0)
+
+
+# Prepare for the Whippet Sort engine: the table is preloaded with pyarrow,
+# as DuckDB's is, to eliminate the IO overhead
+def whippet_prepare(file_name):
+    return pq.read_table(file_name)
+
+
+# Benchmark code for the Whippet Sort engine, through its Python bindings
+def whippet_sort(sort_query, table):
+    order_by, limit = parse_sort_query(sort_query)
+    res = whippet.sort(table, order_by, limit=limit)
+    return res
+
+
 def benchmark(discription, attr_num, benchmark_func, warmup, iterations, *args):
     # Warmup phase
     for i in range(warmup):
@@ -104,7 +138,7 @@ def benchmark(discription, attr_num, benchmark_func, warmup, iterations, *args):
     }
 
 
-def mix_bench(warmup, itr, con):
+def mix_bench(warmup, itr, sort_func, target):
     query_two_items = "SELECT * FROM lineitem ORDER BY L_LINENUMBER,L_SHIPINSTRUCT"
     query_three_items = (
         "SELECT * FROM lineitem ORDER BY L_LINENUMBER,L_SHIPINSTRUCT,L_SHIPMODE"
@@ -113,34 +147,34 @@ def mix_bench(warmup, itr, con):
     res_2 = benchmark(
         "Mix Test With 1 number attribute and 1 string attribute",
         2,
-        duckdb_sort,
+        sort_func,
         warmup,
         itr,
         query_two_items,
-        con,
+        target,
     )
     res_3 = benchmark(
         "Mix Test With 1 number attribute and 2 string attribute",
         3,
-        duckdb_sort,
+        sort_func,
         warmup,
         itr,
         query_three_items,
-        con,
+        target,
     )
     res_4 = benchmark(
         "Mix Test With 2 number attribute and 2 string attribute",
         4,
-        duckdb_sort,
+        sort_func,
         warmup,
         itr,
         query_four_items,
-        con,
+        target,
     )
     return [res_2, res_3, res_4]
 
 
-def number_bench(warmup, itr, con):
+def number_bench(warmup, itr, sort_func, target):
     query_one_item_1 = "SELECT * FROM lineitem ORDER BY L_SUPPKEY"
     query_two_item = "SELECT * FROM lineitem ORDER BY L_LINENUMBER, L_RECEIPTDATE"
     query_three_item = "SELECT * FROM lineitem ORDER BY L_LINENUMBER, L_DISCOUNT, L_TAX"
@@ -148,43 +182,43 @@ def number_bench(warmup, itr, con):
     res1 = benchmark(
         "Number Test With 1 attribute",
         1,
-        duckdb_sort,
+        sort_func,
         warmup,
         itr,
         query_one_item_1,
-        con,
+        target,
     )
     res2 = benchmark(
         "Number Test With 2 attributes",
         2,
-        duckdb_sort,
+        sort_func,
         warmup,
         itr,
         query_two_item,
-        con,
+        target,
     )
     res3 = benchmark(
         "Number Test With 3 attributes",
         3,
-        duckdb_sort,
+        sort_func,
         warmup,
         itr,
         query_three_item,
-        con,
+        target,
     )
     res4 = benchmark(
         "Number Test With 4 attributes",
         4,
-        duckdb_sort,
+        sort_func,
         warmup,
         itr,
         query_four_item,
-        con,
+        target,
     )
     return [res1, res2, res3, res4]
 
 
-def string_bench(warmup, itr, con):
+def string_bench(warmup, itr, sort_func, target):
     query_one_item_fixed = "SELECT * FROM lineitem ORDER BY L_SHIPMODE"
     query_two_item = "SELECT * FROM lineitem ORDER BY L_SHIPMODE, L_SHIPINSTRUCT"
     query_three_item = (
@@ -194,38 +228,84 @@ def string_bench(warmup, itr, con):
     res1 = benchmark(
         "String Test With 1 attribute",
         1,
-        duckdb_sort,
+        sort_func,
         warmup,
         itr,
         query_one_item_fixed,
-        con,
+        target,
     )
     res2 = benchmark(
         "String Test With 2 attributes",
         2,
-        duckdb_sort,
+        sort_func,
         warmup,
         itr,
         query_two_item,
-        con,
+        target,
     )
     res3 = benchmark(
         "String Test With 3 attributes",
         3,
-        duckdb_sort,
+        sort_func,
         warmup,
         itr,
         query_three_item,
-        con,
+        target,
     )
     res4 = benchmark(
         "String Test With 4 attributes",
         4,
-        duckdb_sort,
+        sort_func,
+        warmup,
+        itr,
+        query_four_item,
+        target,
+    )
+    return [res1, res2, res3, res4]
+
+
+def topk_bench(warmup, itr, sort_func, target):
+    query_one_item = "SELECT * FROM lineitem ORDER BY L_SHIPDATE LIMIT 100"
+    query_two_item = (
+        "SELECT * FROM lineitem ORDER BY L_EXTENDEDPRICE DESC, L_ORDERKEY LIMIT 100"
+    )
+    query_three_item = "SELECT * FROM lineitem ORDER BY L_SHIPMODE, L_RECEIPTDATE DESC, L_ORDERKEY LIMIT 100"
+    query_four_item = "SELECT * FROM lineitem ORDER BY L_ORDERKEY DESC, L_LINENUMBER, L_SHIPINSTRUCT, L_COMMENT LIMIT 100"
+    res1 = benchmark(
+        "Top-K Test With 1 attribute",
+        1,
+        sort_func,
+        warmup,
+        itr,
+        query_one_item,
+        target,
+    )
+    res2 = benchmark(
+        "Top-K Test With 2 attributes",
+        2,
+        sort_func,
+        warmup,
+        itr,
+        query_two_item,
+        target,
+    )
+    res3 = benchmark(
+        "Top-K Test With 3 attributes",
+        3,
+        sort_func,
+        warmup,
+        itr,
+        query_three_item,
+        target,
+    )
+    res4 = benchmark(
+        "Top-K Test With 4 attributes",
+        4,
+        sort_func,
         warmup,
         itr,
         query_four_item,
-        con,
+        target,
     )
     return [res1, res2, res3, res4]
 
@@ -277,7 +357,8 @@ if __name__ == "__main__":
     # This table contains most records and attributes
     file_name = f"{data_dir}/lineitem.parquet"
     output_file = args.output
-    con = duckdb_preapre(scale, table_src_name="lineitem.parquet")
+    if "whippet" in args.engines:
+        import whippet_sort as whippet
     # Increase priority
     os.nice(-20)
 
@@ -285,26 +366,30 @@ if __name__ == "__main__":
     read_time = benchmark(
         "Arrow Read Benchmark", 0, arrow_read, args.warmup, args.iterations, file_name
     )
-    number_res = number_bench(args.warmup, args.iterations, con)
-    string_res = string_bench(args.warmup, args.iterations, con)
-    mix_res = mix_bench(args.warmup, args.iterations, con)
-    add_percentage(read_time["avg"], number_res)
-    add_percentage(read_time["avg"], string_res)
-    add_percentage(read_time["avg"], mix_res)
-    # Generate plot graph
-    plot_res(number_res, f"number_sort_ratio_{scale}.png")
-    plot_res(string_res, f"string_sort_ratio_{scale}.png")
-    plot_res(mix_res, f"mix_sort_ratio_{scale}.png")
+    results = {"Read Time": read_time}
+    # The query families: result key, plot name and benchmark
+    families = [
+        ("Number Sort", "number", number_bench),
+        ("String Sort", "string", string_bench),
+        ("Mix Sort", "mix", mix_bench),
+        ("Top-K Sort", "topk", topk_bench),
+    ]
+    for engine in args.engines:
+        if engine == "duckdb":
+            con = duckdb_preapre(scale, table_src_name="lineitem.parquet")
+            sort_func, target, key_prefix, plot_prefix = duckdb_sort, con, "", ""
+        else:
+            table = whippet_prepare(file_name)
+            sort_func, target = whippet_sort, table
+            key_prefix, plot_prefix = "Whippet ", "whippet_"
+        for key, plot_name, bench in families:
+            res = bench(args.warmup, args.iterations, sort_func, target)
+            add_percentage(read_time["avg"], res)
+            # Generate plot graph
+            plot_res(res, f"{plot_prefix}{plot_name}_sort_ratio_{scale}.png")
+            results[key_prefix + key] = res
+        if engine == "duckdb":
+            con.close()
     # Write the result to a json file
     with open(output_file, "w") as f:
-        json.dump(
-            {
-                "Read Time": read_time,
-                "Number Sort": number_res,
-                "String Sort": string_res,
-                "Mix Sort": mix_res,
-            },
-            f,
-            indent=4,
-        )
-    con.close()
+        json.dump(results, f, indent=4)
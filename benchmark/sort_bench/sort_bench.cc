@@ -0,0 +1,542 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+// Runs the ORDER BY queries of read_order_percentile/with_duckdb.py over
+// lineitem with the Whippet Sort engine, DuckDB and Velox in one process,
+// and writes the results in the layout of duckdb_bench_res_{scale}.json.
+// --dataset=tpcds sorts store_sales and --dataset=synthetic the skewed keys
+// of gen_tpc_data.py instead.
+//
+// usage: sort_bench [--dataset=tpch|tpcds|synthetic] [--scale=<n>]
+//                   [--data_dir=<dir>] [--warmup=<n>] [--iterations=<n>]
+//                   [--output=<file>] [benchmark flags]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+#include <arrow/c/bridge.h>
+#include <arrow/io/file.h>
+#include <benchmark/benchmark.h>
+#include <duckdb.hpp>
+#include <parquet/arrow/reader.h>
+#include <unistd.h>
+
+#include "engine/parquet_sorter.h"
+#include "engine/sort_stats.h"
+#include "exec/whippet_order_by.h"
+#include "sort/gpu_sort.h"
+#include "sort/sort_spec.h"
+#include "velox/common/memory/Memory.h"
+#include "velox/exec/tests/utils/AssertQueryBuilder.h"
+#include "velox/exec/tests/utils/PlanBuilder.h"
+#include "velox/vector/arrow/Bridge.h"
+
+namespace {
+
+namespace velox = facebook::velox;
+
+struct Flags {
+  std::string dataset = "tpch";
+  int scale = 1;
+  std::string data_dir = "/workspace/whippet_docker/data";
+  int warmup = 2;
+  int iterations = 20;
+  std::string output;
+};
+
+// The query matrix of with_duckdb.py, and matrices of the same families
+// for the other datasets. Column names are lower case as gen_tpc_data.py
+// writes them; DuckDB ignores the case, the other engines do not.
+struct Query {
+  std::string family;
+  std::string description;
+  int num_attributes;
+  std::string order_by;
+};
+
+// The table a dataset is sorted from, in <data_dir>/<dataset>/s<scale>.
+std::string TableName(const std::string& dataset) {
+  if (dataset == "tpcds") return "store_sales";
+  if (dataset == "synthetic") return "keys";
+  return "lineitem";
+}
+
+std::vector<Query> Queries(const std::string& dataset) {
+  if (dataset == "tpcds") {
+    return {
+        {"Number", "Number Test With 1 attribute", 1, "ss_item_sk"},
+        {"Number", "Number Test With 2 attributes", 2,
+         "ss_store_sk, ss_sold_date_sk"},
+        {"Number", "Number Test With 3 attributes", 3,
+         "ss_customer_sk NULLS FIRST, ss_sold_date_sk, ss_ticket_number"},
+        {"Number", "Number Test With 4 attributes", 4,
+         "ss_quantity DESC, ss_sales_price, ss_item_sk, ss_ticket_number"},
+    };
+  }
+  if (dataset == "synthetic") {
+    // One key column per distribution, see synthetic_batch() of
+    // gen_tpc_data.py.
+    return {
+        {"Distribution", "Uniform keys", 1, "k_uniform"},
+        {"Distribution", "Zipf keys", 1, "k_zipf"},
+        {"Distribution", "Nearly sorted keys", 1, "k_nearly_sorted"},
+        {"Distribution", "Reverse sorted keys", 1, "k_reverse_sorted"},
+        {"Distribution", "All duplicate keys", 1, "k_duplicates"},
+        {"Distribution", "Zipf string keys", 1, "s_zipf"},
+        {"Distribution", "All duplicate then uniform keys", 2,
+         "k_duplicates, k_uniform"},
+    };
+  }
+  return {
+      {"Number", "Number Test With 1 attribute", 1, "l_suppkey"},
+      {"Number", "Number Test With 2 attributes", 2,
+       "l_linenumber, l_receiptdate"},
+      {"Number", "Number Test With 3 attributes", 3,
+       "l_linenumber, l_discount, l_tax"},
+      {"Number", "Number Test With 4 attributes", 4,
+       "l_linenumber, l_discount, l_quantity, l_extendedprice"},
+      {"String", "String Test With 1 attribute", 1, "l_shipmode"},
+      {"String", "String Test With 2 attributes", 2,
+       "l_shipmode, l_shipinstruct"},
+      {"String", "String Test With 3 attributes", 3,
+       "l_shipmode DESC, l_shipinstruct, l_returnflag"},
+      {"String", "String Test With 4 attributes", 4,
+       "l_shipmode, l_shipinstruct, l_returnflag, l_comment"},
+      {"Mix", "Mix Test With 1 number attribute and 1 string attribute", 2,
+       "l_linenumber, l_shipinstruct"},
+      {"Mix", "Mix Test With 1 number attribute and 2 string attribute", 3,
+       "l_linenumber, l_shipinstruct, l_shipmode"},
+      {"Mix", "Mix Test With 2 number attribute and 2 string attribute", 4,
+       "l_linenumber, l_shipinstruct, l_shipmode, l_discount"},
+  };
+}
+
+// The engines and the result keys of their queries, e.g. "Number Sort" for
+// DuckDB as in with_duckdb.py and "Whippet Number Sort" for the engine.
+const std::vector<std::string>& Engines() {
+  static const std::vector<std::string> engines = {
+      "DuckDB", "Whippet", "WhippetGpu", "Velox", "VeloxWhippet"};
+  return engines;
+}
+
+std::string ResultKey(const std::string& engine, const std::string& family) {
+  if (engine == "DuckDB") return family + " Sort";
+  return engine + " " + family + " Sort";
+}
+
+bool ParseFlag(const char* arg, const std::string& name, std::string* value) {
+  const std::string prefix = "--" + name + "=";
+  if (std::string(arg).rfind(prefix, 0) != 0) return false;
+  *value = arg + prefix.size();
+  return true;
+}
+
+// Takes our flags out of argv and leaves the benchmark flags.
+Flags ParseFlags(int* argc, char** argv) {
+  Flags flags;
+  int kept = 1;
+  for (int i = 1; i < *argc; ++i) {
+    std::string value;
+    if (ParseFlag(argv[i], "dataset", &value)) {
+      flags.dataset = value;
+    } else if (ParseFlag(argv[i], "scale", &value)) {
+      flags.scale = std::atoi(value.c_str());
+    } else if (ParseFlag(argv[i], "data_dir", &value)) {
+      flags.data_dir = value;
+    } else if (ParseFlag(argv[i], "warmup", &value)) {
+      flags.warmup = std::atoi(value.c_str());
+    } else if (ParseFlag(argv[i], "iterations", &value)) {
+      flags.iterations = std::max(1, std::atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "output", &value)) {
+      flags.output = value;
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+  *argc = kept;
+  if (flags.dataset != "tpch" && flags.dataset != "tpcds" &&
+      flags.dataset != "synthetic") {
+    std::cerr << "unknown dataset " << flags.dataset << std::endl;
+    std::exit(1);
+  }
+  if (flags.output.empty()) {
+    // TPC-H keeps the file name of with_duckdb.py.
+    const auto dataset = flags.dataset == "tpch" ? "" : flags.dataset + "_";
+    flags.output =
+        "duckdb_bench_res_" + dataset + std::to_string(flags.scale) + ".json";
+  }
+  return flags;
+}
+
+template <typename T>
+T ValueOrExit(arrow::Result<T> result) {
+  if (!result.ok()) {
+    std::cerr << result.status().ToString() << std::endl;
+    std::exit(1);
+  }
+  return std::move(result).ValueUnsafe();
+}
+
+void CheckOk(const arrow::Status& status) {
+  if (!status.ok()) {
+    std::cerr << status.ToString() << std::endl;
+    std::exit(1);
+  }
+}
+
+std::shared_ptr<arrow::Table> ReadParquet(const std::string& path) {
+  auto file = ValueOrExit(arrow::io::ReadableFile::Open(path));
+  std::unique_ptr<parquet::arrow::FileReader> reader;
+  CheckOk(parquet::arrow::OpenFile(file, arrow::default_memory_pool(),
+                                   &reader));
+  std::shared_ptr<arrow::Table> table;
+  CheckOk(reader->ReadTable(&table));
+  return table;
+}
+
+int64_t DecodedBytes(const arrow::Table& table) {
+  int64_t bytes = 0;
+  for (const auto& column : table.columns()) {
+    for (const auto& chunk : column->chunks()) {
+      for (const auto& buffer : chunk->data()->buffers) {
+        if (buffer != nullptr) bytes += buffer->size();
+      }
+    }
+  }
+  return bytes;
+}
+
+// The inputs shared by the benchmarks, loaded once like the preloaded
+// DuckDB table of with_duckdb.py.
+struct Inputs {
+  std::string table_name;
+  std::string input;
+  std::string sorted_output;
+  int64_t num_rows = 0;
+  int64_t decoded_bytes = 0;
+  std::unique_ptr<duckdb::DuckDB> duckdb;
+  std::unique_ptr<duckdb::Connection> connection;
+  std::shared_ptr<velox::memory::MemoryPool> velox_pool;
+  std::vector<velox::RowVectorPtr> vectors;
+};
+
+Inputs* inputs = nullptr;
+
+void LoadInputs(const Flags& flags) {
+  inputs = new Inputs;
+  inputs->table_name = TableName(flags.dataset);
+  inputs->input = flags.data_dir + "/" + flags.dataset + "/s" +
+                  std::to_string(flags.scale) + "/" + inputs->table_name +
+                  ".parquet";
+  inputs->sorted_output =
+      "/tmp/whippet_sort_bench_" + std::to_string(getpid()) + ".parquet";
+  auto table = ReadParquet(inputs->input);
+  inputs->num_rows = table->num_rows();
+  inputs->decoded_bytes = DecodedBytes(*table);
+
+  inputs->duckdb = std::make_unique<duckdb::DuckDB>(nullptr);
+  inputs->connection = std::make_unique<duckdb::Connection>(*inputs->duckdb);
+  auto created = inputs->connection->Query(
+      "CREATE TABLE " + inputs->table_name +
+      " AS SELECT * FROM read_parquet('" + inputs->input + "')");
+  if (created->HasError()) {
+    std::cerr << created->GetError() << std::endl;
+    std::exit(1);
+  }
+
+  velox::memory::MemoryManager::initialize({});
+  whippet_sort::RegisterWhippetOrderBy();
+  inputs->velox_pool = velox::memory::memoryManager()->addLeafPool();
+  arrow::TableBatchReader reader(*table);
+  reader.set_chunksize(64 * 1024);
+  std::shared_ptr<arrow::RecordBatch> batch;
+  while (true) {
+    CheckOk(reader.ReadNext(&batch));
+    if (batch == nullptr) break;
+    ArrowSchema schema;
+    ArrowArray array;
+    CheckOk(arrow::ExportRecordBatch(*batch, &array, &schema));
+    inputs->vectors.push_back(std::dynamic_pointer_cast<velox::RowVector>(
+        velox::importFromArrowAsOwner(schema, array,
+                                      inputs->velox_pool.get())));
+  }
+}
+
+// Runs `run` `warmup` times on the first repetition only, then times it.
+template <typename Run>
+void Measure(benchmark::State& state, int* warmup, Run run) {
+  for (; *warmup > 0; --*warmup) run();
+  for (auto _ : state) {
+    run();
+  }
+  state.SetItemsProcessed(inputs->num_rows);
+  state.SetBytesProcessed(inputs->decoded_bytes);
+}
+
+void BM_ArrowRead(benchmark::State& state, int* warmup) {
+  Measure(state, warmup, [] {
+    benchmark::DoNotOptimize(ReadParquet(inputs->input));
+  });
+}
+
+void BM_DuckDB(benchmark::State& state, int* warmup, std::string order_by) {
+  const auto query =
+      "SELECT * FROM " + inputs->table_name + " ORDER BY " + order_by;
+  Measure(state, warmup, [&] {
+    auto result = inputs->connection->Query(query);
+    if (result->HasError()) state.SkipWithError(result->GetError().c_str());
+  });
+}
+
+// `gpu` sorts the keys on the GPU; otherwise the engine never picks it.
+void BM_Whippet(benchmark::State& state, int* warmup, std::string order_by,
+                bool gpu) {
+  whippet_sort::SortOptions options;
+  options.sort_keys = ValueOrExit(whippet_sort::ParseSortSpec(order_by));
+  options.perf_counters = true;
+  options.use_gpu = false;
+  if (gpu) options.algorithm = whippet_sort::SortAlgorithm::kGpu;
+  whippet_sort::ParquetSorter sorter(options);
+  whippet_sort::SortStats total;
+  Measure(state, warmup, [&] {
+    auto stats = sorter.Sort(inputs->input, inputs->sorted_output);
+    if (!stats.ok()) {
+      state.SkipWithError(stats.status().ToString().c_str());
+      return;
+    }
+    total.gathered_bytes += stats->gathered_bytes;
+    for (int i = 0; i < whippet_sort::kNumPhases; ++i) {
+      total.phase_nanos[i] += stats->phase_nanos[i];
+      for (int e = 0; e < whippet_sort::kNumPerfEvents; ++e) {
+        const auto count = stats->phase_counts[i][e];
+        if (count < 0) continue;
+        auto& sum = total.phase_counts[i][e];
+        sum = std::max<int64_t>(sum, 0) + count;
+      }
+    }
+  });
+  // Phase times and hardware event counts of the timed runs only.
+  const int64_t gather_nanos = total.phase_nanos_of(
+      whippet_sort::Phase::kMaterialize);
+  if (gather_nanos > 0) {
+    state.counters["gather_bytes_per_second"] = benchmark::Counter(
+        static_cast<double>(total.gathered_bytes) * 1e9 /
+        static_cast<double>(gather_nanos));
+  }
+  for (int i = 0; i < whippet_sort::kNumPhases; ++i) {
+    const auto phase = static_cast<whippet_sort::Phase>(i);
+    const std::string name = whippet_sort::PhaseName(phase);
+    state.counters[name + "_ms"] = benchmark::Counter(
+        total.phase_millis(phase), benchmark::Counter::kAvgIterations);
+    for (int e = 0; e < whippet_sort::kNumPerfEvents; ++e) {
+      const auto count = total.phase_counts[i][e];
+      if (count < 0) continue;
+      const auto event = static_cast<whippet_sort::PerfEvent>(e);
+      state.counters[name + "_" + whippet_sort::PerfEventName(event)] =
+          benchmark::Counter(static_cast<double>(count),
+                             benchmark::Counter::kAvgIterations);
+    }
+  }
+}
+
+void BM_Velox(benchmark::State& state, int* warmup, std::string order_by,
+              bool whippet) {
+  auto spec = ValueOrExit(whippet_sort::ParseSortSpec(order_by));
+  velox::exec::test::PlanBuilder builder;
+  builder.values(inputs->vectors);
+  if (whippet) {
+    builder.addNode(whippet_sort::AddWhippetOrderBy(order_by));
+  } else {
+    std::vector<std::string> keys;
+    for (const auto& key : spec) keys.push_back(key.ToString());
+    builder.orderBy(keys, /*isPartial=*/false);
+  }
+  auto plan = builder.planNode();
+  Measure(state, warmup, [&] {
+    std::shared_ptr<velox::exec::Task> task;
+    benchmark::DoNotOptimize(
+        velox::exec::test::AssertQueryBuilder(plan).runWithoutResults(task));
+  });
+}
+
+using Runs = std::vector<benchmark::BenchmarkReporter::Run>;
+
+// Keeps the timed repetitions of every benchmark for the JSON output.
+class Collector : public benchmark::ConsoleReporter {
+ public:
+  void ReportRuns(const std::vector<Run>& runs) override {
+    for (const auto& run : runs) {
+      if (run.run_type == Run::RT_Iteration && !run.skipped) {
+        runs_[run.run_name.function_name].push_back(run);
+      }
+    }
+    ConsoleReporter::ReportRuns(runs);
+  }
+
+  const Runs* Find(const std::string& name) const {
+    auto it = runs_.find(name);
+    return it == runs_.end() ? nullptr : &it->second;
+  }
+
+ private:
+  std::map<std::string, Runs> runs_;
+};
+
+std::string Quote(const std::string& text) { return "\"" + text + "\""; }
+
+// One result object of with_duckdb.py's benchmark(), plus the rates and, for
+// the engine, the phase times. `indent` is the indent of the closing brace.
+std::string ResultJson(const std::string& description, int num_attributes,
+                       const Runs& runs, double read_avg,
+                       const std::string& indent) {
+  std::vector<double> times;
+  for (const auto& run : runs) times.push_back(run.GetAdjustedRealTime());
+  std::sort(times.begin(), times.end());
+  const double n = static_cast<double>(times.size());
+  const double avg = std::accumulate(times.begin(), times.end(), 0.0) / n;
+  double variance = 0;
+  for (double t : times) variance += (t - avg) * (t - avg);
+  const size_t mid = times.size() / 2;
+  const double median = times.size() % 2 == 1
+                            ? times[mid]
+                            : (times[mid - 1] + times[mid]) / 2;
+  const double avg_percentile =
+      static_cast<double>(std::lower_bound(times.begin(), times.end(), avg) -
+                          times.begin()) /
+      n;
+
+  std::map<std::string, double> counters;
+  for (const auto& run : runs) {
+    for (const auto& [name, counter] : run.counters) {
+      counters[name] += counter.value / n;
+    }
+  }
+  std::ostringstream out;
+  out << "{\n";
+  const std::string in = indent + "    ";
+  out << in << "\"Description\": " << Quote(description) << ",\n"
+      << in << "\"Number of Attributes\": " << num_attributes << ",\n"
+      << in << "\"min\": " << times.front() << ",\n"
+      << in << "\"max\": " << times.back() << ",\n"
+      << in << "\"avg\": " << avg << ",\n"
+      << in << "\"median\": " << median << ",\n"
+      << in << "\"std\": " << std::sqrt(variance / n) << ",\n"
+      << in << "\"avg_percentile\": " << avg_percentile;
+  if (read_avg > 0) {
+    out << ",\n" << in << "\"Read/Sort Ratio\": " << read_avg / avg;
+  }
+  for (const auto& [name, value] : counters) {
+    const auto key = name == "items_per_second"   ? std::string("rows/s")
+                     : name == "bytes_per_second" ? std::string("bytes/s")
+                                                  : name;
+    out << ",\n" << in << Quote(key) << ": " << value;
+  }
+  out << "\n" << indent << "}";
+  return out.str();
+}
+
+double AverageMillis(const Runs& runs) {
+  double total = 0;
+  for (const auto& run : runs) total += run.GetAdjustedRealTime();
+  return runs.empty() ? 0 : total / static_cast<double>(runs.size());
+}
+
+void WriteJson(const Flags& flags, const Collector& collector) {
+  const auto* read_runs = collector.Find("Read/Arrow");
+  const double read_avg = read_runs == nullptr ? 0 : AverageMillis(*read_runs);
+  std::ofstream out(flags.output);
+  out << "{\n";
+  bool first = true;
+  if (read_runs != nullptr) {
+    out << "    \"Read Time\": "
+        << ResultJson("Arrow Read Benchmark", 0, *read_runs, 0, "    ");
+    first = false;
+  }
+  for (const auto& engine : Engines()) {
+    std::map<std::string, std::vector<std::string>> families;
+    std::vector<std::string> order;
+    for (const auto& query : Queries(flags.dataset)) {
+      const auto* runs = collector.Find(engine + "/" + query.description);
+      if (runs == nullptr || runs->empty()) continue;
+      const auto key = ResultKey(engine, query.family);
+      if (families.count(key) == 0) order.push_back(key);
+      families[key].push_back(ResultJson(query.description,
+                                         query.num_attributes, *runs,
+                                         read_avg, "        "));
+    }
+    for (const auto& key : order) {
+      out << (first ? "" : ",\n") << "    " << Quote(key) << ": [\n";
+      first = false;
+      const auto& results = families[key];
+      for (size_t i = 0; i < results.size(); ++i) {
+        out << "        " << results[i]
+            << (i + 1 < results.size() ? ",\n" : "\n");
+      }
+      out << "    ]";
+    }
+  }
+  out << "\n}\n";
+  std::cout << "results written to " << flags.output << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto flags = ParseFlags(&argc, argv);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  LoadInputs(flags);
+
+  // One timed iteration per repetition, like one perf_counter() sample of
+  // with_duckdb.py, and warmup runs before the first repetition.
+  std::vector<std::unique_ptr<int>> warmups;
+  auto add = [&](const std::string& name, auto function, auto... args) {
+    warmups.push_back(std::make_unique<int>(flags.warmup));
+    benchmark::RegisterBenchmark(name.c_str(), function, warmups.back().get(),
+                                 args...)
+        ->Iterations(1)
+        ->Repetitions(flags.iterations)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+  };
+  add("Read/Arrow", BM_ArrowRead);
+  for (const auto& query : Queries(flags.dataset)) {
+    add("DuckDB/" + query.description, BM_DuckDB, query.order_by);
+    add("Whippet/" + query.description, BM_Whippet, query.order_by, false);
+    if (whippet_sort::GetGpuDevice() != nullptr) {
+      add("WhippetGpu/" + query.description, BM_Whippet, query.order_by,
+          true);
+    }
+    add("Velox/" + query.description, BM_Velox, query.order_by, false);
+    add("VeloxWhippet/" + query.description, BM_Velox, query.order_by, true);
+  }
+
+  Collector collector;
+  benchmark::RunSpecifiedBenchmarks(&collector);
+  benchmark::Shutdown();
+  WriteJson(flags, collector);
+  std::remove(inputs->sorted_output.c_str());
+  return 0;
+}
@@ -25,6 +25,14 @@ FOLLY_SHA256="b249436cb61b6dfd5288093565438d8da642b07ae021191a4042b221bc1bdc0e"
 # arrow
 ARROW_VERSION=release-15.0.0-rc0
 
+# Arrow's SIMD: the baseline every machine must have, and the highest
+# level whose kernels are compiled in and picked at runtime.
+ARROW_SIMD_LEVEL=${ARROW_SIMD_LEVEL:-SSE4_2}
+ARROW_RUNTIME_SIMD_LEVEL=${ARROW_RUNTIME_SIMD_LEVEL:-MAX}
+
+# google benchmark
+BENCHMARK_VERSION=v1.8.3
+
 check_if_source_exist() {
   if [ -z $1 ]; then
     echo "dir should specified to check if exist." && return 1
@@ -98,7 +106,7 @@ build_arrow() {
     -DARROW_ALTIVEC=OFF \
     -DARROW_DEPENDENCY_USE_SHARED=OFF -DARROW_BOOST_USE_SHARED=OFF -DARROW_BUILD_SHARED=OFF \
     -DARROW_BUILD_STATIC=ON -DARROW_COMPUTE=ON -DARROW_IPC=ON -DARROW_JEMALLOC=OFF \
-    -DARROW_SIMD_LEVEL=NONE -DARROW_RUNTIME_SIMD_LEVEL=NONE \
+    -DARROW_SIMD_LEVEL=${ARROW_SIMD_LEVEL} -DARROW_RUNTIME_SIMD_LEVEL=${ARROW_RUNTIME_SIMD_LEVEL} \
     -DARROW_WITH_BROTLI=OFF \
     -DARROW_WITH_LZ4=ON -Dlz4_SOURCE=BUNDLED -DARROW_WITH_SNAPPY=ON -DSnappy_SOURCE=BUNDLED -DARROW_WITH_ZLIB=ON -DZLIB_SOURCE=BUNDLED \
     -DARROW_WITH_ZSTD=ON -Dzstd_SOURCE=BUNDLED -DThrift_SOURCE=BUNDLED \
@@ -118,8 +126,34 @@ build_arrow() {
   popd
 }
 
+download_benchmark() {
+  mkdir -p $third_party_dir
+  pushd $third_party_dir
+  if [ ! -e benchmark ]; then git clone https://github.com/google/benchmark.git; fi
+  cd benchmark
+  git checkout ${BENCHMARK_VERSION}
+  popd
+}
+
+build_benchmark() {
+  download_benchmark
+  pushd $third_party_dir/benchmark
+
+  mkdir -p build && cd build
+
+  cmake -G${CMAKE_GENERATOR} ${COMMON_CMAKE_FLAGS} \
+    -DCMAKE_INSTALL_PREFIX=${install_dir}/benchmark \
+    -DBENCHMARK_ENABLE_TESTING=OFF -DBENCHMARK_ENABLE_GTEST_TESTS=OFF \
+    -DBENCHMARK_ENABLE_WERROR=OFF \
+    ..
+  cmake --build . --config Release -- -j $PARALLEL
+  cmake --install .
+  popd
+}
+
 all() {
   build_arrow
+  build_benchmark
 }
 
 $@
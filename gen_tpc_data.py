@@ -1,6 +1,8 @@
 #!/usr/bin/env python3
 
 import duckdb
+import numpy as np
+import pyarrow as pa
 import pyarrow.parquet as pq
 import os
 from argparse import ArgumentParser
@@ -8,18 +10,101 @@ from argparse import ArgumentParser
 root_dir = os.path.dirname(os.path.realpath(__file__))
 data_dir = os.path.join(root_dir, "data")
 
+# Rows of lineitem per unit of scale factor, the size of the synthetic table.
+synthetic_rows_per_scale = 6_000_000
+# Rows generated and written at a time for the synthetic table.
+synthetic_batch_rows = 1 << 20
+
 
 def parse_args():
-    parser = ArgumentParser(description="Generate TPC-H/TPC-DS data.")
+    parser = ArgumentParser(description="Generate TPC-H/TPC-DS/synthetic data.")
     parser.add_argument("-s", "--scale-factor", type=int, required=True)
-    parser.add_argument("-d", "--dataset", default="tpch", choices=["tpch", "tpcds"])
+    parser.add_argument(
+        "-d", "--dataset", default="tpch", choices=["tpch", "tpcds", "synthetic"]
+    )
+    parser.add_argument(
+        "-t",
+        "--tables",
+        default="store_sales,catalog_sales",
+        help="comma-separated TPC-DS tables to write (default: %(default)s)",
+    )
+    parser.add_argument(
+        "-r",
+        "--row-group-size",
+        type=int,
+        default=None,
+        help="rows per Parquet row group (default: pyarrow's)",
+    )
+    parser.add_argument(
+        "-c",
+        "--compression",
+        default="snappy",
+        choices=["snappy", "lz4", "zstd", "gzip", "none"],
+    )
+    parser.add_argument(
+        "-e",
+        "--encoding",
+        default="dictionary",
+        choices=["dictionary", "plain", "delta"],
+        help="dictionary: pyarrow's default; plain: no dictionaries; delta: "
+        "DELTA_BINARY_PACKED integers and DELTA_LENGTH_BYTE_ARRAY strings",
+    )
+    parser.add_argument(
+        "--zipf-exponent",
+        type=float,
+        default=1.2,
+        help="exponent of the Zipf-skewed synthetic keys (default: %(default)s)",
+    )
+    parser.add_argument(
+        "--unsorted-fraction",
+        type=float,
+        default=0.01,
+        help="fraction of out-of-place rows in the nearly sorted synthetic "
+        "keys (default: %(default)s)",
+    )
+    parser.add_argument("--seed", type=int, default=42)
     return parser.parse_args()
 
 
+# Keyword arguments of pq.write_table/pq.ParquetWriter for the chosen layout.
+def parquet_options(args, schema):
+    options = {"compression": args.compression}
+    if args.row_group_size is not None:
+        options["row_group_size"] = args.row_group_size
+    if args.encoding == "plain":
+        options["use_dictionary"] = False
+    elif args.encoding == "delta":
+        encodings = {}
+        for field in schema:
+            if pa.types.is_integer(field.type):
+                encodings[field.name] = "DELTA_BINARY_PACKED"
+            elif pa.types.is_string(field.type) or pa.types.is_binary(field.type):
+                encodings[field.name] = "DELTA_LENGTH_BYTE_ARRAY"
+            else:
+                encodings[field.name] = "PLAIN"
+        options["use_dictionary"] = False
+        options["column_encoding"] = encodings
+    return options
+
+
+def write_parquet(args, table, parquet_path):
+    print(f"write to {parquet_path}")
+    options = parquet_options(args, table.schema)
+    # ParquetWriter takes the row group size per write_table call.
+    row_group_size = options.pop("row_group_size", None)
+    with pq.ParquetWriter(parquet_path, table.schema, **options) as writer:
+        writer.write_table(table, row_group_size=row_group_size)
+
+
+def make_output_dir(dataset, scale_factor):
+    output_dir = os.path.join(data_dir, dataset, f"s{scale_factor}")
+    os.makedirs(output_dir)
+    return output_dir
+
+
 def gen_tpch(args):
     scale_factor = args.scale_factor
-    output_dir = os.path.join(data_dir, "tpch", f"s{scale_factor}")
-    os.makedirs(output_dir)
+    output_dir = make_output_dir("tpch", scale_factor)
     print(f"Generating TPC-H data with SF={scale_factor}, output dir is {output_dir}")
     con = duckdb.connect(database=":memory:")
     con.execute("INSTALL tpch; LOAD tpch")
@@ -27,9 +112,67 @@ def gen_tpch(args):
     for table in con.execute("show tables").fetchall():
         table_name = table[0]
         parquet_path = os.path.join(output_dir, f"{table_name}.parquet")
-        print(f"write to {parquet_path}")
         res = con.query(f"SELECT * FROM {table_name}")
-        pq.write_table(res.to_arrow_table(), parquet_path)
+        write_parquet(args, res.to_arrow_table(), parquet_path)
+
+
+def gen_tpcds(args):
+    scale_factor = args.scale_factor
+    output_dir = make_output_dir("tpcds", scale_factor)
+    print(f"Generating TPC-DS data with SF={scale_factor}, output dir is {output_dir}")
+    con = duckdb.connect(database=":memory:")
+    con.execute("INSTALL tpcds; LOAD tpcds")
+    con.execute(f"CALL dsdgen(sf={scale_factor})")
+    tables = [t for t in args.tables.split(",") if t]
+    for table_name in tables:
+        parquet_path = os.path.join(output_dir, f"{table_name}.parquet")
+        res = con.query(f"SELECT * FROM {table_name}")
+        write_parquet(args, res.to_arrow_table(), parquet_path)
+
+
+# One batch of the synthetic table: rows [begin, begin + length) of
+# `num_rows`, with one key column per distribution and two payload columns.
+def synthetic_batch(args, rng, begin, length, num_rows):
+    row = np.arange(begin, begin + length, dtype=np.int64)
+    zipf = np.minimum(rng.zipf(args.zipf_exponent, length), num_rows).astype(np.int64)
+    nearly_sorted = row.copy()
+    unsorted = rng.random(length) < args.unsorted_fraction
+    nearly_sorted[unsorted] = rng.integers(0, num_rows, int(unsorted.sum()))
+    string_zipf = np.minimum(rng.zipf(args.zipf_exponent, length), 1 << 20)
+    return pa.table(
+        {
+            "k_uniform": pa.array(rng.integers(0, num_rows, length)),
+            "k_zipf": pa.array(zipf),
+            "k_nearly_sorted": pa.array(nearly_sorted),
+            "k_reverse_sorted": pa.array(num_rows - 1 - row),
+            "k_duplicates": pa.array(np.zeros(length, dtype=np.int64)),
+            "s_zipf": pa.array([f"key_{v:08d}" for v in string_zipf]),
+            "p_double": pa.array(rng.random(length)),
+            "p_string": pa.array([f"payload_{v:012d}" for v in row]),
+        }
+    )
+
+
+def gen_synthetic(args):
+    scale_factor = args.scale_factor
+    output_dir = make_output_dir("synthetic", scale_factor)
+    num_rows = synthetic_rows_per_scale * scale_factor
+    print(f"Generating {num_rows} synthetic rows, output dir is {output_dir}")
+    rng = np.random.default_rng(args.seed)
+    parquet_path = os.path.join(output_dir, "keys.parquet")
+    print(f"write to {parquet_path}")
+    # Every write ends a row group, so batches are at least a row group.
+    batch_rows = max(synthetic_batch_rows, args.row_group_size or 0)
+    writer = None
+    for begin in range(0, num_rows, batch_rows):
+        length = min(batch_rows, num_rows - begin)
+        batch = synthetic_batch(args, rng, begin, length, num_rows)
+        if writer is None:
+            options = parquet_options(args, batch.schema)
+            row_group_size = options.pop("row_group_size", None)
+            writer = pq.ParquetWriter(parquet_path, batch.schema, **options)
+        writer.write_table(batch, row_group_size=row_group_size)
+    writer.close()
 
 
 if __name__ == "__main__":
@@ -37,3 +180,7 @@ if __name__ == "__main__":
 
     if args.dataset == "tpch":
         gen_tpch(args)
+    elif args.dataset == "tpcds":
+        gen_tpcds(args)
+    else:
+        gen_synthetic(args)
@@ -0,0 +1,101 @@
+"""Python bindings of the Whippet Sort engine.
+
+Sorts pyarrow tables, record batch readers, datasets, Parquet files,
+directories and globs of Parquet files by an ORDER BY list such as
+"l_shipmode DESC, l_shipinstruct". Data moves between pyarrow and the
+engine through the Arrow C data interface without copies, and the sorts
+release the GIL.
+
+Every function takes the options of the command line tool as keywords:
+limit, memory_limit (bytes), threads, algorithm ("auto", "comparison",
+"radix", "counting", "run-merge" or "gpu"), string_prefix, spill_directory
+and use_gpu; sort_file() also takes row_group_size and compression. The
+stats of a sort are a dict with the phase times in "phase_ms" and the
+engine's summary in "summary".
+"""
+
+import os
+
+import pyarrow as pa
+
+from ._whippet_sort import (
+    sort_file as _sort_file,
+    sort_path as _sort_path,
+    sort_path_indices as _sort_path_indices,
+    sort_table as _sort_table,
+    sort_table_indices as _sort_table_indices,
+)
+
+__all__ = ["sort", "sort_indices", "sort_reader", "sort_file"]
+
+# Rows per batch of sort_reader() and of the tables read from files.
+DEFAULT_BATCH_ROWS = 64 * 1024
+
+
+def _is_path(source):
+    return isinstance(source, (str, os.PathLike))
+
+
+# The C stream of a table, a record batch reader or a dataset.
+def _stream_capsule(source):
+    try:
+        import pyarrow.dataset as ds
+
+        if isinstance(source, ds.Dataset):
+            source = source.scanner().to_reader()
+    except ImportError:
+        pass
+    if not hasattr(source, "__arrow_c_stream__"):
+        raise TypeError(
+            f"cannot sort a {type(source).__name__}; expected a path, a "
+            "pyarrow.Table, a RecordBatchReader or a pyarrow.dataset.Dataset"
+        )
+    return source.__arrow_c_stream__()
+
+
+def sort_reader(path, by, batch_rows=DEFAULT_BATCH_ROWS, **options):
+    """Sorts a Parquet file, directory or glob and returns a
+    pyarrow.RecordBatchReader of the sorted rows and a function returning
+    the stats, which are complete once the reader is exhausted. The keys are
+    sorted before this returns; the batches are gathered as they are read,
+    one batch ahead of the reader."""
+    sorted_file = _sort_path(os.fspath(path), by, batch_rows, options)
+    reader = pa.RecordBatchReader._import_from_c_capsule(
+        sorted_file.__arrow_c_stream__()
+    )
+    return reader, sorted_file.stats
+
+
+def sort(source, by, with_stats=False, **options):
+    """Returns the rows of `source` sorted by `by` as a pyarrow.Table, and
+    the stats of the sort if `with_stats`. `source` is a path of Parquet
+    files, a pyarrow.Table, a RecordBatchReader or a dataset."""
+    if _is_path(source):
+        reader, stats = sort_reader(source, by, **options)
+        table = reader.read_all()
+        stats = stats()
+    else:
+        stream, stats = _sort_table(_stream_capsule(source), by, options)
+        table = pa.RecordBatchReader._import_from_c_capsule(stream).read_all()
+    return (table, stats) if with_stats else table
+
+
+def sort_indices(source, by, with_stats=False, **options):
+    """Returns the row ids of `source` in sorted order as a
+    pyarrow.UInt64Array, for pyarrow.Table.take(), and the stats of the sort
+    if `with_stats`. Only the key columns of a file are read; a path must be
+    a single Parquet file."""
+    if _is_path(source):
+        (schema, array), stats = _sort_path_indices(os.fspath(source), by, options)
+    else:
+        (schema, array), stats = _sort_table_indices(
+            _stream_capsule(source), by, options
+        )
+    indices = pa.Array._import_from_c_capsule(schema, array)
+    return (indices, stats) if with_stats else indices
+
+
+def sort_file(input_path, output_path, by, **options):
+    """Sorts Parquet files into the Parquet file `output_path` and returns the
+    stats of the sort."""
+    return _sort_file(os.fspath(input_path), os.fspath(output_path), by, options)
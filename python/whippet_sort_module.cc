@@ -0,0 +1,328 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+// The _whippet_sort extension module of the whippet_sort Python package.
+//
+// Tables and arrays cross into and out of the module through the Arrow C
+// data interface, as PyCapsules of the Arrow PyCapsule protocol. The module
+// links its own Arrow, so it does not depend on the one pyarrow was built
+// with, and the buffers are shared in both directions without copies. The
+// sorts run with the GIL released.
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <arrow/api.h>
+#include <arrow/c/abi.h>
+#include <arrow/c/bridge.h>
+#include <arrow/util/compression.h>
+#include <pybind11/pybind11.h>
+
+#include "engine/parquet_sorter.h"
+#include "engine/sort_stats.h"
+#include "engine/sorted_stream.h"
+#include "sort/sort_algorithm.h"
+#include "sort/sort_spec.h"
+
+namespace py = pybind11;
+
+namespace whippet_sort {
+
+namespace {
+
+// Raises the Python exception closest to `status` unless it is OK.
+void ThrowIfError(const arrow::Status& status) {
+  if (status.ok()) return;
+  if (status.IsInvalid() || status.IsNotImplemented()) {
+    throw py::value_error(status.ToString());
+  }
+  if (status.IsKeyError()) throw py::key_error(status.ToString());
+  if (status.IsOutOfMemory()) throw std::bad_alloc();
+  throw std::runtime_error(status.ToString());
+}
+
+template <typename T>
+T ValueOrThrow(arrow::Result<T> result) {
+  ThrowIfError(result.status());
+  return std::move(result).ValueOrDie();
+}
+
+// Destructors of the capsules this module exports: they release the Arrow
+// structure if no consumer moved it out, then free it.
+void DeleteSchemaCapsule(PyObject* capsule) {
+  auto* schema = static_cast<ArrowSchema*>(
+      PyCapsule_GetPointer(capsule, "arrow_schema"));
+  if (schema->release != nullptr) schema->release(schema);
+  delete schema;
+}
+
+void DeleteArrayCapsule(PyObject* capsule) {
+  auto* array =
+      static_cast<ArrowArray*>(PyCapsule_GetPointer(capsule, "arrow_array"));
+  if (array->release != nullptr) array->release(array);
+  delete array;
+}
+
+void DeleteStreamCapsule(PyObject* capsule) {
+  auto* stream = static_cast<ArrowArrayStream*>(
+      PyCapsule_GetPointer(capsule, "arrow_array_stream"));
+  if (stream->release != nullptr) stream->release(stream);
+  delete stream;
+}
+
+py::capsule ExportStream(std::shared_ptr<arrow::RecordBatchReader> reader) {
+  auto stream = std::make_unique<ArrowArrayStream>();
+  ThrowIfError(arrow::ExportRecordBatchReader(std::move(reader), stream.get()));
+  return py::capsule(stream.release(), "arrow_array_stream",
+                     &DeleteStreamCapsule);
+}
+
+// The (schema, array) capsule pair of `array`.
+py::tuple ExportArray(const arrow::Array& array) {
+  auto c_schema = std::make_unique<ArrowSchema>();
+  auto c_array = std::make_unique<ArrowArray>();
+  ThrowIfError(arrow::ExportArray(array, c_array.get(), c_schema.get()));
+  return py::make_tuple(
+      py::capsule(c_schema.release(), "arrow_schema", &DeleteSchemaCapsule),
+      py::capsule(c_array.release(), "arrow_array", &DeleteArrayCapsule));
+}
+
+// Imports the stream of a capsule from __arrow_c_stream__() and reads it
+// into a table, without the GIL. The import moves the stream out of the
+// capsule, whose producer then only frees the released structure.
+std::shared_ptr<arrow::Table> ImportTable(const py::capsule& capsule) {
+  if (capsule.name() == nullptr ||
+      std::string(capsule.name()) != "arrow_array_stream") {
+    throw py::type_error("expected an arrow_array_stream capsule");
+  }
+  auto* stream = capsule.get_pointer<ArrowArrayStream>();
+  py::gil_scoped_release release;
+  auto reader = ValueOrThrow(arrow::ImportRecordBatchReader(stream));
+  return ValueOrThrow(reader->ToTable());
+}
+
+// SortOptions from the keyword arguments of the Python functions, see
+// whippet_sort/__init__.py for their meaning.
+SortOptions MakeSortOptions(const std::string& by, const py::dict& kwargs) {
+  SortOptions options;
+  options.sort_keys = ValueOrThrow(ParseSortSpec(by));
+  for (const auto& [key, value] : kwargs) {
+    const auto name = key.cast<std::string>();
+    if (value.is_none()) continue;
+    if (name == "limit") {
+      options.limit = value.cast<int64_t>();
+    } else if (name == "memory_limit") {
+      options.memory_limit = value.cast<int64_t>();
+    } else if (name == "threads") {
+      options.num_threads = value.cast<int>();
+    } else if (name == "algorithm") {
+      options.algorithm =
+          ValueOrThrow(ParseSortAlgorithm(value.cast<std::string>()));
+    } else if (name == "string_prefix") {
+      options.string_prefix_width = value.cast<int>();
+    } else if (name == "spill_directory") {
+      options.spill_directory = value.cast<std::string>();
+    } else if (name == "row_group_size") {
+      options.output_row_group_size = value.cast<int64_t>();
+    } else if (name == "compression") {
+      auto codec = value.cast<std::string>();
+      // Parquet has no LZ4 frame format; its LZ4 codec is LZ4_RAW.
+      options.output_compression =
+          ValueOrThrow(arrow::util::Codec::GetCompressionType(
+              codec == "lz4" ? "lz4_raw" : codec));
+    } else if (name == "use_gpu") {
+      options.use_gpu = value.cast<bool>();
+    } else {
+      throw py::type_error("unknown sort option '" + name + "'");
+    }
+  }
+  return options;
+}
+
+py::dict StatsToDict(const SortStats& stats) {
+  py::dict dict;
+  dict["num_rows"] = stats.num_rows;
+  dict["sort_algorithm"] = stats.sort_algorithm;
+  dict["sort_algorithm_reason"] = stats.sort_algorithm_reason;
+  dict["key_width"] = stats.normalized_key_width;
+  dict["threads"] = stats.num_threads;
+  dict["runs"] = stats.num_runs;
+  dict["spill_bytes_written"] = stats.spill_bytes_written;
+  py::dict phases;
+  for (int i = 0; i < kNumPhases; ++i) {
+    const auto phase = static_cast<Phase>(i);
+    phases[PhaseName(phase)] = stats.phase_millis(phase);
+  }
+  dict["phase_ms"] = phases;
+  dict["total_ms"] = static_cast<double>(stats.total_nanos()) / 1e6;
+  if (stats.num_stream_batches > 0) {
+    dict["stream_batches"] = stats.num_stream_batches;
+    dict["first_batch_ms"] = static_cast<double>(stats.first_batch_nanos) / 1e6;
+  }
+  dict["summary"] = stats.ToString();
+  return dict;
+}
+
+// The sorted rows of a file or dataset as a stream, see
+// ParquetSorter::SortStream(). Keeps the sorter alive for the stream.
+class SortedFile : public arrow::RecordBatchReader {
+ public:
+  SortedFile(std::unique_ptr<ParquetSorter> sorter,
+             std::shared_ptr<SortedStream> stream)
+      : sorter_(std::move(sorter)), stream_(std::move(stream)) {}
+
+  std::shared_ptr<arrow::Schema> schema() const override {
+    return stream_->schema();
+  }
+  arrow::Status ReadNext(std::shared_ptr<arrow::RecordBatch>* batch) override {
+    return stream_->ReadNext(batch);
+  }
+  arrow::Status Close() override { return stream_->Close(); }
+
+  const SortStats& stats() const { return stream_->stats(); }
+
+ private:
+  std::unique_ptr<ParquetSorter> sorter_;
+  /// Destroyed before the sorter it uses.
+  std::shared_ptr<SortedStream> stream_;
+};
+
+// The Python object of a SortedFile: exports it once through
+// __arrow_c_stream__ and reports the stats of the sort afterwards.
+class PySortedFile {
+ public:
+  explicit PySortedFile(std::shared_ptr<SortedFile> reader)
+      : reader_(std::move(reader)) {}
+
+  py::capsule ExportStream(const py::object& requested_schema) {
+    if (!requested_schema.is_none()) {
+      throw py::value_error("the sorted stream has a fixed schema");
+    }
+    if (exported_) throw py::value_error("the sorted stream was exported");
+    exported_ = true;
+    return whippet_sort::ExportStream(reader_);
+  }
+
+  // Complete once the consumer read the last batch or released the stream.
+  py::dict Stats() const { return StatsToDict(reader_->stats()); }
+
+ private:
+  std::shared_ptr<SortedFile> reader_;
+  bool exported_ = false;
+};
+
+py::tuple SortTable(const py::capsule& stream, const std::string& by,
+                    const py::dict& kwargs) {
+  auto options = MakeSortOptions(by, kwargs);
+  auto table = ImportTable(stream);
+  SortStats stats;
+  std::shared_ptr<arrow::Table> sorted;
+  {
+    py::gil_scoped_release release;
+    ParquetSorter sorter(std::move(options));
+    sorted = ValueOrThrow(sorter.SortTable(table, &stats));
+  }
+  return py::make_tuple(
+      ExportStream(std::make_shared<arrow::TableBatchReader>(sorted)),
+      StatsToDict(stats));
+}
+
+py::tuple SortTableIndices(const py::capsule& stream, const std::string& by,
+                           const py::dict& kwargs) {
+  auto options = MakeSortOptions(by, kwargs);
+  auto table = ImportTable(stream);
+  SortStats stats;
+  std::shared_ptr<arrow::Array> row_ids;
+  {
+    py::gil_scoped_release release;
+    ParquetSorter sorter(std::move(options));
+    row_ids = ValueOrThrow(sorter.SortTableOrder(table, &stats));
+  }
+  return py::make_tuple(ExportArray(*row_ids), StatsToDict(stats));
+}
+
+PySortedFile SortPath(const std::string& path, const std::string& by,
+                      int64_t batch_rows, const py::dict& kwargs) {
+  auto options = MakeSortOptions(by, kwargs);
+  StreamOptions stream_options;
+  stream_options.batch_rows = batch_rows;
+  py::gil_scoped_release release;
+  auto sorter = std::make_unique<ParquetSorter>(std::move(options));
+  auto stream = ValueOrThrow(sorter->SortStream(path, stream_options));
+  return PySortedFile(
+      std::make_shared<SortedFile>(std::move(sorter), std::move(stream)));
+}
+
+// File row ids of the sort order of `path`, see ParquetSorter::ComputeOrder().
+py::tuple SortPathIndices(const std::string& path, const std::string& by,
+                          const py::dict& kwargs) {
+  auto options = MakeSortOptions(by, kwargs);
+  SortStats stats;
+  std::shared_ptr<arrow::Array> row_ids;
+  {
+    py::gil_scoped_release release;
+    ParquetSorter sorter(std::move(options));
+    auto permutation = ValueOrThrow(sorter.ComputeOrder(path, &stats));
+    // Unpack the ids relative to their row groups into file row ids.
+    const int64_t num_rows = permutation.num_rows();
+    arrow::UInt64Builder builder;
+    ThrowIfError(builder.Reserve(num_rows));
+    for (int64_t i = 0; i < num_rows; ++i) {
+      builder.UnsafeAppend(static_cast<uint64_t>(permutation.row_id(i)));
+    }
+    row_ids = ValueOrThrow(builder.Finish());
+  }
+  return py::make_tuple(ExportArray(*row_ids), StatsToDict(stats));
+}
+
+py::dict SortFile(const std::string& input_path,
+                  const std::string& output_path, const std::string& by,
+                  const py::dict& kwargs) {
+  auto options = MakeSortOptions(by, kwargs);
+  SortStats stats;
+  {
+    py::gil_scoped_release release;
+    ParquetSorter sorter(std::move(options));
+    stats = ValueOrThrow(sorter.Sort(input_path, output_path));
+  }
+  return StatsToDict(stats);
+}
+
+}  // namespace
+
+}  // namespace whippet_sort
+
+PYBIND11_MODULE(_whippet_sort, m) {
+  using namespace whippet_sort;
+  m.doc() = "Whippet Sort engine, see the whippet_sort package";
+
+  py::class_<PySortedFile>(m, "SortedFile")
+      .def("__arrow_c_stream__", &PySortedFile::ExportStream,
+           py::arg("requested_schema") = py::none())
+      .def("stats", &PySortedFile::Stats);
+
+  m.def("sort_table", &SortTable, py::arg("stream"), py::arg("by"),
+        py::arg("options"));
+  m.def("sort_table_indices", &SortTableIndices, py::arg("stream"),
+        py::arg("by"), py::arg("options"));
+  m.def("sort_path", &SortPath, py::arg("path"), py::arg("by"),
+        py::arg("batch_rows"), py::arg("options"));
+  m.def("sort_path_indices", &SortPathIndices, py::arg("path"), py::arg("by"),
+        py::arg("options"));
+  m.def("sort_file", &SortFile, py::arg("input_path"), py::arg("output_path"),
+        py::arg("by"), py::arg("options"));
+}
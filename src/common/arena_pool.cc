@@ -0,0 +1,233 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "common/arena_pool.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace whippet_sort {
+
+namespace {
+
+constexpr int64_t kHugePageSize = 2 << 20;
+constexpr int64_t kChunkAlignment = 64;
+
+// Zero-size buffers all point here, like in Arrow's own pools.
+alignas(kChunkAlignment) uint8_t zero_size_area[1];
+
+int64_t RoundUp(int64_t value, int64_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+}  // namespace
+
+ArenaMemoryPool::ArenaMemoryPool(ArenaOptions options,
+                                 arrow::MemoryPool* parent)
+    : options_(options), parent_(parent) {}
+
+ArenaMemoryPool::~ArenaMemoryPool() {
+  for (const auto& chunk : chunks_) {
+    parent_->Free(chunk.data, chunk.size,
+                  options_.huge_pages ? kHugePageSize : kChunkAlignment);
+  }
+}
+
+arrow::Status ArenaMemoryPool::Allocate(int64_t size, int64_t alignment,
+                                        uint8_t** out) {
+  if (size < 0) {
+    return arrow::Status::Invalid("negative allocation size");
+  }
+  if (size == 0) {
+    *out = zero_size_area;
+    return arrow::Status::OK();
+  }
+  alignment = std::max<int64_t>(alignment, 1);
+  std::lock_guard<std::mutex> lock(mutex_);
+  Chunk* target = nullptr;
+  int64_t offset = 0;
+  for (auto& chunk : chunks_) {
+    if (chunk.dedicated) continue;
+    const auto address = reinterpret_cast<uintptr_t>(chunk.data + chunk.used);
+    offset = chunk.used +
+             static_cast<int64_t>(RoundUp(static_cast<int64_t>(address),
+                                          alignment) -
+                                  static_cast<int64_t>(address));
+    if (offset + size <= chunk.size) {
+      target = &chunk;
+      break;
+    }
+  }
+  if (target == nullptr) {
+    const int64_t min_size = size + alignment;
+    const bool dedicated = min_size > options_.chunk_size / 4;
+    ARROW_RETURN_NOT_OK(
+        AddChunk(dedicated ? min_size : options_.chunk_size, dedicated));
+    target = &chunks_.back();
+    const auto address = reinterpret_cast<uintptr_t>(target->data);
+    offset = RoundUp(static_cast<int64_t>(address), alignment) -
+             static_cast<int64_t>(address);
+  }
+  target->last_offset = offset;
+  target->used = offset + size;
+  ++target->num_live;
+  *out = target->data + offset;
+
+  ++num_live_;
+  bytes_allocated_ += size;
+  max_memory_ = std::max(max_memory_, bytes_allocated_);
+  total_bytes_allocated_ += size;
+  ++num_allocations_;
+  return arrow::Status::OK();
+}
+
+arrow::Status ArenaMemoryPool::Reallocate(int64_t old_size, int64_t new_size,
+                                          int64_t alignment, uint8_t** ptr) {
+  if (*ptr == zero_size_area || old_size == 0) {
+    return Allocate(new_size, alignment, ptr);
+  }
+  if (new_size == 0) {
+    Free(*ptr, old_size, alignment);
+    *ptr = zero_size_area;
+    return arrow::Status::OK();
+  }
+  {
+    // Grow or shrink the last allocation of a chunk in place.
+    std::lock_guard<std::mutex> lock(mutex_);
+    Chunk* chunk = FindChunk(*ptr);
+    if (chunk != nullptr && chunk->last_offset >= 0 &&
+        *ptr == chunk->data + chunk->last_offset &&
+        chunk->last_offset + new_size <= chunk->size) {
+      chunk->used = chunk->last_offset + new_size;
+      bytes_allocated_ += new_size - old_size;
+      max_memory_ = std::max(max_memory_, bytes_allocated_);
+      if (new_size > old_size) total_bytes_allocated_ += new_size - old_size;
+      return arrow::Status::OK();
+    }
+  }
+  uint8_t* moved = nullptr;
+  ARROW_RETURN_NOT_OK(Allocate(new_size, alignment, &moved));
+  std::memcpy(moved, *ptr, static_cast<size_t>(std::min(old_size, new_size)));
+  Free(*ptr, old_size, alignment);
+  *ptr = moved;
+  return arrow::Status::OK();
+}
+
+void ArenaMemoryPool::Free(uint8_t* buffer, int64_t size,
+                           int64_t /*alignment*/) {
+  if (buffer == zero_size_area) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  --num_live_;
+  bytes_allocated_ -= size;
+  Chunk* chunk = FindChunk(buffer);
+  if (chunk != nullptr) {
+    if (--chunk->num_live == 0) {
+      if (chunk->dedicated) {
+        // A buffer with a chunk of its own is big, typically the keys or
+        // the scratch of a large sort; holding on to it would keep that
+        // memory reserved through the rest of the sort.
+        FreeChunk(chunk);
+      } else {
+        chunk->used = 0;
+        chunk->last_offset = -1;
+      }
+    } else if (chunk->last_offset >= 0 &&
+               buffer == chunk->data + chunk->last_offset) {
+      chunk->used = chunk->last_offset;
+      chunk->last_offset = -1;
+    }
+  }
+  if (num_live_ == 0) {
+    // The sort is done: everything is free again.
+    TrimChunks(options_.max_retained_bytes);
+  }
+}
+
+void ArenaMemoryPool::ReleaseUnused() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  TrimChunks(options_.max_retained_bytes);
+}
+
+int64_t ArenaMemoryPool::bytes_allocated() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bytes_allocated_;
+}
+
+int64_t ArenaMemoryPool::max_memory() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return max_memory_;
+}
+
+int64_t ArenaMemoryPool::total_bytes_allocated() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return total_bytes_allocated_;
+}
+
+int64_t ArenaMemoryPool::num_allocations() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_allocations_;
+}
+
+int64_t ArenaMemoryPool::reserved_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t bytes = 0;
+  for (const auto& chunk : chunks_) bytes += chunk.size;
+  return bytes;
+}
+
+arrow::Status ArenaMemoryPool::AddChunk(int64_t min_size, bool dedicated) {
+  const int64_t alignment =
+      options_.huge_pages ? kHugePageSize : kChunkAlignment;
+  const int64_t size = RoundUp(std::max(min_size, int64_t{1}), alignment);
+  uint8_t* data = nullptr;
+  ARROW_RETURN_NOT_OK(parent_->Allocate(size, alignment, &data));
+#ifdef MADV_HUGEPAGE
+  // Only a hint: without transparent huge pages the chunk keeps 4K pages.
+  if (options_.huge_pages) madvise(data, size, MADV_HUGEPAGE);
+#endif
+  chunks_.push_back(Chunk{data, size, /*used=*/0, /*last_offset=*/-1,
+                          /*num_live=*/0, dedicated});
+  return arrow::Status::OK();
+}
+
+ArenaMemoryPool::Chunk* ArenaMemoryPool::FindChunk(const uint8_t* buffer) {
+  for (auto& chunk : chunks_) {
+    if (buffer >= chunk.data && buffer < chunk.data + chunk.size) {
+      return &chunk;
+    }
+  }
+  return nullptr;
+}
+
+void ArenaMemoryPool::FreeChunk(Chunk* chunk) {
+  parent_->Free(chunk->data, chunk->size,
+                options_.huge_pages ? kHugePageSize : kChunkAlignment);
+  chunks_.erase(chunks_.begin() + (chunk - chunks_.data()));
+}
+
+void ArenaMemoryPool::TrimChunks(int64_t max_bytes) {
+  int64_t reserved = 0;
+  for (const auto& chunk : chunks_) reserved += chunk.size;
+  // Idle chunks go back newest first, so the oldest, most used ones stay.
+  for (size_t i = chunks_.size(); i > 0 && reserved > max_bytes; --i) {
+    auto& chunk = chunks_[i - 1];
+    if (chunk.num_live != 0) continue;
+    reserved -= chunk.size;
+    FreeChunk(&chunk);
+  }
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,118 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <arrow/memory_pool.h>
+#include <arrow/status.h>
+
+namespace whippet_sort {
+
+struct ArenaOptions {
+  /// Bytes taken from the parent pool at a time. Allocations larger than a
+  /// quarter of this get a chunk of their own, which goes back to the parent
+  /// pool as soon as the allocation is freed.
+  int64_t chunk_size = 64 << 20;
+  /// Aligns chunks to 2 MiB and asks the kernel to back them with
+  /// transparent huge pages.
+  bool huge_pages = true;
+  /// Bytes of idle chunks kept for reuse once all buffers are freed; the
+  /// rest goes back to the parent pool.
+  int64_t max_retained_bytes = 1LL << 30;
+};
+
+/// A MemoryPool handing out buffers from large chunks of a parent pool by
+/// bumping an offset, for the short-lived buffers of one sort: normalized
+/// keys and the scratch of the run sorts and merges.
+///
+/// Freeing a buffer only returns its memory right away if it was the last
+/// one carved from its chunk, and a chunk is rewound once all of its buffers
+/// are freed. Rewound chunks stay reserved, up to
+/// ArenaOptions::max_retained_bytes once every buffer is freed, so that the
+/// buffers of later runs and sorts land on pages that are already mapped,
+/// huge and warm in the TLB. Chunks of a single large allocation are not
+/// kept.
+///
+/// Thread-safe; one mutex guards the bump pointer, since the sort allocates
+/// few and large buffers.
+class ArenaMemoryPool : public arrow::MemoryPool {
+ public:
+  explicit ArenaMemoryPool(ArenaOptions options = {},
+                           arrow::MemoryPool* parent =
+                               arrow::default_memory_pool());
+  ~ArenaMemoryPool() override;
+
+  ArenaMemoryPool(const ArenaMemoryPool&) = delete;
+  ArenaMemoryPool& operator=(const ArenaMemoryPool&) = delete;
+
+  using arrow::MemoryPool::Allocate;
+  using arrow::MemoryPool::Free;
+  using arrow::MemoryPool::Reallocate;
+
+  arrow::Status Allocate(int64_t size, int64_t alignment,
+                         uint8_t** out) override;
+  arrow::Status Reallocate(int64_t old_size, int64_t new_size,
+                           int64_t alignment, uint8_t** ptr) override;
+  void Free(uint8_t* buffer, int64_t size, int64_t alignment) override;
+
+  /// Returns the idle chunks beyond ArenaOptions::max_retained_bytes to the
+  /// parent pool.
+  void ReleaseUnused() override;
+
+  int64_t bytes_allocated() const override;
+  int64_t max_memory() const override;
+  int64_t total_bytes_allocated() const override;
+  int64_t num_allocations() const override;
+  std::string backend_name() const override { return "arena"; }
+
+  /// Bytes held from the parent pool.
+  int64_t reserved_bytes() const;
+
+ private:
+  struct Chunk {
+    uint8_t* data;
+    int64_t size;
+    int64_t used;
+    /// The offset of the last allocation, for rewinding on its Free().
+    int64_t last_offset;
+    /// Buffers carved from this chunk that are not freed yet.
+    int64_t num_live;
+    /// Holds one allocation larger than a quarter of the chunk size.
+    bool dedicated;
+  };
+
+  arrow::Status AddChunk(int64_t min_size, bool dedicated);
+  Chunk* FindChunk(const uint8_t* buffer);
+  /// Returns `chunk` to the parent pool and forgets it.
+  void FreeChunk(Chunk* chunk);
+  void TrimChunks(int64_t max_bytes);
+
+  const ArenaOptions options_;
+  arrow::MemoryPool* parent_;
+  mutable std::mutex mutex_;
+  /// The last chunk is the one allocations are carved from.
+  std::vector<Chunk> chunks_;
+  int64_t num_live_ = 0;
+  int64_t bytes_allocated_ = 0;
+  int64_t max_memory_ = 0;
+  int64_t total_bytes_allocated_ = 0;
+  int64_t num_allocations_ = 0;
+};
+
+}  // namespace whippet_sort
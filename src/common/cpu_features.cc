@@ -0,0 +1,79 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "common/cpu_features.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace whippet_sort {
+
+namespace {
+
+SimdLevel DetectSimdLevel() {
+#if defined(WHIPPET_SIMD_X86)
+  // Each level needs every extension its kernel files are compiled with, see
+  // the *_FLAGS in src/CMakeLists.txt, or the kernels may fault on the CPU.
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512dq") &&
+      __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("bmi2")) {
+    return SimdLevel::kAvx512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2")) {
+    return SimdLevel::kAvx2;
+  }
+  if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+    return SimdLevel::kSse42;
+  }
+#endif
+  return SimdLevel::kNone;
+}
+
+SimdLevel SelectSimdLevel() {
+  SimdLevel level = DetectSimdLevel();
+  const char* cap = std::getenv("WHIPPET_SIMD_LEVEL");
+  if (cap == nullptr) return level;
+  for (auto candidate : {SimdLevel::kNone, SimdLevel::kSse42, SimdLevel::kAvx2,
+                         SimdLevel::kAvx512}) {
+    if (std::strcmp(cap, SimdLevelName(candidate)) == 0) {
+      return std::min(level, candidate);
+    }
+  }
+  return level;
+}
+
+}  // namespace
+
+SimdLevel GetSimdLevel() {
+  static const SimdLevel level = SelectSimdLevel();
+  return level;
+}
+
+const char* SimdLevelName(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::kSse42:
+      return "sse4.2";
+    case SimdLevel::kAvx2:
+      return "avx2";
+    case SimdLevel::kAvx512:
+      return "avx512";
+    default:
+      return "none";
+  }
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,35 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+namespace whippet_sort {
+
+/// Instruction set levels the SIMD kernels are compiled for. Each level
+/// implies the ones before it.
+enum class SimdLevel : int {
+  kNone = 0,
+  kSse42,
+  kAvx2,
+  kAvx512,
+};
+
+/// The highest level supported both by the CPU we run on and by the kernels
+/// compiled into this binary, capped by the WHIPPET_SIMD_LEVEL environment
+/// variable (none, sse4.2, avx2 or avx512) if set. Detected once, then cached.
+SimdLevel GetSimdLevel();
+
+const char* SimdLevelName(SimdLevel level);
+
+}  // namespace whippet_sort
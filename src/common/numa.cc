@@ -0,0 +1,164 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "common/numa.h"
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace whippet_sort {
+
+namespace {
+
+// Parses a sysfs CPU list such as "0-15,32-47".
+std::vector<int> ParseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::istringstream in(list);
+  std::string range;
+  while (std::getline(in, range, ',')) {
+    if (range.empty()) continue;
+    auto dash = range.find('-');
+    int first = std::stoi(range.substr(0, dash));
+    int last = dash == std::string::npos ? first
+                                         : std::stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+// Pages looked up per move_pages(2) call.
+constexpr int64_t kPagesPerQuery = 4096;
+
+struct NumaTopology {
+  std::vector<std::vector<int>> cpus;
+  std::vector<int> ids;
+};
+
+NumaTopology DetectNumaNodes() {
+  NumaTopology topology;
+  auto& nodes = topology.cpus;
+  for (int node = 0;; ++node) {
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) +
+                     "/cpulist");
+    if (!in) break;
+    std::string list;
+    std::getline(in, list);
+    auto cpus = ParseCpuList(list);
+    // Memory-only nodes have no CPUs to run on.
+    if (!cpus.empty()) {
+      nodes.push_back(std::move(cpus));
+      topology.ids.push_back(node);
+    }
+  }
+  if (nodes.empty()) {
+    int num_cpus = static_cast<int>(std::thread::hardware_concurrency());
+    nodes.emplace_back();
+    for (int cpu = 0; cpu < std::max(num_cpus, 1); ++cpu) {
+      nodes.back().push_back(cpu);
+    }
+    topology.ids.push_back(0);
+  }
+  return topology;
+}
+
+const NumaTopology& Topology() {
+  static const NumaTopology topology = DetectNumaNodes();
+  return topology;
+}
+
+int64_t PageSize() {
+  static const int64_t page_size = sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+
+}  // namespace
+
+const std::vector<std::vector<int>>& NumaNodeCpus() { return Topology().cpus; }
+
+const std::vector<int>& NumaNodeIds() { return Topology().ids; }
+
+int NumNumaNodes() { return static_cast<int>(NumaNodeCpus().size()); }
+
+bool PinCurrentThreadToNumaNode(int node) {
+  const auto& nodes = NumaNodeCpus();
+  if (node < 0 || node >= static_cast<int>(nodes.size())) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : nodes[node]) {
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool BindToNumaNode(void* data, int64_t size, int node) {
+  const auto& ids = NumaNodeIds();
+  if (node < 0 || node >= static_cast<int>(ids.size())) return false;
+  const auto page = static_cast<uintptr_t>(PageSize());
+  const auto address = reinterpret_cast<uintptr_t>(data);
+  const uintptr_t begin = (address + page - 1) / page * page;
+  const uintptr_t end = (address + static_cast<uintptr_t>(size)) / page * page;
+  if (begin >= end) return true;
+  constexpr int kBitsPerWord = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> mask(ids[node] / kBitsPerWord + 1, 0);
+  mask[ids[node] / kBitsPerWord] |= 1UL << (ids[node] % kBitsPerWord);
+  // The kernel reads one bit less than `maxnode`.
+  const auto max_node = mask.size() * kBitsPerWord + 1;
+  return syscall(SYS_mbind, begin, end - begin, MPOL_PREFERRED, mask.data(),
+                 max_node, MPOL_MF_MOVE) == 0;
+}
+
+std::vector<int64_t> NumaNodeBytes(const void* data, int64_t size) {
+  const auto& ids = NumaNodeIds();
+  std::vector<int64_t> bytes(ids.size(), 0);
+  const int64_t page = PageSize();
+  const auto address = reinterpret_cast<uintptr_t>(data);
+  const uintptr_t first = address / page * page;
+  const uintptr_t last = (address + size + page - 1) / page * page;
+  const int64_t num_pages =
+      size > 0 ? static_cast<int64_t>((last - first) / page) : 0;
+  std::vector<void*> pages;
+  std::vector<int> status;
+  for (int64_t begin = 0; begin < num_pages; begin += kPagesPerQuery) {
+    const int64_t count = std::min(kPagesPerQuery, num_pages - begin);
+    pages.resize(count);
+    status.resize(count);
+    for (int64_t i = 0; i < count; ++i) {
+      pages[i] = reinterpret_cast<void*>(first + (begin + i) * page);
+    }
+    // Without target nodes, move_pages(2) only reports the node of each page.
+    if (syscall(SYS_move_pages, 0, count, pages.data(), nullptr,
+                status.data(), 0) != 0) {
+      return {};
+    }
+    for (int node_id : status) {
+      auto it = std::find(ids.begin(), ids.end(), node_id);
+      if (it != ids.end()) bytes[it - ids.begin()] += page;
+    }
+  }
+  return bytes;
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,46 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace whippet_sort {
+
+/// The CPUs of each NUMA node as listed in /sys/devices/system/node. Without
+/// that information the machine is reported as one node with all CPUs. Read
+/// once, then cached.
+const std::vector<std::vector<int>>& NumaNodeCpus();
+
+int NumNumaNodes();
+
+/// The kernel's id of each node of NumaNodeCpus(). Nodes without CPUs are
+/// left out, so the ids may have gaps.
+const std::vector<int>& NumaNodeIds();
+
+/// Restricts the calling thread to the CPUs of `node`. Returns false if the
+/// node does not exist or the affinity cannot be set.
+bool PinCurrentThreadToNumaNode(int node);
+
+/// Moves the whole pages within [data, data + size) to `node`, an index into
+/// NumaNodeCpus(), and makes it the preferred node of the pages faulted in
+/// later. Returns false if the kernel refuses, e.g. without NUMA support.
+bool BindToNumaNode(void* data, int64_t size, int node);
+
+/// Bytes of the resident pages overlapping [data, data + size) on each node,
+/// indexed as NumaNodeCpus(); empty if the kernel cannot tell.
+std::vector<int64_t> NumaNodeBytes(const void* data, int64_t size);
+
+}  // namespace whippet_sort
@@ -0,0 +1,161 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "common/perf_counters.h"
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace whippet_sort {
+
+namespace {
+
+thread_local const PerfCounters* current_counters = nullptr;
+
+uint64_t CacheEvent(uint64_t cache, uint64_t op, uint64_t result) {
+  return cache | (op << 8) | (result << 16);
+}
+
+void EventOf(PerfEvent event, perf_event_attr* attr) {
+  switch (event) {
+    case PerfEvent::kCycles:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case PerfEvent::kInstructions:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case PerfEvent::kLlcMisses:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config =
+          CacheEvent(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ,
+                     PERF_COUNT_HW_CACHE_RESULT_MISS);
+      break;
+    case PerfEvent::kDtlbMisses:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config =
+          CacheEvent(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                     PERF_COUNT_HW_CACHE_RESULT_MISS);
+      break;
+    case PerfEvent::kBranchMisses:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    case PerfEvent::kNodeLoadMisses:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config =
+          CacheEvent(PERF_COUNT_HW_CACHE_NODE, PERF_COUNT_HW_CACHE_OP_READ,
+                     PERF_COUNT_HW_CACHE_RESULT_MISS);
+      break;
+    default:
+      break;
+  }
+}
+
+int OpenEvent(PerfEvent event) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  EventOf(event, &attr);
+  // Userspace only, so that an unprivileged process may count.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.inherit = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return static_cast<int>(syscall(SYS_perf_event_open, &attr, /*pid=*/0,
+                                  /*cpu=*/-1, /*group_fd=*/-1,
+                                  /*flags=*/0));
+}
+
+}  // namespace
+
+const char* PerfEventName(PerfEvent event) {
+  switch (event) {
+    case PerfEvent::kCycles:
+      return "cycles";
+    case PerfEvent::kInstructions:
+      return "instructions";
+    case PerfEvent::kLlcMisses:
+      return "llc_misses";
+    case PerfEvent::kDtlbMisses:
+      return "dtlb_misses";
+    case PerfEvent::kBranchMisses:
+      return "branch_misses";
+    case PerfEvent::kNodeLoadMisses:
+      return "node_load_misses";
+    default:
+      return "unknown";
+  }
+}
+
+PerfCounts UnknownPerfCounts() {
+  PerfCounts counts;
+  counts.fill(-1);
+  return counts;
+}
+
+PerfCounters::PerfCounters() {
+  for (int i = 0; i < kNumPerfEvents; ++i) {
+    fds_[i] = OpenEvent(static_cast<PerfEvent>(i));
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  for (int fd : fds_) {
+    if (fd >= 0) close(fd);
+  }
+}
+
+bool PerfCounters::available() const {
+  for (int fd : fds_) {
+    if (fd >= 0) return true;
+  }
+  return false;
+}
+
+PerfCounts PerfCounters::Read() const {
+  auto counts = UnknownPerfCounts();
+  for (int i = 0; i < kNumPerfEvents; ++i) {
+    if (fds_[i] < 0) continue;
+    // value, time enabled, time running
+    uint64_t values[3];
+    if (read(fds_[i], values, sizeof(values)) != sizeof(values)) continue;
+    if (values[2] == 0) {
+      counts[i] = 0;
+    } else if (values[2] < values[1]) {
+      counts[i] = static_cast<int64_t>(static_cast<double>(values[0]) *
+                                       static_cast<double>(values[1]) /
+                                       static_cast<double>(values[2]));
+    } else {
+      counts[i] = static_cast<int64_t>(values[0]);
+    }
+  }
+  return counts;
+}
+
+const PerfCounters* PerfCounters::Current() { return current_counters; }
+
+PerfCounters::Scope::Scope(const PerfCounters* counters)
+    : previous_(current_counters) {
+  current_counters = counters;
+}
+
+PerfCounters::Scope::~Scope() { current_counters = previous_; }
+
+}  // namespace whippet_sort
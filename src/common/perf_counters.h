@@ -0,0 +1,85 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace whippet_sort {
+
+/// Hardware events counted around each sort phase.
+enum class PerfEvent : int {
+  kCycles = 0,
+  kInstructions,
+  kLlcMisses,
+  kDtlbMisses,
+  kBranchMisses,
+  /// Loads served from the memory of another NUMA node.
+  kNodeLoadMisses,
+  kNumEvents,
+};
+
+constexpr int kNumPerfEvents = static_cast<int>(PerfEvent::kNumEvents);
+
+const char* PerfEventName(PerfEvent event);
+
+/// One count per PerfEvent; -1 for events that could not be counted.
+using PerfCounts = std::array<int64_t, kNumPerfEvents>;
+
+/// Returns counts that are all unknown.
+PerfCounts UnknownPerfCounts();
+
+/// Hardware counters of the calling thread and of all threads it creates
+/// after the counters are opened, through perf_event_open(2). Every event is
+/// a counter of its own, so that the kernel can multiplex them, and the
+/// counts are scaled up by the time each one actually ran.
+///
+/// Events the CPU or kernel does not offer, or that the perf_event_paranoid
+/// setting forbids, stay unknown.
+class PerfCounters {
+ public:
+  PerfCounters();
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  /// Whether at least one event is counted.
+  bool available() const;
+
+  /// The counts since the counters were opened.
+  PerfCounts Read() const;
+
+  /// The counters of the sort running on the calling thread, or nullptr.
+  static const PerfCounters* Current();
+
+  /// Makes `counters` Current() on the calling thread for its scope.
+  class Scope {
+   public:
+    explicit Scope(const PerfCounters* counters);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    const PerfCounters* previous_;
+  };
+
+ private:
+  std::array<int, kNumPerfEvents> fds_;
+};
+
+}  // namespace whippet_sort
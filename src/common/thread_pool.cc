@@ -0,0 +1,216 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "common/thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "common/numa.h"
+
+namespace whippet_sort {
+
+namespace {
+
+// The pool and index of the worker running on this thread, if any.
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local int current_worker = -1;
+
+}  // namespace
+
+ThreadPool::ThreadPool(ThreadPoolOptions options) {
+  int num_threads = options.num_threads;
+  if (num_threads <= 0) {
+    num_threads =
+        std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    queues_.push_back(std::make_unique<Queue>());
+  }
+  const bool pin = options.pin_to_numa_nodes;
+  if (pin) num_nodes_ = NumNumaNodes();
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this, i, pin] {
+      if (pin) PinCurrentThreadToNumaNode(i % num_nodes_);
+      WorkerLoop(i);
+    });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_available_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+int ThreadPool::num_threads_on_node(int node) const {
+  if (node < 0 || node >= num_nodes_) return 0;
+  return (num_threads() - node + num_nodes_ - 1) / num_nodes_;
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+  int index = current_pool == this
+                  ? current_worker
+                  : static_cast<int>(next_queue_.fetch_add(1) % queues_.size());
+  Push(index, std::move(task));
+}
+
+void ThreadPool::Submit(std::function<void()> task, int node) {
+  const int on_node = num_threads_on_node(node);
+  if (num_nodes_ == 1 || on_node == 0) return Submit(std::move(task));
+  int index;
+  if (current_pool == this && current_worker % num_nodes_ == node) {
+    index = current_worker;
+  } else {
+    index = node + num_nodes_ * static_cast<int>(next_queue_.fetch_add(1) %
+                                                 on_node);
+  }
+  Push(index, std::move(task));
+}
+
+void ThreadPool::Push(int index, std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+    queues_[index]->tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_pending_.fetch_add(1);
+  }
+  work_available_.notify_one();
+}
+
+bool ThreadPool::TryTake(int index, std::function<void()>* task) {
+  // Own queue first, newest task first.
+  if (index >= 0) {
+    auto& queue = *queues_[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      *task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      num_pending_.fetch_sub(1);
+      return true;
+    }
+  }
+  // Then steal the oldest task of another queue, on the same node first.
+  if (index >= 0 && num_nodes_ > 1 && TrySteal(index, true, task)) {
+    return true;
+  }
+  return TrySteal(index, false, task);
+}
+
+bool ThreadPool::TrySteal(int index, bool same_node,
+                          std::function<void()>* task) {
+  const int n = static_cast<int>(queues_.size());
+  const int start = index >= 0 ? index + 1 : 0;
+  for (int k = 0; k < n; ++k) {
+    const int victim = (start + k) % n;
+    if (victim == index) continue;
+    if (same_node && victim % num_nodes_ != index % num_nodes_) continue;
+    auto& queue = *queues_[victim];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      *task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      num_pending_.fetch_sub(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::RunOne() {
+  std::function<void()> task;
+  if (!TryTake(current_pool == this ? current_worker : -1, &task)) {
+    return false;
+  }
+  task();
+  return true;
+}
+
+void ThreadPool::WorkerLoop(int index) {
+  current_pool = this;
+  current_worker = index;
+  std::function<void()> task;
+  while (true) {
+    if (TryTake(index, &task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_available_.wait(
+        lock, [this] { return stopping_ || num_pending_.load() > 0; });
+    if (stopping_ && num_pending_.load() == 0) return;
+  }
+}
+
+TaskGroup::~TaskGroup() { (void)Wait(); }
+
+void TaskGroup::Spawn(std::function<arrow::Status()> task, int node) {
+  num_running_.fetch_add(1);
+  pool_->Submit(
+      [this, task = std::move(task)] {
+        Finish(failed_.load() ? arrow::Status::OK() : task());
+      },
+      node);
+}
+
+void TaskGroup::Finish(arrow::Status status) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!status.ok() && status_.ok()) {
+    status_ = std::move(status);
+    failed_.store(true);
+  }
+  if (num_running_.fetch_sub(1) == 1) {
+    done_.notify_all();
+  }
+}
+
+arrow::Status TaskGroup::Wait() {
+  while (num_running_.load() > 0) {
+    if (pool_->RunOne()) continue;
+    // The remaining tasks run elsewhere; they may still spawn more, so look
+    // for work again now and then.
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait_for(lock, std::chrono::milliseconds(1),
+                   [this] { return num_running_.load() == 0; });
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  return status_;
+}
+
+arrow::Status ParallelFor(ThreadPool* pool, int64_t n, int64_t min_range,
+                          const RangeFunction& body) {
+  if (n <= 0) return arrow::Status::OK();
+  const int64_t max_ranges = n / std::max<int64_t>(min_range, 1);
+  const int64_t num_ranges = std::max<int64_t>(
+      1, std::min<int64_t>(pool->num_threads(), max_ranges));
+  if (num_ranges == 1) return body(0, n);
+  TaskGroup group(pool);
+  for (int64_t i = 0; i < num_ranges; ++i) {
+    const int64_t begin = n * i / num_ranges;
+    const int64_t end = n * (i + 1) / num_ranges;
+    group.Spawn([&body, begin, end] { return body(begin, end); });
+  }
+  return group.Wait();
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,130 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <arrow/status.h>
+
+namespace whippet_sort {
+
+struct ThreadPoolOptions {
+  /// Number of worker threads; 0 uses one per hardware thread.
+  int num_threads = 0;
+  /// Pins worker i to the CPUs of NUMA node i % NumNumaNodes().
+  bool pin_to_numa_nodes = false;
+};
+
+/// A fixed-size work-stealing thread pool.
+///
+/// Every worker owns a task deque. A task submitted from a worker goes to the
+/// back of that worker's deque, which the worker drains LIFO so that it keeps
+/// working on the data it just touched; idle workers steal from the front of
+/// the other deques. Tasks submitted from outside the pool are spread over
+/// the deques round-robin.
+///
+/// With workers pinned to NUMA nodes, a task can be submitted to a node: it
+/// goes to the deque of a worker on that node, and idle workers steal from
+/// the workers of their own node before those of the other nodes.
+class ThreadPool {
+ public:
+  explicit ThreadPool(ThreadPoolOptions options = {});
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  int num_threads() const { return static_cast<int>(threads_.size()); }
+
+  /// The NUMA nodes the workers are pinned to; 1 if they are not pinned.
+  int num_numa_nodes() const { return num_nodes_; }
+  /// The workers pinned to `node`.
+  int num_threads_on_node(int node) const;
+
+  void Submit(std::function<void()> task);
+  /// Submits `task` to a worker on `node`, or as Submit() if `node` is -1 or
+  /// the workers are not pinned.
+  void Submit(std::function<void()> task, int node);
+
+  /// Runs one pending task on the calling thread. Returns false if there was
+  /// none. Lets a thread that waits for tasks help instead of blocking.
+  bool RunOne();
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  void WorkerLoop(int index);
+  bool TryTake(int index, std::function<void()>* task);
+  bool TrySteal(int index, bool same_node, std::function<void()>* task);
+  void Push(int index, std::function<void()> task);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+  /// Worker i runs on node i % num_nodes_.
+  int num_nodes_ = 1;
+  std::atomic<uint32_t> next_queue_{0};
+  /// Number of tasks in all queues. Updated under `mutex_` when it grows, so
+  /// that a worker going to sleep cannot miss a new task.
+  std::atomic<int64_t> num_pending_{0};
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  bool stopping_ = false;
+};
+
+/// A set of tasks on a ThreadPool that can be waited for together.
+class TaskGroup {
+ public:
+  explicit TaskGroup(ThreadPool* pool) : pool_(pool) {}
+  ~TaskGroup();
+
+  /// Runs `task` on the pool, on NUMA node `node` unless it is -1, see
+  /// ThreadPool::Submit(). The first error of any task is returned by
+  /// Wait(); the tasks spawned after it are skipped.
+  void Spawn(std::function<arrow::Status()> task, int node = -1);
+
+  /// Waits for all spawned tasks, running pending tasks of the pool on the
+  /// calling thread meanwhile, so it may be called from within a task.
+  arrow::Status Wait();
+
+ private:
+  void Finish(arrow::Status status);
+
+  ThreadPool* pool_;
+  std::atomic<int64_t> num_running_{0};
+  std::atomic<bool> failed_{false};
+  std::mutex mutex_;
+  std::condition_variable done_;
+  arrow::Status status_;
+};
+
+using RangeFunction = std::function<arrow::Status(int64_t, int64_t)>;
+
+/// Calls `body(begin, end)` on the pool for consecutive ranges of [0, n) of
+/// at least `min_range` elements, about one range per thread, and waits.
+arrow::Status ParallelFor(ThreadPool* pool, int64_t n, int64_t min_range,
+                          const RangeFunction& body);
+
+}  // namespace whippet_sort
@@ -0,0 +1,270 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+#include "engine/distributed_sort.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include <arrow/api.h>
+#include <arrow/compute/api.h>
+#include <arrow/util/compression.h>
+
+#include "io/parquet_input.h"
+#include "io/spill_file.h"
+#include "sort/key_comparator.h"
+
+namespace whippet_sort {
+
+namespace {
+
+// How often a rank looks for the files of the others.
+constexpr auto kExchangePollInterval = std::chrono::milliseconds(10);
+
+// The key arrays of `table` in ORDER BY order, for a KeyComparator.
+arrow::Result<std::vector<std::shared_ptr<arrow::Array>>> KeyArrays(
+    const arrow::Table& table, const KeyComparator& comparator,
+    arrow::MemoryPool* pool) {
+  std::vector<std::shared_ptr<arrow::Array>> keys;
+  for (int column : comparator.columns()) {
+    ARROW_ASSIGN_OR_RAISE(auto array,
+                          CombineChunks(table.column(column), pool));
+    keys.push_back(std::move(array));
+  }
+  return keys;
+}
+
+std::vector<const arrow::Array*> RawPointers(
+    const std::vector<std::shared_ptr<arrow::Array>>& arrays) {
+  std::vector<const arrow::Array*> pointers;
+  for (const auto& array : arrays) pointers.push_back(array.get());
+  return pointers;
+}
+
+}  // namespace
+
+arrow::Status ValidateDistributedSortOptions(
+    const DistributedSortOptions& options) {
+  if (options.num_ranks < 1 || options.rank < 0 ||
+      options.rank >= options.num_ranks) {
+    return arrow::Status::Invalid("rank ", options.rank, " is not one of ",
+                                  options.num_ranks, " ranks");
+  }
+  if (options.exchange_directory.empty()) {
+    return arrow::Status::Invalid("a distributed sort needs a directory ",
+                                  "shared by all ranks");
+  }
+  if (options.samples_per_rank < 1) {
+    return arrow::Status::Invalid("samples per rank must be positive");
+  }
+  if (!IsSpillCompressionSupported(options.exchange_compression)) {
+    return arrow::Status::NotImplemented(
+        "exchange compression ",
+        arrow::util::Codec::GetCodecAsString(options.exchange_compression));
+  }
+  return arrow::Status::OK();
+}
+
+std::string SampleFilePath(const std::string& directory, int rank) {
+  return (std::filesystem::path(directory) /
+          ("samples_" + std::to_string(rank) + ".arrow"))
+      .string();
+}
+
+std::string PartitionFilePath(const std::string& directory, int source,
+                              int destination) {
+  return (std::filesystem::path(directory) /
+          ("rows_" + std::to_string(source) + "_to_" +
+           std::to_string(destination) + ".arrow"))
+      .string();
+}
+
+arrow::Result<int64_t> WriteExchangeFile(const std::string& path,
+                                         const arrow::Table& table,
+                                         const DistributedSortOptions& options,
+                                         int64_t batch_rows,
+                                         arrow::MemoryPool* pool) {
+  const std::string partial = path + ".partial";
+  ARROW_ASSIGN_OR_RAISE(
+      auto writer, SpillWriter::Open(partial, table.schema(),
+                                     options.exchange_compression, pool));
+  ARROW_RETURN_NOT_OK(writer->WriteTable(table, batch_rows));
+  ARROW_RETURN_NOT_OK(writer->Close());
+  std::error_code error;
+  std::filesystem::rename(partial, path, error);
+  if (error) {
+    return arrow::Status::IOError("cannot rename ", partial, " to ", path,
+                                  ": ", error.message());
+  }
+  return writer->bytes_written();
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> ReadExchangeFile(
+    const std::string& path, arrow::MemoryPool* pool) {
+  ARROW_ASSIGN_OR_RAISE(auto reader,
+                        SpillReader::Open(path, pool, /*memory_map=*/true));
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+  for (int i = 0; i < reader->num_batches(); ++i) {
+    ARROW_ASSIGN_OR_RAISE(auto batch, reader->ReadBatch(i));
+    batches.push_back(std::move(batch));
+  }
+  return arrow::Table::FromRecordBatches(reader->schema(), batches);
+}
+
+arrow::Status WaitForExchangeFile(const std::string& path,
+                                  int64_t timeout_seconds) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(timeout_seconds);
+  while (true) {
+    std::error_code error;
+    if (std::filesystem::exists(path, error)) return arrow::Status::OK();
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return arrow::Status::IOError("timed out after ", timeout_seconds,
+                                    " s waiting for ", path);
+    }
+    std::this_thread::sleep_for(kExchangePollInterval);
+  }
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> SampleKeys(
+    const arrow::Table& sorted, const SortSpec& spec, int64_t num_samples,
+    arrow::MemoryPool* pool) {
+  std::vector<int> columns;
+  for (const auto& key : spec) {
+    int column = sorted.schema()->GetFieldIndex(key.column);
+    if (column < 0) {
+      return arrow::Status::KeyError("sort key '", key.column,
+                                     "' is not a column of the input");
+    }
+    if (std::find(columns.begin(), columns.end(), column) == columns.end()) {
+      columns.push_back(column);
+    }
+  }
+  ARROW_ASSIGN_OR_RAISE(auto keys, sorted.SelectColumns(columns));
+
+  // The middle row of each of `count` equal ranges, as in sorting by regular
+  // sampling: no range between two samples holds more than n / count rows.
+  const int64_t num_rows = sorted.num_rows();
+  const int64_t count = std::min(num_samples, num_rows);
+  arrow::UInt64Builder positions(pool);
+  ARROW_RETURN_NOT_OK(positions.Reserve(count));
+  for (int64_t i = 0; i < count; ++i) {
+    positions.UnsafeAppend(
+        static_cast<uint64_t>((2 * i + 1) * num_rows / (2 * count)));
+  }
+  ARROW_ASSIGN_OR_RAISE(auto indices, positions.Finish());
+  arrow::compute::ExecContext ctx(pool);
+  ARROW_ASSIGN_OR_RAISE(
+      auto samples,
+      arrow::compute::Take(keys, indices,
+                           arrow::compute::TakeOptions::NoBoundsCheck(), &ctx));
+
+  // Shards of different sizes send as many samples each, so every sample
+  // carries the rows it stands for.
+  arrow::DoubleBuilder weights(pool);
+  ARROW_RETURN_NOT_OK(weights.Reserve(count));
+  for (int64_t i = 0; i < count; ++i) {
+    weights.UnsafeAppend(static_cast<double>(num_rows) /
+                         static_cast<double>(count));
+  }
+  ARROW_ASSIGN_OR_RAISE(auto weight_array, weights.Finish());
+  const auto& table = samples.table();
+  return table->AddColumn(
+      table->num_columns(), arrow::field(kSampleWeightColumn, arrow::float64()),
+      std::make_shared<arrow::ChunkedArray>(weight_array));
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> ChooseSplitters(
+    const std::shared_ptr<arrow::Table>& sorted_samples, int num_ranks) {
+  const int64_t num_samples = sorted_samples->num_rows();
+  std::vector<double> weights(num_samples, 1.0);
+  auto keys = sorted_samples;
+  const int weight_column =
+      sorted_samples->schema()->GetFieldIndex(kSampleWeightColumn);
+  if (weight_column >= 0) {
+    int64_t i = 0;
+    for (const auto& chunk :
+         sorted_samples->column(weight_column)->chunks()) {
+      const auto& values = static_cast<const arrow::DoubleArray&>(*chunk);
+      for (int64_t j = 0; j < values.length(); ++j) {
+        weights[i++] = values.IsValid(j) ? values.Value(j) : 0.0;
+      }
+    }
+    ARROW_ASSIGN_OR_RAISE(keys, sorted_samples->RemoveColumn(weight_column));
+  }
+  if (num_samples == 0) return keys;
+
+  // Splitter p is the sample whose middle is first at or past p / num_ranks
+  // of the total weight, the weighted form of every num_samples / num_ranks-th
+  // sample.
+  double total = 0;
+  for (double weight : weights) total += weight;
+  std::vector<std::shared_ptr<arrow::Table>> splitters;
+  int64_t i = 0;
+  double before = 0;
+  for (int p = 1; p < num_ranks; ++p) {
+    const double target = total * p / num_ranks;
+    while (i < num_samples - 1 && before + weights[i] / 2 < target) {
+      before += weights[i++];
+    }
+    splitters.push_back(keys->Slice(i, 1));
+  }
+  if (splitters.empty()) return keys->Slice(0, 0);
+  return arrow::ConcatenateTables(splitters);
+}
+
+arrow::Result<std::vector<int64_t>> PartitionBounds(
+    const arrow::Table& sorted, const arrow::Table& splitters,
+    const SortSpec& spec, int num_ranks, arrow::MemoryPool* pool) {
+  const int64_t num_rows = sorted.num_rows();
+  std::vector<int64_t> bounds(num_ranks + 1, num_rows);
+  bounds[0] = 0;
+  if (num_rows == 0 || splitters.num_rows() == 0) return bounds;
+
+  ARROW_ASSIGN_OR_RAISE(auto comparator,
+                        KeyComparator::Make(spec, *sorted.schema()));
+  ARROW_ASSIGN_OR_RAISE(auto splitter_comparator,
+                        KeyComparator::Make(spec, *splitters.schema()));
+  ARROW_ASSIGN_OR_RAISE(auto row_arrays, KeyArrays(sorted, comparator, pool));
+  ARROW_ASSIGN_OR_RAISE(auto splitter_arrays,
+                        KeyArrays(splitters, splitter_comparator, pool));
+  const auto rows = RawPointers(row_arrays);
+  const auto splitter_keys = RawPointers(splitter_arrays);
+
+  const int64_t num_splitters =
+      std::min<int64_t>(splitters.num_rows(), num_ranks - 1);
+  for (int64_t p = 0; p < num_splitters; ++p) {
+    // The first row after splitter p, searched from the previous bound.
+    int64_t begin = bounds[p];
+    int64_t end = num_rows;
+    while (begin < end) {
+      const int64_t middle = begin + (end - begin) / 2;
+      if (comparator.Compare(rows.data(), middle, splitter_keys.data(), p) <=
+          0) {
+        begin = middle + 1;
+      } else {
+        end = middle;
+      }
+    }
+    bounds[p + 1] = begin;
+  }
+  return bounds;
+}
+
+}  // namespace whippet_sort
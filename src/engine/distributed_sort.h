@@ -0,0 +1,107 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+#include <arrow/util/type_fwd.h>
+
+#include "sort/sort_spec.h"
+
+namespace whippet_sort {
+
+/// The place of one process in a distributed sort, and how the processes
+/// meet. Every rank sorts its own Parquet shards and writes one part of the
+/// global order: the output of rank i holds the rows that sort after those
+/// of rank i - 1 and before those of rank i + 1.
+struct DistributedSortOptions {
+  /// This process, in [0, num_ranks).
+  int rank = 0;
+  int num_ranks = 1;
+  /// Directory that all ranks see, e.g. on a shared file system. The ranks
+  /// exchange their key samples and rows as Arrow IPC files in it, so each
+  /// sort needs a directory of its own that is empty when it starts.
+  std::string exchange_directory;
+  /// Keys each rank samples from its sorted rows to choose the splitters.
+  int64_t samples_per_rank = 1024;
+  /// Uncompressed exchange files are memory-mapped and merged without
+  /// copying them; LZ4_FRAME or ZSTD write fewer bytes to the shared file
+  /// system.
+  arrow::Compression::type exchange_compression =
+      arrow::Compression::UNCOMPRESSED;
+  /// How long to wait for the files of the other ranks.
+  int64_t timeout_seconds = 3600;
+};
+
+arrow::Status ValidateDistributedSortOptions(
+    const DistributedSortOptions& options);
+
+/// The key sample of `rank`, and the rows `source` sends to `destination`.
+std::string SampleFilePath(const std::string& directory, int rank);
+std::string PartitionFilePath(const std::string& directory, int source,
+                              int destination);
+
+/// Writes `table` as an exchange file at `path`. The file is written under
+/// a temporary name and renamed once complete, so a rank that sees `path`
+/// can read all of it. Returns the file size.
+arrow::Result<int64_t> WriteExchangeFile(const std::string& path,
+                                         const arrow::Table& table,
+                                         const DistributedSortOptions& options,
+                                         int64_t batch_rows,
+                                         arrow::MemoryPool* pool);
+
+/// Reads a whole exchange file, memory-mapped if it is uncompressed.
+arrow::Result<std::shared_ptr<arrow::Table>> ReadExchangeFile(
+    const std::string& path, arrow::MemoryPool* pool);
+
+/// Waits until another rank has written `path`.
+arrow::Status WaitForExchangeFile(const std::string& path,
+                                  int64_t timeout_seconds);
+
+/// The column of a key sample that holds the number of rows each sample
+/// stands for.
+inline constexpr char kSampleWeightColumn[] = "__whippet_sort_sample_weight";
+
+/// Takes up to `num_samples` evenly spaced rows of the key columns of
+/// `sorted`, which is sorted by `spec`, and adds the kSampleWeightColumn:
+/// each sample stands for `sorted.num_rows()` / the number of samples rows.
+arrow::Result<std::shared_ptr<arrow::Table>> SampleKeys(
+    const arrow::Table& sorted, const SortSpec& spec, int64_t num_samples,
+    arrow::MemoryPool* pool);
+
+/// Picks `num_ranks` - 1 splitters from the samples of all ranks sorted by
+/// the keys, at evenly spaced quantiles of the sample weights, so that ranks
+/// with more rows than others move the splitters by as much. Samples without
+/// a kSampleWeightColumn weigh the same. Fewer splitters than that if there
+/// are no samples; the splitters hold only the key columns.
+arrow::Result<std::shared_ptr<arrow::Table>> ChooseSplitters(
+    const std::shared_ptr<arrow::Table>& sorted_samples, int num_ranks);
+
+/// Cuts `sorted` into one range per rank by the splitters and returns the
+/// num_ranks + 1 range bounds. Rank p gets the rows that sort after splitter
+/// p - 1 and not after splitter p, so rows that tie on all keys go to the
+/// same rank.
+arrow::Result<std::vector<int64_t>> PartitionBounds(
+    const arrow::Table& sorted, const arrow::Table& splitters,
+    const SortSpec& spec, int num_ranks, arrow::MemoryPool* pool);
+
+}  // namespace whippet_sort
@@ -0,0 +1,277 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+#include "engine/incremental_merge.h"
+
+#include <utility>
+
+#include <arrow/api.h>
+#include <arrow/compute/api.h>
+#include <parquet/metadata.h>
+#include <parquet/types.h>
+
+#include "sort/key_comparator.h"
+
+namespace whippet_sort {
+
+namespace {
+
+// The first and last first-key value of a row group in ORDER BY order, as
+// one-element arrays; a null element stands for the row group's nulls.
+struct KeyRange {
+  std::shared_ptr<arrow::Array> low;
+  std::shared_ptr<arrow::Array> high;
+};
+
+// Compares row `i` of `a` with row `j` of `b` on the first key.
+class FirstKeyComparator {
+ public:
+  explicit FirstKeyComparator(KeyComparator comparator)
+      : comparator_(std::move(comparator)) {}
+
+  int operator()(const arrow::Array& a, int64_t i, const arrow::Array& b,
+                 int64_t j) const {
+    const arrow::Array* a_keys[] = {&a};
+    const arrow::Array* b_keys[] = {&b};
+    return comparator_.Compare(a_keys, i, b_keys, j);
+  }
+
+ private:
+  KeyComparator comparator_;
+};
+
+// Returns the range of row group `rg`, or no arrays if it is unknown.
+arrow::Result<KeyRange> RowGroupKeyRange(
+    const ParquetInput& input, int rg, int column, const SortKey& key,
+    arrow::MemoryPool* pool) {
+  const auto& type = input.schema()->field(column)->type();
+  ARROW_ASSIGN_OR_RAISE(auto statistics, input.ColumnStatistics(rg, column));
+  auto null_value = [&]() { return arrow::MakeArrayOfNull(type, 1, pool); };
+  if (statistics.null_count == input.row_group_num_rows(rg)) {
+    ARROW_ASSIGN_OR_RAISE(auto nulls, null_value());
+    return KeyRange{nulls, nulls};
+  }
+  auto first = key.ascending() ? statistics.min : statistics.max;
+  auto last = key.ascending() ? statistics.max : statistics.min;
+  if (first == nullptr || last == nullptr) return KeyRange{};
+  // An unknown null count may hide nulls at either end.
+  const bool has_nulls = statistics.null_count != 0;
+  KeyRange range;
+  if (has_nulls && key.nulls_first()) {
+    ARROW_ASSIGN_OR_RAISE(range.low, null_value());
+  } else {
+    ARROW_ASSIGN_OR_RAISE(range.low,
+                          arrow::MakeArrayFromScalar(*first, 1, pool));
+  }
+  if (has_nulls && !key.nulls_first()) {
+    ARROW_ASSIGN_OR_RAISE(range.high, null_value());
+  } else {
+    ARROW_ASSIGN_OR_RAISE(range.high,
+                          arrow::MakeArrayFromScalar(*last, 1, pool));
+  }
+  return range;
+}
+
+// The first index in [begin, end) for which `after` holds, given that it then
+// holds for all later indices too.
+template <typename After>
+int64_t PartitionPoint(int64_t begin, int64_t end, After&& after) {
+  while (begin < end) {
+    const int64_t mid = begin + (end - begin) / 2;
+    if (after(mid)) {
+      end = mid;
+    } else {
+      begin = mid + 1;
+    }
+  }
+  return begin;
+}
+
+}  // namespace
+
+arrow::Result<SortSpec> SortSpecFromMetadata(const ParquetInput& input) {
+  const auto& metadata = *input.metadata();
+  std::vector<parquet::SortingColumn> sorting_columns;
+  for (int rg = 0; rg < input.num_row_groups(); ++rg) {
+    auto columns = metadata.RowGroup(rg)->sorting_columns();
+    if (rg == 0) {
+      sorting_columns = std::move(columns);
+      continue;
+    }
+    bool same = columns.size() == sorting_columns.size();
+    for (size_t i = 0; same && i < columns.size(); ++i) {
+      same = columns[i].column_idx == sorting_columns[i].column_idx &&
+             columns[i].descending == sorting_columns[i].descending &&
+             columns[i].nulls_first == sorting_columns[i].nulls_first;
+    }
+    if (!same) {
+      return arrow::Status::Invalid("the row groups of ", input.path(),
+                                    " record different sort orders");
+    }
+  }
+  if (sorting_columns.empty()) {
+    return arrow::Status::Invalid(input.path(),
+                                  " records no sort order (sorting_columns)");
+  }
+  SortSpec spec;
+  for (const auto& column : sorting_columns) {
+    if (column.column_idx < 0 || column.column_idx >= input.num_columns()) {
+      return arrow::Status::Invalid("sorting column ", column.column_idx,
+                                    " is not a column of ", input.path());
+    }
+    SortKey key;
+    key.column = input.schema()->field(column.column_idx)->name();
+    key.order =
+        column.descending ? SortOrder::kDescending : SortOrder::kAscending;
+    key.null_placement = column.nulls_first ? NullPlacement::kNullsFirst
+                                            : NullPlacement::kNullsLast;
+    spec.push_back(std::move(key));
+  }
+  return spec;
+}
+
+arrow::Result<std::vector<InsertStep>> PlanInsert(
+    const ParquetInput& input, const SortKey& first_key,
+    const std::shared_ptr<arrow::Array>& new_first_key,
+    arrow::MemoryPool* pool) {
+  const int64_t num_new = new_first_key->length();
+  const int num_row_groups = input.num_row_groups();
+  std::vector<InsertStep> steps;
+  auto add_new_rows = [&](int64_t begin, int64_t end) {
+    if (begin == end) return;
+    InsertStep step;
+    step.new_begin = begin;
+    step.new_end = end;
+    steps.push_back(std::move(step));
+  };
+  auto merge_all = [&]() {
+    InsertStep step;
+    step.kind = InsertStep::Kind::kMerge;
+    for (int rg = 0; rg < num_row_groups; ++rg) step.row_groups.push_back(rg);
+    step.new_end = num_new;
+    return std::vector<InsertStep>{std::move(step)};
+  };
+  if (num_row_groups == 0) {
+    add_new_rows(0, num_new);
+    return steps;
+  }
+
+  ARROW_ASSIGN_OR_RAISE(int column, input.ColumnIndex(first_key.column));
+  const auto& field = input.schema()->field(column);
+  if (arrow::is_floating(field->type()->id())) return merge_all();
+  std::vector<KeyRange> ranges(num_row_groups);
+  for (int rg = 0; rg < num_row_groups; ++rg) {
+    ARROW_ASSIGN_OR_RAISE(ranges[rg],
+                          RowGroupKeyRange(input, rg, column, first_key, pool));
+    if (ranges[rg].low == nullptr) return merge_all();
+  }
+  ARROW_ASSIGN_OR_RAISE(
+      auto comparator,
+      KeyComparator::Make({first_key}, *arrow::schema({field})));
+  const FirstKeyComparator compare(std::move(comparator));
+  const auto& keys = *new_first_key;
+
+  int64_t next = 0;
+  int rg = 0;
+  while (rg < num_row_groups) {
+    // New rows before the row group on the first key sort before all its
+    // rows, and after those of the row groups already planned.
+    const auto& low = *ranges[rg].low;
+    const int64_t begin = PartitionPoint(next, num_new, [&](int64_t row) {
+      return compare(keys, row, low, 0) >= 0;
+    });
+    add_new_rows(next, begin);
+    next = begin;
+    if (next == num_new || compare(keys, next, *ranges[rg].high, 0) > 0) {
+      InsertStep step;
+      step.kind = InsertStep::Kind::kCopy;
+      step.row_groups.push_back(rg++);
+      steps.push_back(std::move(step));
+      continue;
+    }
+    // Take in the following row groups that start at or before the end of
+    // the merged range, so rows that tie on the first key across row groups
+    // are merged in the full order.
+    InsertStep step;
+    step.kind = InsertStep::Kind::kMerge;
+    step.row_groups.push_back(rg);
+    const arrow::Array* high = ranges[rg].high.get();
+    for (++rg; rg < num_row_groups; ++rg) {
+      if (compare(*ranges[rg].low, 0, *high, 0) > 0) break;
+      step.row_groups.push_back(rg);
+      if (compare(*ranges[rg].high, 0, *high, 0) > 0) {
+        high = ranges[rg].high.get();
+      }
+    }
+    step.new_begin = next;
+    step.new_end = PartitionPoint(next, num_new, [&](int64_t row) {
+      return compare(keys, row, *high, 0) > 0;
+    });
+    next = step.new_end;
+    steps.push_back(std::move(step));
+  }
+  add_new_rows(next, num_new);
+  return steps;
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> MergeSortedTables(
+    const std::shared_ptr<arrow::Table>& a,
+    const std::shared_ptr<arrow::Table>& b, const SortSpec& spec,
+    arrow::MemoryPool* pool) {
+  ARROW_ASSIGN_OR_RAISE(auto comparator,
+                        KeyComparator::Make(spec, *a->schema()));
+  std::vector<std::shared_ptr<arrow::Array>> a_arrays;
+  std::vector<std::shared_ptr<arrow::Array>> b_arrays;
+  std::vector<const arrow::Array*> a_keys;
+  std::vector<const arrow::Array*> b_keys;
+  for (int column : comparator.columns()) {
+    ARROW_ASSIGN_OR_RAISE(auto a_array, CombineChunks(a->column(column), pool));
+    ARROW_ASSIGN_OR_RAISE(auto b_array, CombineChunks(b->column(column), pool));
+    a_keys.push_back(a_array.get());
+    b_keys.push_back(b_array.get());
+    a_arrays.push_back(std::move(a_array));
+    b_arrays.push_back(std::move(b_array));
+  }
+
+  // Rows of the concatenation of `a` and `b` in merged order.
+  const int64_t a_rows = a->num_rows();
+  const int64_t b_rows = b->num_rows();
+  arrow::UInt64Builder indices(pool);
+  ARROW_RETURN_NOT_OK(indices.Reserve(a_rows + b_rows));
+  int64_t i = 0;
+  int64_t j = 0;
+  while (i < a_rows && j < b_rows) {
+    if (comparator.Compare(b_keys.data(), j, a_keys.data(), i) < 0) {
+      indices.UnsafeAppend(static_cast<uint64_t>(a_rows + j++));
+    } else {
+      indices.UnsafeAppend(static_cast<uint64_t>(i++));
+    }
+  }
+  for (; i < a_rows; ++i) indices.UnsafeAppend(static_cast<uint64_t>(i));
+  for (; j < b_rows; ++j) {
+    indices.UnsafeAppend(static_cast<uint64_t>(a_rows + j));
+  }
+  ARROW_ASSIGN_OR_RAISE(auto order, indices.Finish());
+
+  ARROW_ASSIGN_OR_RAISE(auto both, arrow::ConcatenateTables({a, b}));
+  arrow::compute::ExecContext ctx(pool);
+  ARROW_ASSIGN_OR_RAISE(
+      auto merged,
+      arrow::compute::Take(both, order,
+                           arrow::compute::TakeOptions::NoBoundsCheck(), &ctx));
+  return merged.table();
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,77 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+
+#include "io/parquet_input.h"
+#include "sort/sort_spec.h"
+
+namespace whippet_sort {
+
+/// One step of inserting sorted new rows into a sorted file, in output order.
+struct InsertStep {
+  enum class Kind {
+    /// Writes the new rows [new_begin, new_end), which sort between two
+    /// existing row groups.
+    kNewRows,
+    /// Writes back an existing row group that no new row sorts into, as one
+    /// row group of its own.
+    kCopy,
+    /// Merges existing row groups with the new rows [new_begin, new_end)
+    /// that sort into their key range.
+    kMerge,
+  };
+
+  Kind kind = Kind::kNewRows;
+  std::vector<int> row_groups;
+  int64_t new_begin = 0;
+  int64_t new_end = 0;
+};
+
+/// Returns the order of the rows of `input` from the sorting_columns of its
+/// row groups, or an error unless all row groups record the same order.
+arrow::Result<SortSpec> SortSpecFromMetadata(const ParquetInput& input);
+
+/// Plans the insertion of new rows into the sorted file `input` from the
+/// min/max statistics of the first key of each row group, like a
+/// log-structured merge: row groups no new row sorts into are kept, the
+/// others are merged with the new rows in their range, and row groups whose
+/// ranges touch on the first key are merged together. `new_first_key` is the
+/// first key of the new rows, in sorted order.
+///
+/// Without statistics the range of a row group is unknown, and Parquet
+/// statistics leave out NaN, so such files and floating point first keys are
+/// merged as a whole.
+arrow::Result<std::vector<InsertStep>> PlanInsert(
+    const ParquetInput& input, const SortKey& first_key,
+    const std::shared_ptr<arrow::Array>& new_first_key,
+    arrow::MemoryPool* pool);
+
+/// Merges two tables sorted by `spec` that have the same schema. Rows that
+/// tie come from `a` first.
+arrow::Result<std::shared_ptr<arrow::Table>> MergeSortedTables(
+    const std::shared_ptr<arrow::Table>& a,
+    const std::shared_ptr<arrow::Table>& b, const SortSpec& spec,
+    arrow::MemoryPool* pool);
+
+}  // namespace whippet_sort
@@ -0,0 +1,1650 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "engine/parquet_sorter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <arrow/api.h>
+#include <arrow/compute/api.h>
+#include <arrow/util/compression.h>
+#include <arrow/util/key_value_metadata.h>
+
+#include "common/cpu_features.h"
+#include "engine/distributed_sort.h"
+#include "engine/incremental_merge.h"
+#include "engine/run_merger.h"
+#include "engine/sort_index.h"
+#include "engine/top_k.h"
+#include "io/parquet_dataset.h"
+#include "io/parquet_input.h"
+#include "io/parquet_output.h"
+#include "io/prefetcher.h"
+#include "sort/dictionary_collation.h"
+#include "sort/gather.h"
+#include "sort/gpu_sort.h"
+#include "sort/key_normalizer.h"
+#include "sort/parallel_sort.h"
+
+namespace whippet_sort {
+
+namespace {
+
+// An in-memory sort holds the decoded input, its normalized keys and the
+// sorted copy, so a spilled run gets this fraction of the memory limit. The
+// run being prefetched takes one more share.
+constexpr int64_t kRunMemoryFactor = 3;
+
+// Merging more runs at once than this costs more in loser tree comparisons
+// and random I/O than another pass over the data.
+constexpr int64_t kMaxMergeFanIn = 256;
+
+// Schema metadata of a key sample: the rows of the shards it was taken from.
+constexpr char kShardRowsMetadataKey[] = "whippet_sort.shard_rows";
+
+// The best first-key value of a row group by its statistics: its min for ASC,
+// its max for DESC, or null if unknown.
+struct RowGroupBound {
+  int row_group = 0;
+  std::shared_ptr<arrow::Scalar> best;
+  int64_t null_count = -1;
+  int64_t num_rows = 0;
+};
+
+// Whether no row of a row group can beat the first-key value `threshold` of
+// the last selected row. Rows that tie on the first key may still win on a
+// later key, so only a strictly worse bound prunes.
+arrow::Result<bool> CannotBeat(const RowGroupBound& bound,
+                               const std::shared_ptr<arrow::Scalar>& threshold,
+                               const SortKey& key) {
+  if (threshold == nullptr || !threshold->is_valid) return false;
+  if (bound.null_count != 0 && key.nulls_first()) return false;
+  if (bound.null_count == bound.num_rows) return true;
+  if (bound.best == nullptr) return false;
+  return key.ascending() ? ScalarLess(threshold, bound.best)
+                         : ScalarLess(bound.best, threshold);
+}
+
+// Distinct keys above this are as good as unbounded for the algorithm choice.
+constexpr int64_t kManyDistinctKeys = int64_t{1} << 40;
+
+// The range of an integer column by the min/max statistics of its row groups:
+// unknown if a row group with values has no statistics or the values do not
+// fit an int64, and empty (max < min) if all values are null.
+arrow::Result<std::optional<KeyRange>> IntegerRangeByStatistics(
+    const ParquetInput& input, int column) {
+  const auto type_id = input.schema()->field(column)->type()->id();
+  if (!arrow::is_integer(type_id)) return std::nullopt;
+  std::shared_ptr<arrow::Scalar> min;
+  std::shared_ptr<arrow::Scalar> max;
+  for (int rg = 0; rg < input.num_row_groups(); ++rg) {
+    ARROW_ASSIGN_OR_RAISE(auto chunk, input.ColumnStatistics(rg, column));
+    if (chunk.min == nullptr || chunk.max == nullptr) {
+      if (chunk.null_count == input.row_group_num_rows(rg)) continue;
+      return std::nullopt;
+    }
+    if (min == nullptr) {
+      min = std::move(chunk.min);
+      max = std::move(chunk.max);
+      continue;
+    }
+    ARROW_ASSIGN_OR_RAISE(bool smaller, ScalarLess(chunk.min, min));
+    if (smaller) min = std::move(chunk.min);
+    ARROW_ASSIGN_OR_RAISE(bool larger, ScalarLess(max, chunk.max));
+    if (larger) max = std::move(chunk.max);
+  }
+  if (min == nullptr) return KeyRange{0, -1};
+  // Unsigned 64-bit values past the int64 range leave the range unknown.
+  auto low = min->CastTo(arrow::int64());
+  auto high = max->CastTo(arrow::int64());
+  if (!low.ok() || !high.ok()) return std::nullopt;
+  return KeyRange{static_cast<const arrow::Int64Scalar&>(**low).value,
+                  static_cast<const arrow::Int64Scalar&>(**high).value};
+}
+
+// The distinct non-null values of an integer or boolean column by the min/max
+// statistics of its row groups, or -1 if unknown.
+arrow::Result<int64_t> DistinctValuesByStatistics(const ParquetInput& input,
+                                                  int column) {
+  const auto type_id = input.schema()->field(column)->type()->id();
+  if (type_id == arrow::Type::BOOL) return 2;
+  ARROW_ASSIGN_OR_RAISE(auto bounds, IntegerRangeByStatistics(input, column));
+  if (!bounds.has_value()) return -1;
+  if (bounds->max < bounds->min) return 0;
+  const auto range = static_cast<uint64_t>(bounds->max) -
+                     static_cast<uint64_t>(bounds->min);
+  return range >= static_cast<uint64_t>(kManyDistinctKeys)
+             ? kManyDistinctKeys
+             : static_cast<int64_t>(range) + 1;
+}
+
+// Bounds the distinct keys of `profile` by the product of the distinct values
+// of the key columns: the dictionary size of collated columns and the range
+// of the statistics of integer columns, plus one if the column has nulls.
+// Leaves the bound unknown if a key column has neither.
+arrow::Status BoundDistinctKeys(
+    const ParquetInput& input, const SortSpec& spec,
+    const std::vector<std::shared_ptr<arrow::Array>>& columns,
+    const std::vector<std::shared_ptr<arrow::Array>>& dictionaries,
+    KeyProfile* profile) {
+  int64_t bound = 1;
+  bool from_statistics = false;
+  bool from_dictionaries = false;
+  std::vector<int> seen;
+  for (const auto& key : spec) {
+    ARROW_ASSIGN_OR_RAISE(int column, input.ColumnIndex(key.column));
+    if (std::find(seen.begin(), seen.end(), column) != seen.end()) continue;
+    seen.push_back(column);
+    int64_t values = -1;
+    if (dictionaries[column] != nullptr) {
+      values = dictionaries[column]->length();
+      from_dictionaries = true;
+    } else {
+      ARROW_ASSIGN_OR_RAISE(values, DistinctValuesByStatistics(input, column));
+      from_statistics = true;
+    }
+    if (values < 0) return arrow::Status::OK();
+    if (columns[column]->null_count() > 0) ++values;
+    values = std::max<int64_t>(values, 1);
+    bound = values >= kManyDistinctKeys / bound ? kManyDistinctKeys
+                                                : bound * values;
+  }
+  profile->max_distinct_keys = bound;
+  profile->distinct_keys_from_statistics = from_statistics;
+  profile->distinct_keys_from_dictionaries = from_dictionaries;
+  return arrow::Status::OK();
+}
+
+// Known bounds of the sort keys for KeyCompression: the codes of collated
+// columns, and the statistics of integer columns.
+arrow::Result<std::vector<std::optional<KeyRange>>> KeyRanges(
+    const ParquetInput& input, const SortSpec& spec,
+    const std::vector<std::shared_ptr<arrow::Array>>& dictionaries) {
+  std::vector<std::optional<KeyRange>> ranges;
+  for (const auto& key : spec) {
+    ARROW_ASSIGN_OR_RAISE(int column, input.ColumnIndex(key.column));
+    std::optional<KeyRange> range;
+    if (dictionaries[column] != nullptr) {
+      range = KeyRange{0, dictionaries[column]->length() - 1};
+    } else {
+      ARROW_ASSIGN_OR_RAISE(range, IntegerRangeByStatistics(input, column));
+    }
+    if (range.has_value() && range->max < range->min) range.reset();
+    ranges.push_back(range);
+  }
+  return ranges;
+}
+
+// The distinct columns of `spec`, which may sort on a column more than once.
+int64_t NumKeyColumns(const SortSpec& spec) {
+  std::vector<std::string> columns;
+  for (const auto& key : spec) {
+    if (std::find(columns.begin(), columns.end(), key.column) ==
+        columns.end()) {
+      columns.push_back(key.column);
+    }
+  }
+  return static_cast<int64_t>(columns.size());
+}
+
+int64_t EstimateDecodedBytes(const ParquetInput& input) {
+  int64_t bytes = 0;
+  for (int rg = 0; rg < input.num_row_groups(); ++rg) {
+    bytes += input.row_group_bytes(rg);
+  }
+  return bytes;
+}
+
+}  // namespace
+
+ParquetSorter::ParquetSorter(SortOptions options, arrow::MemoryPool* pool)
+    : options_(std::move(options)), pool_(pool) {
+  if (options_.use_arena) {
+    arena_ = std::make_unique<ArenaMemoryPool>(ArenaOptions{}, pool_);
+  }
+  if (options_.footer_cache_entries > 0) {
+    footer_cache_ =
+        std::make_unique<FooterCache>(options_.footer_cache_entries);
+  }
+  if (options_.perf_counters) {
+    perf_counters_ = std::make_unique<PerfCounters>();
+  }
+  ThreadPoolOptions thread_options;
+  thread_options.num_threads = options_.num_threads;
+  thread_options.pin_to_numa_nodes = options_.pin_threads_to_numa_nodes;
+  threads_ = std::make_unique<ThreadPool>(thread_options);
+}
+
+ParquetSorter::~ParquetSorter() = default;
+
+ParquetInputOptions ParquetSorter::InputOptions() const {
+  ParquetInputOptions input_options;
+  input_options.use_threads = options_.use_threads;
+  input_options.pre_buffer = options_.prefetch;
+  input_options.memory_map = options_.memory_map;
+  return input_options;
+}
+
+arrow::Status ParquetSorter::Validate() const {
+  return Validate(options_.sort_keys);
+}
+
+arrow::Status ParquetSorter::Validate(const SortSpec& spec) const {
+  if (spec.empty()) {
+    return arrow::Status::Invalid("no sort keys given");
+  }
+  if (options_.output_row_group_size <= 0) {
+    return arrow::Status::Invalid("output row group size must be positive");
+  }
+  if (options_.run_size <= 0) {
+    return arrow::Status::Invalid("run size must be positive");
+  }
+  if (options_.memory_limit < 0) {
+    return arrow::Status::Invalid("memory limit must not be negative");
+  }
+  if (options_.limit < 0) {
+    return arrow::Status::Invalid("limit must not be negative");
+  }
+  if (options_.spill_batch_rows <= 0) {
+    return arrow::Status::Invalid("spill batch size must be positive");
+  }
+  if (!arrow::util::Codec::IsAvailable(options_.output_compression)) {
+    return arrow::Status::NotImplemented(
+        "output codec ",
+        arrow::util::Codec::GetCodecAsString(options_.output_compression),
+        " is not built into Arrow");
+  }
+  if (!IsSpillCompressionSupported(options_.spill_compression)) {
+    return arrow::Status::NotImplemented(
+        "spill files are uncompressed or compressed with LZ4 or ZSTD");
+  }
+  return arrow::Status::OK();
+}
+
+arrow::Result<std::unique_ptr<ParquetOutput>> ParquetSorter::OpenOutput(
+    const std::string& path, const ParquetInput& input) const {
+  return OpenOutput(path, input, options_.sort_keys);
+}
+
+arrow::Result<std::unique_ptr<ParquetOutput>> ParquetSorter::OpenOutput(
+    const std::string& path, const ParquetInput& input,
+    const SortSpec& spec) const {
+  std::vector<bool> dictionary_columns(input.num_columns());
+  for (int column = 0; column < input.num_columns(); ++column) {
+    dictionary_columns[column] = input.HasOnlyDictionaryPages(column);
+  }
+  return OpenOutput(path, input.schema(), dictionary_columns, spec);
+}
+
+arrow::Result<std::unique_ptr<ParquetOutput>> ParquetSorter::OpenOutput(
+    const std::string& path, const ParquetDataset& input) const {
+  std::vector<bool> dictionary_columns(input.num_columns());
+  for (int column = 0; column < input.num_columns(); ++column) {
+    dictionary_columns[column] = input.HasOnlyDictionaryPages(column);
+  }
+  return OpenOutput(path, input.schema(), dictionary_columns,
+                    options_.sort_keys);
+}
+
+arrow::Result<std::unique_ptr<ParquetOutput>> ParquetSorter::OpenOutput(
+    const std::string& path, const std::shared_ptr<arrow::Schema>& schema,
+    const std::vector<bool>& dictionary_columns, const SortSpec& spec) const {
+  ParquetOutputOptions output_options;
+  output_options.compression = options_.output_compression;
+  output_options.max_row_group_rows = options_.output_row_group_size;
+  output_options.use_threads = options_.use_threads;
+  output_options.background = options_.background_write;
+  output_options.write_page_index = options_.write_page_index;
+  for (const auto& key : spec) {
+    const int column = schema->GetFieldIndex(key.column);
+    if (column < 0) {
+      return arrow::Status::KeyError("sort key '", key.column,
+                                     "' is not a column of the input");
+    }
+    parquet::SortingColumn sorting_column;
+    sorting_column.column_idx = column;
+    sorting_column.descending = !key.ascending();
+    sorting_column.nulls_first = key.nulls_first();
+    output_options.sorting_columns.push_back(sorting_column);
+  }
+  // Sorting does not change the distinct values of a column, so keep the
+  // input writer's choice instead of building dictionaries that fall back.
+  for (int column = 0; column < schema->num_fields(); ++column) {
+    if (!dictionary_columns[column]) {
+      output_options.plain_columns.push_back(schema->field(column)->name());
+    }
+  }
+  return ParquetOutput::Open(path, schema, output_options, pool_);
+}
+
+arrow::Status ParquetSorter::GatherRows(
+    const SortedColumns& sorted, int64_t offset, int64_t length,
+    std::vector<std::shared_ptr<arrow::Array>>* gathered, SortStats* stats) {
+  ScopedPhaseTimer timer(stats, Phase::kMaterialize);
+  const auto& columns = sorted.columns;
+  const auto& dictionaries = sorted.dictionaries;
+  auto slice = sorted.row_ids->Slice(offset, length);
+  gathered->resize(columns.size());
+  TaskGroup gather(threads_.get());
+  for (size_t i = 0; i < columns.size(); ++i) {
+    gather.Spawn([&, i]() -> arrow::Status {
+      if (dictionaries[i] != nullptr) {
+        ARROW_ASSIGN_OR_RAISE(
+            (*gathered)[i],
+            TakeCollated({columns[i], dictionaries[i]}, *slice, pool_));
+      } else {
+        ARROW_ASSIGN_OR_RAISE((*gathered)[i],
+                              Gather(*columns[i], *slice, pool_));
+      }
+      return arrow::Status::OK();
+    });
+  }
+  ARROW_RETURN_NOT_OK(gather.Wait());
+  for (const auto& column : *gathered) {
+    stats->gathered_bytes += GatheredBytes(*column);
+  }
+  return arrow::Status::OK();
+}
+
+arrow::Status ParquetSorter::WriteGathered(const SortedColumns& sorted,
+                                           ParquetOutput* output,
+                                           SortStats* stats) {
+  // Gather and write one output row group at a time, so that at most two
+  // sorted row groups, the one gathered and the one written in the
+  // background, are held on top of the decoded input.
+  const int64_t num_rows = sorted.row_ids->length();
+  std::vector<std::shared_ptr<arrow::Array>> row_group;
+  for (int64_t offset = 0; offset < num_rows;
+       offset += options_.output_row_group_size) {
+    auto length = std::min(options_.output_row_group_size, num_rows - offset);
+    ARROW_RETURN_NOT_OK(GatherRows(sorted, offset, length, &row_group, stats));
+    ScopedPhaseTimer timer(stats, Phase::kWrite);
+    ARROW_RETURN_NOT_OK(output->WriteRowGroup(row_group));
+  }
+  {
+    ScopedPhaseTimer timer(stats, Phase::kWrite);
+    ARROW_RETURN_NOT_OK(output->Close());
+  }
+  stats->num_output_row_groups = output->num_row_groups();
+  stats->background_write_nanos += output->background_nanos();
+  return arrow::Status::OK();
+}
+
+arrow::Status ParquetSorter::WriteTable(const arrow::Table& table,
+                                        ParquetOutput* output) const {
+  std::vector<std::shared_ptr<arrow::Array>> row_group(table.num_columns());
+  for (int64_t offset = 0; offset < table.num_rows();
+       offset += options_.output_row_group_size) {
+    auto slice = table.Slice(offset, options_.output_row_group_size);
+    for (int column = 0; column < slice->num_columns(); ++column) {
+      ARROW_ASSIGN_OR_RAISE(row_group[column],
+                            CombineChunks(slice->column(column), pool_));
+    }
+    ARROW_RETURN_NOT_OK(output->WriteRowGroup(row_group));
+  }
+  return arrow::Status::OK();
+}
+
+arrow::Result<ParquetSorter::SortInput> ParquetSorter::OpenSortInput(
+    const std::string& input_path, bool collate_dictionaries,
+    SortStats* stats) {
+  auto input_options = InputOptions();
+  ARROW_ASSIGN_OR_RAISE(auto files, ListDatasetFiles(input_path));
+  stats->num_input_files = static_cast<int64_t>(files.size());
+  const int64_t footer_hits =
+      footer_cache_ != nullptr ? footer_cache_->hits() : 0;
+  SortInput input;
+  if (files.size() > 1 || !files.front().partitions.empty()) {
+    ScopedPhaseTimer timer(stats, Phase::kRead);
+    ARROW_ASSIGN_OR_RAISE(
+        input.dataset, ParquetDataset::Open(files, pool_, input_options,
+                                            threads_.get(),
+                                            footer_cache_.get()));
+    stats->num_rows = input.dataset->num_rows();
+    stats->num_input_row_groups = input.dataset->num_row_groups();
+  } else {
+    if (options_.sort_dictionary_codes && collate_dictionaries) {
+      for (const auto& key : options_.sort_keys) {
+        input_options.dictionary_columns.push_back(key.column);
+      }
+    }
+    ARROW_ASSIGN_OR_RAISE(
+        input.file, OpenWithFooterCache(files.front().path, pool_,
+                                        input_options, footer_cache_.get()));
+    stats->num_rows = input.file->num_rows();
+    stats->num_input_row_groups = input.file->num_row_groups();
+  }
+  if (footer_cache_ != nullptr) {
+    stats->num_cached_footers = footer_cache_->hits() - footer_hits;
+  }
+  return input;
+}
+
+bool ParquetSorter::ExceedsMemoryLimit(const SortInput& input) const {
+  if (options_.memory_limit == 0) return false;
+  const int64_t decoded_bytes = input.dataset != nullptr
+                                    ? input.dataset->decoded_bytes()
+                                    : EstimateDecodedBytes(*input.file);
+  return decoded_bytes > options_.memory_limit;
+}
+
+arrow::Result<SortStats> ParquetSorter::Sort(const std::string& input_path,
+                                             const std::string& output_path) {
+  ARROW_RETURN_NOT_OK(Validate());
+  PerfCounters::Scope perf_scope(perf_counters_.get());
+  SortStats stats;
+
+  // Collated codes are per file, while a top-K sort reads row groups one by
+  // one, so it decodes its keys.
+  ARROW_ASSIGN_OR_RAISE(
+      auto input, OpenSortInput(input_path, options_.limit == 0, &stats));
+  if (input.dataset != nullptr) {
+    ARROW_RETURN_NOT_OK(SortDataset(input.dataset.get(), output_path, &stats));
+    return stats;
+  }
+  if (options_.limit > 0) {
+    ARROW_RETURN_NOT_OK(SortTopK(input.file.get(), output_path, &stats));
+    return stats;
+  }
+  if (ExceedsMemoryLimit(input)) {
+    auto dataset = ParquetDataset::FromInput(std::move(input.file), pool_);
+    ARROW_RETURN_NOT_OK(SortExternal(dataset.get(), output_path, &stats));
+    return stats;
+  }
+  ARROW_ASSIGN_OR_RAISE(auto sorted, SortColumns(input.file.get(), &stats));
+  ARROW_ASSIGN_OR_RAISE(auto output, OpenOutput(output_path, *input.file));
+  ARROW_RETURN_NOT_OK(WriteGathered(sorted, output.get(), &stats));
+  return stats;
+}
+
+arrow::Result<std::shared_ptr<SortedStream>> ParquetSorter::SortStream(
+    const std::string& input_path, const StreamOptions& stream_options) {
+  ARROW_RETURN_NOT_OK(Validate());
+  if (stream_options.batch_rows <= 0) {
+    return arrow::Status::Invalid("stream batch rows must be positive");
+  }
+  if (stream_options.read_ahead < 0) {
+    return arrow::Status::Invalid("stream read-ahead must not be negative");
+  }
+  const auto start = SortedStream::Clock::now();
+  PerfCounters::Scope perf_scope(perf_counters_.get());
+  auto stats = std::make_shared<SortStats>();
+
+  ARROW_ASSIGN_OR_RAISE(auto input,
+                        OpenSortInput(input_path, /*collate_dictionaries=*/true,
+                                      stats.get()));
+  const int64_t num_rows = options_.limit > 0
+                               ? std::min(stats->num_rows, options_.limit)
+                               : stats->num_rows;
+  const int64_t batch_rows = stream_options.batch_rows;
+  const int64_t num_batches = (num_rows + batch_rows - 1) / batch_rows;
+  if (num_batches > std::numeric_limits<int>::max()) {
+    return arrow::Status::Invalid("stream batches of ", batch_rows,
+                                  " rows are too small for ", num_rows,
+                                  " rows");
+  }
+  auto batch_length = [=](int i) {
+    return std::min(batch_rows, num_rows - int64_t{i} * batch_rows);
+  };
+
+  const bool external = ExceedsMemoryLimit(input);
+  std::unique_ptr<ParquetDataset> dataset = std::move(input.dataset);
+  if (external) {
+    // Spill and merge down to the final merge, which the stream runs: each
+    // batch merges the next rows of the runs.
+    if (dataset == nullptr) {
+      dataset = ParquetDataset::FromInput(std::move(input.file), pool_);
+    }
+    struct MergeState {
+      explicit MergeState(std::string spill_directory)
+          : spill_files(std::move(spill_directory)) {}
+      SpillFiles spill_files;
+      /// Destroyed first, as it reads the spill files.
+      std::unique_ptr<RunMerger> merger;
+    };
+    auto state = std::make_shared<MergeState>(options_.spill_directory);
+    std::vector<std::string> runs;
+    ARROW_ASSIGN_OR_RAISE(state->merger,
+                          MergeSpilledRuns(dataset.get(), &state->spill_files,
+                                           &runs, stats.get()));
+    dataset.reset();
+    const int64_t spill_bytes_read = stats->spill_bytes_read;
+    auto produce = [state, stats, batch_rows, batch_length,
+                    spill_bytes_read](int i)
+        -> arrow::Result<std::shared_ptr<arrow::RecordBatch>> {
+      ScopedPhaseTimer timer(stats.get(), Phase::kMerge);
+      ARROW_ASSIGN_OR_RAISE(auto batch, state->merger->Next(batch_length(i)));
+      stats->spill_bytes_read = spill_bytes_read + state->merger->bytes_read();
+      if (batch == nullptr) {
+        return arrow::Status::IOError("spilled runs ended before row ",
+                                      int64_t{i} * batch_rows);
+      }
+      return batch;
+    };
+    return std::make_shared<SortedStream>(
+        state->merger->schema(), static_cast<int>(num_batches),
+        std::move(produce), stream_options, std::move(stats), start);
+  }
+
+  // Sort the row ids up front; each batch then gathers its rows of the
+  // decoded columns, which the stream holds until it is closed.
+  std::shared_ptr<arrow::Schema> schema;
+  std::shared_ptr<SortedColumns> sorted;
+  if (dataset != nullptr) {
+    schema = dataset->schema();
+    ARROW_ASSIGN_OR_RAISE(auto columns,
+                          SortDatasetColumns(dataset.get(), stats.get()));
+    sorted = std::make_shared<SortedColumns>(std::move(columns));
+  } else {
+    schema = input.file->schema();
+    ARROW_ASSIGN_OR_RAISE(auto columns,
+                          SortColumns(input.file.get(), stats.get()));
+    sorted = std::make_shared<SortedColumns>(std::move(columns));
+  }
+  auto produce = [this, sorted, stats, schema, batch_rows, batch_length](
+                     int i)
+      -> arrow::Result<std::shared_ptr<arrow::RecordBatch>> {
+    const int64_t length = batch_length(i);
+    std::vector<std::shared_ptr<arrow::Array>> columns;
+    ARROW_RETURN_NOT_OK(GatherRows(*sorted, int64_t{i} * batch_rows, length,
+                                   &columns, stats.get()));
+    return arrow::RecordBatch::Make(schema, length, std::move(columns));
+  };
+  return std::make_shared<SortedStream>(std::move(schema),
+                                        static_cast<int>(num_batches),
+                                        std::move(produce), stream_options,
+                                        std::move(stats), start);
+}
+
+arrow::Result<ParquetSorter::SortedColumns> ParquetSorter::SortColumns(
+    ParquetInput* input, SortStats* stats) {
+  // Decode only the ORDER BY columns first. Dictionary-encoded string keys
+  // are replaced by their collated codes, and `dictionaries` keeps the sorted
+  // dictionary to decode them after the sort.
+  std::vector<std::shared_ptr<arrow::Array>> columns(input->num_columns());
+  std::vector<std::shared_ptr<arrow::Array>> dictionaries(input->num_columns());
+  std::vector<std::shared_ptr<arrow::Array>> keys;
+  ARROW_RETURN_NOT_OK(
+      ReadKeyColumns(input, &columns, &dictionaries, &keys, stats));
+
+  // A sort index on the same file and keys already knows the order.
+  std::unique_ptr<SortIndex> index;
+  SortIndexKey index_key;
+  std::shared_ptr<arrow::Array> row_ids;
+  if (!options_.index_directory.empty()) {
+    ScopedPhaseTimer timer(stats, Phase::kRead);
+    index = std::make_unique<SortIndex>(options_.index_directory,
+                                        options_.index_max_bytes, pool_);
+    ARROW_ASSIGN_OR_RAISE(index_key,
+                          MakeSortIndexKey(input->path(), options_.sort_keys));
+    std::string index_path;
+    ARROW_ASSIGN_OR_RAISE(
+        row_ids, index->Lookup(index_key, input->num_rows(),
+                               options_.index_prefix_reuse, &index_path));
+    if (row_ids != nullptr) {
+      stats->sort_algorithm = "none";
+      stats->sort_algorithm_reason = "rows ordered by sort index " + index_path;
+    }
+  }
+
+  // The key statistics may read the page index through the reader that the
+  // payload prefetch uses, so they are taken before it starts.
+  KeyProfile profile;
+  std::vector<std::optional<KeyRange>> ranges;
+  if (row_ids == nullptr) {
+    if (options_.algorithm == SortAlgorithm::kAuto) {
+      ARROW_RETURN_NOT_OK(BoundDistinctKeys(*input, options_.sort_keys,
+                                            columns, dictionaries, &profile));
+    }
+    ARROW_ASSIGN_OR_RAISE(
+        ranges, KeyRanges(*input, options_.sort_keys, dictionaries));
+  }
+
+  // The payload is needed only once the output order is known, so it is
+  // decoded in the background while the keys are sorted.
+  std::vector<int> payload_columns;
+  for (int column = 0; column < input->num_columns(); ++column) {
+    if (columns[column] == nullptr) payload_columns.push_back(column);
+  }
+  const int num_payload_columns = static_cast<int>(payload_columns.size());
+  input->Advise({}, payload_columns, AccessPattern::kSequential);
+  std::unique_ptr<Prefetcher<std::shared_ptr<arrow::Array>>> payload;
+  if (options_.prefetch && num_payload_columns > 0) {
+    payload = std::make_unique<Prefetcher<std::shared_ptr<arrow::Array>>>(
+        num_payload_columns,
+        [&](int i) { return input->ReadColumn(payload_columns[i]); },
+        num_payload_columns);
+  }
+
+  if (row_ids == nullptr) {
+    ARROW_ASSIGN_OR_RAISE(row_ids,
+                          SortRowIds(options_.sort_keys, keys, stats, profile,
+                                     nullptr, {}, ranges));
+    if (index != nullptr) {
+      ScopedPhaseTimer timer(stats, Phase::kWrite);
+      ARROW_RETURN_NOT_OK(index->Store(index_key, row_ids));
+    }
+  }
+  keys.clear();
+
+  {
+    ScopedPhaseTimer timer(stats, Phase::kRead);
+    for (int column : payload_columns) {
+      if (payload != nullptr) {
+        ARROW_ASSIGN_OR_RAISE(columns[column], payload->Next());
+      } else {
+        ARROW_ASSIGN_OR_RAISE(columns[column], input->ReadColumn(column));
+      }
+    }
+    stats->num_payload_columns = num_payload_columns;
+  }
+  if (payload != nullptr) {
+    stats->prefetch_nanos += payload->read_nanos();
+    stats->prefetch_wait_nanos += payload->wait_nanos();
+    payload.reset();
+  }
+
+  if (options_.limit > 0 && options_.limit < row_ids->length()) {
+    row_ids = row_ids->Slice(0, options_.limit);
+  }
+  return SortedColumns{std::move(columns), std::move(dictionaries),
+                       std::move(row_ids)};
+}
+
+arrow::Status ParquetSorter::SortDataset(ParquetDataset* input,
+                                         const std::string& output_path,
+                                         SortStats* stats) {
+  if (options_.memory_limit > 0 &&
+      input->decoded_bytes() > options_.memory_limit) {
+    return SortExternal(input, output_path, stats);
+  }
+  ARROW_ASSIGN_OR_RAISE(auto sorted, SortDatasetColumns(input, stats));
+  ARROW_ASSIGN_OR_RAISE(auto output, OpenOutput(output_path, *input));
+  return WriteGathered(sorted, output.get(), stats);
+}
+
+arrow::Result<ParquetSorter::SortedColumns>
+ParquetSorter::SortDatasetColumns(ParquetDataset* input, SortStats* stats) {
+  // Decode the ORDER BY columns first, each from all files in parallel.
+  std::vector<std::shared_ptr<arrow::Array>> columns(input->num_columns());
+  std::vector<std::shared_ptr<arrow::Array>> keys;
+  {
+    ScopedPhaseTimer timer(stats, Phase::kRead);
+    std::vector<int> key_columns;
+    for (const auto& key : options_.sort_keys) {
+      ARROW_ASSIGN_OR_RAISE(int column, input->ColumnIndex(key.column));
+      key_columns.push_back(column);
+    }
+    input->Advise(key_columns, AccessPattern::kSequential);
+    for (int column : key_columns) {
+      auto& decoded = columns[column];
+      if (decoded == nullptr) {
+        ARROW_ASSIGN_OR_RAISE(decoded,
+                              input->ReadColumn(column, threads_.get()));
+        ++stats->num_key_columns;
+      }
+      keys.push_back(decoded);
+    }
+  }
+  std::vector<std::shared_ptr<arrow::Array>> dictionaries(columns.size());
+
+  std::vector<int> payload_columns;
+  for (int column = 0; column < input->num_columns(); ++column) {
+    if (columns[column] == nullptr) payload_columns.push_back(column);
+  }
+  const int num_payload_columns = static_cast<int>(payload_columns.size());
+  input->Advise(payload_columns, AccessPattern::kSequential);
+  std::unique_ptr<Prefetcher<std::shared_ptr<arrow::Array>>> payload;
+  if (options_.prefetch && num_payload_columns > 0) {
+    payload = std::make_unique<Prefetcher<std::shared_ptr<arrow::Array>>>(
+        num_payload_columns,
+        [&](int i) { return input->ReadColumn(payload_columns[i]); },
+        num_payload_columns);
+  }
+
+  // Every file is sorted in runs of its own; the merge of all runs orders
+  // the dataset.
+  std::vector<int64_t> splits;
+  for (int i = 1; i < input->num_files(); ++i) {
+    splits.push_back(input->file_row_offset(i));
+  }
+  ARROW_ASSIGN_OR_RAISE(
+      auto row_ids,
+      SortRowIds(options_.sort_keys, keys, stats, {}, nullptr, splits));
+  keys.clear();
+
+  {
+    ScopedPhaseTimer timer(stats, Phase::kRead);
+    for (int column : payload_columns) {
+      if (payload != nullptr) {
+        ARROW_ASSIGN_OR_RAISE(columns[column], payload->Next());
+      } else {
+        ARROW_ASSIGN_OR_RAISE(columns[column],
+                              input->ReadColumn(column, threads_.get()));
+      }
+    }
+    stats->num_payload_columns = num_payload_columns;
+  }
+  if (payload != nullptr) {
+    stats->prefetch_nanos += payload->read_nanos();
+    stats->prefetch_wait_nanos += payload->wait_nanos();
+    payload.reset();
+  }
+
+  if (options_.limit > 0 && options_.limit < row_ids->length()) {
+    row_ids = row_ids->Slice(0, options_.limit);
+  }
+  return SortedColumns{std::move(columns), std::move(dictionaries),
+                       std::move(row_ids)};
+}
+
+arrow::Result<SortStats> ParquetSorter::Insert(
+    const std::string& sorted_path, const std::vector<std::string>& new_paths,
+    const std::string& output_path) {
+  PerfCounters::Scope perf_scope(perf_counters_.get());
+  SortStats stats;
+  auto input_options = InputOptions();
+  ARROW_ASSIGN_OR_RAISE(auto sorted,
+                        ParquetInput::Open(sorted_path, pool_, input_options));
+  // The order comes from the file, so that one sorter can insert into files
+  // of different orders.
+  ARROW_ASSIGN_OR_RAISE(auto spec, SortSpecFromMetadata(*sorted));
+  if (!options_.sort_keys.empty() &&
+      SortSpecToString(options_.sort_keys) != SortSpecToString(spec)) {
+    return arrow::Status::Invalid(sorted_path, " is sorted by ",
+                                  SortSpecToString(spec), ", not by ",
+                                  SortSpecToString(options_.sort_keys));
+  }
+  ARROW_RETURN_NOT_OK(Validate(spec));
+  if (options_.limit > 0) {
+    return arrow::Status::Invalid("an insert keeps all rows, not a limit");
+  }
+  stats.num_input_row_groups = sorted->num_row_groups();
+  stats.num_key_columns = NumKeyColumns(spec);
+  stats.num_payload_columns = sorted->num_columns() - stats.num_key_columns;
+
+  // Sort the new rows on their own.
+  std::vector<std::shared_ptr<arrow::Table>> pieces;
+  {
+    ScopedPhaseTimer timer(&stats, Phase::kRead);
+    for (const auto& path : new_paths) {
+      ARROW_ASSIGN_OR_RAISE(auto input,
+                            OpenWithFooterCache(path, pool_, input_options,
+                                                footer_cache_.get()));
+      if (!input->schema()->Equals(*sorted->schema())) {
+        return arrow::Status::Invalid(path, " does not have the schema of ",
+                                      sorted_path);
+      }
+      std::vector<int> row_groups(input->num_row_groups());
+      std::iota(row_groups.begin(), row_groups.end(), 0);
+      input->Advise(row_groups, {}, AccessPattern::kSequential);
+      ARROW_ASSIGN_OR_RAISE(auto table, input->ReadRowGroups(row_groups));
+      pieces.push_back(std::move(table));
+    }
+  }
+  std::shared_ptr<arrow::Table> new_rows;
+  if (pieces.empty()) {
+    ARROW_ASSIGN_OR_RAISE(new_rows,
+                          arrow::Table::MakeEmpty(sorted->schema(), pool_));
+  } else {
+    ARROW_ASSIGN_OR_RAISE(new_rows, arrow::ConcatenateTables(pieces));
+    pieces.clear();
+  }
+  if (new_rows->num_rows() > 1) {
+    ARROW_ASSIGN_OR_RAISE(new_rows, SortInMemory(new_rows, spec, &stats));
+  }
+  stats.num_rows = sorted->num_rows() + new_rows->num_rows();
+
+  ARROW_ASSIGN_OR_RAISE(
+      auto new_first_key,
+      CombineChunks(new_rows->GetColumnByName(spec.front().column), pool_));
+  ARROW_ASSIGN_OR_RAISE(
+      auto steps, PlanInsert(*sorted, spec.front(), new_first_key, pool_));
+  new_first_key.reset();
+
+  sorted->Advise({}, {}, AccessPattern::kSequential);
+  ARROW_ASSIGN_OR_RAISE(auto output, OpenOutput(output_path, *sorted, spec));
+  for (const auto& step : steps) {
+    auto new_slice =
+        new_rows->Slice(step.new_begin, step.new_end - step.new_begin);
+    std::shared_ptr<arrow::Table> table;
+    if (step.kind == InsertStep::Kind::kNewRows) {
+      table = std::move(new_slice);
+    } else {
+      ScopedPhaseTimer timer(&stats, Phase::kRead);
+      ARROW_ASSIGN_OR_RAISE(table, sorted->ReadRowGroups(step.row_groups));
+    }
+    if (step.kind == InsertStep::Kind::kMerge) {
+      ScopedPhaseTimer timer(&stats, Phase::kMerge);
+      ARROW_ASSIGN_OR_RAISE(table,
+                            MergeSortedTables(table, new_slice, spec, pool_));
+      stats.num_rewritten_row_groups +=
+          static_cast<int64_t>(step.row_groups.size());
+    }
+    ScopedPhaseTimer timer(&stats, Phase::kWrite);
+    if (step.kind == InsertStep::Kind::kCopy) {
+      // A copied row group keeps its rows together, whatever the output row
+      // group size.
+      std::vector<std::shared_ptr<arrow::Array>> row_group(
+          table->num_columns());
+      for (int column = 0; column < table->num_columns(); ++column) {
+        ARROW_ASSIGN_OR_RAISE(row_group[column],
+                              CombineChunks(table->column(column), pool_));
+      }
+      ARROW_RETURN_NOT_OK(output->WriteRowGroup(row_group));
+      continue;
+    }
+    ARROW_RETURN_NOT_OK(WriteTable(*table, output.get()));
+  }
+  {
+    ScopedPhaseTimer timer(&stats, Phase::kWrite);
+    ARROW_RETURN_NOT_OK(output->Close());
+  }
+  if (stats.sort_algorithm.empty()) stats.sort_algorithm = "merge";
+  stats.num_output_row_groups = output->num_row_groups();
+  stats.background_write_nanos += output->background_nanos();
+  return stats;
+}
+
+arrow::Result<SortStats> ParquetSorter::SortDistributed(
+    const std::vector<std::string>& shard_paths,
+    const std::string& output_path,
+    const DistributedSortOptions& distributed) {
+  ARROW_RETURN_NOT_OK(Validate());
+  ARROW_RETURN_NOT_OK(ValidateDistributedSortOptions(distributed));
+  if (options_.limit > 0 || options_.memory_limit > 0) {
+    return arrow::Status::NotImplemented(
+        "a distributed sort sorts the shards of each rank in memory, without ",
+        "a limit");
+  }
+  if (shard_paths.empty()) {
+    return arrow::Status::Invalid("rank ", distributed.rank, " has no shards");
+  }
+  PerfCounters::Scope perf_scope(perf_counters_.get());
+  SortStats stats;
+  stats.rank = distributed.rank;
+  stats.num_ranks = distributed.num_ranks;
+  const auto& directory = distributed.exchange_directory;
+  const int num_ranks = distributed.num_ranks;
+
+  auto input_options = InputOptions();
+  std::unique_ptr<ParquetInput> first_shard;
+  std::vector<std::shared_ptr<arrow::Table>> pieces;
+  {
+    ScopedPhaseTimer timer(&stats, Phase::kRead);
+    for (const auto& path : shard_paths) {
+      ARROW_ASSIGN_OR_RAISE(auto input,
+                            OpenWithFooterCache(path, pool_, input_options,
+                                                footer_cache_.get()));
+      if (first_shard != nullptr &&
+          !input->schema()->Equals(*first_shard->schema())) {
+        return arrow::Status::Invalid(path, " does not have the schema of ",
+                                      first_shard->path());
+      }
+      std::vector<int> row_groups(input->num_row_groups());
+      std::iota(row_groups.begin(), row_groups.end(), 0);
+      input->Advise(row_groups, {}, AccessPattern::kSequential);
+      ARROW_ASSIGN_OR_RAISE(auto table, input->ReadRowGroups(row_groups));
+      pieces.push_back(std::move(table));
+      stats.num_input_row_groups += input->num_row_groups();
+      if (first_shard == nullptr) first_shard = std::move(input);
+    }
+  }
+  ARROW_ASSIGN_OR_RAISE(auto sorted, arrow::ConcatenateTables(pieces));
+  pieces.clear();
+  stats.num_shard_rows = sorted->num_rows();
+  stats.num_key_columns = NumKeyColumns(options_.sort_keys);
+  stats.num_payload_columns = sorted->num_columns() - stats.num_key_columns;
+  if (sorted->num_rows() > 1) {
+    ARROW_ASSIGN_OR_RAISE(sorted,
+                          SortInMemory(sorted, options_.sort_keys, &stats));
+  }
+
+  // Every rank reads the samples of all ranks in rank order and sorts them
+  // the same way, so all ranks choose the same splitters.
+  std::shared_ptr<arrow::Table> splitters;
+  int64_t total_rows = 0;
+  {
+    ScopedPhaseTimer timer(&stats, Phase::kExchange);
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+      return arrow::Status::IOError("cannot create ", directory, ": ",
+                                    error.message());
+    }
+    ARROW_ASSIGN_OR_RAISE(auto samples,
+                          SampleKeys(*sorted, options_.sort_keys,
+                                     distributed.samples_per_rank, pool_));
+    samples = samples->ReplaceSchemaMetadata(arrow::key_value_metadata(
+        {kShardRowsMetadataKey}, {std::to_string(sorted->num_rows())}));
+    ARROW_ASSIGN_OR_RAISE(
+        int64_t bytes,
+        WriteExchangeFile(SampleFilePath(directory, distributed.rank),
+                          *samples, distributed, options_.spill_batch_rows,
+                          pool_));
+    stats.exchange_bytes_written += bytes;
+
+    std::vector<std::shared_ptr<arrow::Table>> all_samples;
+    for (int rank = 0; rank < num_ranks; ++rank) {
+      const auto path = SampleFilePath(directory, rank);
+      ARROW_RETURN_NOT_OK(
+          WaitForExchangeFile(path, distributed.timeout_seconds));
+      ARROW_ASSIGN_OR_RAISE(auto table, ReadExchangeFile(path, pool_));
+      const auto& metadata = table->schema()->metadata();
+      if (metadata == nullptr) {
+        return arrow::Status::Invalid(path, " is not a key sample");
+      }
+      ARROW_ASSIGN_OR_RAISE(auto rows, metadata->Get(kShardRowsMetadataKey));
+      total_rows += std::atoll(rows.c_str());
+      all_samples.push_back(table->ReplaceSchemaMetadata(nullptr));
+    }
+    ARROW_ASSIGN_OR_RAISE(auto sorted_samples,
+                          arrow::ConcatenateTables(all_samples));
+    if (sorted_samples->num_rows() > 1) {
+      SortStats sample_stats;
+      ARROW_ASSIGN_OR_RAISE(
+          sorted_samples,
+          SortInMemory(sorted_samples, options_.sort_keys, &sample_stats));
+    }
+    ARROW_ASSIGN_OR_RAISE(splitters,
+                          ChooseSplitters(sorted_samples, num_ranks));
+  }
+
+  // Cut the sorted rows into the key ranges of the ranks and send each rank
+  // its range, this one included, so that all ranks merge alike.
+  {
+    ScopedPhaseTimer timer(&stats, Phase::kExchange);
+    ARROW_ASSIGN_OR_RAISE(auto bounds,
+                          PartitionBounds(*sorted, *splitters,
+                                          options_.sort_keys, num_ranks,
+                                          pool_));
+    for (int rank = 0; rank < num_ranks; ++rank) {
+      auto range = sorted->Slice(bounds[rank], bounds[rank + 1] - bounds[rank]);
+      ARROW_ASSIGN_OR_RAISE(
+          int64_t bytes,
+          WriteExchangeFile(
+              PartitionFilePath(directory, distributed.rank, rank), *range,
+              distributed, options_.spill_batch_rows, pool_));
+      stats.exchange_bytes_written += bytes;
+      if (rank != distributed.rank) {
+        stats.num_shuffled_rows += range->num_rows();
+      }
+    }
+    sorted.reset();
+  }
+
+  std::vector<std::string> ranges;
+  {
+    ScopedPhaseTimer timer(&stats, Phase::kExchange);
+    for (int rank = 0; rank < num_ranks; ++rank) {
+      ranges.push_back(PartitionFilePath(directory, rank, distributed.rank));
+      ARROW_RETURN_NOT_OK(
+          WaitForExchangeFile(ranges.back(), distributed.timeout_seconds));
+    }
+  }
+
+  // The received ranges are sorted runs; uncompressed ones are merged
+  // straight from the mapped files.
+  std::unique_ptr<RunMerger> merger;
+  {
+    ScopedPhaseTimer timer(&stats, Phase::kMerge);
+    ARROW_ASSIGN_OR_RAISE(
+        merger, RunMerger::Open(ranges, options_.sort_keys, pool_,
+                                /*memory_map=*/true));
+  }
+  stats.merge_fan_in = num_ranks;
+  ARROW_ASSIGN_OR_RAISE(auto output, OpenOutput(output_path, *first_shard));
+  while (true) {
+    std::shared_ptr<arrow::RecordBatch> batch;
+    {
+      ScopedPhaseTimer timer(&stats, Phase::kMerge);
+      ARROW_ASSIGN_OR_RAISE(batch,
+                            merger->Next(options_.output_row_group_size));
+    }
+    if (batch == nullptr) break;
+    stats.num_rows += batch->num_rows();
+    ScopedPhaseTimer timer(&stats, Phase::kWrite);
+    ARROW_RETURN_NOT_OK(output->WriteRowGroup(batch->columns()));
+  }
+  stats.exchange_bytes_read += merger->bytes_read();
+  merger.reset();
+  {
+    ScopedPhaseTimer timer(&stats, Phase::kWrite);
+    ARROW_RETURN_NOT_OK(output->Close());
+  }
+
+  // All ranks have read the samples by the time they sent their ranges.
+  std::error_code error;
+  for (const auto& path : ranges) {
+    std::filesystem::remove(path, error);
+  }
+  std::filesystem::remove(SampleFilePath(directory, distributed.rank), error);
+
+  stats.partition_skew =
+      total_rows > 0 ? static_cast<double>(stats.num_rows) * num_ranks /
+                           static_cast<double>(total_rows)
+                     : 1.0;
+  stats.num_output_row_groups = output->num_row_groups();
+  stats.background_write_nanos += output->background_nanos();
+  return stats;
+}
+
+arrow::Result<SortPermutation> ParquetSorter::ComputeOrder(
+    const std::string& input_path, SortStats* stats) {
+  ARROW_RETURN_NOT_OK(Validate());
+  PerfCounters::Scope perf_scope(perf_counters_.get());
+  auto input_options = InputOptions();
+  if (options_.sort_dictionary_codes) {
+    for (const auto& key : options_.sort_keys) {
+      input_options.dictionary_columns.push_back(key.column);
+    }
+  }
+  ARROW_ASSIGN_OR_RAISE(auto input,
+                        ParquetInput::Open(input_path, pool_, input_options));
+  stats->num_rows = input->num_rows();
+  stats->num_input_row_groups = input->num_row_groups();
+
+  std::vector<std::shared_ptr<arrow::Array>> columns(input->num_columns());
+  std::vector<std::shared_ptr<arrow::Array>> dictionaries(input->num_columns());
+  std::vector<std::shared_ptr<arrow::Array>> keys;
+  ARROW_RETURN_NOT_OK(
+      ReadKeyColumns(input.get(), &columns, &dictionaries, &keys, stats));
+  KeyProfile profile;
+  if (options_.algorithm == SortAlgorithm::kAuto) {
+    ARROW_RETURN_NOT_OK(BoundDistinctKeys(*input, options_.sort_keys, columns,
+                                          dictionaries, &profile));
+  }
+  ARROW_ASSIGN_OR_RAISE(auto ranges,
+                        KeyRanges(*input, options_.sort_keys, dictionaries));
+  columns.clear();
+  dictionaries.clear();
+
+  BlockKeys block_keys;
+  block_keys.block_rows = options_.output_row_group_size;
+  ARROW_ASSIGN_OR_RAISE(auto row_ids,
+                        SortRowIds(options_.sort_keys, keys, stats, profile,
+                                   &block_keys, {}, ranges));
+  keys.clear();
+  if (options_.limit > 0 && options_.limit < row_ids->length()) {
+    row_ids = row_ids->Slice(0, options_.limit);
+  }
+
+  ScopedPhaseTimer timer(stats, Phase::kMaterialize);
+  std::vector<int64_t> row_group_offsets(input->num_row_groups() + 1, 0);
+  for (int rg = 0; rg < input->num_row_groups(); ++rg) {
+    row_group_offsets[rg + 1] =
+        row_group_offsets[rg] + input->row_group_num_rows(rg);
+  }
+  ARROW_ASSIGN_OR_RAISE(
+      auto permutation,
+      PackRowIds(*row_ids, std::move(row_group_offsets), pool_));
+  permutation.block_rows = block_keys.block_rows;
+  permutation.block_keys = std::move(block_keys.keys);
+  permutation.exact_keys = block_keys.exact;
+  return permutation;
+}
+
+arrow::Status ParquetSorter::ReadKeyColumns(
+    ParquetInput* input, std::vector<std::shared_ptr<arrow::Array>>* columns,
+    std::vector<std::shared_ptr<arrow::Array>>* dictionaries,
+    std::vector<std::shared_ptr<arrow::Array>>* keys, SortStats* stats) {
+  ScopedPhaseTimer timer(stats, Phase::kRead);
+  std::vector<int> key_columns;
+  for (const auto& key : options_.sort_keys) {
+    ARROW_ASSIGN_OR_RAISE(int column, input->ColumnIndex(key.column));
+    key_columns.push_back(column);
+  }
+  input->Advise({}, key_columns, AccessPattern::kSequential);
+  for (int column : key_columns) {
+    auto& decoded = (*columns)[column];
+    if (decoded == nullptr) {
+      if (input->is_dictionary_column(column)) {
+        ARROW_ASSIGN_OR_RAISE(auto chunked,
+                              input->ReadDictionaryColumn(column));
+        ARROW_ASSIGN_OR_RAISE(auto collated,
+                              CollateDictionaryColumn(*chunked, pool_));
+        decoded = std::move(collated.codes);
+        (*dictionaries)[column] = std::move(collated.dictionary);
+        ++stats->num_dictionary_key_columns;
+      } else {
+        ARROW_ASSIGN_OR_RAISE(decoded, input->ReadColumn(column));
+      }
+      ++stats->num_key_columns;
+    }
+    keys->push_back(decoded);
+  }
+  return arrow::Status::OK();
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> ParquetSorter::SortTable(
+    const std::shared_ptr<arrow::Table>& table, SortStats* stats) {
+  ARROW_RETURN_NOT_OK(Validate());
+  PerfCounters::Scope perf_scope(perf_counters_.get());
+  stats->num_rows = table->num_rows();
+  ARROW_ASSIGN_OR_RAISE(auto sorted,
+                        SortInMemory(table, options_.sort_keys, stats));
+  if (options_.limit > 0 && options_.limit < sorted->num_rows()) {
+    sorted = sorted->Slice(0, options_.limit);
+  }
+  return sorted;
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> ParquetSorter::SortTableOrder(
+    const std::shared_ptr<arrow::Table>& table, SortStats* stats) {
+  ARROW_RETURN_NOT_OK(Validate());
+  PerfCounters::Scope perf_scope(perf_counters_.get());
+  stats->num_rows = table->num_rows();
+  ARROW_ASSIGN_OR_RAISE(auto row_ids,
+                        SortTableRowIds(*table, options_.sort_keys, stats));
+  if (options_.limit > 0 && options_.limit < row_ids->length()) {
+    row_ids = row_ids->Slice(0, options_.limit);
+  }
+  return row_ids;
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> ParquetSorter::SortTableRowIds(
+    const arrow::Table& table, const SortSpec& spec, SortStats* stats) {
+  std::vector<std::shared_ptr<arrow::Array>> keys;
+  for (const auto& key : spec) {
+    auto column = table.GetColumnByName(key.column);
+    if (column == nullptr) {
+      return arrow::Status::KeyError("sort key '", key.column,
+                                     "' is not a column of the input");
+    }
+    ARROW_ASSIGN_OR_RAISE(auto array, CombineChunks(column, pool_));
+    keys.push_back(std::move(array));
+  }
+  return SortRowIds(spec, keys, stats);
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> ParquetSorter::SortInMemory(
+    const std::shared_ptr<arrow::Table>& table, const SortSpec& spec,
+    SortStats* stats) {
+  ARROW_ASSIGN_OR_RAISE(auto row_ids, SortTableRowIds(*table, spec, stats));
+  ScopedPhaseTimer timer(stats, Phase::kMaterialize);
+  arrow::compute::ExecContext ctx(pool_);
+  ARROW_ASSIGN_OR_RAISE(
+      auto sorted,
+      arrow::compute::Take(table, row_ids,
+                           arrow::compute::TakeOptions::NoBoundsCheck(), &ctx));
+  return sorted.table();
+}
+
+arrow::Status ParquetSorter::SortTopK(ParquetInput* input,
+                                      const std::string& output_path,
+                                      SortStats* stats) {
+  // Row groups are visited by their statistics and only those holding result
+  // rows are decoded in full, in no particular file order.
+  input->Advise({}, {}, AccessPattern::kRandom);
+  const auto& first_key = options_.sort_keys.front();
+  std::vector<int> key_columns;
+  for (const auto& key : options_.sort_keys) {
+    ARROW_ASSIGN_OR_RAISE(int column, input->ColumnIndex(key.column));
+    if (std::find(key_columns.begin(), key_columns.end(), column) ==
+        key_columns.end()) {
+      key_columns.push_back(column);
+    }
+  }
+  stats->num_key_columns = static_cast<int64_t>(key_columns.size());
+  const int first_column = key_columns.front();
+  const auto& first_type = input->schema()->field(first_column)->type();
+  // NaN goes after every value, so it is the best value of a DESC key, but
+  // Parquet statistics leave it out.
+  const bool prunable =
+      !(arrow::is_floating(first_type->id()) && !first_key.ascending());
+
+  std::vector<int64_t> first_row_ids(input->num_row_groups() + 1, 0);
+  std::vector<RowGroupBound> bounds(input->num_row_groups());
+  for (int rg = 0; rg < input->num_row_groups(); ++rg) {
+    first_row_ids[rg + 1] = first_row_ids[rg] + input->row_group_num_rows(rg);
+    auto& bound = bounds[rg];
+    bound.row_group = rg;
+    bound.num_rows = input->row_group_num_rows(rg);
+    ARROW_ASSIGN_OR_RAISE(auto statistics,
+                          input->ColumnStatistics(rg, first_column));
+    bound.null_count = statistics.null_count;
+    bound.best = first_key.ascending() ? statistics.min : statistics.max;
+  }
+
+  // Visit the row groups with the best bounds first, so that the threshold
+  // is tight early and prunes most of the rest. Bounds that are unknown go
+  // first, as they cannot be pruned anyway.
+  std::stable_sort(bounds.begin(), bounds.end(),
+                   [&](const RowGroupBound& a, const RowGroupBound& b) {
+                     if (a.best == nullptr || b.best == nullptr) {
+                       return a.best == nullptr && b.best != nullptr;
+                     }
+                     auto less = first_key.ascending()
+                                     ? ScalarLess(a.best, b.best)
+                                     : ScalarLess(b.best, a.best);
+                     return less.ValueOr(false);
+                   });
+
+  TopKSelector selector(options_.sort_keys, options_.limit,
+                        options_.string_prefix_width, pool_);
+  for (const auto& bound : bounds) {
+    if (prunable && selector.full()) {
+      ARROW_ASSIGN_OR_RAISE(auto threshold, selector.Threshold());
+      ARROW_ASSIGN_OR_RAISE(bool skip, CannotBeat(bound, threshold, first_key));
+      if (skip) {
+        ++stats->num_pruned_row_groups;
+        continue;
+      }
+    }
+    std::vector<std::shared_ptr<arrow::Array>> keys;
+    {
+      ScopedPhaseTimer timer(stats, Phase::kRead);
+      ARROW_ASSIGN_OR_RAISE(auto table,
+                            input->ReadRowGroup(bound.row_group, key_columns));
+      for (const auto& key : options_.sort_keys) {
+        ARROW_ASSIGN_OR_RAISE(
+            auto array,
+            CombineChunks(table->GetColumnByName(key.column), pool_));
+        keys.push_back(std::move(array));
+      }
+    }
+    ScopedPhaseTimer timer(stats, Phase::kSort);
+    ARROW_RETURN_NOT_OK(selector.Add(keys, first_row_ids[bound.row_group]));
+  }
+  stats->sort_algorithm = "top-k";
+
+  // Decode the row groups holding result rows, keep only those rows, and put
+  // them in result order.
+  const auto& row_ids = selector.row_ids();
+  std::vector<int> row_groups;
+  // The slot of each row group in `row_groups`, or -1 if it has no result row.
+  std::vector<int> slots(input->num_row_groups(), -1);
+  std::vector<std::vector<int64_t>> local_rows;
+  std::vector<std::pair<size_t, int64_t>> positions(row_ids.size());
+  for (size_t i = 0; i < row_ids.size(); ++i) {
+    const auto id = static_cast<int64_t>(row_ids[i]);
+    const int rg = static_cast<int>(std::upper_bound(first_row_ids.begin(),
+                                                     first_row_ids.end(), id) -
+                                    first_row_ids.begin()) -
+                   1;
+    if (slots[rg] < 0) {
+      slots[rg] = static_cast<int>(row_groups.size());
+      row_groups.push_back(rg);
+      local_rows.emplace_back();
+    }
+    const auto slot = static_cast<size_t>(slots[rg]);
+    positions[i] = {slot, static_cast<int64_t>(local_rows[slot].size())};
+    local_rows[slot].push_back(id - first_row_ids[rg]);
+  }
+
+  std::vector<int> all_columns(input->num_columns());
+  for (int column = 0; column < input->num_columns(); ++column) {
+    all_columns[column] = column;
+  }
+  stats->num_payload_columns = input->num_columns() - stats->num_key_columns;
+  arrow::compute::ExecContext ctx(pool_);
+  auto take_options = arrow::compute::TakeOptions::NoBoundsCheck();
+  std::vector<std::shared_ptr<arrow::Table>> pieces;
+  std::vector<int64_t> piece_offsets;
+  int64_t num_piece_rows = 0;
+  for (size_t slot = 0; slot < row_groups.size(); ++slot) {
+    std::shared_ptr<arrow::Table> table;
+    {
+      ScopedPhaseTimer timer(stats, Phase::kRead);
+      ARROW_ASSIGN_OR_RAISE(table,
+                            input->ReadRowGroup(row_groups[slot], all_columns));
+    }
+    ScopedPhaseTimer timer(stats, Phase::kMaterialize);
+    arrow::Int64Builder indices(pool_);
+    ARROW_RETURN_NOT_OK(indices.AppendValues(local_rows[slot]));
+    ARROW_ASSIGN_OR_RAISE(auto indices_array, indices.Finish());
+    ARROW_ASSIGN_OR_RAISE(
+        auto piece,
+        arrow::compute::Take(table, indices_array, take_options, &ctx));
+    piece_offsets.push_back(num_piece_rows);
+    num_piece_rows += static_cast<int64_t>(local_rows[slot].size());
+    pieces.push_back(piece.table());
+  }
+
+  std::shared_ptr<arrow::Table> result;
+  {
+    ScopedPhaseTimer timer(stats, Phase::kMaterialize);
+    arrow::Int64Builder indices(pool_);
+    ARROW_RETURN_NOT_OK(
+        indices.Reserve(static_cast<int64_t>(positions.size())));
+    for (const auto& [slot, index] : positions) {
+      indices.UnsafeAppend(piece_offsets[slot] + index);
+    }
+    ARROW_ASSIGN_OR_RAISE(auto indices_array, indices.Finish());
+    if (pieces.empty()) {
+      ARROW_ASSIGN_OR_RAISE(result,
+                            arrow::Table::MakeEmpty(input->schema(), pool_));
+    } else {
+      ARROW_ASSIGN_OR_RAISE(auto concatenated,
+                            arrow::ConcatenateTables(pieces));
+      ARROW_ASSIGN_OR_RAISE(auto taken,
+                            arrow::compute::Take(concatenated, indices_array,
+                                                 take_options, &ctx));
+      result = taken.table();
+    }
+  }
+
+  ARROW_ASSIGN_OR_RAISE(auto output, OpenOutput(output_path, *input));
+  ScopedPhaseTimer timer(stats, Phase::kWrite);
+  ARROW_RETURN_NOT_OK(WriteTable(*result, output.get()));
+  ARROW_RETURN_NOT_OK(output->Close());
+  stats->num_output_row_groups = output->num_row_groups();
+  stats->background_write_nanos += output->background_nanos();
+  return arrow::Status::OK();
+}
+
+arrow::Result<std::unique_ptr<RunMerger>> ParquetSorter::MergeSpilledRuns(
+    ParquetDataset* input, SpillFiles* spill_files,
+    std::vector<std::string>* final_runs, SortStats* stats) {
+  input->Advise({}, AccessPattern::kSequential);
+  const int64_t input_bytes = input->decoded_bytes();
+  const int64_t run_bytes_limit =
+      options_.memory_limit / (kRunMemoryFactor + (options_.prefetch ? 1 : 0));
+
+  // Cut each file into runs of consecutive row groups, so that the merge,
+  // which takes ties in run order, keeps the sort stable.
+  struct RunRowGroups {
+    int file;
+    std::vector<int> row_groups;
+  };
+  std::vector<RunRowGroups> run_row_groups;
+  int64_t run_bytes = 0;
+  for (int i = 0; i < input->num_files(); ++i) {
+    const auto* file = input->file(i);
+    for (int rg = 0; rg < file->num_row_groups(); ++rg) {
+      if (run_row_groups.empty() || run_row_groups.back().file != i ||
+          run_bytes + file->row_group_bytes(rg) > run_bytes_limit) {
+        run_row_groups.push_back({i, {}});
+        run_bytes = 0;
+      }
+      run_row_groups.back().row_groups.push_back(rg);
+      run_bytes += file->row_group_bytes(rg);
+    }
+  }
+  // An input without rows still gets an empty run, and an empty output.
+  if (run_row_groups.empty()) run_row_groups.push_back({0, {}});
+  auto read_run = [&](int i) {
+    const auto& run = run_row_groups[i];
+    return input->ReadRowGroups(run.file, run.row_groups);
+  };
+
+  // Decode the next run while the current one is sorted and spilled.
+  const int num_runs = static_cast<int>(run_row_groups.size());
+  std::unique_ptr<Prefetcher<std::shared_ptr<arrow::Table>>> reads;
+  if (options_.prefetch) {
+    reads = std::make_unique<Prefetcher<std::shared_ptr<arrow::Table>>>(
+        num_runs, read_run);
+  }
+  auto& runs = *final_runs;
+  for (int i = 0; i < num_runs; ++i) {
+    std::shared_ptr<arrow::Table> table;
+    {
+      ScopedPhaseTimer timer(stats, Phase::kRead);
+      if (reads != nullptr) {
+        ARROW_ASSIGN_OR_RAISE(table, reads->Next());
+      } else {
+        ARROW_ASSIGN_OR_RAISE(table, read_run(i));
+      }
+    }
+    ARROW_ASSIGN_OR_RAISE(auto run,
+                          SpillRun(std::move(table), spill_files, stats));
+    runs.push_back(std::move(run));
+  }
+  if (reads != nullptr) {
+    stats->prefetch_nanos += reads->read_nanos();
+    stats->prefetch_wait_nanos += reads->wait_nanos();
+    reads.reset();
+  }
+
+  // Every run being merged holds one batch, and the merged output gathers up
+  // to one more per run.
+  const int64_t row_bytes =
+      std::max<int64_t>(1, input_bytes / std::max<int64_t>(1, stats->num_rows));
+  const int64_t batch_bytes = row_bytes * options_.spill_batch_rows;
+  const auto fan_in = static_cast<size_t>(std::clamp<int64_t>(
+      options_.memory_limit / (2 * batch_bytes), 2, kMaxMergeFanIn));
+  while (runs.size() > fan_in) {
+    ++stats->num_merge_passes;
+    std::vector<std::string> merged;
+    for (size_t begin = 0; begin < runs.size(); begin += fan_in) {
+      const size_t end = std::min(runs.size(), begin + fan_in);
+      if (end - begin == 1) {
+        merged.push_back(runs[begin]);
+        continue;
+      }
+      std::vector<std::string> group(runs.begin() + begin, runs.begin() + end);
+      ARROW_ASSIGN_OR_RAISE(auto run, MergeRuns(group, spill_files, stats));
+      merged.push_back(std::move(run));
+    }
+    runs = std::move(merged);
+  }
+
+  ++stats->num_merge_passes;
+  stats->merge_fan_in =
+      std::max(stats->merge_fan_in, static_cast<int64_t>(runs.size()));
+  std::unique_ptr<RunMerger> merger;
+  {
+    ScopedPhaseTimer timer(stats, Phase::kMerge);
+    ARROW_ASSIGN_OR_RAISE(merger,
+                          RunMerger::Open(runs, options_.sort_keys, pool_));
+  }
+  return merger;
+}
+
+arrow::Status ParquetSorter::SortExternal(ParquetDataset* input,
+                                          const std::string& output_path,
+                                          SortStats* stats) {
+  SpillFiles spill_files(options_.spill_directory);
+  std::vector<std::string> runs;
+  ARROW_ASSIGN_OR_RAISE(auto merger,
+                        MergeSpilledRuns(input, &spill_files, &runs, stats));
+  ARROW_ASSIGN_OR_RAISE(auto output, OpenOutput(output_path, *input));
+  int64_t num_written = 0;
+  while (options_.limit == 0 || num_written < options_.limit) {
+    std::shared_ptr<arrow::RecordBatch> batch;
+    {
+      ScopedPhaseTimer timer(stats, Phase::kMerge);
+      ARROW_ASSIGN_OR_RAISE(batch,
+                            merger->Next(options_.output_row_group_size));
+    }
+    if (batch == nullptr) break;
+    if (options_.limit > 0 &&
+        batch->num_rows() > options_.limit - num_written) {
+      batch = batch->Slice(0, options_.limit - num_written);
+    }
+    num_written += batch->num_rows();
+    ScopedPhaseTimer timer(stats, Phase::kWrite);
+    ARROW_RETURN_NOT_OK(output->WriteRowGroup(batch->columns()));
+  }
+  stats->spill_bytes_read += merger->bytes_read();
+  merger.reset();
+  for (const auto& run : runs) {
+    spill_files.Remove(run);
+  }
+  {
+    ScopedPhaseTimer timer(stats, Phase::kWrite);
+    ARROW_RETURN_NOT_OK(output->Close());
+  }
+  stats->num_output_row_groups = output->num_row_groups();
+  stats->background_write_nanos += output->background_nanos();
+  return arrow::Status::OK();
+}
+
+arrow::Result<std::string> ParquetSorter::SpillRun(
+    std::shared_ptr<arrow::Table> table, SpillFiles* spill_files,
+    SortStats* stats) {
+  ARROW_ASSIGN_OR_RAISE(auto sorted,
+                        SortInMemory(table, options_.sort_keys, stats));
+  table.reset();
+
+  ScopedPhaseTimer timer(stats, Phase::kSpill);
+  auto path = spill_files->NewPath();
+  ARROW_ASSIGN_OR_RAISE(auto writer,
+                        SpillWriter::Open(path, sorted->schema(),
+                                          options_.spill_compression, pool_));
+  ARROW_RETURN_NOT_OK(writer->WriteTable(*sorted, options_.spill_batch_rows));
+  ARROW_RETURN_NOT_OK(writer->Close());
+  stats->spill_bytes_written += writer->bytes_written();
+  ++stats->num_spill_runs;
+  return path;
+}
+
+arrow::Result<std::string> ParquetSorter::MergeRuns(
+    const std::vector<std::string>& runs, SpillFiles* spill_files,
+    SortStats* stats) {
+  stats->merge_fan_in =
+      std::max(stats->merge_fan_in, static_cast<int64_t>(runs.size()));
+  std::unique_ptr<RunMerger> merger;
+  {
+    ScopedPhaseTimer timer(stats, Phase::kMerge);
+    ARROW_ASSIGN_OR_RAISE(merger,
+                          RunMerger::Open(runs, options_.sort_keys, pool_));
+  }
+  auto path = spill_files->NewPath();
+  std::unique_ptr<SpillWriter> writer;
+  {
+    ScopedPhaseTimer timer(stats, Phase::kSpill);
+    ARROW_ASSIGN_OR_RAISE(writer,
+                          SpillWriter::Open(path, merger->schema(),
+                                            options_.spill_compression, pool_));
+  }
+  while (true) {
+    std::shared_ptr<arrow::RecordBatch> batch;
+    {
+      ScopedPhaseTimer timer(stats, Phase::kMerge);
+      ARROW_ASSIGN_OR_RAISE(batch, merger->Next(options_.spill_batch_rows));
+    }
+    if (batch == nullptr) break;
+    ScopedPhaseTimer timer(stats, Phase::kSpill);
+    ARROW_RETURN_NOT_OK(writer->Write(*batch));
+  }
+  {
+    ScopedPhaseTimer timer(stats, Phase::kSpill);
+    ARROW_RETURN_NOT_OK(writer->Close());
+  }
+  stats->spill_bytes_written += writer->bytes_written();
+  stats->spill_bytes_read += merger->bytes_read();
+  merger.reset();
+  for (const auto& run : runs) {
+    spill_files->Remove(run);
+  }
+  return path;
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> ParquetSorter::SortRowIds(
+    const SortSpec& spec,
+    const std::vector<std::shared_ptr<arrow::Array>>& keys, SortStats* stats,
+    KeyProfile profile, BlockKeys* block_keys,
+    const std::vector<int64_t>& run_splits,
+    const std::vector<std::optional<KeyRange>>& key_ranges) {
+  ScopedPhaseTimer normalize_timer(stats, Phase::kNormalize);
+  KeyCompression compression;
+  compression.pack_integers = options_.compress_keys;
+  compression.ranges = key_ranges;
+  ARROW_ASSIGN_OR_RAISE(
+      auto normalizer,
+      KeyNormalizer::Make(spec, keys, options_.string_prefix_width,
+                          compression));
+  stats->normalized_key_width = normalizer->key_width();
+  stats->uncompressed_key_width = normalizer->uncompressed_key_width();
+  ParallelSorter sorter(*normalizer, threads_.get(), sort_pool());
+  ARROW_RETURN_NOT_OK(sorter.Normalize(options_.run_size, run_splits));
+  normalize_timer.Stop();
+  stats->numa_node_key_bytes = sorter.numa_node_bytes();
+  stats->num_threads = threads_->num_threads();
+  stats->num_runs = sorter.num_runs();
+
+  // The row ids outlive the sort, so they do not come from the arena.
+  const int64_t num_rows = normalizer->num_rows();
+  ARROW_ASSIGN_OR_RAISE(
+      std::shared_ptr<arrow::Buffer> buffer,
+      arrow::AllocateBuffer(num_rows * sizeof(uint64_t), pool_));
+  auto* row_ids = reinterpret_cast<uint64_t*>(buffer->mutable_data());
+  auto algorithm = options_.algorithm;
+  {
+    ScopedPhaseTimer timer(stats, Phase::kSort);
+    if (algorithm == SortAlgorithm::kAuto) {
+      profile.run_rows = sorter.run_rows(0);
+      profile.num_rows = num_rows;
+      profile.num_threads = threads_->num_threads();
+      profile.key_width = normalizer->key_width();
+      profile.row_width = sorter.keys().row_width;
+      profile.exact = normalizer->exact();
+      SampleKeyOrder(sorter.keys(), *normalizer, &profile);
+      auto choice = ChooseSortAlgorithm(
+          profile, options_.use_gpu ? GetGpuDevice() : nullptr);
+      algorithm = choice.algorithm;
+      stats->sort_algorithm_reason = std::move(choice.reason);
+    } else {
+      stats->sort_algorithm_reason = "requested";
+    }
+    if (algorithm == SortAlgorithm::kGpu) {
+      if (!normalizer->exact()) {
+        return arrow::Status::Invalid(
+            "the GPU sort needs keys whose normalized form decides the "
+            "order; raise the string prefix width");
+      }
+      GpuSortTimes gpu_times;
+      auto status = GpuSortRowIds(sorter.keys(), row_ids, &gpu_times);
+      stats->gpu_transfer_nanos += gpu_times.transfer_nanos;
+      if (status.IsOutOfMemory() &&
+          options_.algorithm == SortAlgorithm::kAuto) {
+        // The estimate's memory was free when the device was first queried.
+        algorithm = SortAlgorithm::kRadix;
+        stats->sort_algorithm_reason += "; " + status.message() + ", radix";
+      } else {
+        ARROW_RETURN_NOT_OK(status);
+      }
+    }
+    if (algorithm != SortAlgorithm::kGpu) {
+      ARROW_RETURN_NOT_OK(sorter.SortRuns(algorithm));
+    }
+  }
+  stats->simd_level = SimdLevelName(GetSimdLevel());
+  stats->sort_algorithm = SortAlgorithmName(algorithm);
+
+  ScopedPhaseTimer timer(stats, Phase::kMerge);
+  if (algorithm == SortAlgorithm::kGpu) {
+    stats->num_runs = 1;
+  } else {
+    ARROW_RETURN_NOT_OK(sorter.Merge(row_ids));
+  }
+  if (block_keys != nullptr) {
+    // Encode the first row of each block again, which is cheaper than
+    // keeping the sorted normalized keys around.
+    const int32_t width = normalizer->key_width();
+    const int64_t every = std::max<int64_t>(block_keys->block_rows, 1);
+    const int64_t num_blocks = (num_rows + every - 1) / every;
+    ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::Buffer> data,
+                          arrow::AllocateBuffer(num_blocks * width, pool_));
+    for (int64_t block = 0; block < num_blocks; ++block) {
+      normalizer->Normalize(static_cast<int64_t>(row_ids[block * every]), 1,
+                            data->mutable_data() + block * width, width);
+    }
+    block_keys->keys = std::make_shared<arrow::FixedSizeBinaryArray>(
+        arrow::fixed_size_binary(width), num_blocks, std::move(data));
+    block_keys->exact = normalizer->exact();
+  }
+  return std::make_shared<arrow::UInt64Array>(num_rows, std::move(buffer));
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,388 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+#include <arrow/util/type_fwd.h>
+
+#include "common/arena_pool.h"
+#include "common/perf_counters.h"
+#include "common/thread_pool.h"
+#include "engine/distributed_sort.h"
+#include "engine/run_merger.h"
+#include "engine/sort_permutation.h"
+#include "engine/sort_stats.h"
+#include "engine/sorted_stream.h"
+#include "io/parquet_dataset.h"
+#include "io/parquet_input.h"
+#include "io/parquet_output.h"
+#include "io/spill_file.h"
+#include "sort/key_normalizer.h"
+#include "sort/sort_algorithm.h"
+#include "sort/sort_spec.h"
+
+namespace whippet_sort {
+
+struct SortOptions {
+  SortSpec sort_keys;
+  /// Maximum number of rows per row group in the sorted output.
+  int64_t output_row_group_size = 1024 * 1024;
+  /// Any codec of the Arrow build: SNAPPY, LZ4, ZSTD, ...
+  arrow::Compression::type output_compression = arrow::Compression::SNAPPY;
+  /// Lets Arrow decode and encode columns with its internal thread pool.
+  bool use_threads = true;
+  /// Encodes and writes each output row group on a background thread while
+  /// the next one is gathered.
+  bool background_write = true;
+  /// Writes the Parquet column and offset indexes of the output, next to the
+  /// sorting_columns metadata, so readers can skip pages on the sort keys.
+  bool write_page_index = true;
+  /// Reads ahead on a background thread: the payload columns while the keys
+  /// are sorted, and the next run while an external sort sorts and spills the
+  /// current one. Also pre-buffers the column chunks of each read.
+  bool prefetch = true;
+  /// Memory-maps the input files instead of reading them into buffers:
+  /// uncompressed pages are decoded straight from the page cache, and the
+  /// kernel is advised to read the key and payload columns ahead in order,
+  /// or, for a top-K sort, not to read ahead of its scattered row groups.
+  bool memory_map = true;
+  /// Sorts dictionary-encoded string keys on their collated dictionary codes
+  /// instead of decoding the strings.
+  bool sort_dictionary_codes = true;
+  /// Bytes of each string key kept in the normalized key. Longer strings are
+  /// compared in full only when their prefixes tie.
+  int string_prefix_width = KeyNormalizer::kDefaultStringPrefixWidth;
+  /// Packs integer, decimal and dictionary-code keys into the bytes their
+  /// range needs, taking the range from the column statistics where it can,
+  /// see KeyCompression.
+  bool compress_keys = true;
+  /// Algorithm that sorts each run.
+  SortAlgorithm algorithm = SortAlgorithm::kAuto;
+  /// Lets kAuto sort large in-memory sorts of exact keys on the GPU when the
+  /// transfers pay off, see ChooseSortAlgorithm(). Only has an effect with
+  /// WHIPPET_ENABLE_CUDA.
+  bool use_gpu = true;
+  /// Threads that normalize, sort and merge the keys; 0 uses one per hardware
+  /// thread.
+  int num_threads = 0;
+  /// Pins the sort threads round-robin to the NUMA nodes. On several nodes,
+  /// each node then sorts and merges its own share of the runs in its own
+  /// memory before a final merge across nodes, see ParallelSorter.
+  bool pin_threads_to_numa_nodes = false;
+  /// Maximum number of rows sorted as one run before the merge. The input is
+  /// also cut into at least one run per thread.
+  int64_t run_size = 1024 * 1024;
+  /// Memory the sort may use, in bytes; 0 means no limit. An input whose
+  /// decoded size exceeds the limit is sorted externally: it is sorted in
+  /// parts that fit the limit, the sorted runs are spilled to disk and then
+  /// merged.
+  int64_t memory_limit = 0;
+  /// Directory of the spill files; empty uses the system temporary directory.
+  std::string spill_directory;
+  /// UNCOMPRESSED, LZ4_FRAME or ZSTD.
+  arrow::Compression::type spill_compression = arrow::Compression::LZ4_FRAME;
+  /// Rows per batch of the spill files; the merge reads one batch per run at
+  /// a time.
+  int64_t spill_batch_rows = 64 * 1024;
+  /// Directory of sort index sidecar files, see SortIndex; empty keeps none.
+  /// An in-memory Sort() of a file that has an index on its keys gathers the
+  /// rows in the order of the index instead of sorting them, and otherwise
+  /// stores the index of its sort.
+  std::string index_directory;
+  /// Also reuses an index on keys that the sort keys are a prefix of. Rows
+  /// that tie on the sort keys then come in the order of the remaining index
+  /// keys instead of in input order.
+  bool index_prefix_reuse = false;
+  /// Size of the index files above which the least recently used ones are
+  /// removed.
+  int64_t index_max_bytes = int64_t{4} << 30;
+  /// Input files whose parsed footers the sorter keeps for later sorts, see
+  /// FooterCache; 0 keeps none.
+  int64_t footer_cache_entries = FooterCache::kDefaultMaxEntries;
+  /// Keeps only the first `limit` rows of the sorted output, as in
+  /// `ORDER BY ... LIMIT limit`; 0 keeps all rows. Sort() then reads the
+  /// input one row group at a time and skips the row groups whose
+  /// statistics show they cannot contribute.
+  int64_t limit = 0;
+  /// Counts hardware events (cycles, instructions, LLC, dTLB and branch
+  /// misses) per phase into SortStats::phase_counts. The counters cover the
+  /// thread calling Sort() and the threads the sorter starts, but not the
+  /// threads of Arrow's pool that already run when the sorter is created.
+  bool perf_counters = false;
+  /// Takes the buffers that do not outlive the sort (normalized keys and the
+  /// scratch of the run sorts and merges) from an arena of 2 MiB-aligned,
+  /// huge-page chunks that later sorts reuse, instead of allocating each from
+  /// `pool`. Row ids and decoded columns always come from `pool`.
+  bool use_arena = true;
+};
+
+/// Sorts a Parquet file or dataset into one Parquet file.
+///
+/// Only the ORDER BY columns are decoded before the sort. The payload columns
+/// are decoded after the row order is known, and the output is gathered and
+/// written one row group at a time. The keys are sorted in runs on the
+/// sorter's own thread pool and merged in parallel, see ParallelSorter.
+/// Inputs larger than SortOptions::memory_limit are sorted externally.
+class ParquetSorter {
+ public:
+  explicit ParquetSorter(
+      SortOptions options,
+      arrow::MemoryPool* pool = arrow::default_memory_pool());
+  ~ParquetSorter();
+
+  /// Reads `input_path`, sorts all rows by the configured keys and writes the
+  /// result to `output_path`. The output has the schema of the input.
+  ///
+  /// `input_path` may also be a directory or a glob pattern of Parquet files
+  /// with one schema, see ListDatasetFiles(); the values of Hive partition
+  /// directories become string columns after those of the files. The files
+  /// are opened in parallel, with the footers of the FooterCache, and their
+  /// key columns decoded in parallel. Each file is sorted in runs of its
+  /// own, which the merge of all runs puts in one order. Dictionary codes
+  /// and sort indexes are per file, so a dataset decodes its string keys and
+  /// keeps no index; a limit keeps the first rows of the merge.
+  arrow::Result<SortStats> Sort(const std::string& input_path,
+                                const std::string& output_path);
+
+  /// Inserts the rows of the files `new_paths` into the sorted file
+  /// `sorted_path` and writes the result to `output_path`, without sorting
+  /// the existing rows again. The order is learned from the sorting_columns
+  /// of `sorted_path`; if SortOptions::sort_keys is not empty it must match.
+  /// The new rows are sorted in memory, and by the first-key statistics of
+  /// the existing row groups, only those the new rows sort into are merged
+  /// with them; the others are written back unchanged as one row group each.
+  /// They are still decoded and encoded again, since the Parquet writer
+  /// cannot append encoded column chunks, and `sorted_path` must be a single
+  /// file. See PlanInsert().
+  arrow::Result<SortStats> Insert(const std::string& sorted_path,
+                                  const std::vector<std::string>& new_paths,
+                                  const std::string& output_path);
+
+  /// Sorts the Parquet shards of this rank as one part of a sample sort over
+  /// `distributed.num_ranks` processes, typically one per node, and writes
+  /// the rows of the key range of this rank to `output_path`. Concatenating
+  /// the outputs in rank order gives all rows in sorted order.
+  ///
+  /// Each rank sorts its shards in memory, writes evenly spaced samples of
+  /// its keys to the exchange directory and picks the splitters from the
+  /// samples of all ranks, which all ranks do alike. It then sends each rank
+  /// the sorted rows of its range as an Arrow IPC file, and merges the sorted
+  /// rows it receives. Rows that tie on all keys stay in rank order.
+  arrow::Result<SortStats> SortDistributed(
+      const std::vector<std::string>& shard_paths,
+      const std::string& output_path,
+      const DistributedSortOptions& distributed);
+
+  /// Returns the sorted order of the rows of `input_path` instead of writing
+  /// them, see SortPermutation, with the normalized key of the first row of
+  /// every output row group size rows. Only the key columns are decoded, so
+  /// the sort needs no memory for the payload, and SortOptions::limit keeps
+  /// the first rows of the order.
+  arrow::Result<SortPermutation> ComputeOrder(const std::string& input_path,
+                                              SortStats* stats);
+
+  /// Sorts `input_path` like Sort(), but returns the sorted rows as a stream
+  /// of batches of `stream_options.batch_rows` rows instead of writing them.
+  /// The keys are sorted before this returns; the payload of each batch is
+  /// gathered, or the spilled runs of an external sort merged, as the stream
+  /// is read. The stream holds the decoded input or the spill files until it
+  /// ends or is closed, and must not outlive the sorter.
+  arrow::Result<std::shared_ptr<SortedStream>> SortStream(
+      const std::string& input_path, const StreamOptions& stream_options = {});
+
+  /// Returns `table` sorted by the configured keys.
+  arrow::Result<std::shared_ptr<arrow::Table>> SortTable(
+      const std::shared_ptr<arrow::Table>& table, SortStats* stats);
+
+  /// Returns the row ids of `table` in sorted order as a UInt64 array, or
+  /// the first SortOptions::limit of them, for callers that take the rows
+  /// themselves.
+  arrow::Result<std::shared_ptr<arrow::Array>> SortTableOrder(
+      const std::shared_ptr<arrow::Table>& table, SortStats* stats);
+
+  const SortOptions& options() const { return options_; }
+
+ private:
+  arrow::Status Validate() const;
+  /// Validate() with the sort keys `spec` instead of SortOptions::sort_keys.
+  arrow::Status Validate(const SortSpec& spec) const;
+
+  /// The options of the inputs the sorter opens, from SortOptions.
+  ParquetInputOptions InputOptions() const;
+
+  /// The pool of the buffers that do not outlive a sort. Anything that is
+  /// still alive during the gather or returned to the caller comes from
+  /// `pool_`, so the arena's chunks free up as soon as the keys are sorted.
+  arrow::MemoryPool* sort_pool() const {
+    return arena_ != nullptr ? arena_.get() : pool_;
+  }
+
+  /// The input of Sort(): one file, or a dataset of several files or with
+  /// partitions.
+  struct SortInput {
+    std::unique_ptr<ParquetInput> file;
+    std::unique_ptr<ParquetDataset> dataset;
+  };
+  /// Lists and opens `input_path` and records its size in `stats`. Reads the
+  /// string keys of a single file as collated dictionary codes if
+  /// `collate_dictionaries` and SortOptions::sort_dictionary_codes.
+  arrow::Result<SortInput> OpenSortInput(const std::string& input_path,
+                                         bool collate_dictionaries,
+                                         SortStats* stats);
+
+  /// Whether the decoded input would not fit SortOptions::memory_limit.
+  bool ExceedsMemoryLimit(const SortInput& input) const;
+
+  /// The decoded columns of a sort in memory and the order of their rows.
+  /// Columns with a dictionary in `dictionaries` hold its collated codes.
+  struct SortedColumns {
+    std::vector<std::shared_ptr<arrow::Array>> columns;
+    std::vector<std::shared_ptr<arrow::Array>> dictionaries;
+    std::shared_ptr<arrow::Array> row_ids;
+  };
+
+  /// Decodes and sorts `input` in memory, the payload read while the keys
+  /// are sorted, and keeps the first SortOptions::limit rows if set.
+  arrow::Result<SortedColumns> SortColumns(ParquetInput* input,
+                                           SortStats* stats);
+  arrow::Result<SortedColumns> SortDatasetColumns(ParquetDataset* input,
+                                                  SortStats* stats);
+
+  /// Opens the sorted output of `input`: recorded as sorted by `spec`, the
+  /// configured keys unless given, and with dictionary encoding for the
+  /// columns whose input pages all were.
+  arrow::Result<std::unique_ptr<ParquetOutput>> OpenOutput(
+      const std::string& path, const ParquetInput& input) const;
+  arrow::Result<std::unique_ptr<ParquetOutput>> OpenOutput(
+      const std::string& path, const ParquetInput& input,
+      const SortSpec& spec) const;
+  arrow::Result<std::unique_ptr<ParquetOutput>> OpenOutput(
+      const std::string& path, const ParquetDataset& input) const;
+  arrow::Result<std::unique_ptr<ParquetOutput>> OpenOutput(
+      const std::string& path, const std::shared_ptr<arrow::Schema>& schema,
+      const std::vector<bool>& dictionary_columns,
+      const SortSpec& spec) const;
+
+  /// Decodes the sort keys of `input` into `columns`, indexed by column, and
+  /// `keys`, in ORDER BY order. Dictionary-encoded string keys are replaced
+  /// by their collated codes, and `dictionaries` keeps the sorted dictionary
+  /// to decode them after the sort.
+  arrow::Status ReadKeyColumns(
+      ParquetInput* input, std::vector<std::shared_ptr<arrow::Array>>* columns,
+      std::vector<std::shared_ptr<arrow::Array>>* dictionaries,
+      std::vector<std::shared_ptr<arrow::Array>>* keys, SortStats* stats);
+
+  /// Gathers the sorted rows [offset, offset + length) of `sorted` into
+  /// `gathered`, the columns in parallel.
+  arrow::Status GatherRows(
+      const SortedColumns& sorted, int64_t offset, int64_t length,
+      std::vector<std::shared_ptr<arrow::Array>>* gathered, SortStats* stats);
+
+  /// Gathers the sorted rows and writes them to `output` one row group at a
+  /// time, then closes it.
+  arrow::Status WriteGathered(const SortedColumns& sorted,
+                              ParquetOutput* output, SortStats* stats);
+
+  /// Writes `table` in row groups of the output row group size.
+  arrow::Status WriteTable(const arrow::Table& table,
+                           ParquetOutput* output) const;
+
+  /// Returns the row ids of `table` in the order of `spec`, see SortRowIds().
+  arrow::Result<std::shared_ptr<arrow::Array>> SortTableRowIds(
+      const arrow::Table& table, const SortSpec& spec, SortStats* stats);
+
+  /// Sorts `table` by `spec` and gathers the sorted table.
+  arrow::Result<std::shared_ptr<arrow::Table>> SortInMemory(
+      const std::shared_ptr<arrow::Table>& table, const SortSpec& spec,
+      SortStats* stats);
+
+  /// Sort() of a dataset of several files or with partitions, in memory or
+  /// externally.
+  arrow::Status SortDataset(ParquetDataset* input,
+                            const std::string& output_path, SortStats* stats);
+
+  /// Sorts `input` under the memory limit: sorts and spills runs of row
+  /// groups of one file that fit the limit, merges them down to a fan-in the
+  /// limit allows and writes the final merge to `output_path`, or its first
+  /// SortOptions::limit rows.
+  arrow::Status SortExternal(ParquetDataset* input,
+                             const std::string& output_path,
+                             SortStats* stats);
+
+  /// The spill phase of SortExternal(): sorts and spills the runs, merges
+  /// them down to the fan-in and returns the merger of the last pass over
+  /// `final_runs`.
+  arrow::Result<std::unique_ptr<RunMerger>> MergeSpilledRuns(
+      ParquetDataset* input, SpillFiles* spill_files,
+      std::vector<std::string>* final_runs, SortStats* stats);
+
+  /// Writes the first `limit` sorted rows of `input` to `output_path`: visits
+  /// the row groups in the order of the min/max statistics of the first key,
+  /// skips those that cannot beat the current last row, and decodes the
+  /// payload only for the row groups holding result rows.
+  arrow::Status SortTopK(ParquetInput* input, const std::string& output_path,
+                         SortStats* stats);
+
+  /// Sorts a part of the input and spills it as one run. Drops `table` once
+  /// it is sorted.
+  arrow::Result<std::string> SpillRun(std::shared_ptr<arrow::Table> table,
+                                      SpillFiles* spill_files,
+                                      SortStats* stats);
+
+  /// Merges spilled runs into one new run.
+  arrow::Result<std::string> MergeRuns(const std::vector<std::string>& runs,
+                                       SpillFiles* spill_files,
+                                       SortStats* stats);
+
+  /// Returns the row ids of `keys` in the order of `spec` as a UInt64 array.
+  /// `keys` holds one array per entry of `spec`. The keys are first
+  /// normalized into one memcmp-comparable byte string per row, then sorted
+  /// in runs and merged. With SortAlgorithm::kAuto, the algorithm of the runs
+  /// is chosen from `profile`, which may bound the distinct keys, and a sample
+  /// of the keys.
+  /// With `block_keys`, also encodes the key of sorted rows 0,
+  /// block_keys->block_rows, 2 * block_keys->block_rows, ... into it. A run
+  /// starts at each row of `run_splits`, see ParallelSorter::Normalize().
+  /// `key_ranges` are known bounds of the keys, see KeyCompression.
+  struct BlockKeys {
+    int64_t block_rows = 0;
+    std::shared_ptr<arrow::Array> keys;
+    bool exact = false;
+  };
+  arrow::Result<std::shared_ptr<arrow::Array>> SortRowIds(
+      const SortSpec& spec,
+      const std::vector<std::shared_ptr<arrow::Array>>& keys, SortStats* stats,
+      KeyProfile profile = {}, BlockKeys* block_keys = nullptr,
+      const std::vector<int64_t>& run_splits = {},
+      const std::vector<std::optional<KeyRange>>& key_ranges = {});
+
+  SortOptions options_;
+  arrow::MemoryPool* pool_;
+  std::unique_ptr<ArenaMemoryPool> arena_;
+  std::unique_ptr<FooterCache> footer_cache_;
+  /// Opened before `threads_` so that they count the sort threads too.
+  std::unique_ptr<PerfCounters> perf_counters_;
+  std::unique_ptr<ThreadPool> threads_;
+};
+
+}  // namespace whippet_sort
@@ -0,0 +1,159 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "engine/run_merger.h"
+
+#include <utility>
+
+#include <arrow/api.h>
+#include <arrow/compute/api.h>
+
+namespace whippet_sort {
+
+arrow::Result<std::unique_ptr<RunMerger>> RunMerger::Open(
+    const std::vector<std::string>& run_paths, const SortSpec& spec,
+    arrow::MemoryPool* pool, bool memory_map) {
+  if (run_paths.empty()) {
+    return arrow::Status::Invalid("no runs to merge");
+  }
+  std::vector<Run> runs(run_paths.size());
+  for (size_t i = 0; i < run_paths.size(); ++i) {
+    ARROW_ASSIGN_OR_RAISE(runs[i].reader,
+                          SpillReader::Open(run_paths[i], pool, memory_map));
+  }
+  auto schema = runs.front().reader->schema();
+  ARROW_ASSIGN_OR_RAISE(auto comparator, KeyComparator::Make(spec, *schema));
+  std::unique_ptr<RunMerger> merger(
+      new RunMerger(std::move(schema), std::move(comparator), std::move(runs),
+                    pool));
+  for (auto& run : merger->runs_) {
+    merger->bytes_read_ += run.reader->file_size();
+    ARROW_RETURN_NOT_OK(merger->Advance(&run));
+  }
+  merger->tree_ = std::make_unique<LoserTree<RunMerger>>(
+      static_cast<int>(merger->runs_.size()), merger.get());
+  return merger;
+}
+
+RunMerger::RunMerger(std::shared_ptr<arrow::Schema> schema,
+                     KeyComparator comparator, std::vector<Run> runs,
+                     arrow::MemoryPool* pool)
+    : schema_(std::move(schema)),
+      comparator_(std::move(comparator)),
+      runs_(std::move(runs)),
+      pool_(pool) {}
+
+bool RunMerger::Less(int i, int j) const {
+  const Run& a = runs_[i];
+  const Run& b = runs_[j];
+  int cmp = comparator_.Compare(a.keys.data(), a.row, b.keys.data(), b.row);
+  return cmp != 0 ? cmp < 0 : i < j;
+}
+
+arrow::Status RunMerger::Advance(Run* run) {
+  while (run->next_batch < run->reader->num_batches()) {
+    ARROW_ASSIGN_OR_RAISE(run->batch,
+                          run->reader->ReadBatch(run->next_batch++));
+    if (run->batch->num_rows() == 0) continue;
+    run->row = 0;
+    run->key_arrays.clear();
+    run->keys.clear();
+    for (int column : comparator_.columns()) {
+      run->key_arrays.push_back(run->batch->column(column));
+      run->keys.push_back(run->key_arrays.back().get());
+    }
+    return arrow::Status::OK();
+  }
+  run->batch = nullptr;
+  run->key_arrays.clear();
+  run->keys.clear();
+  run->reader.reset();
+  return arrow::Status::OK();
+}
+
+void RunMerger::OpenSlice(Run* run) {
+  run->slice = static_cast<int>(slices_.size());
+  slices_.push_back({run->batch, run->row, run->row});
+}
+
+void RunMerger::CloseSlice(Run* run) { slices_[run->slice].end = run->row; }
+
+arrow::Result<std::shared_ptr<arrow::RecordBatch>> RunMerger::Next(
+    int64_t max_rows) {
+  if (tree_->empty()) return nullptr;
+  slices_.clear();
+  for (auto& run : runs_) {
+    if (run.batch != nullptr) OpenSlice(&run);
+  }
+
+  // Pick the rows as (slice, row) first; the slices are only known at the
+  // end.
+  std::vector<int32_t> row_slices;
+  std::vector<int64_t> rows;
+  int64_t num_rows = 0;
+  while (num_rows < max_rows && !tree_->empty()) {
+    const int source = tree_->top();
+    Run& run = runs_[source];
+    row_slices.push_back(run.slice);
+    rows.push_back(run.row);
+    ++num_rows;
+    if (++run.row == run.batch->num_rows()) {
+      CloseSlice(&run);
+      ARROW_RETURN_NOT_OK(Advance(&run));
+      if (run.batch != nullptr) OpenSlice(&run);
+    }
+    tree_->Replay();
+  }
+  for (auto& run : runs_) {
+    if (run.batch != nullptr) CloseSlice(&run);
+  }
+
+  // Gather the picked rows from the concatenated slices.
+  std::vector<int64_t> slice_offsets(slices_.size());
+  int64_t total = 0;
+  for (size_t s = 0; s < slices_.size(); ++s) {
+    slice_offsets[s] = total;
+    total += slices_[s].end - slices_[s].begin;
+  }
+  arrow::Int64Builder indices_builder(pool_);
+  ARROW_RETURN_NOT_OK(indices_builder.Reserve(num_rows));
+  for (int64_t i = 0; i < num_rows; ++i) {
+    const auto& slice = slices_[row_slices[i]];
+    indices_builder.UnsafeAppend(slice_offsets[row_slices[i]] + rows[i] -
+                                 slice.begin);
+  }
+  ARROW_ASSIGN_OR_RAISE(auto indices, indices_builder.Finish());
+
+  arrow::compute::ExecContext ctx(pool_);
+  std::vector<std::shared_ptr<arrow::Array>> columns(schema_->num_fields());
+  for (int c = 0; c < schema_->num_fields(); ++c) {
+    std::vector<std::shared_ptr<arrow::Array>> parts;
+    for (const auto& slice : slices_) {
+      const int64_t length = slice.end - slice.begin;
+      if (length > 0) {
+        parts.push_back(slice.batch->column(c)->Slice(slice.begin, length));
+      }
+    }
+    ARROW_ASSIGN_OR_RAISE(auto values, arrow::Concatenate(parts, pool_));
+    ARROW_ASSIGN_OR_RAISE(
+        columns[c],
+        arrow::compute::Take(*values, *indices,
+                             arrow::compute::TakeOptions::NoBoundsCheck(),
+                             &ctx));
+  }
+  slices_.clear();
+  return arrow::RecordBatch::Make(schema_, num_rows, std::move(columns));
+}
+
+}  // namespace whippet_sort
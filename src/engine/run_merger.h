@@ -0,0 +1,96 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+
+#include "io/spill_file.h"
+#include "sort/key_comparator.h"
+#include "sort/loser_tree.h"
+#include "sort/sort_spec.h"
+
+namespace whippet_sort {
+
+/// Merges sorted spill runs with a loser tree.
+///
+/// Every run keeps one batch in memory and reads the next one when it runs
+/// out, so the runs are read sequentially in large blocks. Rows that tie on
+/// all keys come out in run order, so merging the runs of consecutive parts
+/// of the input keeps the sort stable.
+class RunMerger {
+ public:
+  /// `memory_map` maps the runs, see SpillReader::Open().
+  static arrow::Result<std::unique_ptr<RunMerger>> Open(
+      const std::vector<std::string>& run_paths, const SortSpec& spec,
+      arrow::MemoryPool* pool, bool memory_map = false);
+
+  const std::shared_ptr<arrow::Schema>& schema() const { return schema_; }
+
+  /// Returns the next up to `max_rows` merged rows, or null after the last.
+  arrow::Result<std::shared_ptr<arrow::RecordBatch>> Next(int64_t max_rows);
+
+  /// Spill file bytes read so far.
+  int64_t bytes_read() const { return bytes_read_; }
+
+  /// Whether the current head of run `i` sorts before that of run `j`; for
+  /// the loser tree.
+  bool Less(int i, int j) const;
+  bool Exhausted(int i) const { return runs_[i].batch == nullptr; }
+
+ private:
+  struct Run {
+    std::unique_ptr<SpillReader> reader;
+    int next_batch = 0;
+    std::shared_ptr<arrow::RecordBatch> batch;
+    std::vector<std::shared_ptr<arrow::Array>> key_arrays;
+    std::vector<const arrow::Array*> keys;
+    int64_t row = 0;
+    /// The part of `batch` the current Next() call collects rows from.
+    int slice = -1;
+    int64_t slice_begin = 0;
+  };
+
+  /// A part of one run batch that goes to the output.
+  struct Slice {
+    std::shared_ptr<arrow::RecordBatch> batch;
+    int64_t begin;
+    int64_t end;
+  };
+
+  RunMerger(std::shared_ptr<arrow::Schema> schema, KeyComparator comparator,
+            std::vector<Run> runs, arrow::MemoryPool* pool);
+
+  /// Loads the next batch of `run`, or marks it exhausted.
+  arrow::Status Advance(Run* run);
+  void OpenSlice(Run* run);
+  void CloseSlice(Run* run);
+
+  std::shared_ptr<arrow::Schema> schema_;
+  KeyComparator comparator_;
+  std::vector<Run> runs_;
+  arrow::MemoryPool* pool_;
+  std::unique_ptr<LoserTree<RunMerger>> tree_;
+  std::vector<Slice> slices_;
+  int64_t bytes_read_ = 0;
+};
+
+}  // namespace whippet_sort
@@ -0,0 +1,248 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "engine/sort_index.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <arrow/api.h>
+#include <arrow/util/key_value_metadata.h>
+
+#include "io/spill_file.h"
+
+namespace whippet_sort {
+
+namespace {
+
+constexpr char kIndexExtension[] = ".sortidx";
+constexpr char kPathKey[] = "whippet_sort.index.path";
+constexpr char kModificationTimeKey[] = "whippet_sort.index.modification_time";
+constexpr char kFileSizeKey[] = "whippet_sort.index.file_size";
+constexpr char kSortKeysKey[] = "whippet_sort.index.sort_keys";
+
+// FNV-1a, which is the same on every build, unlike std::hash.
+uint64_t Fnv1a(const std::string& text) {
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : text) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+std::string Hex(uint64_t value) {
+  char out[17];
+  std::snprintf(out, sizeof(out), "%016llx",
+                static_cast<unsigned long long>(value));
+  return out;
+}
+
+// The prefix of the names of all indexes on `path`.
+std::string PathPrefix(const std::string& path) {
+  return Hex(Fnv1a(path)) + "_";
+}
+
+bool EndsWith(const std::string& text, const std::string& suffix) {
+  return text.size() >= suffix.size() &&
+         text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Whether the metadata of an index file is that of an index on the file of
+// `key` on its keys, or with `allow_prefix` on keys they are a prefix of.
+// Sets `index_keys` to the keys of the index.
+bool Matches(const arrow::KeyValueMetadata& metadata, const SortIndexKey& key,
+             bool allow_prefix, SortSpec* index_keys) {
+  auto path = metadata.Get(kPathKey);
+  auto time = metadata.Get(kModificationTimeKey);
+  auto size = metadata.Get(kFileSizeKey);
+  auto keys = metadata.Get(kSortKeysKey);
+  if (!path.ok() || !time.ok() || !size.ok() || !keys.ok()) return false;
+  if (*path != key.path || *time != std::to_string(key.modification_time) ||
+      *size != std::to_string(key.file_size)) {
+    return false;
+  }
+  auto spec = ParseSortSpec(*keys);
+  if (!spec.ok() || !IsSortPrefix(key.sort_keys, *spec) ||
+      (!allow_prefix && spec->size() != key.sort_keys.size())) {
+    return false;
+  }
+  *index_keys = std::move(spec).ValueUnsafe();
+  return true;
+}
+
+}  // namespace
+
+arrow::Result<SortIndexKey> MakeSortIndexKey(const std::string& path,
+                                             const SortSpec& sort_keys) {
+  std::error_code error;
+  SortIndexKey key;
+  key.path = std::filesystem::absolute(path, error).lexically_normal();
+  if (!error) {
+    const auto time = std::filesystem::last_write_time(path, error);
+    key.modification_time = time.time_since_epoch().count();
+  }
+  if (!error) {
+    key.file_size =
+        static_cast<int64_t>(std::filesystem::file_size(path, error));
+  }
+  if (error) {
+    return arrow::Status::IOError("cannot stat ", path, ": ",
+                                  error.message());
+  }
+  key.sort_keys = sort_keys;
+  return key;
+}
+
+bool IsSortPrefix(const SortSpec& sort_keys, const SortSpec& index_keys) {
+  if (sort_keys.empty() || sort_keys.size() > index_keys.size()) return false;
+  for (size_t i = 0; i < sort_keys.size(); ++i) {
+    if (sort_keys[i].column != index_keys[i].column ||
+        sort_keys[i].order != index_keys[i].order ||
+        sort_keys[i].null_placement != index_keys[i].null_placement) {
+      return false;
+    }
+  }
+  return true;
+}
+
+SortIndex::SortIndex(std::string directory, int64_t max_bytes,
+                     arrow::MemoryPool* pool)
+    : directory_(std::move(directory)), max_bytes_(max_bytes), pool_(pool) {}
+
+std::string SortIndex::IndexPath(const SortIndexKey& key) const {
+  return (std::filesystem::path(directory_) /
+          (PathPrefix(key.path) + Hex(Fnv1a(SortSpecToString(key.sort_keys))) +
+           kIndexExtension))
+      .string();
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> SortIndex::Lookup(
+    const SortIndexKey& key, int64_t num_rows, bool allow_prefix,
+    std::string* index_path) {
+  const std::string prefix = PathPrefix(key.path);
+  std::error_code error;
+  std::unique_ptr<SpillReader> best;
+  std::string best_path;
+  size_t best_keys = 0;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(directory_, error)) {
+    const std::string name = entry.path().filename().string();
+    if (name.rfind(prefix, 0) != 0 || !EndsWith(name, kIndexExtension)) {
+      continue;
+    }
+    // Another sort may be evicting the file; then it is just not used.
+    auto reader = SpillReader::Open(entry.path().string(), pool_,
+                                    /*memory_map=*/true);
+    if (!reader.ok()) continue;
+    const auto& schema = (*reader)->schema();
+    SortSpec index_keys;
+    if (schema->metadata() == nullptr ||
+        !Matches(*schema->metadata(), key, allow_prefix, &index_keys) ||
+        (best != nullptr && index_keys.size() >= best_keys)) {
+      continue;
+    }
+    best = std::move(reader).ValueUnsafe();
+    best_path = entry.path().string();
+    best_keys = index_keys.size();
+  }
+  if (best == nullptr || best->num_batches() != 1) return nullptr;
+  ARROW_ASSIGN_OR_RAISE(auto batch, best->ReadBatch(0));
+  if (batch->num_columns() != 1 || batch->num_rows() != num_rows ||
+      batch->column(0)->type_id() != arrow::Type::UINT64) {
+    return nullptr;
+  }
+  std::filesystem::last_write_time(
+      best_path, std::filesystem::file_time_type::clock::now(), error);
+  if (index_path != nullptr) *index_path = best_path;
+  return batch->column(0);
+}
+
+arrow::Status SortIndex::Store(const SortIndexKey& key,
+                               const std::shared_ptr<arrow::Array>& row_ids) {
+  if (row_ids->length() * static_cast<int64_t>(sizeof(uint64_t)) >
+      max_bytes_) {
+    return arrow::Status::OK();
+  }
+  std::error_code error;
+  std::filesystem::create_directories(directory_, error);
+  if (error) {
+    return arrow::Status::IOError("cannot create ", directory_, ": ",
+                                  error.message());
+  }
+  auto metadata = arrow::key_value_metadata(
+      {kPathKey, kModificationTimeKey, kFileSizeKey, kSortKeysKey},
+      {key.path, std::to_string(key.modification_time),
+       std::to_string(key.file_size), SortSpecToString(key.sort_keys)});
+  auto schema =
+      arrow::schema({arrow::field("row_id", arrow::uint64(), false)},
+                    std::move(metadata));
+
+  // Uncompressed, so that Lookup() maps the row ids without a copy. The
+  // temporary name is unique per process, as concurrent sorts may store the
+  // same index.
+  const std::string path = IndexPath(key);
+  const std::string partial = path + ".partial." + std::to_string(getpid());
+  ARROW_ASSIGN_OR_RAISE(
+      auto writer, SpillWriter::Open(partial, schema,
+                                     arrow::Compression::UNCOMPRESSED, pool_));
+  ARROW_RETURN_NOT_OK(writer->Write(
+      *arrow::RecordBatch::Make(schema, row_ids->length(), {row_ids})));
+  ARROW_RETURN_NOT_OK(writer->Close());
+  std::filesystem::rename(partial, path, error);
+  if (error) {
+    return arrow::Status::IOError("cannot rename ", partial, " to ", path,
+                                  ": ", error.message());
+  }
+  return Evict();
+}
+
+arrow::Status SortIndex::Evict() {
+  using Entry =
+      std::tuple<std::filesystem::file_time_type, int64_t, std::string>;
+  std::vector<Entry> entries;
+  int64_t total_bytes = 0;
+  std::error_code error;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(directory_, error)) {
+    const std::string path = entry.path().string();
+    if (!EndsWith(path, kIndexExtension)) continue;
+    std::error_code stat_error;
+    auto time = std::filesystem::last_write_time(path, stat_error);
+    auto size = std::filesystem::file_size(path, stat_error);
+    if (stat_error) continue;
+    entries.emplace_back(time, static_cast<int64_t>(size), path);
+    total_bytes += static_cast<int64_t>(size);
+  }
+  if (error) {
+    return arrow::Status::IOError("cannot list ", directory_, ": ",
+                                  error.message());
+  }
+  std::sort(entries.begin(), entries.end());
+  for (const auto& [time, size, path] : entries) {
+    if (total_bytes <= max_bytes_) break;
+    std::filesystem::remove(path, error);
+    total_bytes -= size;
+  }
+  return arrow::Status::OK();
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,99 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/status.h>
+#include <arrow/type_fwd.h>
+
+#include "sort/sort_spec.h"
+
+namespace whippet_sort {
+
+/// The input a sort index was built for: a file as of its last change, and
+/// the ORDER BY list of the sort.
+struct SortIndexKey {
+  /// Absolute path of the file.
+  std::string path;
+  /// Last write time, in ticks of the file system clock, and size of the
+  /// file. An index on an older version of the file no longer matches.
+  int64_t modification_time = 0;
+  int64_t file_size = 0;
+  SortSpec sort_keys;
+};
+
+/// Returns the key of `path` as it is now, sorted by `sort_keys`.
+arrow::Result<SortIndexKey> MakeSortIndexKey(const std::string& path,
+                                             const SortSpec& sort_keys);
+
+/// Whether rows sorted by `index_keys` are also sorted by `sort_keys`, i.e.
+/// `sort_keys` is a prefix of `index_keys`. Rows that tie on `sort_keys`
+/// then come in the order of the remaining index keys, which ORDER BY
+/// allows but which differs from the input order a sort keeps for them.
+bool IsSortPrefix(const SortSpec& sort_keys, const SortSpec& index_keys);
+
+/// A directory of sidecar files keeping the sorted row ids of earlier sorts,
+/// so that sorting the same file by the same keys, or optionally by a prefix
+/// of them, again only gathers the rows.
+///
+/// Each index is an Arrow IPC file with one UInt64 column of file row ids in
+/// sorted order and its SortIndexKey in the schema metadata, named after a
+/// hash of the path and the keys. Using an index marks it recently used; the
+/// least recently used indexes are removed once the directory holds more
+/// than `max_bytes`. Indexes are written to a temporary name and renamed, so
+/// concurrent sorts sharing the directory see only complete ones.
+class SortIndex {
+ public:
+  SortIndex(std::string directory, int64_t max_bytes,
+            arrow::MemoryPool* pool);
+
+  const std::string& directory() const { return directory_; }
+
+  /// Returns the row ids of an index on the file of `key` with `num_rows`
+  /// rows and keys key.sort_keys, memory-mapped, or nullptr if there is
+  /// none. With `allow_prefix`, an index whose keys start with key.sort_keys
+  /// also qualifies, although the rows that tie on key.sort_keys then keep
+  /// the order of its remaining keys rather than their input order; the
+  /// index with the fewest keys is preferred. Sets `index_path` to the file
+  /// of the index.
+  arrow::Result<std::shared_ptr<arrow::Array>> Lookup(
+      const SortIndexKey& key, int64_t num_rows, bool allow_prefix = false,
+      std::string* index_path = nullptr);
+
+  /// Stores `row_ids` (UInt64) as the index of `key`, replacing an earlier
+  /// one, and evicts indexes beyond the size limit. An index larger than the
+  /// limit on its own is not stored.
+  arrow::Status Store(const SortIndexKey& key,
+                      const std::shared_ptr<arrow::Array>& row_ids);
+
+  /// Removes the least recently used indexes until the directory holds at
+  /// most `max_bytes` of them.
+  arrow::Status Evict();
+
+  /// Path of the index file of `key`.
+  std::string IndexPath(const SortIndexKey& key) const;
+
+ private:
+  std::string directory_;
+  int64_t max_bytes_;
+  arrow::MemoryPool* pool_;
+};
+
+}  // namespace whippet_sort
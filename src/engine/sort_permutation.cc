@@ -0,0 +1,110 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+#include "engine/sort_permutation.h"
+
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+#include <arrow/api.h>
+
+namespace whippet_sort {
+
+namespace {
+
+// Bits needed to store the values 0 to `max_value`.
+int BitWidth(uint64_t max_value) {
+  int bits = 0;
+  while (bits < 64 && (max_value >> bits) != 0) ++bits;
+  return bits;
+}
+
+template <typename T>
+arrow::Result<std::shared_ptr<arrow::Array>> Pack(
+    const uint64_t* row_ids, int64_t num_rows,
+    const std::vector<int64_t>& row_group_offsets, int row_bits,
+    arrow::MemoryPool* pool) {
+  ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::Buffer> buffer,
+                        arrow::AllocateBuffer(num_rows * sizeof(T), pool));
+  auto* out = reinterpret_cast<T*>(buffer->mutable_data());
+  for (int64_t i = 0; i < num_rows; ++i) {
+    const auto id = static_cast<int64_t>(row_ids[i]);
+    const auto next = std::upper_bound(row_group_offsets.begin(),
+                                       row_group_offsets.end(), id);
+    const auto row_group = next - row_group_offsets.begin() - 1;
+    out[i] = static_cast<T>(
+        (static_cast<uint64_t>(row_group) << row_bits) |
+        static_cast<uint64_t>(id - row_group_offsets[row_group]));
+  }
+  using ArrayType = std::conditional_t<sizeof(T) == 4, arrow::UInt32Array,
+                                       arrow::UInt64Array>;
+  return std::make_shared<ArrayType>(num_rows, std::move(buffer));
+}
+
+}  // namespace
+
+int64_t SortPermutation::num_rows() const {
+  return packed_row_ids->length();
+}
+
+uint64_t SortPermutation::packed_row_id(int64_t i) const {
+  if (packed_row_ids->type_id() == arrow::Type::UINT32) {
+    return static_cast<const arrow::UInt32Array&>(*packed_row_ids).Value(i);
+  }
+  return static_cast<const arrow::UInt64Array&>(*packed_row_ids).Value(i);
+}
+
+arrow::Result<SortPermutation> PackRowIds(
+    const arrow::Array& row_ids, std::vector<int64_t> row_group_offsets,
+    arrow::MemoryPool* pool) {
+  if (row_ids.type_id() != arrow::Type::UINT64 || row_ids.null_count() > 0 ||
+      row_group_offsets.empty()) {
+    return arrow::Status::Invalid("row ids must be UInt64 without nulls");
+  }
+  int64_t max_rows = 0;
+  for (size_t rg = 0; rg + 1 < row_group_offsets.size(); ++rg) {
+    max_rows =
+        std::max(max_rows, row_group_offsets[rg + 1] - row_group_offsets[rg]);
+  }
+  const auto num_row_groups =
+      static_cast<int64_t>(row_group_offsets.size()) - 1;
+
+  SortPermutation permutation;
+  permutation.row_bits =
+      BitWidth(static_cast<uint64_t>(std::max<int64_t>(max_rows - 1, 0)));
+  const int row_group_bits =
+      BitWidth(static_cast<uint64_t>(std::max<int64_t>(num_row_groups - 1, 0)));
+  if (permutation.row_bits + row_group_bits > 64) {
+    return arrow::Status::CapacityError("row ids do not fit in 64 bits");
+  }
+  const uint64_t* ids =
+      static_cast<const arrow::UInt64Array&>(row_ids).raw_values();
+  if (permutation.row_bits + row_group_bits <= 32) {
+    ARROW_ASSIGN_OR_RAISE(
+        permutation.packed_row_ids,
+        Pack<uint32_t>(ids, row_ids.length(), row_group_offsets,
+                       permutation.row_bits, pool));
+  } else {
+    ARROW_ASSIGN_OR_RAISE(
+        permutation.packed_row_ids,
+        Pack<uint64_t>(ids, row_ids.length(), row_group_offsets,
+                       permutation.row_bits, pool));
+  }
+  permutation.row_group_offsets = std::move(row_group_offsets);
+  return permutation;
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,72 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+
+namespace whippet_sort {
+
+/// The sorted order of the rows of a Parquet file, without the rows. Callers
+/// gather the rows they need themselves, or hand the order to an engine that
+/// reads the file, e.g. as the indices of a Velox DictionaryVector.
+///
+/// Sorted row i is row row_in_group(i) of row group row_group(i). The ids
+/// are packed relative to their row group, (row group << row_bits) | row,
+/// in a UInt32 array if all of them fit in 32 bits and in a UInt64 array
+/// otherwise.
+struct SortPermutation {
+  std::shared_ptr<arrow::Array> packed_row_ids;
+  int row_bits = 0;
+  /// The first row of each row group in the file, and the number of rows.
+  std::vector<int64_t> row_group_offsets;
+
+  /// The normalized key of sorted rows 0, block_rows, 2 * block_rows, ...
+  /// as a FixedSizeBinary array. The keys compare with memcmp in sort order,
+  /// but only with each other: they depend on the file and the options of
+  /// the sort. Unless `exact_keys`, rows with equal normalized keys may
+  /// still differ in a longer string key.
+  int64_t block_rows = 0;
+  std::shared_ptr<arrow::Array> block_keys;
+  bool exact_keys = false;
+
+  int64_t num_rows() const;
+  uint64_t packed_row_id(int64_t i) const;
+  int row_group(int64_t i) const {
+    return static_cast<int>(packed_row_id(i) >> row_bits);
+  }
+  int64_t row_in_group(int64_t i) const {
+    return static_cast<int64_t>(packed_row_id(i) &
+                                ((uint64_t{1} << row_bits) - 1));
+  }
+  /// The row in the whole file.
+  int64_t row_id(int64_t i) const {
+    return row_group_offsets[row_group(i)] + row_in_group(i);
+  }
+};
+
+/// Packs the file row ids `row_ids` (UInt64) relative to the row groups
+/// starting at `row_group_offsets`, which ends with the number of rows.
+arrow::Result<SortPermutation> PackRowIds(
+    const arrow::Array& row_ids, std::vector<int64_t> row_group_offsets,
+    arrow::MemoryPool* pool);
+
+}  // namespace whippet_sort
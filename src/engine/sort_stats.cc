@@ -0,0 +1,169 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "engine/sort_stats.h"
+
+#include <sstream>
+
+namespace whippet_sort {
+
+const char* PhaseName(Phase phase) {
+  switch (phase) {
+    case Phase::kRead:
+      return "read";
+    case Phase::kNormalize:
+      return "normalize";
+    case Phase::kSort:
+      return "sort";
+    case Phase::kMerge:
+      return "merge";
+    case Phase::kMaterialize:
+      return "materialize";
+    case Phase::kSpill:
+      return "spill";
+    case Phase::kExchange:
+      return "exchange";
+    case Phase::kWrite:
+      return "write";
+    default:
+      return "unknown";
+  }
+}
+
+int64_t SortStats::total_nanos() const {
+  int64_t total = 0;
+  for (auto nanos : phase_nanos) {
+    total += nanos;
+  }
+  return total;
+}
+
+bool SortStats::has_perf_counts() const {
+  for (const auto& counts : phase_counts) {
+    for (auto count : counts) {
+      if (count >= 0) return true;
+    }
+  }
+  return false;
+}
+
+std::array<PerfCounts, kNumPhases> SortStats::UnknownPhaseCounts() {
+  std::array<PerfCounts, kNumPhases> counts;
+  counts.fill(UnknownPerfCounts());
+  return counts;
+}
+
+std::string SortStats::ToString() const {
+  std::ostringstream out;
+  out << "rows: " << num_rows;
+  if (num_input_files > 1) {
+    out << ", input files: " << num_input_files << " ("
+        << num_cached_footers << " cached footers)";
+  }
+  out << ", input row groups: " << num_input_row_groups;
+  if (num_pruned_row_groups > 0) {
+    out << " (" << num_pruned_row_groups << " pruned)";
+  }
+  if (num_rewritten_row_groups > 0) {
+    out << " (" << num_rewritten_row_groups << " rewritten)";
+  }
+  out << ", output row groups: " << num_output_row_groups
+      << ", key columns: " << num_key_columns << " ("
+      << num_dictionary_key_columns << " dictionary)"
+      << ", payload columns: " << num_payload_columns
+      << ", key width: " << normalized_key_width << " bytes";
+  if (uncompressed_key_width > normalized_key_width) {
+    out << " (" << uncompressed_key_width << " uncompressed)";
+  }
+  out << "\n  algorithm: " << sort_algorithm;
+  if (!simd_level.empty()) out << " (" << simd_level << ")";
+  out << ", threads: " << num_threads << ", runs: " << num_runs << "\n";
+  if (!sort_algorithm_reason.empty()) {
+    out << "  why " << sort_algorithm << ": " << sort_algorithm_reason << "\n";
+  }
+  if (num_spill_runs > 0) {
+    out << "  spilled runs: " << num_spill_runs
+        << ", spill bytes written: " << spill_bytes_written
+        << ", read: " << spill_bytes_read
+        << ", merge passes: " << num_merge_passes
+        << ", fan-in: " << merge_fan_in << "\n";
+  }
+  if (num_ranks > 0) {
+    out << "  rank " << rank << " of " << num_ranks
+        << ": shard rows: " << num_shard_rows
+        << ", sent to other ranks: " << num_shuffled_rows
+        << ", exchange bytes written: " << exchange_bytes_written
+        << ", read: " << exchange_bytes_read
+        << ", partition skew: " << partition_skew << "\n";
+  }
+  if (!numa_node_key_bytes.empty()) {
+    out << "  key bytes per NUMA node:";
+    for (size_t node = 0; node < numa_node_key_bytes.size(); ++node) {
+      out << (node > 0 ? ", " : " ") << node << ": "
+          << numa_node_key_bytes[node];
+    }
+    out << "\n";
+  }
+  if (gathered_bytes > 0) {
+    out << "  gathered: " << gathered_bytes << " bytes";
+    if (phase_nanos_of(Phase::kMaterialize) > 0) {
+      out << ", "
+          << static_cast<double>(gathered_bytes) /
+                 static_cast<double>(phase_nanos_of(Phase::kMaterialize))
+          << " GB/s";
+    }
+    out << "\n";
+  }
+  if (prefetch_nanos > 0) {
+    out << "  prefetched reads: " << static_cast<double>(prefetch_nanos) / 1e6
+        << " ms, waited: " << static_cast<double>(prefetch_wait_nanos) / 1e6
+        << " ms\n";
+  }
+  if (gpu_transfer_nanos > 0) {
+    out << "  gpu transfers: " << static_cast<double>(gpu_transfer_nanos) / 1e6
+        << " ms\n";
+  }
+  if (num_stream_batches > 0) {
+    out << "  stream: " << num_stream_batches << " batches, first after "
+        << static_cast<double>(first_batch_nanos) / 1e6
+        << " ms, waited: " << static_cast<double>(stream_wait_nanos) / 1e6
+        << " ms\n";
+  }
+  if (background_write_nanos > 0) {
+    out << "  background writes: "
+        << static_cast<double>(background_write_nanos) / 1e6 << " ms\n";
+  }
+  for (int i = 0; i < kNumPhases; ++i) {
+    auto phase = static_cast<Phase>(i);
+    out << "  " << PhaseName(phase) << ": " << phase_millis(phase) << " ms";
+    const auto& counts = phase_counts_of(phase);
+    for (int e = 0; e < kNumPerfEvents; ++e) {
+      if (counts[e] < 0) continue;
+      out << ", " << PerfEventName(static_cast<PerfEvent>(e)) << ": "
+          << counts[e];
+    }
+    const auto cycles = counts[static_cast<int>(PerfEvent::kCycles)];
+    const auto instructions =
+        counts[static_cast<int>(PerfEvent::kInstructions)];
+    if (cycles > 0 && instructions >= 0) {
+      out << ", IPC: "
+          << static_cast<double>(instructions) / static_cast<double>(cycles);
+    }
+    out << "\n";
+  }
+  out << "  total: " << static_cast<double>(total_nanos()) / 1e6 << " ms";
+  return out.str();
+}
+
+}  // namespace whippet_sort
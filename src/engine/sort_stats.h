@@ -0,0 +1,185 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/perf_counters.h"
+
+namespace whippet_sort {
+
+/// The phases of one sort query, in execution order.
+enum class Phase : int {
+  kRead = 0,
+  kNormalize,
+  kSort,
+  kMerge,
+  kMaterialize,
+  kSpill,
+  kExchange,
+  kWrite,
+  kNumPhases,
+};
+
+constexpr int kNumPhases = static_cast<int>(Phase::kNumPhases);
+
+const char* PhaseName(Phase phase);
+
+/// Per-query statistics returned by the engine.
+struct SortStats {
+  int64_t num_rows = 0;
+  /// Files of the input dataset, and those whose footers came from the
+  /// sorter's FooterCache.
+  int64_t num_input_files = 0;
+  int64_t num_cached_footers = 0;
+  int64_t num_input_row_groups = 0;
+  /// Input row groups skipped by a top-K sort based on their statistics.
+  int64_t num_pruned_row_groups = 0;
+  /// Input row groups an insert merged with new rows instead of copying.
+  int64_t num_rewritten_row_groups = 0;
+  int64_t num_output_row_groups = 0;
+  /// Columns decoded before the sort, i.e. the distinct ORDER BY columns.
+  int64_t num_key_columns = 0;
+  /// Key columns sorted on collated dictionary codes.
+  int64_t num_dictionary_key_columns = 0;
+  /// Columns decoded only after the sort for late materialization.
+  int64_t num_payload_columns = 0;
+  /// Bytes per row of the normalized sort key, and without key compression.
+  int64_t normalized_key_width = 0;
+  int64_t uncompressed_key_width = 0;
+  /// The algorithm that sorted the normalized keys, and why it was chosen.
+  std::string sort_algorithm;
+  std::string sort_algorithm_reason;
+  /// The SIMD kernels used to normalize, sort and gather the rows.
+  std::string simd_level;
+  /// Threads of the sort pool, and sorted runs merged into the output.
+  int64_t num_threads = 0;
+  int64_t num_runs = 0;
+  /// External sort only: the sorted runs spilled to disk, the spill file
+  /// bytes written and read, the merge passes over the spilled data including
+  /// the final one, and the most runs merged at once.
+  int64_t num_spill_runs = 0;
+  int64_t spill_bytes_written = 0;
+  int64_t spill_bytes_read = 0;
+  int64_t num_merge_passes = 0;
+  int64_t merge_fan_in = 0;
+  /// Bytes of normalized keys on each NUMA node, if the sort threads are
+  /// pinned to several nodes.
+  std::vector<int64_t> numa_node_key_bytes;
+  /// Bytes of the output columns gathered in sorted order, for the gather
+  /// throughput of the materialize phase.
+  int64_t gathered_bytes = 0;
+  /// Reads done ahead on a background thread: their time, and the part of it
+  /// the sort waited for, which is also counted in the read phase.
+  int64_t prefetch_nanos = 0;
+  int64_t prefetch_wait_nanos = 0;
+  /// GPU sort only: the time of the copies to and from the device, which is
+  /// also counted in the sort phase.
+  int64_t gpu_transfer_nanos = 0;
+  /// SortStream() only: the batches read from the stream, the time from the
+  /// start of the sort to the first of them, and the time the consumer
+  /// waited for batches prepared ahead.
+  int64_t num_stream_batches = 0;
+  int64_t first_batch_nanos = 0;
+  int64_t stream_wait_nanos = 0;
+  /// Output row groups encoded and written on a background thread: their
+  /// time. The write phase only counts the time the sort waited for them.
+  int64_t background_write_nanos = 0;
+  /// Distributed sort only: this rank and the number of ranks, the rows read
+  /// from the shards of this rank and those of them sent to other ranks, the
+  /// exchange file bytes written and read, and the rows of the partition of
+  /// this rank over the mean partition size (1 means no skew).
+  int64_t rank = 0;
+  int64_t num_ranks = 0;
+  int64_t num_shard_rows = 0;
+  int64_t num_shuffled_rows = 0;
+  int64_t exchange_bytes_written = 0;
+  int64_t exchange_bytes_read = 0;
+  double partition_skew = 0;
+  std::array<int64_t, kNumPhases> phase_nanos{};
+  /// Hardware event counts of each phase, see SortOptions::perf_counters.
+  std::array<PerfCounts, kNumPhases> phase_counts = UnknownPhaseCounts();
+
+  int64_t phase_nanos_of(Phase phase) const {
+    return phase_nanos[static_cast<int>(phase)];
+  }
+  double phase_millis(Phase phase) const {
+    return static_cast<double>(phase_nanos_of(phase)) / 1e6;
+  }
+  int64_t total_nanos() const;
+
+  const PerfCounts& phase_counts_of(Phase phase) const {
+    return phase_counts[static_cast<int>(phase)];
+  }
+  /// Whether any phase has a known hardware event count.
+  bool has_perf_counts() const;
+
+  static std::array<PerfCounts, kNumPhases> UnknownPhaseCounts();
+
+  /// One-line-per-phase human readable summary.
+  std::string ToString() const;
+};
+
+/// Adds the wall time of its scope to one phase of a SortStats, and the
+/// hardware event counts if PerfCounters::Current() has counters.
+class ScopedPhaseTimer {
+ public:
+  ScopedPhaseTimer(SortStats* stats, Phase phase)
+      : stats_(stats),
+        phase_(phase),
+        counters_(PerfCounters::Current()),
+        start_counts_(counters_ != nullptr ? counters_->Read()
+                                           : UnknownPerfCounts()),
+        start_(Clock::now()) {}
+
+  ~ScopedPhaseTimer() { Stop(); }
+
+  /// Ends the phase before the end of the scope.
+  void Stop() {
+    if (stats_ == nullptr) return;
+    auto elapsed = Clock::now() - start_;
+    stats_->phase_nanos[static_cast<int>(phase_)] +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    if (counters_ != nullptr) {
+      const auto end_counts = counters_->Read();
+      auto& counts = stats_->phase_counts[static_cast<int>(phase_)];
+      for (int i = 0; i < kNumPerfEvents; ++i) {
+        if (start_counts_[i] < 0 || end_counts[i] < 0) continue;
+        counts[i] = std::max<int64_t>(counts[i], 0) + end_counts[i] -
+                    start_counts_[i];
+      }
+    }
+    stats_ = nullptr;
+  }
+
+  ScopedPhaseTimer(const ScopedPhaseTimer&) = delete;
+  ScopedPhaseTimer& operator=(const ScopedPhaseTimer&) = delete;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  SortStats* stats_;
+  Phase phase_;
+  const PerfCounters* counters_;
+  PerfCounts start_counts_;
+  Clock::time_point start_;
+};
+
+}  // namespace whippet_sort
@@ -0,0 +1,73 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "engine/sorted_stream.h"
+
+#include <utility>
+
+namespace whippet_sort {
+
+SortedStream::SortedStream(std::shared_ptr<arrow::Schema> schema,
+                           int num_batches, ProduceFunction produce,
+                           const StreamOptions& options,
+                           std::shared_ptr<SortStats> stats,
+                           Clock::time_point start)
+    : schema_(std::move(schema)),
+      num_batches_(num_batches),
+      produce_(std::move(produce)),
+      stats_(std::move(stats)),
+      start_(start) {
+  if (options.read_ahead > 0 && num_batches_ > 0) {
+    batches_ =
+        std::make_unique<Prefetcher<std::shared_ptr<arrow::RecordBatch>>>(
+            num_batches_, produce_, options.read_ahead);
+  }
+}
+
+SortedStream::~SortedStream() { (void)Close(); }
+
+arrow::Status SortedStream::ReadNext(
+    std::shared_ptr<arrow::RecordBatch>* batch) {
+  batch->reset();
+  if (closed_ || next_batch_ == num_batches_) return arrow::Status::OK();
+  auto next = batches_ != nullptr ? batches_->Next() : produce_(next_batch_);
+  if (!next.ok()) {
+    ARROW_RETURN_NOT_OK(Close());
+    return next.status();
+  }
+  *batch = std::move(next).ValueOrDie();
+  if (next_batch_ == 0) {
+    stats_->first_batch_nanos =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                             start_)
+            .count();
+  }
+  stats_->num_stream_batches = ++next_batch_;
+  if (next_batch_ == num_batches_) return Close();
+  return arrow::Status::OK();
+}
+
+arrow::Status SortedStream::Close() {
+  if (closed_) return arrow::Status::OK();
+  closed_ = true;
+  if (batches_ != nullptr) {
+    stats_->stream_wait_nanos = batches_->wait_nanos();
+    batches_.reset();
+  }
+  // The produce function holds the state of the sort.
+  produce_ = nullptr;
+  return arrow::Status::OK();
+}
+
+}  // namespace whippet_sort
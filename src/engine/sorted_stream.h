@@ -0,0 +1,93 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include <arrow/record_batch.h>
+#include <arrow/result.h>
+#include <arrow/status.h>
+#include <arrow/type_fwd.h>
+
+#include "engine/sort_stats.h"
+#include "io/prefetcher.h"
+
+namespace whippet_sort {
+
+struct StreamOptions {
+  /// Maximum number of rows per batch of the stream.
+  int64_t batch_rows = 64 * 1024;
+  /// Batches prepared on a background thread ahead of the consumer. The
+  /// producer blocks once this many are waiting, so a slow consumer holds at
+  /// most `read_ahead` batches on top of the one it reads. 0 prepares each
+  /// batch in ReadNext().
+  int read_ahead = 1;
+};
+
+/// The sorted rows of a sort, pulled batch by batch instead of written to a
+/// file, e.g. to feed the next operator of a query.
+///
+/// The sort itself, up to the order of the rows, is done when the stream is
+/// created; what is left is gathering the payload of every batch, or merging
+/// the spilled runs of an external sort, which the stream does as it is read.
+/// The batches come from a produce function called for batches 0, 1, ...
+/// num_batches() - 1 in order, one at a time.
+class SortedStream : public arrow::RecordBatchReader {
+ public:
+  using ProduceFunction =
+      std::function<arrow::Result<std::shared_ptr<arrow::RecordBatch>>(int)>;
+
+  using Clock = std::chrono::steady_clock;
+
+  /// `stats` are those of the sort that started at `start` so far, which the
+  /// produce function adds the phases of each batch to.
+  SortedStream(std::shared_ptr<arrow::Schema> schema, int num_batches,
+               ProduceFunction produce, const StreamOptions& options,
+               std::shared_ptr<SortStats> stats, Clock::time_point start);
+  ~SortedStream() override;
+
+  std::shared_ptr<arrow::Schema> schema() const override { return schema_; }
+
+  /// Returns the next batch, or null after the last, waiting for the batch
+  /// being prepared if needed. Errors of the sort end the stream.
+  arrow::Status ReadNext(std::shared_ptr<arrow::RecordBatch>* batch) override;
+
+  /// Stops preparing batches and releases what the sort holds, e.g. its
+  /// decoded columns or spill files. Later reads return no batches.
+  arrow::Status Close() override;
+
+  int num_batches() const { return num_batches_; }
+
+  /// The statistics of the sort, including the batches produced so far. Only
+  /// safe to read while no batch is being prepared: after the last batch, or
+  /// after Close().
+  const SortStats& stats() const { return *stats_; }
+
+ private:
+  std::shared_ptr<arrow::Schema> schema_;
+  const int num_batches_;
+  ProduceFunction produce_;
+  std::shared_ptr<SortStats> stats_;
+  const Clock::time_point start_;
+  /// Null without read-ahead, and once the stream is closed.
+  std::unique_ptr<Prefetcher<std::shared_ptr<arrow::RecordBatch>>> batches_;
+  int next_batch_ = 0;
+  bool closed_ = false;
+};
+
+}  // namespace whippet_sort
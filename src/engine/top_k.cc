@@ -0,0 +1,156 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "engine/top_k.h"
+
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <utility>
+
+#include <arrow/api.h>
+#include <arrow/compute/api.h>
+
+#include "sort/comparison_sort.h"
+#include "sort/key_normalizer.h"
+
+namespace whippet_sort {
+
+TopKSelector::TopKSelector(SortSpec spec, int64_t limit,
+                           int string_prefix_width, arrow::MemoryPool* pool)
+    : spec_(std::move(spec)),
+      limit_(limit),
+      string_prefix_width_(string_prefix_width),
+      pool_(pool) {
+  // Rows that tie on all keys keep their input order.
+  spec_.push_back(
+      SortKey{"", SortOrder::kAscending, NullPlacement::kNullsLast});
+}
+
+arrow::Status TopKSelector::Add(
+    const std::vector<std::shared_ptr<arrow::Array>>& keys,
+    int64_t first_row_id) {
+  if (keys.empty() || keys.front()->length() == 0) {
+    return arrow::Status::OK();
+  }
+  const int64_t num_new = keys.front()->length();
+  if (!comparator_.has_value()) {
+    // The keys are compared by position, so name them by position too, which
+    // also allows the same column twice in the ORDER BY.
+    arrow::FieldVector fields;
+    SortSpec spec;
+    for (size_t k = 0; k < keys.size(); ++k) {
+      fields.push_back(arrow::field(std::to_string(k), keys[k]->type()));
+      spec.push_back(spec_[k]);
+      spec.back().column = fields.back()->name();
+    }
+    ARROW_ASSIGN_OR_RAISE(comparator_,
+                          KeyComparator::Make(spec, *arrow::schema(fields)));
+  }
+
+  // Only the new rows are normalized; the candidates are already in order.
+  std::vector<std::shared_ptr<arrow::Array>> new_keys = keys;
+  arrow::UInt64Builder ids_builder(pool_);
+  ARROW_RETURN_NOT_OK(ids_builder.Reserve(num_new));
+  for (int64_t i = 0; i < num_new; ++i) {
+    ids_builder.UnsafeAppend(static_cast<uint64_t>(first_row_id + i));
+  }
+  ARROW_ASSIGN_OR_RAISE(auto ids, ids_builder.Finish());
+  new_keys.push_back(std::move(ids));
+  ARROW_ASSIGN_OR_RAISE(auto normalizer,
+                        KeyNormalizer::Make(spec_, new_keys,
+                                            string_prefix_width_));
+  ARROW_ASSIGN_OR_RAISE(auto normalized, normalizer->NormalizeAll(pool_));
+  std::vector<uint64_t> order(num_new);
+  std::iota(order.begin(), order.end(), uint64_t{0});
+  const int64_t num_best = std::min(limit_, num_new);
+  PartialComparisonSort(normalized, *normalizer, order.data(), num_new,
+                        num_best);
+  return Merge(keys, order, num_best, first_row_id);
+}
+
+arrow::Status TopKSelector::Merge(
+    const std::vector<std::shared_ptr<arrow::Array>>& keys,
+    const std::vector<uint64_t>& order, int64_t num_best,
+    int64_t first_row_id) {
+  arrow::compute::ExecContext ctx(pool_);
+  auto take_options = arrow::compute::TakeOptions::NoBoundsCheck();
+  arrow::UInt64Builder best_builder(pool_);
+  ARROW_RETURN_NOT_OK(best_builder.AppendValues(order.data(), num_best));
+  ARROW_ASSIGN_OR_RAISE(auto best, best_builder.Finish());
+  std::vector<std::shared_ptr<arrow::Array>> best_keys(keys.size());
+  for (size_t k = 0; k < keys.size(); ++k) {
+    ARROW_ASSIGN_OR_RAISE(
+        best_keys[k],
+        arrow::compute::Take(*keys[k], *best, take_options, &ctx));
+  }
+  if (keys_.empty()) {
+    keys_ = std::move(best_keys);
+    row_ids_.resize(num_best);
+    for (int64_t i = 0; i < num_best; ++i) {
+      row_ids_[i] = static_cast<uint64_t>(first_row_id) + order[i];
+    }
+    return arrow::Status::OK();
+  }
+
+  // Both sides are in order; ties on the keys go by row id.
+  std::vector<const arrow::Array*> old_arrays;
+  std::vector<const arrow::Array*> new_arrays;
+  for (size_t k = 0; k < keys.size(); ++k) {
+    old_arrays.push_back(keys_[k].get());
+    new_arrays.push_back(best_keys[k].get());
+  }
+  const int64_t num_old = num_rows();
+  arrow::UInt64Builder take_builder(pool_);
+  ARROW_RETURN_NOT_OK(
+      take_builder.Reserve(std::min(limit_, num_old + num_best)));
+  std::vector<uint64_t> row_ids;
+  int64_t i = 0;
+  int64_t j = 0;
+  while (static_cast<int64_t>(row_ids.size()) < limit_ &&
+         (i < num_old || j < num_best)) {
+    const uint64_t new_id = j < num_best
+                                ? static_cast<uint64_t>(first_row_id) + order[j]
+                                : 0;
+    bool take_old = j == num_best;
+    if (i < num_old && j < num_best) {
+      int cmp =
+          comparator_->Compare(old_arrays.data(), i, new_arrays.data(), j);
+      take_old = cmp < 0 || (cmp == 0 && row_ids_[i] < new_id);
+    }
+    if (take_old) {
+      take_builder.UnsafeAppend(static_cast<uint64_t>(i));
+      row_ids.push_back(row_ids_[i++]);
+    } else {
+      take_builder.UnsafeAppend(static_cast<uint64_t>(num_old + j++));
+      row_ids.push_back(new_id);
+    }
+  }
+  ARROW_ASSIGN_OR_RAISE(auto take, take_builder.Finish());
+  for (size_t k = 0; k < keys.size(); ++k) {
+    ARROW_ASSIGN_OR_RAISE(auto combined,
+                          arrow::Concatenate({keys_[k], best_keys[k]}, pool_));
+    ARROW_ASSIGN_OR_RAISE(
+        keys_[k], arrow::compute::Take(*combined, *take, take_options, &ctx));
+  }
+  row_ids_ = std::move(row_ids);
+  return arrow::Status::OK();
+}
+
+arrow::Result<std::shared_ptr<arrow::Scalar>> TopKSelector::Threshold() const {
+  if (!full() || limit_ == 0) return nullptr;
+  return keys_.front()->GetScalar(limit_ - 1);
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,82 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+
+#include "sort/key_comparator.h"
+#include "sort/sort_spec.h"
+
+namespace whippet_sort {
+
+/// Keeps the first `limit` rows in ORDER BY order of the row groups offered
+/// so far, for `ORDER BY ... LIMIT limit`.
+///
+/// Each Add() normalizes the keys of the new rows only, with the row id as
+/// the last key, selects their best `limit` with a bounded heap, and merges
+/// those with the current candidates on the key values. Only the key values
+/// and row ids of the candidates are kept, so the payload is decoded only for
+/// the rows of the result.
+class TopKSelector {
+ public:
+  TopKSelector(SortSpec spec, int64_t limit, int string_prefix_width,
+               arrow::MemoryPool* pool);
+
+  /// Offers rows with consecutive row ids starting at `first_row_id`. `keys`
+  /// holds one array per sort key.
+  arrow::Status Add(const std::vector<std::shared_ptr<arrow::Array>>& keys,
+                    int64_t first_row_id);
+
+  /// Whether `limit` rows have been selected, so that only better rows can
+  /// change the result.
+  bool full() const { return num_rows() == limit_; }
+
+  int64_t num_rows() const { return static_cast<int64_t>(row_ids_.size()); }
+
+  /// The value of the first sort key of the last selected row; null until
+  /// full(). A row group cannot change the result if none of its rows beats
+  /// it on the first key.
+  arrow::Result<std::shared_ptr<arrow::Scalar>> Threshold() const;
+
+  /// The row ids of the selected rows, in ORDER BY order.
+  const std::vector<uint64_t>& row_ids() const { return row_ids_; }
+
+ private:
+  /// Merges the best new rows with the candidates, see Add().
+  arrow::Status Merge(const std::vector<std::shared_ptr<arrow::Array>>& keys,
+                      const std::vector<uint64_t>& order, int64_t num_best,
+                      int64_t first_row_id);
+
+  /// The ORDER BY keys followed by the row id.
+  SortSpec spec_;
+  /// Compares candidates with new rows; made from the types of the first
+  /// keys offered.
+  std::optional<KeyComparator> comparator_;
+  int64_t limit_;
+  int string_prefix_width_;
+  arrow::MemoryPool* pool_;
+  /// Key values of the selected rows, one array per sort key, in order.
+  std::vector<std::shared_ptr<arrow::Array>> keys_;
+  std::vector<uint64_t> row_ids_;
+};
+
+}  // namespace whippet_sort
@@ -0,0 +1,242 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "exec/whippet_order_by.h"
+
+#include <sstream>
+#include <utility>
+
+#include <arrow/api.h>
+#include <arrow/c/bridge.h>
+
+#include "sort/sort_spec.h"
+#include "velox/vector/arrow/Bridge.h"
+
+namespace whippet_sort {
+
+namespace velox = facebook::velox;
+
+namespace {
+
+void ThrowIfError(const arrow::Status& status) {
+  if (!status.ok()) {
+    VELOX_FAIL("WhippetOrderBy: {}", status.ToString());
+  }
+}
+
+template <typename T>
+T ValueOrThrow(arrow::Result<T> result) {
+  ThrowIfError(result.status());
+  return std::move(result).ValueUnsafe();
+}
+
+SortKey MakeSortKey(const velox::core::FieldAccessTypedExprPtr& field,
+                    const velox::core::SortOrder& order) {
+  SortKey key;
+  key.column = field->name();
+  key.order =
+      order.isAscending() ? SortOrder::kAscending : SortOrder::kDescending;
+  key.null_placement = order.isNullsFirst() ? NullPlacement::kNullsFirst
+                                            : NullPlacement::kNullsLast;
+  return key;
+}
+
+SortOptions MakeSortOptions(
+    const std::vector<velox::core::FieldAccessTypedExprPtr>& keys,
+    const std::vector<velox::core::SortOrder>& orders, int64_t limit,
+    const SortOptions& defaults) {
+  SortOptions options = defaults;
+  options.sort_keys.clear();
+  for (size_t i = 0; i < keys.size(); ++i) {
+    options.sort_keys.push_back(MakeSortKey(keys[i], orders[i]));
+  }
+  options.limit = limit;
+  return options;
+}
+
+// Dictionary and constant vectors are flattened, since the engine sorts
+// dense Arrow arrays.
+velox::ArrowOptions ExportOptions() {
+  velox::ArrowOptions options;
+  options.flattenDictionary = true;
+  options.flattenConstant = true;
+  return options;
+}
+
+}  // namespace
+
+WhippetOrderByNode::WhippetOrderByNode(const velox::core::PlanNodeId& id,
+                                       SortOptions options,
+                                       velox::core::PlanNodePtr source)
+    : PlanNode(id), options_(std::move(options)), sources_{std::move(source)} {
+  VELOX_USER_CHECK(!options_.sort_keys.empty(),
+                   "WhippetOrderBy needs at least one sort key");
+  VELOX_USER_CHECK_GE(options_.limit, 0, "WhippetOrderBy limit");
+  const auto& type = sources_[0]->outputType();
+  for (const auto& key : options_.sort_keys) {
+    VELOX_USER_CHECK(type->containsChild(key.column),
+                     "sort key {} is not a column of {}", key.column,
+                     type->toString());
+  }
+}
+
+void WhippetOrderByNode::addDetails(std::stringstream& stream) const {
+  stream << "ORDER BY " << SortSpecToString(options_.sort_keys);
+  if (options_.limit > 0) stream << " LIMIT " << options_.limit;
+}
+
+std::shared_ptr<const WhippetOrderByNode> ToWhippetOrderBy(
+    const velox::core::PlanNodePtr& node, const SortOptions& defaults) {
+  if (auto order_by =
+          std::dynamic_pointer_cast<const velox::core::OrderByNode>(node)) {
+    if (order_by->isPartial()) return nullptr;
+    return std::make_shared<WhippetOrderByNode>(
+        node->id(),
+        MakeSortOptions(order_by->sortingKeys(), order_by->sortingOrders(),
+                        /*limit=*/0, defaults),
+        node->sources()[0]);
+  }
+  if (auto top_n =
+          std::dynamic_pointer_cast<const velox::core::TopNNode>(node)) {
+    if (top_n->isPartial()) return nullptr;
+    return std::make_shared<WhippetOrderByNode>(
+        node->id(),
+        MakeSortOptions(top_n->sortingKeys(), top_n->sortingOrders(),
+                        top_n->count(), defaults),
+        node->sources()[0]);
+  }
+  return nullptr;
+}
+
+std::function<velox::core::PlanNodePtr(std::string, velox::core::PlanNodePtr)>
+AddWhippetOrderBy(const std::string& keys, int64_t limit,
+                  const SortOptions& defaults) {
+  auto spec = ParseSortSpec(keys);
+  VELOX_USER_CHECK(spec.ok(), "{}", spec.status().ToString());
+  SortOptions options = defaults;
+  options.sort_keys = *std::move(spec);
+  options.limit = limit;
+  return [options](std::string id, velox::core::PlanNodePtr source) {
+    return std::make_shared<WhippetOrderByNode>(id, options,
+                                                std::move(source));
+  };
+}
+
+WhippetOrderBy::WhippetOrderBy(
+    int32_t operator_id, velox::exec::DriverCtx* driver_ctx,
+    const std::shared_ptr<const WhippetOrderByNode>& node)
+    : Operator(driver_ctx, node->outputType(), operator_id, node->id(),
+               "WhippetOrderBy"),
+      sorter_(node->options()),
+      output_batch_rows_(
+          driver_ctx->queryConfig().preferredOutputBatchRows()) {}
+
+void WhippetOrderBy::addInput(velox::RowVectorPtr input) {
+  if (input->size() == 0) return;
+  input->loadedVector();
+  ArrowSchema schema;
+  ArrowArray array;
+  const auto options = ExportOptions();
+  velox::exportToArrow(input, schema, options);
+  velox::exportToArrow(input, array, pool(), options);
+  batches_.push_back(ValueOrThrow(arrow::ImportRecordBatch(&array, &schema)));
+}
+
+void WhippetOrderBy::noMoreInput() {
+  Operator::noMoreInput();
+  if (batches_.empty()) {
+    finished_ = true;
+    return;
+  }
+  auto table = ValueOrThrow(arrow::Table::FromRecordBatches(batches_));
+  batches_.clear();
+  SortStats stats;
+  sorted_ = ValueOrThrow(sorter_.SortTable(table, &stats));
+  table.reset();
+  reader_ = std::make_unique<arrow::TableBatchReader>(*sorted_);
+  reader_->set_chunksize(output_batch_rows_);
+
+  auto locked = stats_.wlock();
+  for (int i = 0; i < kNumPhases; ++i) {
+    const auto phase = static_cast<Phase>(i);
+    if (stats.phase_nanos_of(phase) == 0) continue;
+    locked->addRuntimeStat(
+        std::string("whippet.") + PhaseName(phase) + "Nanos",
+        velox::RuntimeCounter(stats.phase_nanos_of(phase),
+                              velox::RuntimeCounter::Unit::kNanos));
+  }
+  locked->addRuntimeStat("whippet.runs", velox::RuntimeCounter(stats.num_runs));
+}
+
+velox::RowVectorPtr WhippetOrderBy::getOutput() {
+  if (finished_ || reader_ == nullptr) return nullptr;
+  std::shared_ptr<arrow::RecordBatch> batch;
+  ThrowIfError(reader_->ReadNext(&batch));
+  if (batch == nullptr) {
+    reader_.reset();
+    sorted_.reset();
+    finished_ = true;
+    return nullptr;
+  }
+  ArrowSchema schema;
+  ArrowArray array;
+  ThrowIfError(arrow::ExportRecordBatch(*batch, &array, &schema));
+  auto vector = velox::importFromArrowAsOwner(schema, array, pool());
+  return std::dynamic_pointer_cast<velox::RowVector>(vector);
+}
+
+velox::RowVectorPtr WrapInSortOrder(const velox::RowVectorPtr& input,
+                                    const SortPermutation& permutation,
+                                    int64_t offset, velox::vector_size_t length,
+                                    velox::memory::MemoryPool* pool) {
+  VELOX_CHECK_LE(offset + length, permutation.num_rows());
+  VELOX_CHECK_EQ(input->size(), permutation.row_group_offsets.back());
+  auto indices = velox::allocateIndices(length, pool);
+  auto* raw_indices = indices->asMutable<velox::vector_size_t>();
+  for (velox::vector_size_t i = 0; i < length; ++i) {
+    raw_indices[i] =
+        static_cast<velox::vector_size_t>(permutation.row_id(offset + i));
+  }
+  std::vector<velox::VectorPtr> children;
+  children.reserve(input->childrenSize());
+  for (const auto& child : input->children()) {
+    children.push_back(
+        velox::BaseVector::wrapInDictionary(nullptr, indices, length, child));
+  }
+  return std::make_shared<velox::RowVector>(pool, input->type(), nullptr,
+                                            length, std::move(children));
+}
+
+std::unique_ptr<velox::exec::Operator> WhippetOrderByTranslator::toOperator(
+    velox::exec::DriverCtx* ctx, int32_t id,
+    const velox::core::PlanNodePtr& node) {
+  if (auto order_by =
+          std::dynamic_pointer_cast<const WhippetOrderByNode>(node)) {
+    return std::make_unique<WhippetOrderBy>(id, ctx, order_by);
+  }
+  return nullptr;
+}
+
+std::optional<uint32_t> WhippetOrderByTranslator::maxDrivers(
+    const velox::core::PlanNodePtr& node) {
+  if (std::dynamic_pointer_cast<const WhippetOrderByNode>(node)) return 1;
+  return std::nullopt;
+}
+
+void RegisterWhippetOrderBy() {
+  velox::exec::Operator::registerOperator(
+      std::make_unique<WhippetOrderByTranslator>());
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,141 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <arrow/table.h>
+#include <arrow/type_fwd.h>
+
+#include "engine/parquet_sorter.h"
+#include "velox/core/PlanNode.h"
+#include "velox/exec/Operator.h"
+
+namespace whippet_sort {
+
+/// A Velox plan node sorting its input with the Whippet Sort engine: ORDER BY
+/// `options.sort_keys`, and LIMIT `options.limit` unless it is 0. It stands
+/// for a final OrderByNode or TopNNode and produces the same output.
+class WhippetOrderByNode : public facebook::velox::core::PlanNode {
+ public:
+  WhippetOrderByNode(const facebook::velox::core::PlanNodeId& id,
+                     SortOptions options,
+                     facebook::velox::core::PlanNodePtr source);
+
+  const facebook::velox::RowTypePtr& outputType() const override {
+    return sources_[0]->outputType();
+  }
+
+  const std::vector<facebook::velox::core::PlanNodePtr>& sources()
+      const override {
+    return sources_;
+  }
+
+  std::string_view name() const override { return "WhippetOrderBy"; }
+
+  const SortOptions& options() const { return options_; }
+
+ private:
+  void addDetails(std::stringstream& stream) const override;
+
+  SortOptions options_;
+  std::vector<facebook::velox::core::PlanNodePtr> sources_;
+};
+
+/// Returns a WhippetOrderByNode doing the work of a final OrderByNode or
+/// TopNNode on the same source, or nullptr for any other node, including
+/// partial sorts.
+std::shared_ptr<const WhippetOrderByNode> ToWhippetOrderBy(
+    const facebook::velox::core::PlanNodePtr& node,
+    const SortOptions& defaults = {});
+
+/// For PlanBuilder::addNode(): adds a WhippetOrderByNode on top of the plan.
+/// `keys` is an ORDER BY list as ParseSortSpec() takes it.
+std::function<facebook::velox::core::PlanNodePtr(
+    std::string, facebook::velox::core::PlanNodePtr)>
+AddWhippetOrderBy(const std::string& keys, int64_t limit = 0,
+                  const SortOptions& defaults = {});
+
+/// Returns sorted rows [offset, offset + length) of `permutation` as
+/// dictionary vectors over the columns of `input`, which holds all rows of
+/// the sorted file in file order, e.g. as read by a Velox table scan. No row
+/// is copied; only the indices are allocated from `pool`.
+facebook::velox::RowVectorPtr WrapInSortOrder(
+    const facebook::velox::RowVectorPtr& input,
+    const SortPermutation& permutation, int64_t offset,
+    facebook::velox::vector_size_t length,
+    facebook::velox::memory::MemoryPool* pool);
+
+/// The operator of a WhippetOrderByNode. It converts its input vectors to
+/// Arrow record batches through the Arrow C data interface, sorts them all
+/// with ParquetSorter::SortTable() once the input is complete, and returns
+/// the result in batches of the preferred output size. The sort's phase
+/// times are reported as runtime stats of the operator.
+///
+/// The input is buffered in Arrow memory, outside of the Velox memory pool
+/// of the operator, and is not spilled.
+class WhippetOrderBy : public facebook::velox::exec::Operator {
+ public:
+  WhippetOrderBy(int32_t operator_id,
+                 facebook::velox::exec::DriverCtx* driver_ctx,
+                 const std::shared_ptr<const WhippetOrderByNode>& node);
+
+  bool needsInput() const override { return !noMoreInput_; }
+
+  void addInput(facebook::velox::RowVectorPtr input) override;
+
+  void noMoreInput() override;
+
+  facebook::velox::RowVectorPtr getOutput() override;
+
+  facebook::velox::exec::BlockingReason isBlocked(
+      facebook::velox::ContinueFuture* /*future*/) override {
+    return facebook::velox::exec::BlockingReason::kNotBlocked;
+  }
+
+  bool isFinished() override { return finished_; }
+
+ private:
+  ParquetSorter sorter_;
+  const int64_t output_batch_rows_;
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches_;
+  std::shared_ptr<arrow::Table> sorted_;
+  std::unique_ptr<arrow::TableBatchReader> reader_;
+  bool finished_ = false;
+};
+
+/// Creates WhippetOrderBy operators for WhippetOrderByNodes, with one driver
+/// per node since the engine sorts on its own thread pool.
+class WhippetOrderByTranslator
+    : public facebook::velox::exec::Operator::PlanNodeTranslator {
+ public:
+  std::unique_ptr<facebook::velox::exec::Operator> toOperator(
+      facebook::velox::exec::DriverCtx* ctx, int32_t id,
+      const facebook::velox::core::PlanNodePtr& node) override;
+
+  std::optional<uint32_t> maxDrivers(
+      const facebook::velox::core::PlanNodePtr& node) override;
+};
+
+/// Registers WhippetOrderByTranslator with Velox. Call once at startup.
+void RegisterWhippetOrderBy();
+
+}  // namespace whippet_sort
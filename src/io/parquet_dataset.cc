@@ -0,0 +1,385 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+#include "io/parquet_dataset.h"
+
+#include <glob.h>
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <system_error>
+
+#include <arrow/api.h>
+
+namespace whippet_sort {
+
+namespace {
+
+// The value Hive writes for a null partition key.
+constexpr char kHiveNullPartition[] = "__HIVE_DEFAULT_PARTITION__";
+
+bool IsHidden(const std::filesystem::path& path) {
+  const auto name = path.filename().string();
+  return !name.empty() && (name.front() == '.' || name.front() == '_');
+}
+
+bool HasWildcards(const std::string& text) {
+  return text.find_first_of("*?[") != std::string::npos;
+}
+
+// Undoes the %XX escapes Hive writes for characters such as `/` and `=` in
+// partition values.
+std::string UnescapePartitionValue(const std::string& value) {
+  std::string out;
+  for (size_t i = 0; i < value.size(); ++i) {
+    if (value[i] == '%' && i + 2 < value.size() &&
+        std::isxdigit(static_cast<unsigned char>(value[i + 1])) &&
+        std::isxdigit(static_cast<unsigned char>(value[i + 2]))) {
+      out += static_cast<char>(std::stoi(value.substr(i + 1, 2), nullptr, 16));
+      i += 2;
+    } else {
+      out += value[i];
+    }
+  }
+  return out;
+}
+
+// Adds `path` if it is a file, or the visible files below it if it is a
+// directory, to `paths`.
+arrow::Status AddFiles(const std::filesystem::path& path,
+                       std::vector<std::filesystem::path>* paths) {
+  std::error_code error;
+  if (!std::filesystem::is_directory(path, error)) {
+    if (!std::filesystem::exists(path, error)) {
+      return arrow::Status::IOError(path.string(), " does not exist");
+    }
+    paths->push_back(path);
+    return arrow::Status::OK();
+  }
+  std::filesystem::recursive_directory_iterator it(path, error);
+  for (; !error && it != std::filesystem::recursive_directory_iterator();
+       it.increment(error)) {
+    if (IsHidden(it->path())) {
+      if (it->is_directory(error)) it.disable_recursion_pending();
+      continue;
+    }
+    if (it->is_regular_file(error)) paths->push_back(it->path());
+  }
+  if (error) {
+    return arrow::Status::IOError("cannot list ", path.string(), ": ",
+                                  error.message());
+  }
+  return arrow::Status::OK();
+}
+
+}  // namespace
+
+std::shared_ptr<parquet::FileMetaData> FooterCache::Lookup(
+    const std::string& path, int64_t file_size, int64_t modification_time) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(path);
+  if (it == entries_.end() || it->second.file_size != file_size ||
+      it->second.modification_time != modification_time) {
+    ++misses_;
+    return nullptr;
+  }
+  ++hits_;
+  lru_.splice(lru_.begin(), lru_, it->second.use);
+  return it->second.metadata;
+}
+
+void FooterCache::Insert(const std::string& path, int64_t file_size,
+                         int64_t modification_time,
+                         std::shared_ptr<parquet::FileMetaData> metadata) {
+  if (max_entries_ <= 0) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(path);
+  if (it != entries_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second.use);
+  } else {
+    lru_.push_front(path);
+    it = entries_.emplace(path, Entry{0, 0, nullptr, lru_.begin()}).first;
+  }
+  it->second.file_size = file_size;
+  it->second.modification_time = modification_time;
+  it->second.metadata = std::move(metadata);
+  while (static_cast<int64_t>(entries_.size()) > max_entries_) {
+    entries_.erase(lru_.back());
+    lru_.pop_back();
+  }
+}
+
+int64_t FooterCache::hits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+int64_t FooterCache::misses() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+arrow::Result<std::unique_ptr<ParquetInput>> OpenWithFooterCache(
+    const std::string& path, arrow::MemoryPool* pool,
+    ParquetInputOptions options, FooterCache* cache) {
+  if (cache == nullptr) return ParquetInput::Open(path, pool, options);
+  std::error_code error;
+  const auto file_size =
+      static_cast<int64_t>(std::filesystem::file_size(path, error));
+  int64_t modification_time = 0;
+  if (!error) {
+    modification_time = std::filesystem::last_write_time(path, error)
+                            .time_since_epoch()
+                            .count();
+  }
+  // A file that cannot be stat'ed fails to open with a better message.
+  if (error) return ParquetInput::Open(path, pool, options);
+  options.metadata = cache->Lookup(path, file_size, modification_time);
+  const bool cached = options.metadata != nullptr;
+  ARROW_ASSIGN_OR_RAISE(auto input, ParquetInput::Open(path, pool, options));
+  if (!cached) {
+    cache->Insert(path, file_size, modification_time, input->metadata());
+  }
+  return input;
+}
+
+arrow::Result<std::vector<DatasetFile>> ListDatasetFiles(
+    const std::string& path) {
+  std::vector<std::filesystem::path> paths;
+  std::filesystem::path base = path;
+  if (HasWildcards(path)) {
+    // The partitions start below the last directory without wildcards.
+    base.clear();
+    for (const auto& component : std::filesystem::path(path)) {
+      if (HasWildcards(component.string())) break;
+      base /= component;
+    }
+    glob_t matches;
+    const int result = ::glob(path.c_str(), 0, nullptr, &matches);
+    if (result != 0 && result != GLOB_NOMATCH) {
+      ::globfree(&matches);
+      return arrow::Status::IOError("cannot expand ", path);
+    }
+    arrow::Status status;
+    for (size_t i = 0; status.ok() && i < matches.gl_pathc; ++i) {
+      status = AddFiles(matches.gl_pathv[i], &paths);
+    }
+    ::globfree(&matches);
+    ARROW_RETURN_NOT_OK(status);
+  } else {
+    ARROW_RETURN_NOT_OK(AddFiles(path, &paths));
+  }
+  if (paths.empty()) {
+    return arrow::Status::Invalid("no files match ", path);
+  }
+  std::sort(paths.begin(), paths.end());
+  paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+  std::vector<DatasetFile> files;
+  for (const auto& file_path : paths) {
+    DatasetFile file;
+    file.path = file_path.string();
+    const auto relative = file_path.parent_path().lexically_relative(base);
+    for (const auto& component : relative) {
+      const auto name = component.string();
+      const auto equals = name.find('=');
+      if (equals == std::string::npos || equals == 0) continue;
+      file.partitions.emplace_back(
+          name.substr(0, equals),
+          UnescapePartitionValue(name.substr(equals + 1)));
+    }
+    if (!files.empty()) {
+      const auto& first = files.front().partitions;
+      bool same_keys = first.size() == file.partitions.size();
+      for (size_t i = 0; same_keys && i < first.size(); ++i) {
+        same_keys = first[i].first == file.partitions[i].first;
+      }
+      if (!same_keys) {
+        return arrow::Status::Invalid(file.path,
+                                      " has other partition keys than ",
+                                      files.front().path);
+      }
+    }
+    files.push_back(std::move(file));
+  }
+  return files;
+}
+
+arrow::Result<std::unique_ptr<ParquetDataset>> ParquetDataset::Open(
+    const std::vector<DatasetFile>& files, arrow::MemoryPool* pool,
+    const ParquetInputOptions& options, ThreadPool* threads,
+    FooterCache* cache) {
+  if (files.empty()) return arrow::Status::Invalid("a dataset has no files");
+  // Opening a file waits for its footer, so the files are opened in parallel
+  // to overlap those reads.
+  std::vector<std::unique_ptr<ParquetInput>> inputs(files.size());
+  TaskGroup open(threads);
+  for (size_t i = 0; i < files.size(); ++i) {
+    open.Spawn([&, i]() -> arrow::Status {
+      ARROW_ASSIGN_OR_RAISE(
+          inputs[i], OpenWithFooterCache(files[i].path, pool, options, cache));
+      return arrow::Status::OK();
+    });
+  }
+  ARROW_RETURN_NOT_OK(open.Wait());
+
+  const auto& first = inputs.front();
+  for (const auto& input : inputs) {
+    if (!input->schema()->Equals(*first->schema())) {
+      return arrow::Status::Invalid(input->path(),
+                                    " does not have the schema of ",
+                                    first->path());
+    }
+  }
+  auto fields = first->schema()->fields();
+  for (const auto& [key, value] : files.front().partitions) {
+    if (first->schema()->GetFieldIndex(key) >= 0) {
+      return arrow::Status::Invalid("partition key ", key,
+                                    " is also a column of ", first->path());
+    }
+    fields.push_back(arrow::field(key, arrow::utf8()));
+  }
+  auto schema = arrow::schema(std::move(fields));
+  return std::unique_ptr<ParquetDataset>(new ParquetDataset(
+      std::move(inputs), files, std::move(schema), pool));
+}
+
+std::unique_ptr<ParquetDataset> ParquetDataset::FromInput(
+    std::unique_ptr<ParquetInput> input, arrow::MemoryPool* pool) {
+  std::vector<DatasetFile> files = {{input->path(), {}}};
+  auto schema = input->schema();
+  std::vector<std::unique_ptr<ParquetInput>> inputs;
+  inputs.push_back(std::move(input));
+  return std::unique_ptr<ParquetDataset>(
+      new ParquetDataset(std::move(inputs), std::move(files),
+                         std::move(schema), pool));
+}
+
+ParquetDataset::ParquetDataset(
+    std::vector<std::unique_ptr<ParquetInput>> inputs,
+    std::vector<DatasetFile> files, std::shared_ptr<arrow::Schema> schema,
+    arrow::MemoryPool* pool)
+    : inputs_(std::move(inputs)),
+      files_(std::move(files)),
+      schema_(std::move(schema)),
+      pool_(pool),
+      row_offsets_(inputs_.size() + 1, 0) {
+  for (size_t i = 0; i < inputs_.size(); ++i) {
+    row_offsets_[i + 1] = row_offsets_[i] + inputs_[i]->num_rows();
+  }
+}
+
+int ParquetDataset::num_columns() const { return schema_->num_fields(); }
+
+int64_t ParquetDataset::num_row_groups() const {
+  int64_t row_groups = 0;
+  for (const auto& input : inputs_) row_groups += input->num_row_groups();
+  return row_groups;
+}
+
+int64_t ParquetDataset::decoded_bytes() const {
+  int64_t bytes = 0;
+  for (const auto& input : inputs_) {
+    for (int rg = 0; rg < input->num_row_groups(); ++rg) {
+      bytes += input->row_group_bytes(rg);
+    }
+  }
+  return bytes;
+}
+
+arrow::Result<int> ParquetDataset::ColumnIndex(const std::string& name) const {
+  int index = schema_->GetFieldIndex(name);
+  if (index < 0) {
+    return arrow::Status::KeyError("column '", name, "' is not in ",
+                                   inputs_.front()->path());
+  }
+  return index;
+}
+
+bool ParquetDataset::HasOnlyDictionaryPages(int column) const {
+  if (is_partition_column(column)) return true;
+  for (const auto& input : inputs_) {
+    if (!input->HasOnlyDictionaryPages(column)) return false;
+  }
+  return true;
+}
+
+void ParquetDataset::Advise(const std::vector<int>& columns,
+                            AccessPattern pattern) const {
+  std::vector<int> file_columns;
+  for (int column : columns) {
+    if (!is_partition_column(column)) file_columns.push_back(column);
+  }
+  // Only partition columns: nothing to read.
+  if (!columns.empty() && file_columns.empty()) return;
+  for (const auto& input : inputs_) input->Advise({}, file_columns, pattern);
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> ParquetDataset::PartitionColumn(
+    int i, int column, int64_t length) const {
+  const int key = column - inputs_.front()->num_columns();
+  const auto& value = files_[i].partitions[key].second;
+  if (value == kHiveNullPartition) {
+    return arrow::MakeArrayOfNull(arrow::utf8(), length, pool_);
+  }
+  return arrow::MakeArrayFromScalar(arrow::StringScalar(value), length, pool_);
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> ParquetDataset::ReadColumn(
+    int i, int column) {
+  if (is_partition_column(column)) {
+    return PartitionColumn(i, column, inputs_[i]->num_rows());
+  }
+  return inputs_[i]->ReadColumn(column);
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> ParquetDataset::ReadColumn(
+    int column, ThreadPool* threads) {
+  if (num_files() == 1) return ReadColumn(0, column);
+  arrow::ArrayVector pieces(inputs_.size());
+  if (threads != nullptr) {
+    TaskGroup read(threads);
+    for (int i = 0; i < num_files(); ++i) {
+      read.Spawn([&, i]() -> arrow::Status {
+        ARROW_ASSIGN_OR_RAISE(pieces[i], ReadColumn(i, column));
+        return arrow::Status::OK();
+      });
+    }
+    ARROW_RETURN_NOT_OK(read.Wait());
+  } else {
+    for (int i = 0; i < num_files(); ++i) {
+      ARROW_ASSIGN_OR_RAISE(pieces[i], ReadColumn(i, column));
+    }
+  }
+  return arrow::Concatenate(pieces, pool_);
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> ParquetDataset::ReadRowGroups(
+    int i, const std::vector<int>& row_groups) {
+  ARROW_ASSIGN_OR_RAISE(auto table, inputs_[i]->ReadRowGroups(row_groups));
+  for (int column = inputs_[i]->num_columns(); column < num_columns();
+       ++column) {
+    ARROW_ASSIGN_OR_RAISE(auto values,
+                          PartitionColumn(i, column, table->num_rows()));
+    ARROW_ASSIGN_OR_RAISE(
+        table, table->AddColumn(column, schema_->field(column),
+                                std::make_shared<arrow::ChunkedArray>(
+                                    std::move(values))));
+  }
+  return table;
+}
+
+}  // namespace whippet_sort
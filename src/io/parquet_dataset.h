@@ -0,0 +1,176 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+#include <parquet/metadata.h>
+
+#include "common/thread_pool.h"
+#include "io/parquet_input.h"
+
+namespace whippet_sort {
+
+/// Parsed Parquet footers by file, so that planning a dataset of thousands of
+/// files reads and parses each footer once per process rather than once per
+/// sort. An entry is used only while the file keeps the size and
+/// modification time it had when the footer was parsed. Thread-safe.
+class FooterCache {
+ public:
+  static constexpr int64_t kDefaultMaxEntries = 16 * 1024;
+
+  /// Keeps the footers of the `max_entries` files used most recently.
+  explicit FooterCache(int64_t max_entries = kDefaultMaxEntries)
+      : max_entries_(max_entries) {}
+
+  /// Returns the footer of `path` if it is cached for its current size and
+  /// modification time, else null.
+  std::shared_ptr<parquet::FileMetaData> Lookup(const std::string& path,
+                                                int64_t file_size,
+                                                int64_t modification_time);
+
+  void Insert(const std::string& path, int64_t file_size,
+              int64_t modification_time,
+              std::shared_ptr<parquet::FileMetaData> metadata);
+
+  int64_t hits() const;
+  int64_t misses() const;
+
+ private:
+  struct Entry {
+    int64_t file_size;
+    int64_t modification_time;
+    std::shared_ptr<parquet::FileMetaData> metadata;
+    /// The position of the path in lru_.
+    std::list<std::string>::iterator use;
+  };
+
+  const int64_t max_entries_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+  /// Paths from the most to the least recently used.
+  std::list<std::string> lru_;
+  int64_t hits_ = 0;
+  int64_t misses_ = 0;
+};
+
+/// Opens `path` like ParquetInput::Open(), taking its footer from `cache` if
+/// it is there and adding it otherwise. `cache` may be null.
+arrow::Result<std::unique_ptr<ParquetInput>> OpenWithFooterCache(
+    const std::string& path, arrow::MemoryPool* pool,
+    ParquetInputOptions options, FooterCache* cache);
+
+/// One file of a dataset and the values of its Hive partition directories,
+/// e.g. {"year", "2024"} for `.../year=2024/part-0.parquet`.
+struct DatasetFile {
+  std::string path;
+  std::vector<std::pair<std::string, std::string>> partitions;
+};
+
+/// Lists the files of a dataset: `path` itself if it is a file, all files
+/// below it if it is a directory, or the files matching it if it is a glob
+/// pattern such as `data/*/part-*.parquet`, each directory match standing
+/// for the files below it. Files and directories whose names start with `.`
+/// or `_`, such as `_SUCCESS`, are left out. The files are in path order.
+/// The `key=value` directories below the directory given, or below the
+/// last directory of the pattern without wildcards, are Hive partitions;
+/// all files must have the same partition keys.
+arrow::Result<std::vector<DatasetFile>> ListDatasetFiles(
+    const std::string& path);
+
+/// The files of a dataset opened as one input. The files must have the same
+/// schema. The dataset's schema is that schema, followed by one string
+/// column per partition key, whose value is the same for all rows of a
+/// file. Rows are numbered across the files in file order.
+class ParquetDataset {
+ public:
+  /// Opens the files in parallel on `threads`, taking their footers from
+  /// `cache` if it is not null.
+  static arrow::Result<std::unique_ptr<ParquetDataset>> Open(
+      const std::vector<DatasetFile>& files, arrow::MemoryPool* pool,
+      const ParquetInputOptions& options, ThreadPool* threads,
+      FooterCache* cache);
+
+  /// A dataset of one open file without partitions.
+  static std::unique_ptr<ParquetDataset> FromInput(
+      std::unique_ptr<ParquetInput> input, arrow::MemoryPool* pool);
+
+  const std::shared_ptr<arrow::Schema>& schema() const { return schema_; }
+  int num_columns() const;
+  int num_files() const { return static_cast<int>(inputs_.size()); }
+  ParquetInput* file(int i) const { return inputs_[i].get(); }
+  int64_t num_rows() const { return row_offsets_.back(); }
+  /// The row id of the first row of file `i`; num_rows() for i = num_files().
+  int64_t file_row_offset(int i) const { return row_offsets_[i]; }
+  int64_t num_row_groups() const;
+  /// Uncompressed bytes of all row groups, an estimate of the decoded size.
+  int64_t decoded_bytes() const;
+
+  /// Returns the index of the column named `name`.
+  arrow::Result<int> ColumnIndex(const std::string& name) const;
+
+  /// Whether `column` holds the values of a partition key.
+  bool is_partition_column(int column) const {
+    return column >= inputs_.front()->num_columns();
+  }
+
+  /// Whether `column` is dictionary-encoded in every file, see
+  /// ParquetInput::HasOnlyDictionaryPages(). Partition columns are.
+  bool HasOnlyDictionaryPages(int column) const;
+
+  /// Advises the kernel on all column chunks of `columns` of every file.
+  void Advise(const std::vector<int>& columns, AccessPattern pattern) const;
+
+  /// Decodes a whole column of file `i`.
+  arrow::Result<std::shared_ptr<arrow::Array>> ReadColumn(int i, int column);
+
+  /// Decodes a whole column of all files into one contiguous array, reading
+  /// the files in parallel on `threads` unless it is null.
+  arrow::Result<std::shared_ptr<arrow::Array>> ReadColumn(
+      int column, ThreadPool* threads = nullptr);
+
+  /// Decodes all columns of the given row groups of file `i`.
+  arrow::Result<std::shared_ptr<arrow::Table>> ReadRowGroups(
+      int i, const std::vector<int>& row_groups);
+
+ private:
+  ParquetDataset(std::vector<std::unique_ptr<ParquetInput>> inputs,
+                 std::vector<DatasetFile> files,
+                 std::shared_ptr<arrow::Schema> schema,
+                 arrow::MemoryPool* pool);
+
+  /// The column of a partition key for `length` rows of file `i`.
+  arrow::Result<std::shared_ptr<arrow::Array>> PartitionColumn(
+      int i, int column, int64_t length) const;
+
+  std::vector<std::unique_ptr<ParquetInput>> inputs_;
+  std::vector<DatasetFile> files_;
+  std::shared_ptr<arrow::Schema> schema_;
+  arrow::MemoryPool* pool_;
+  std::vector<int64_t> row_offsets_;
+};
+
+}  // namespace whippet_sort
@@ -0,0 +1,342 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "io/parquet_input.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <arrow/api.h>
+#include <arrow/compute/api.h>
+#include <arrow/io/caching.h>
+#include <arrow/io/file.h>
+#include <parquet/arrow/reader_internal.h>
+#include <parquet/exception.h>
+#include <parquet/file_reader.h>
+#include <parquet/page_index.h>
+#include <parquet/statistics.h>
+
+namespace whippet_sort {
+
+namespace {
+
+// Whether every row group of `column` starts with a dictionary page, so the
+// reader can hand out indices without building dictionaries from plain pages.
+bool IsDictionaryEncoded(const parquet::FileMetaData& metadata, int column) {
+  if (metadata.schema()->Column(column)->physical_type() !=
+      parquet::Type::BYTE_ARRAY) {
+    return false;
+  }
+  for (int rg = 0; rg < metadata.num_row_groups(); ++rg) {
+    if (!metadata.RowGroup(rg)->ColumnChunk(column)->has_dictionary_page()) {
+      return false;
+    }
+  }
+  return metadata.num_row_groups() > 0;
+}
+
+// Statistics of logical types such as dates come with their physical type. A
+// value that cannot be cast to `type` is left unknown.
+void CastToColumnType(const std::shared_ptr<arrow::DataType>& type,
+                      std::shared_ptr<arrow::Scalar>* value) {
+  if (*value == nullptr || (*value)->type->Equals(*type)) return;
+  auto cast = (*value)->CastTo(type);
+  *value = cast.ok() ? *std::move(cast) : nullptr;
+}
+
+}  // namespace
+
+arrow::Result<std::unique_ptr<ParquetInput>> ParquetInput::Open(
+    const std::string& path, arrow::MemoryPool* pool,
+    const ParquetInputOptions& options) {
+  std::shared_ptr<arrow::io::RandomAccessFile> file;
+  std::shared_ptr<arrow::Buffer> mapping;
+  if (options.memory_map) {
+    ARROW_ASSIGN_OR_RAISE(auto mapped, arrow::io::MemoryMappedFile::Open(
+                                           path, arrow::io::FileMode::READ));
+    ARROW_ASSIGN_OR_RAISE(int64_t size, mapped->GetSize());
+    // Reads of a mapped file are views of one mapping of the whole file.
+    ARROW_ASSIGN_OR_RAISE(mapping, mapped->ReadAt(0, size));
+    file = std::move(mapped);
+  } else {
+    ARROW_ASSIGN_OR_RAISE(file, arrow::io::ReadableFile::Open(path, pool));
+  }
+  parquet::arrow::FileReaderBuilder builder;
+  ARROW_RETURN_NOT_OK(builder.Open(file, parquet::default_reader_properties(),
+                                   options.metadata));
+  auto metadata = builder.raw_reader()->metadata();
+
+  parquet::ArrowReaderProperties properties;
+  properties.set_use_threads(options.use_threads);
+  if (options.pre_buffer && !options.memory_map) {
+    properties.set_pre_buffer(true);
+    properties.set_cache_options(arrow::io::CacheOptions::LazyDefaults());
+  }
+  std::vector<bool> dictionary_columns(metadata->num_columns(), false);
+  for (const auto& name : options.dictionary_columns) {
+    int column = metadata->schema()->ColumnIndex(name);
+    if (column >= 0 && IsDictionaryEncoded(*metadata, column)) {
+      properties.set_read_dictionary(column, true);
+      dictionary_columns[column] = true;
+    }
+  }
+
+  std::unique_ptr<parquet::arrow::FileReader> reader;
+  ARROW_RETURN_NOT_OK(
+      builder.memory_pool(pool)->properties(properties)->Build(&reader));
+  std::shared_ptr<arrow::Schema> schema;
+  ARROW_RETURN_NOT_OK(reader->GetSchema(&schema));
+  if (schema->num_fields() != metadata->num_columns()) {
+    return arrow::Status::NotImplemented("nested columns in ", path);
+  }
+  // Report dictionary columns with their dense type.
+  for (int column = 0; column < schema->num_fields(); ++column) {
+    const auto& field = schema->field(column);
+    if (dictionary_columns[column] &&
+        field->type()->id() == arrow::Type::DICTIONARY) {
+      const auto& type =
+          static_cast<const arrow::DictionaryType&>(*field->type());
+      ARROW_ASSIGN_OR_RAISE(
+          schema, schema->SetField(column, field->WithType(type.value_type())));
+    }
+  }
+  return std::unique_ptr<ParquetInput>(
+      new ParquetInput(path, pool, std::move(reader), std::move(schema),
+                       std::move(dictionary_columns), std::move(mapping),
+                       options.pre_buffer));
+}
+
+ParquetInput::ParquetInput(std::string path, arrow::MemoryPool* pool,
+                           std::unique_ptr<parquet::arrow::FileReader> reader,
+                           std::shared_ptr<arrow::Schema> schema,
+                           std::vector<bool> dictionary_columns,
+                           std::shared_ptr<arrow::Buffer> mapping,
+                           bool read_ahead)
+    : path_(std::move(path)),
+      pool_(pool),
+      reader_(std::move(reader)),
+      schema_(std::move(schema)),
+      metadata_(reader_->parquet_reader()->metadata()),
+      dictionary_columns_(std::move(dictionary_columns)),
+      mapping_(std::move(mapping)),
+      read_ahead_(read_ahead) {}
+
+int ParquetInput::num_columns() const { return schema_->num_fields(); }
+
+arrow::Result<int> ParquetInput::ColumnIndex(const std::string& name) const {
+  int index = schema_->GetFieldIndex(name);
+  if (index < 0) {
+    return arrow::Status::KeyError("column '", name, "' is not in ", path_);
+  }
+  return index;
+}
+
+bool ParquetInput::HasOnlyDictionaryPages(int column) const {
+  for (int rg = 0; rg < num_row_groups(); ++rg) {
+    auto chunk = metadata_->RowGroup(rg)->ColumnChunk(column);
+    if (!chunk->has_dictionary_page()) return false;
+    for (const auto& page : chunk->encoding_stats()) {
+      const bool data_page = page.page_type == parquet::PageType::DATA_PAGE ||
+                             page.page_type == parquet::PageType::DATA_PAGE_V2;
+      if (data_page && page.count > 0 &&
+          page.encoding != parquet::Encoding::RLE_DICTIONARY &&
+          page.encoding != parquet::Encoding::PLAIN_DICTIONARY) {
+        return false;
+      }
+    }
+  }
+  return num_row_groups() > 0;
+}
+
+void ParquetInput::Advise(const std::vector<int>& row_groups,
+                          const std::vector<int>& columns,
+                          AccessPattern pattern) const {
+  if (mapping_ == nullptr || mapping_->size() == 0) return;
+  static const int64_t page_size = ::sysconf(_SC_PAGESIZE);
+  auto advise = [&](int row_group, int column) {
+    auto chunk = metadata_->RowGroup(row_group)->ColumnChunk(column);
+    int64_t begin = chunk->has_dictionary_page()
+                        ? chunk->dictionary_page_offset()
+                        : chunk->data_page_offset();
+    begin = std::clamp<int64_t>(begin, 0, mapping_->size());
+    const int64_t end = std::min(
+        mapping_->size(), begin + chunk->total_compressed_size());
+    if (end <= begin) return;
+    // The mapping starts at a page boundary.
+    begin -= begin % page_size;
+    auto* address = const_cast<uint8_t*>(mapping_->data()) + begin;
+    const auto length = static_cast<size_t>(end - begin);
+    if (pattern == AccessPattern::kRandom) {
+      ::madvise(address, length, MADV_RANDOM);
+      return;
+    }
+    ::madvise(address, length, MADV_SEQUENTIAL);
+    if (read_ahead_) ::madvise(address, length, MADV_WILLNEED);
+  };
+  const int num_groups = row_groups.empty()
+                             ? num_row_groups()
+                             : static_cast<int>(row_groups.size());
+  const int num_chunk_columns =
+      columns.empty() ? num_columns() : static_cast<int>(columns.size());
+  for (int i = 0; i < num_groups; ++i) {
+    const int row_group = row_groups.empty() ? i : row_groups[i];
+    for (int j = 0; j < num_chunk_columns; ++j) {
+      advise(row_group, columns.empty() ? j : columns[j]);
+    }
+  }
+}
+
+arrow::Result<ColumnChunkStatistics> ParquetInput::ColumnStatistics(
+    int row_group, int column) const {
+  ARROW_ASSIGN_OR_RAISE(auto result, PhysicalStatistics(row_group, column));
+  const auto& type = schema_->field(column)->type();
+  CastToColumnType(type, &result.min);
+  CastToColumnType(type, &result.max);
+  return result;
+}
+
+arrow::Result<ColumnChunkStatistics> ParquetInput::PhysicalStatistics(
+    int row_group, int column) const {
+  ColumnChunkStatistics result;
+  try {
+    auto statistics =
+        metadata_->RowGroup(row_group)->ColumnChunk(column)->statistics();
+    if (statistics != nullptr) {
+      if (statistics->HasNullCount()) {
+        result.null_count = statistics->null_count();
+      }
+      if (statistics->HasMinMax()) {
+        ARROW_RETURN_NOT_OK(parquet::arrow::StatisticsAsScalars(
+            *statistics, &result.min, &result.max));
+        return result;
+      }
+    }
+
+    auto page_index = reader_->parquet_reader()->GetPageIndexReader();
+    auto row_group_index =
+        page_index == nullptr ? nullptr : page_index->RowGroup(row_group);
+    auto column_index = row_group_index == nullptr
+                            ? nullptr
+                            : row_group_index->GetColumnIndex(column);
+    if (column_index == nullptr) return result;
+    const auto* descr = metadata_->schema()->Column(column);
+    const auto& null_pages = column_index->null_pages();
+    for (size_t page = 0; page < null_pages.size(); ++page) {
+      if (null_pages[page]) continue;
+      auto page_statistics = parquet::Statistics::Make(
+          descr, column_index->encoded_min_values()[page],
+          column_index->encoded_max_values()[page], /*num_values=*/0,
+          /*null_count=*/0, /*distinct_count=*/0, /*has_min_max=*/true,
+          /*has_null_count=*/false, /*has_distinct_count=*/false, pool_);
+      std::shared_ptr<arrow::Scalar> min;
+      std::shared_ptr<arrow::Scalar> max;
+      ARROW_RETURN_NOT_OK(
+          parquet::arrow::StatisticsAsScalars(*page_statistics, &min, &max));
+      if (result.min == nullptr) {
+        result.min = std::move(min);
+        result.max = std::move(max);
+        continue;
+      }
+      ARROW_ASSIGN_OR_RAISE(bool smaller, ScalarLess(min, result.min));
+      if (smaller) result.min = std::move(min);
+      ARROW_ASSIGN_OR_RAISE(bool larger, ScalarLess(result.max, max));
+      if (larger) result.max = std::move(max);
+    }
+    if (result.null_count < 0 && column_index->has_null_counts()) {
+      result.null_count = 0;
+      for (int64_t count : column_index->null_counts()) {
+        result.null_count += count;
+      }
+    }
+  } catch (const parquet::ParquetException& e) {
+    return arrow::Status::IOError("statistics of ", path_, ": ", e.what());
+  }
+  return result;
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> ParquetInput::ReadColumn(
+    int column) {
+  std::shared_ptr<arrow::ChunkedArray> chunked;
+  ARROW_RETURN_NOT_OK(reader_->ReadColumn(column, &chunked));
+  if (is_dictionary_column(column)) {
+    arrow::compute::ExecContext ctx(pool_);
+    ARROW_ASSIGN_OR_RAISE(
+        auto decoded,
+        arrow::compute::Cast(chunked, schema_->field(column)->type(),
+                             arrow::compute::CastOptions::Safe(), &ctx));
+    chunked = decoded.chunked_array();
+  }
+  return CombineChunks(chunked, pool_);
+}
+
+arrow::Result<std::shared_ptr<arrow::ChunkedArray>>
+ParquetInput::ReadDictionaryColumn(int column) {
+  if (!is_dictionary_column(column)) {
+    return arrow::Status::Invalid("column ", schema_->field(column)->name(),
+                                  " is not read as a dictionary");
+  }
+  std::shared_ptr<arrow::ChunkedArray> chunked;
+  ARROW_RETURN_NOT_OK(reader_->ReadColumn(column, &chunked));
+  return chunked;
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> ParquetInput::ReadRowGroups(
+    const std::vector<int>& row_groups) {
+  std::shared_ptr<arrow::Table> table;
+  ARROW_RETURN_NOT_OK(reader_->ReadRowGroups(row_groups, &table));
+  arrow::compute::ExecContext ctx(pool_);
+  for (int column = 0; column < num_columns(); ++column) {
+    if (!is_dictionary_column(column)) continue;
+    const auto& field = schema_->field(column);
+    ARROW_ASSIGN_OR_RAISE(
+        auto decoded,
+        arrow::compute::Cast(table->column(column), field->type(),
+                             arrow::compute::CastOptions::Safe(), &ctx));
+    ARROW_ASSIGN_OR_RAISE(
+        table, table->SetColumn(column, field, decoded.chunked_array()));
+  }
+  return table;
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> ParquetInput::ReadRowGroup(
+    int row_group, const std::vector<int>& columns) {
+  std::shared_ptr<arrow::Table> table;
+  ARROW_RETURN_NOT_OK(reader_->ReadRowGroup(row_group, columns, &table));
+  return table;
+}
+
+arrow::Result<bool> ScalarLess(const std::shared_ptr<arrow::Scalar>& a,
+                               const std::shared_ptr<arrow::Scalar>& b) {
+  ARROW_ASSIGN_OR_RAISE(auto less,
+                        arrow::compute::CallFunction("less", {a, b}));
+  const auto& result = less.scalar_as<arrow::BooleanScalar>();
+  return result.is_valid && result.value;
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> CombineChunks(
+    const std::shared_ptr<arrow::ChunkedArray>& chunked,
+    arrow::MemoryPool* pool) {
+  if (chunked->num_chunks() == 1) {
+    return chunked->chunk(0);
+  }
+  if (chunked->num_chunks() == 0) {
+    return arrow::MakeArrayOfNull(chunked->type(), 0, pool);
+  }
+  return arrow::Concatenate(chunked->chunks(), pool);
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,175 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+#include <parquet/arrow/reader.h>
+#include <parquet/metadata.h>
+
+namespace whippet_sort {
+
+struct ParquetInputOptions {
+  /// Lets Arrow decode columns with its internal thread pool.
+  bool use_threads = true;
+  /// Fetches the column chunks of the row groups being read with coalesced,
+  /// concurrent reads through Arrow's read range cache before decoding them.
+  bool pre_buffer = true;
+  /// String columns to decode as dictionary indices instead of strings. Only
+  /// columns that are dictionary-encoded in every row group are read this way.
+  std::vector<std::string> dictionary_columns;
+  /// Maps the file instead of reading it into buffers of the pool. The pages
+  /// of uncompressed column chunks then are views of the mapping, which
+  /// shares the page cache, and Advise() tells the kernel how the column
+  /// chunks will be read. Replaces pre-buffering, whose reads would only
+  /// copy the mapping, by read-ahead advice.
+  bool memory_map = false;
+  /// The parsed footer of the file, e.g. from a FooterCache, which saves
+  /// reading and parsing it again; read from the file if null.
+  std::shared_ptr<parquet::FileMetaData> metadata;
+};
+
+/// How the column chunks of a memory-mapped input will be read.
+enum class AccessPattern {
+  /// In file order, once, e.g. a scan of whole columns.
+  kSequential,
+  /// In any order, e.g. single row groups picked by their statistics.
+  kRandom,
+};
+
+/// Min, max and null count of one column chunk as Arrow scalars of the
+/// column's type. Unknown values are null, or -1 for the null count.
+struct ColumnChunkStatistics {
+  std::shared_ptr<arrow::Scalar> min;
+  std::shared_ptr<arrow::Scalar> max;
+  int64_t null_count = -1;
+};
+
+/// A Parquet file opened for column-at-a-time reads. The sort engine reads the
+/// ORDER BY columns first and the payload columns only once the output order
+/// is known, so columns are always addressed individually.
+///
+/// Only flat schemas are supported: field i of the Arrow schema is leaf
+/// column i of the Parquet schema. `schema()` always has the dense (decoded)
+/// types, also for columns read as dictionaries.
+class ParquetInput {
+ public:
+  static arrow::Result<std::unique_ptr<ParquetInput>> Open(
+      const std::string& path, arrow::MemoryPool* pool,
+      const ParquetInputOptions& options = {});
+
+  const std::string& path() const { return path_; }
+  const std::shared_ptr<arrow::Schema>& schema() const { return schema_; }
+  const std::shared_ptr<parquet::FileMetaData>& metadata() const {
+    return metadata_;
+  }
+  int num_columns() const;
+  int num_row_groups() const { return metadata_->num_row_groups(); }
+  int64_t num_rows() const { return metadata_->num_rows(); }
+  int64_t row_group_num_rows(int row_group) const {
+    return metadata_->RowGroup(row_group)->num_rows();
+  }
+  /// Uncompressed bytes of a row group, an estimate of its decoded size.
+  int64_t row_group_bytes(int row_group) const {
+    return metadata_->RowGroup(row_group)->total_byte_size();
+  }
+
+  /// Returns the index of the column named `name`.
+  arrow::Result<int> ColumnIndex(const std::string& name) const;
+
+  /// Whether `column` is read as dictionary indices, see ParquetInputOptions.
+  bool is_dictionary_column(int column) const {
+    return dictionary_columns_[column];
+  }
+
+  /// Whether all data pages of `column` are dictionary-encoded according to
+  /// the page encoding stats, i.e. no row group fell back to plain encoding.
+  /// Without the stats, whether every row group has a dictionary page.
+  bool HasOnlyDictionaryPages(int column) const;
+
+  /// Advises the kernel on the column chunks of `columns` in `row_groups`;
+  /// empty means all of them. Sequential access also starts reading them
+  /// ahead if the input pre-buffers. Does nothing unless the input is
+  /// memory-mapped; the advice is a hint, so failures are ignored.
+  void Advise(const std::vector<int>& row_groups,
+              const std::vector<int>& columns, AccessPattern pattern) const;
+
+  bool memory_mapped() const { return mapping_ != nullptr; }
+
+  /// Returns the statistics of a column chunk from its metadata or, if the
+  /// writer left those out, aggregated over the pages of its page index.
+  /// Values that do not cast from the physical type to the column's type are
+  /// left unknown.
+  arrow::Result<ColumnChunkStatistics> ColumnStatistics(int row_group,
+                                                        int column) const;
+
+  /// Decodes a whole column into one contiguous array.
+  arrow::Result<std::shared_ptr<arrow::Array>> ReadColumn(int column);
+
+  /// Reads a dictionary column without materializing its strings: one
+  /// DictionaryArray chunk per row group, each with its own dictionary.
+  arrow::Result<std::shared_ptr<arrow::ChunkedArray>> ReadDictionaryColumn(
+      int column);
+
+  /// Decodes all columns of the given row groups, with the types of schema().
+  arrow::Result<std::shared_ptr<arrow::Table>> ReadRowGroups(
+      const std::vector<int>& row_groups);
+
+  /// Decodes the given columns of one row group.
+  arrow::Result<std::shared_ptr<arrow::Table>> ReadRowGroup(
+      int row_group, const std::vector<int>& columns);
+
+  parquet::arrow::FileReader* reader() { return reader_.get(); }
+
+ private:
+  ParquetInput(std::string path, arrow::MemoryPool* pool,
+               std::unique_ptr<parquet::arrow::FileReader> reader,
+               std::shared_ptr<arrow::Schema> schema,
+               std::vector<bool> dictionary_columns,
+               std::shared_ptr<arrow::Buffer> mapping, bool read_ahead);
+
+  /// ColumnStatistics() with the min and max as scalars of the Parquet
+  /// physical type.
+  arrow::Result<ColumnChunkStatistics> PhysicalStatistics(int row_group,
+                                                          int column) const;
+
+  std::string path_;
+  arrow::MemoryPool* pool_;
+  std::unique_ptr<parquet::arrow::FileReader> reader_;
+  std::shared_ptr<arrow::Schema> schema_;
+  std::shared_ptr<parquet::FileMetaData> metadata_;
+  std::vector<bool> dictionary_columns_;
+  /// A view of the whole file if it is memory-mapped.
+  std::shared_ptr<arrow::Buffer> mapping_;
+  bool read_ahead_;
+};
+
+/// Whether `a` < `b`, for scalars of comparable types.
+arrow::Result<bool> ScalarLess(const std::shared_ptr<arrow::Scalar>& a,
+                               const std::shared_ptr<arrow::Scalar>& b);
+
+/// Flattens a chunked array into one array, without copying when it has a
+/// single chunk.
+arrow::Result<std::shared_ptr<arrow::Array>> CombineChunks(
+    const std::shared_ptr<arrow::ChunkedArray>& chunked,
+    arrow::MemoryPool* pool);
+
+}  // namespace whippet_sort
@@ -0,0 +1,140 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+#include "io/parquet_output.h"
+
+#include <chrono>
+#include <utility>
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <parquet/properties.h>
+
+namespace whippet_sort {
+
+arrow::Result<std::unique_ptr<ParquetOutput>> ParquetOutput::Open(
+    const std::string& path, std::shared_ptr<arrow::Schema> schema,
+    const ParquetOutputOptions& options, arrow::MemoryPool* pool) {
+  ARROW_ASSIGN_OR_RAISE(auto sink, arrow::io::FileOutputStream::Open(path));
+  parquet::WriterProperties::Builder builder;
+  builder.compression(options.compression)
+      ->memory_pool(pool)
+      ->max_row_group_length(options.max_row_group_rows);
+  if (!options.sorting_columns.empty()) {
+    builder.set_sorting_columns(options.sorting_columns);
+  }
+  if (options.write_page_index) {
+    builder.enable_write_page_index();
+  }
+  for (const auto& column : options.plain_columns) {
+    builder.disable_dictionary(column);
+  }
+  auto arrow_properties = parquet::ArrowWriterProperties::Builder()
+                              .set_use_threads(options.use_threads)
+                              ->build();
+  ARROW_ASSIGN_OR_RAISE(auto writer, parquet::arrow::FileWriter::Open(
+                                         *schema, pool, sink, builder.build(),
+                                         std::move(arrow_properties)));
+  return std::unique_ptr<ParquetOutput>(
+      new ParquetOutput(std::move(sink), std::move(schema), std::move(writer),
+                        options.background));
+}
+
+ParquetOutput::ParquetOutput(std::shared_ptr<arrow::io::OutputStream> sink,
+                             std::shared_ptr<arrow::Schema> schema,
+                             std::unique_ptr<parquet::arrow::FileWriter> writer,
+                             bool background)
+    : sink_(std::move(sink)),
+      schema_(std::move(schema)),
+      writer_(std::move(writer)) {
+  if (background) {
+    thread_ = std::thread([this] { Run(); });
+  }
+}
+
+ParquetOutput::~ParquetOutput() { StopBackground(); }
+
+arrow::Status ParquetOutput::WriteRowGroup(
+    const std::vector<std::shared_ptr<arrow::Array>>& columns) {
+  if (columns.empty() || columns.front()->length() == 0) {
+    return arrow::Status::OK();
+  }
+  ++num_row_groups_;
+  if (!thread_.joinable()) return Write(columns);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    is_idle_.wait(lock, [this] { return !has_pending_; });
+    ARROW_RETURN_NOT_OK(status_);
+    pending_ = columns;
+    has_pending_ = true;
+  }
+  has_work_.notify_one();
+  return arrow::Status::OK();
+}
+
+arrow::Status ParquetOutput::Close() {
+  StopBackground();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ARROW_RETURN_NOT_OK(status_);
+  }
+  ARROW_RETURN_NOT_OK(writer_->Close());
+  return sink_->Close();
+}
+
+int64_t ParquetOutput::background_nanos() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return background_nanos_;
+}
+
+arrow::Status ParquetOutput::Write(
+    const std::vector<std::shared_ptr<arrow::Array>>& columns) {
+  auto batch =
+      arrow::RecordBatch::Make(schema_, columns.front()->length(), columns);
+  // A buffered row group lets the writer encode its columns in parallel.
+  ARROW_RETURN_NOT_OK(writer_->NewBufferedRowGroup());
+  return writer_->WriteRecordBatch(*batch);
+}
+
+void ParquetOutput::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    has_work_.wait(lock, [this] { return has_pending_ || stopping_; });
+    if (!has_pending_) break;
+    lock.unlock();
+    const auto start = std::chrono::steady_clock::now();
+    auto status = Write(pending_);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    lock.lock();
+    background_nanos_ +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    status_ = std::move(status);
+    pending_.clear();
+    has_pending_ = false;
+    is_idle_.notify_one();
+  }
+}
+
+void ParquetOutput::StopBackground() {
+  if (!thread_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  has_work_.notify_one();
+  thread_.join();
+}
+
+}  // namespace whippet_sort
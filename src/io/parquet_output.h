@@ -0,0 +1,111 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arrow/io/type_fwd.h>
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+#include <arrow/util/type_fwd.h>
+#include <parquet/arrow/writer.h>
+#include <parquet/types.h>
+
+namespace whippet_sort {
+
+struct ParquetOutputOptions {
+  /// Any codec the Arrow build has, e.g. SNAPPY, LZ4 or ZSTD.
+  arrow::Compression::type compression = arrow::Compression::SNAPPY;
+  /// Rows of the largest row group passed to WriteRowGroup().
+  int64_t max_row_group_rows = 1024 * 1024;
+  /// Encodes the columns of a row group in parallel on Arrow's CPU pool.
+  bool use_threads = true;
+  /// Encodes and writes each row group on a background thread while the
+  /// caller produces the next one.
+  bool background = true;
+  /// The order of the rows, recorded as the sorting_columns of each row group.
+  std::vector<parquet::SortingColumn> sorting_columns;
+  /// Writes the column and offset indexes, so readers can skip pages by the
+  /// min and max of each page.
+  bool write_page_index = true;
+  /// Columns written with plain instead of dictionary encoding.
+  std::vector<std::string> plain_columns;
+};
+
+/// Writes the sorted output one row group at a time. Each row group is handed
+/// over as whole columns, so callers can gather the columns of one row group
+/// and drop them before producing the next. With a background writer, one
+/// more row group is held while it is written.
+class ParquetOutput {
+ public:
+  static arrow::Result<std::unique_ptr<ParquetOutput>> Open(
+      const std::string& path, std::shared_ptr<arrow::Schema> schema,
+      const ParquetOutputOptions& options, arrow::MemoryPool* pool);
+
+  /// Stops the background writer. The file is only complete after Close().
+  ~ParquetOutput();
+
+  ParquetOutput(const ParquetOutput&) = delete;
+  ParquetOutput& operator=(const ParquetOutput&) = delete;
+
+  /// `columns` are in schema order and all have the same length. With a
+  /// background writer, waits for the previous row group and returns its
+  /// error, if any.
+  arrow::Status WriteRowGroup(
+      const std::vector<std::shared_ptr<arrow::Array>>& columns);
+
+  arrow::Status Close();
+
+  int64_t num_row_groups() const { return num_row_groups_; }
+
+  /// Time spent encoding and writing row groups on the background thread.
+  int64_t background_nanos() const;
+
+ private:
+  ParquetOutput(std::shared_ptr<arrow::io::OutputStream> sink,
+                std::shared_ptr<arrow::Schema> schema,
+                std::unique_ptr<parquet::arrow::FileWriter> writer,
+                bool background);
+
+  arrow::Status Write(
+      const std::vector<std::shared_ptr<arrow::Array>>& columns);
+  void Run();
+  void StopBackground();
+
+  std::shared_ptr<arrow::io::OutputStream> sink_;
+  std::shared_ptr<arrow::Schema> schema_;
+  std::unique_ptr<parquet::arrow::FileWriter> writer_;
+  int64_t num_row_groups_ = 0;
+
+  mutable std::mutex mutex_;
+  std::condition_variable has_work_;
+  std::condition_variable is_idle_;
+  /// The row group handed to the background thread, while it is written.
+  std::vector<std::shared_ptr<arrow::Array>> pending_;
+  bool has_pending_ = false;
+  bool stopping_ = false;
+  arrow::Status status_;
+  int64_t background_nanos_ = 0;
+  std::thread thread_;
+};
+
+}  // namespace whippet_sort
@@ -0,0 +1,143 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include <arrow/result.h>
+#include <arrow/status.h>
+
+namespace whippet_sort {
+
+/// Reads items 0, 1, ... on a background thread, up to `depth` items ahead of
+/// the consumer, so that decoding the next item overlaps with the work on the
+/// current one.
+///
+/// The reads run in order, one at a time. The consumer must not use what the
+/// read function uses, e.g. the same ParquetInput, while the Prefetcher is
+/// alive. Reading stops at the first error, which Next() returns in place of
+/// its item.
+template <typename T>
+class Prefetcher {
+ public:
+  using ReadFunction = std::function<arrow::Result<T>(int)>;
+
+  Prefetcher(int num_items, ReadFunction read, int depth = 1)
+      : num_items_(num_items),
+        read_(std::move(read)),
+        depth_(std::max(depth, 1)) {
+    thread_ = std::thread([this] { Run(); });
+  }
+
+  /// Waits for the read in progress, if any, and drops the unread items.
+  ~Prefetcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    has_space_.notify_all();
+    thread_.join();
+  }
+
+  Prefetcher(const Prefetcher&) = delete;
+  Prefetcher& operator=(const Prefetcher&) = delete;
+
+  /// Returns the next item, waiting for its read to finish if needed.
+  arrow::Result<T> Next() {
+    const auto start = Clock::now();
+    std::unique_lock<std::mutex> lock(mutex_);
+    has_item_.wait(lock, [this] { return !items_.empty() || done_; });
+    wait_nanos_ += Nanos(Clock::now() - start);
+    if (items_.empty()) {
+      return arrow::Status::Invalid("no more items to prefetch");
+    }
+    auto item = std::move(items_.front());
+    items_.pop_front();
+    lock.unlock();
+    has_space_.notify_one();
+    return item;
+  }
+
+  /// Time spent in the read function on the background thread.
+  int64_t read_nanos() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return read_nanos_;
+  }
+
+  /// Time the consumer spent waiting in Next().
+  int64_t wait_nanos() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return wait_nanos_;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  static int64_t Nanos(Clock::duration elapsed) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+        .count();
+  }
+
+  void Run() {
+    for (int i = 0; i < num_items_; ++i) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        has_space_.wait(lock, [this] {
+          return stopping_ || static_cast<int>(items_.size()) < depth_;
+        });
+        if (stopping_) break;
+      }
+      const auto start = Clock::now();
+      arrow::Result<T> item = read_(i);
+      const bool ok = item.ok();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        read_nanos_ += Nanos(Clock::now() - start);
+        items_.push_back(std::move(item));
+      }
+      has_item_.notify_one();
+      if (!ok) break;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_ = true;
+    }
+    has_item_.notify_one();
+  }
+
+  const int num_items_;
+  const ReadFunction read_;
+  const int depth_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable has_item_;
+  std::condition_variable has_space_;
+  std::deque<arrow::Result<T>> items_;
+  bool stopping_ = false;
+  bool done_ = false;
+  int64_t read_nanos_ = 0;
+  int64_t wait_nanos_ = 0;
+  std::thread thread_;
+};
+
+}  // namespace whippet_sort
@@ -0,0 +1,158 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "io/spill_file.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <system_error>
+#include <utility>
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/api.h>
+#include <arrow/util/compression.h>
+
+namespace whippet_sort {
+
+bool IsSpillCompressionSupported(arrow::Compression::type compression) {
+  return compression == arrow::Compression::UNCOMPRESSED ||
+         compression == arrow::Compression::LZ4_FRAME ||
+         compression == arrow::Compression::ZSTD;
+}
+
+arrow::Result<std::unique_ptr<SpillWriter>> SpillWriter::Open(
+    const std::string& path, const std::shared_ptr<arrow::Schema>& schema,
+    arrow::Compression::type compression, arrow::MemoryPool* pool) {
+  if (!IsSpillCompressionSupported(compression)) {
+    return arrow::Status::NotImplemented(
+        "spill compression ",
+        arrow::util::Codec::GetCodecAsString(compression));
+  }
+  auto options = arrow::ipc::IpcWriteOptions::Defaults();
+  options.memory_pool = pool;
+  if (compression != arrow::Compression::UNCOMPRESSED) {
+    ARROW_ASSIGN_OR_RAISE(options.codec,
+                          arrow::util::Codec::Create(compression));
+  }
+  ARROW_ASSIGN_OR_RAISE(auto sink, arrow::io::FileOutputStream::Open(path));
+  ARROW_ASSIGN_OR_RAISE(auto writer,
+                        arrow::ipc::MakeFileWriter(sink, schema, options));
+  return std::unique_ptr<SpillWriter>(
+      new SpillWriter(std::move(sink), std::move(writer)));
+}
+
+SpillWriter::SpillWriter(std::shared_ptr<arrow::io::OutputStream> sink,
+                         std::shared_ptr<arrow::ipc::RecordBatchWriter> writer)
+    : sink_(std::move(sink)), writer_(std::move(writer)) {}
+
+arrow::Status SpillWriter::Write(const arrow::RecordBatch& batch) {
+  ARROW_RETURN_NOT_OK(writer_->WriteRecordBatch(batch));
+  num_rows_ += batch.num_rows();
+  ARROW_ASSIGN_OR_RAISE(bytes_written_, sink_->Tell());
+  return arrow::Status::OK();
+}
+
+arrow::Status SpillWriter::WriteTable(const arrow::Table& table,
+                                      int64_t batch_rows) {
+  arrow::TableBatchReader reader(table);
+  reader.set_chunksize(batch_rows);
+  std::shared_ptr<arrow::RecordBatch> batch;
+  while (true) {
+    ARROW_RETURN_NOT_OK(reader.ReadNext(&batch));
+    if (batch == nullptr) return arrow::Status::OK();
+    ARROW_RETURN_NOT_OK(Write(*batch));
+  }
+}
+
+arrow::Status SpillWriter::Close() {
+  ARROW_RETURN_NOT_OK(writer_->Close());
+  ARROW_ASSIGN_OR_RAISE(bytes_written_, sink_->Tell());
+  return sink_->Close();
+}
+
+arrow::Result<std::unique_ptr<SpillReader>> SpillReader::Open(
+    const std::string& path, arrow::MemoryPool* pool, bool memory_map) {
+  std::shared_ptr<arrow::io::RandomAccessFile> file;
+  if (memory_map) {
+    ARROW_ASSIGN_OR_RAISE(file, arrow::io::MemoryMappedFile::Open(
+                                    path, arrow::io::FileMode::READ));
+  } else {
+    ARROW_ASSIGN_OR_RAISE(file, arrow::io::ReadableFile::Open(path, pool));
+  }
+  ARROW_ASSIGN_OR_RAISE(int64_t file_size, file->GetSize());
+  auto options = arrow::ipc::IpcReadOptions::Defaults();
+  options.memory_pool = pool;
+  ARROW_ASSIGN_OR_RAISE(auto reader,
+                        arrow::ipc::RecordBatchFileReader::Open(file, options));
+  return std::unique_ptr<SpillReader>(
+      new SpillReader(std::move(file), std::move(reader), file_size));
+}
+
+SpillReader::SpillReader(
+    std::shared_ptr<arrow::io::RandomAccessFile> file,
+    std::shared_ptr<arrow::ipc::RecordBatchFileReader> reader,
+    int64_t file_size)
+    : file_(std::move(file)),
+      reader_(std::move(reader)),
+      schema_(reader_->schema()),
+      file_size_(file_size) {}
+
+int SpillReader::num_batches() const {
+  return reader_->num_record_batches();
+}
+
+arrow::Result<std::shared_ptr<arrow::RecordBatch>> SpillReader::ReadBatch(
+    int batch) {
+  return reader_->ReadRecordBatch(batch);
+}
+
+SpillFiles::SpillFiles(std::string directory)
+    : directory_(std::move(directory)) {
+  if (directory_.empty()) {
+    std::error_code error;
+    directory_ = std::filesystem::temp_directory_path(error).string();
+    if (error) directory_ = ".";
+  }
+  // Distinguishes the files of concurrent sorts, also across processes.
+  static std::atomic<int64_t> next_sort{0};
+  prefix_ = "whippet_sort_spill_" + std::to_string(::getpid()) + "_" +
+            std::to_string(next_sort.fetch_add(1)) + "_";
+}
+
+SpillFiles::~SpillFiles() {
+  for (const auto& path : paths_) {
+    std::error_code error;
+    std::filesystem::remove(path, error);
+  }
+}
+
+std::string SpillFiles::NewPath() {
+  auto path = (std::filesystem::path(directory_) /
+               (prefix_ + std::to_string(next_id_++) + ".arrow"))
+                  .string();
+  paths_.push_back(path);
+  return path;
+}
+
+void SpillFiles::Remove(const std::string& path) {
+  std::error_code error;
+  std::filesystem::remove(path, error);
+  paths_.erase(std::remove(paths_.begin(), paths_.end(), path), paths_.end());
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,113 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arrow/io/type_fwd.h>
+#include <arrow/ipc/type_fwd.h>
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+#include <arrow/util/type_fwd.h>
+
+namespace whippet_sort {
+
+/// Whether Arrow IPC can compress spill files with `compression`.
+bool IsSpillCompressionSupported(arrow::Compression::type compression);
+
+/// Writes one sorted run as an Arrow IPC file. Batches are compressed with
+/// LZ4 or ZSTD, if asked, and are written whole, so a run is read back with
+/// one large sequential read per batch.
+class SpillWriter {
+ public:
+  static arrow::Result<std::unique_ptr<SpillWriter>> Open(
+      const std::string& path, const std::shared_ptr<arrow::Schema>& schema,
+      arrow::Compression::type compression, arrow::MemoryPool* pool);
+
+  arrow::Status Write(const arrow::RecordBatch& batch);
+
+  /// Writes `table` in batches of at most `batch_rows` rows.
+  arrow::Status WriteTable(const arrow::Table& table, int64_t batch_rows);
+
+  arrow::Status Close();
+
+  /// File bytes written so far; final after Close().
+  int64_t bytes_written() const { return bytes_written_; }
+  int64_t num_rows() const { return num_rows_; }
+
+ private:
+  SpillWriter(std::shared_ptr<arrow::io::OutputStream> sink,
+              std::shared_ptr<arrow::ipc::RecordBatchWriter> writer);
+
+  std::shared_ptr<arrow::io::OutputStream> sink_;
+  std::shared_ptr<arrow::ipc::RecordBatchWriter> writer_;
+  int64_t bytes_written_ = 0;
+  int64_t num_rows_ = 0;
+};
+
+/// Reads a run written by SpillWriter back one batch at a time.
+class SpillReader {
+ public:
+  /// With `memory_map`, the batches of an uncompressed file point into the
+  /// mapped file instead of being copied into `pool`.
+  static arrow::Result<std::unique_ptr<SpillReader>> Open(
+      const std::string& path, arrow::MemoryPool* pool,
+      bool memory_map = false);
+
+  const std::shared_ptr<arrow::Schema>& schema() const { return schema_; }
+  int num_batches() const;
+
+  arrow::Result<std::shared_ptr<arrow::RecordBatch>> ReadBatch(int batch);
+
+  /// Size of the spill file; a merge reads all of it once.
+  int64_t file_size() const { return file_size_; }
+
+ private:
+  SpillReader(std::shared_ptr<arrow::io::RandomAccessFile> file,
+              std::shared_ptr<arrow::ipc::RecordBatchFileReader> reader,
+              int64_t file_size);
+
+  std::shared_ptr<arrow::io::RandomAccessFile> file_;
+  std::shared_ptr<arrow::ipc::RecordBatchFileReader> reader_;
+  std::shared_ptr<arrow::Schema> schema_;
+  int64_t file_size_;
+};
+
+/// Hands out the paths of the spill files of one sort and removes the files
+/// that are still there when it goes away.
+class SpillFiles {
+ public:
+  /// An empty `directory` uses the system temporary directory.
+  explicit SpillFiles(std::string directory);
+  ~SpillFiles();
+
+  SpillFiles(const SpillFiles&) = delete;
+  SpillFiles& operator=(const SpillFiles&) = delete;
+
+  std::string NewPath();
+  void Remove(const std::string& path);
+
+ private:
+  std::string directory_;
+  std::string prefix_;
+  int64_t next_id_ = 0;
+  std::vector<std::string> paths_;
+};
+
+}  // namespace whippet_sort
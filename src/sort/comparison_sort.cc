@@ -0,0 +1,108 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "sort/comparison_sort.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace whippet_sort {
+
+namespace {
+
+// Calls `sort(less)` with the row order of `keys`.
+template <typename Sort>
+void WithRowOrder(const NormalizedKeys& keys, const KeyNormalizer& normalizer,
+                  Sort&& sort) {
+  const int32_t width = keys.key_width;
+  if (normalizer.exact()) {
+    sort([&](uint64_t a, uint64_t b) {
+      int cmp = CompareNormalizedKeys(keys.row(a), keys.row(b), width);
+      return cmp != 0 ? cmp < 0 : a < b;
+    });
+    return;
+  }
+  sort([&](uint64_t a, uint64_t b) {
+    int cmp = CompareNormalizedKeys(keys.row(a), keys.row(b), width);
+    if (cmp == 0) cmp = normalizer.CompareTail(a, b);
+    return cmp != 0 ? cmp < 0 : a < b;
+  });
+}
+
+}  // namespace
+
+void ComparisonSort(const NormalizedKeys& keys, const KeyNormalizer& normalizer,
+                    uint64_t* row_ids, int64_t num_rows) {
+  WithRowOrder(keys, normalizer, [&](auto less) {
+    std::sort(row_ids, row_ids + num_rows, less);
+  });
+}
+
+int64_t RunMergeSort(const NormalizedKeys& keys,
+                     const KeyNormalizer& normalizer, uint64_t* row_ids,
+                     int64_t num_rows) {
+  int64_t num_runs = 0;
+  WithRowOrder(keys, normalizer, [&](auto less) {
+    // Run i is [bounds[i], bounds[i + 1]). Descending runs are reversed;
+    // they are strictly descending, so reversing them keeps ties in order.
+    std::vector<int64_t> bounds = {0};
+    for (int64_t begin = 0; begin < num_rows;) {
+      int64_t end = begin + 1;
+      if (end < num_rows && less(row_ids[end], row_ids[end - 1])) {
+        while (end < num_rows && less(row_ids[end], row_ids[end - 1])) ++end;
+        std::reverse(row_ids + begin, row_ids + end);
+      } else {
+        while (end < num_rows && !less(row_ids[end], row_ids[end - 1])) ++end;
+      }
+      bounds.push_back(end);
+      begin = end;
+    }
+    num_runs = static_cast<int64_t>(bounds.size()) - 1;
+    if (num_runs <= 1) return;
+
+    std::vector<uint64_t> scratch(num_rows);
+    uint64_t* from = row_ids;
+    uint64_t* to = scratch.data();
+    while (bounds.size() > 2) {
+      std::vector<int64_t> merged = {0};
+      for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+        if (i + 2 < bounds.size()) {
+          std::merge(from + bounds[i], from + bounds[i + 1],
+                     from + bounds[i + 1], from + bounds[i + 2],
+                     to + bounds[i], less);
+          merged.push_back(bounds[i + 2]);
+        } else {
+          std::copy(from + bounds[i], from + bounds[i + 1], to + bounds[i]);
+          merged.push_back(bounds[i + 1]);
+        }
+      }
+      std::swap(from, to);
+      bounds = std::move(merged);
+    }
+    if (from != row_ids) std::copy(from, from + num_rows, row_ids);
+  });
+  return num_runs;
+}
+
+void PartialComparisonSort(const NormalizedKeys& keys,
+                           const KeyNormalizer& normalizer, uint64_t* row_ids,
+                           int64_t num_rows, int64_t k) {
+  k = std::min(k, num_rows);
+  WithRowOrder(keys, normalizer, [&](auto less) {
+    std::partial_sort(row_ids, row_ids + k, row_ids + num_rows, less);
+  });
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,45 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+
+#include "sort/key_normalizer.h"
+
+namespace whippet_sort {
+
+/// Sorts `row_ids`, which index rows of `keys`, by their normalized keys.
+/// Ties on the normalized key are broken by `normalizer.CompareTail` and then
+/// by row id, so the result is the same as a stable sort.
+void ComparisonSort(const NormalizedKeys& keys, const KeyNormalizer& normalizer,
+                    uint64_t* row_ids, int64_t num_rows);
+
+/// Like ComparisonSort, but finds the runs of ascending and of strictly
+/// descending rows already in `row_ids` and merges them bottom-up, so nearly
+/// sorted input takes one pass per doubling of the run length instead of a
+/// full sort. Returns the number of runs found; 1 means `row_ids` already was
+/// in sorted order.
+int64_t RunMergeSort(const NormalizedKeys& keys,
+                     const KeyNormalizer& normalizer, uint64_t* row_ids,
+                     int64_t num_rows);
+
+/// Like ComparisonSort, but only moves the `k` smallest rows to the front of
+/// `row_ids`, in order, keeping a bounded heap of k rows. The order of the
+/// remaining rows is unspecified.
+void PartialComparisonSort(const NormalizedKeys& keys,
+                           const KeyNormalizer& normalizer, uint64_t* row_ids,
+                           int64_t num_rows, int64_t k);
+
+}  // namespace whippet_sort
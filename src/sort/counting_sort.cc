@@ -0,0 +1,91 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+#include "sort/counting_sort.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <arrow/buffer.h>
+
+namespace whippet_sort {
+
+namespace {
+
+// Rows scanned between checks whether too many key bytes vary already.
+constexpr int64_t kVaryingCheckRows = 4096;
+
+}  // namespace
+
+arrow::Result<bool> CountingSort(NormalizedKeys* keys,
+                                 const KeyNormalizer& normalizer,
+                                 arrow::MemoryPool* pool) {
+  if (!normalizer.exact()) return false;
+  const int64_t num_rows = keys->num_rows;
+  const int32_t width = keys->key_width;
+  const int32_t row_width = keys->row_width;
+  if (num_rows <= 1) return true;
+
+  // Find the key bytes in which the rows differ from the first one.
+  std::vector<uint8_t> varying(width, 0);
+  const uint8_t* first = keys->row(0);
+  auto count_varying = [&] {
+    int32_t count = 0;
+    for (uint8_t bits : varying) count += bits != 0;
+    return count;
+  };
+  for (int64_t begin = 1; begin < num_rows; begin += kVaryingCheckRows) {
+    const int64_t end = std::min(num_rows, begin + kVaryingCheckRows);
+    for (int64_t i = begin; i < end; ++i) {
+      const uint8_t* row = keys->row(i);
+      for (int32_t byte = 0; byte < width; ++byte) {
+        varying[byte] |= row[byte] ^ first[byte];
+      }
+    }
+    if (count_varying() > kMaxCountingSortBytes) return false;
+  }
+  int32_t high = -1;
+  int32_t low = -1;
+  for (int32_t byte = 0; byte < width; ++byte) {
+    if (varying[byte] == 0) continue;
+    high = low;
+    low = byte;
+  }
+  // All keys are equal, so the input order is the sorted order.
+  if (low < 0) return true;
+
+  auto digit = [&](const uint8_t* row) -> uint32_t {
+    return (high >= 0 ? static_cast<uint32_t>(row[high]) << 8 : 0) | row[low];
+  };
+  std::vector<int64_t> offsets((high >= 0 ? 1 << 16 : 1 << 8) + 1, 0);
+  for (int64_t i = 0; i < num_rows; ++i) {
+    ++offsets[digit(keys->row(i)) + 1];
+  }
+  for (size_t d = 1; d < offsets.size(); ++d) {
+    offsets[d] += offsets[d - 1];
+  }
+  ARROW_ASSIGN_OR_RAISE(auto sorted,
+                        arrow::AllocateBuffer(num_rows * row_width, pool));
+  uint8_t* out = sorted->mutable_data();
+  for (int64_t i = 0; i < num_rows; ++i) {
+    const uint8_t* row = keys->row(i);
+    std::memcpy(out + offsets[digit(row)]++ * row_width, row, row_width);
+  }
+  std::memcpy(keys->mutable_row(0), out, num_rows * row_width);
+  return true;
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,42 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+#pragma once
+
+#include <cstdint>
+
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+
+#include "sort/key_normalizer.h"
+
+namespace whippet_sort {
+
+/// Key bytes a counting sort buckets on at most.
+constexpr int32_t kMaxCountingSortBytes = 2;
+
+/// Sorts normalized keys that carry their row ids, reordering the rows of
+/// `keys` in place, with one counting pass if the rows differ in at most two
+/// key bytes: few distinct integers, or the codes of a small dictionary.
+/// Rows with equal keys keep their input order. Requires an exact
+/// normalizer.
+///
+/// Returns false, leaving `keys` as they are, if the rows differ in more
+/// bytes or the normalizer is not exact.
+arrow::Result<bool> CountingSort(NormalizedKeys* keys,
+                                 const KeyNormalizer& normalizer,
+                                 arrow::MemoryPool* pool);
+
+}  // namespace whippet_sort
@@ -0,0 +1,182 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "sort/dictionary_collation.h"
+
+#include <algorithm>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+#include <arrow/api.h>
+#include <arrow/compute/api.h>
+
+#include "sort/gather.h"
+
+namespace whippet_sort {
+
+namespace {
+
+bool IsLargeBinaryLike(const arrow::DataType& type) {
+  return type.id() == arrow::Type::LARGE_STRING ||
+         type.id() == arrow::Type::LARGE_BINARY;
+}
+
+arrow::Status CheckValueType(const arrow::DataType& type) {
+  switch (type.id()) {
+    case arrow::Type::STRING:
+    case arrow::Type::BINARY:
+    case arrow::Type::LARGE_STRING:
+    case arrow::Type::LARGE_BINARY:
+      return arrow::Status::OK();
+    default:
+      return arrow::Status::NotImplemented("collating dictionary of type ",
+                                           type.ToString());
+  }
+}
+
+std::string_view ValueAt(const arrow::Array& values, int64_t i) {
+  if (IsLargeBinaryLike(*values.type())) {
+    return static_cast<const arrow::LargeBinaryArray&>(values).GetView(i);
+  }
+  return static_cast<const arrow::BinaryArray&>(values).GetView(i);
+}
+
+template <typename IndexType>
+void AppendCodes(const arrow::Array& indices,
+                 const std::vector<uint32_t>& collation,
+                 arrow::UInt32Builder* codes) {
+  const auto& typed =
+      static_cast<const arrow::NumericArray<IndexType>&>(indices);
+  const auto* raw = typed.raw_values();
+  if (typed.null_count() == 0) {
+    for (int64_t i = 0; i < typed.length(); ++i) {
+      codes->UnsafeAppend(collation[raw[i]]);
+    }
+    return;
+  }
+  for (int64_t i = 0; i < typed.length(); ++i) {
+    if (typed.IsNull(i)) {
+      codes->UnsafeAppendNull();
+    } else {
+      codes->UnsafeAppend(collation[raw[i]]);
+    }
+  }
+}
+
+arrow::Status AppendCodes(const arrow::Array& indices,
+                          const std::vector<uint32_t>& collation,
+                          arrow::UInt32Builder* codes) {
+  switch (indices.type_id()) {
+    case arrow::Type::INT8:
+      AppendCodes<arrow::Int8Type>(indices, collation, codes);
+      break;
+    case arrow::Type::INT16:
+      AppendCodes<arrow::Int16Type>(indices, collation, codes);
+      break;
+    case arrow::Type::INT32:
+      AppendCodes<arrow::Int32Type>(indices, collation, codes);
+      break;
+    case arrow::Type::INT64:
+      AppendCodes<arrow::Int64Type>(indices, collation, codes);
+      break;
+    default:
+      return arrow::Status::NotImplemented("dictionary indices of type ",
+                                           indices.type()->ToString());
+  }
+  return arrow::Status::OK();
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> BuildDictionary(
+    const std::shared_ptr<arrow::DataType>& type,
+    const std::vector<std::string_view>& values, arrow::MemoryPool* pool) {
+  std::unique_ptr<arrow::ArrayBuilder> builder;
+  ARROW_RETURN_NOT_OK(arrow::MakeBuilder(pool, type, &builder));
+  ARROW_RETURN_NOT_OK(builder->Reserve(static_cast<int64_t>(values.size())));
+  for (auto value : values) {
+    if (IsLargeBinaryLike(*type)) {
+      auto* large_builder =
+          static_cast<arrow::LargeBinaryBuilder*>(builder.get());
+      ARROW_RETURN_NOT_OK(large_builder->Append(value));
+    } else {
+      ARROW_RETURN_NOT_OK(
+          static_cast<arrow::BinaryBuilder*>(builder.get())->Append(value));
+    }
+  }
+  std::shared_ptr<arrow::Array> dictionary;
+  ARROW_RETURN_NOT_OK(builder->Finish(&dictionary));
+  return dictionary;
+}
+
+}  // namespace
+
+arrow::Result<CollatedColumn> CollateDictionaryColumn(
+    const arrow::ChunkedArray& column, arrow::MemoryPool* pool) {
+  if (column.type()->id() != arrow::Type::DICTIONARY) {
+    return arrow::Status::Invalid("expect a dictionary column, got ",
+                                  column.type()->ToString());
+  }
+  const auto& dict_type =
+      static_cast<const arrow::DictionaryType&>(*column.type());
+  ARROW_RETURN_NOT_OK(CheckValueType(*dict_type.value_type()));
+
+  // The dictionaries are small, so the views into them are sorted directly.
+  std::vector<std::string_view> merged;
+  for (const auto& chunk : column.chunks()) {
+    const auto& dictionary =
+        *static_cast<const arrow::DictionaryArray&>(*chunk).dictionary();
+    for (int64_t i = 0; i < dictionary.length(); ++i) {
+      merged.push_back(ValueAt(dictionary, i));
+    }
+  }
+  std::sort(merged.begin(), merged.end());
+  merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+  if (merged.size() > std::numeric_limits<uint32_t>::max()) {
+    return arrow::Status::CapacityError("too many distinct dictionary values");
+  }
+
+  arrow::UInt32Builder codes(pool);
+  ARROW_RETURN_NOT_OK(codes.Reserve(column.length()));
+  std::vector<uint32_t> collation;
+  for (const auto& chunk : column.chunks()) {
+    const auto& typed = static_cast<const arrow::DictionaryArray&>(*chunk);
+    const auto& dictionary = *typed.dictionary();
+    collation.resize(dictionary.length());
+    for (int64_t i = 0; i < dictionary.length(); ++i) {
+      auto it = std::lower_bound(merged.begin(), merged.end(),
+                                 ValueAt(dictionary, i));
+      collation[i] = static_cast<uint32_t>(it - merged.begin());
+    }
+    ARROW_RETURN_NOT_OK(AppendCodes(*typed.indices(), collation, &codes));
+  }
+
+  CollatedColumn collated;
+  ARROW_ASSIGN_OR_RAISE(collated.dictionary,
+                        BuildDictionary(dict_type.value_type(), merged, pool));
+  ARROW_RETURN_NOT_OK(codes.Finish(&collated.codes));
+  return collated;
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> TakeCollated(
+    const CollatedColumn& column, const arrow::Array& indices,
+    arrow::MemoryPool* pool) {
+  // The codes are at random rows, while the dictionary is small enough to
+  // stay in cache.
+  ARROW_ASSIGN_OR_RAISE(auto codes, Gather(*column.codes, indices, pool));
+  arrow::compute::ExecContext ctx(pool);
+  auto take_options = arrow::compute::TakeOptions::NoBoundsCheck();
+  return arrow::compute::Take(*column.dictionary, *codes, take_options, &ctx);
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,49 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+
+namespace whippet_sort {
+
+/// A string key column replaced by small integer codes.
+///
+/// `codes` is a UInt32 array with one entry per row and the nulls of the
+/// input. Code c stands for `dictionary[c]`, and the dictionary is sorted
+/// bytewise, so comparing codes is the same as comparing the strings.
+struct CollatedColumn {
+  std::shared_ptr<arrow::Array> codes;
+  std::shared_ptr<arrow::Array> dictionary;
+};
+
+/// Collates a dictionary-encoded column as produced by the Parquet reader with
+/// `read_dictionary` on, i.e. one chunk per row group, each with its own
+/// dictionary. The dictionaries of all chunks are merged into one sorted
+/// dictionary, and a collation map from local index to global code is built
+/// once per chunk. The strings of the rows are never materialized.
+arrow::Result<CollatedColumn> CollateDictionaryColumn(
+    const arrow::ChunkedArray& column, arrow::MemoryPool* pool);
+
+/// Decodes the codes at `indices` back to the strings of the dictionary.
+arrow::Result<std::shared_ptr<arrow::Array>> TakeCollated(
+    const CollatedColumn& column, const arrow::Array& indices,
+    arrow::MemoryPool* pool);
+
+}  // namespace whippet_sort
@@ -0,0 +1,179 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "sort/gather.h"
+
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#include <arrow/api.h>
+#include <arrow/compute/api.h>
+#include <arrow/type_traits.h>
+#include <arrow/util/bit_util.h>
+
+#include "sort/row_kernels.h"
+
+namespace whippet_sort {
+
+namespace {
+
+// Rows ahead of the current one whose source a gather prefetches, as in the
+// row kernels.
+constexpr int64_t kPrefetchDistance = 16;
+
+// Gathers the validity bits of rows `ids` of `values`. Leaves `validity`
+// null if `values` has no nulls.
+arrow::Status GatherValidity(const arrow::ArrayData& values,
+                             const uint64_t* ids, int64_t n,
+                             arrow::MemoryPool* pool,
+                             std::shared_ptr<arrow::Buffer>* validity,
+                             int64_t* null_count) {
+  *null_count = 0;
+  if (values.GetNullCount() == 0) return arrow::Status::OK();
+  ARROW_ASSIGN_OR_RAISE(*validity, arrow::AllocateEmptyBitmap(n, pool));
+  const uint8_t* bits = values.buffers[0]->data();
+  uint8_t* out = (*validity)->mutable_data();
+  for (int64_t i = 0; i < n; ++i) {
+    const auto row = values.offset + static_cast<int64_t>(ids[i]);
+    if (arrow::bit_util::GetBit(bits, row)) {
+      arrow::bit_util::SetBit(out, i);
+    } else {
+      ++*null_count;
+    }
+  }
+  return arrow::Status::OK();
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> GatherFixedWidth(
+    const arrow::ArrayData& values, int32_t byte_width, const uint64_t* ids,
+    int64_t n, arrow::MemoryPool* pool) {
+  ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::Buffer> data,
+                        arrow::AllocateBuffer(n * byte_width, pool));
+  internal::GetRowKernels().gather_rows(
+      values.buffers[1]->data() + values.offset * byte_width, ids, n,
+      byte_width, data->mutable_data());
+  std::shared_ptr<arrow::Buffer> validity;
+  int64_t null_count = 0;
+  ARROW_RETURN_NOT_OK(
+      GatherValidity(values, ids, n, pool, &validity, &null_count));
+  return arrow::MakeArray(arrow::ArrayData::Make(
+      values.type, n, {std::move(validity), std::move(data)}, null_count));
+}
+
+template <typename Offset>
+arrow::Result<std::shared_ptr<arrow::Array>> GatherBinary(
+    const arrow::ArrayData& values, const uint64_t* ids, int64_t n,
+    arrow::MemoryPool* pool) {
+  const Offset* offsets = values.GetValues<Offset>(1);
+  const uint8_t* bytes = values.buffers[2]->data();
+  ARROW_ASSIGN_OR_RAISE(
+      std::shared_ptr<arrow::Buffer> out_offsets_buffer,
+      arrow::AllocateBuffer((n + 1) * sizeof(Offset), pool));
+  auto* out_offsets =
+      reinterpret_cast<Offset*>(out_offsets_buffer->mutable_data());
+
+  // The lengths first, to size the value buffer.
+  int64_t total = 0;
+  out_offsets[0] = 0;
+  for (int64_t i = 0; i < n; ++i) {
+    if (i + kPrefetchDistance < n) {
+      __builtin_prefetch(offsets + ids[i + kPrefetchDistance]);
+    }
+    total += offsets[ids[i] + 1] - offsets[ids[i]];
+    if (total > std::numeric_limits<Offset>::max()) {
+      return arrow::Status::CapacityError("gathered ", values.type->ToString(),
+                                          " values exceed their offsets");
+    }
+    out_offsets[i + 1] = static_cast<Offset>(total);
+  }
+
+  // Then the values. Finding the bytes of a row needs its offset, so the
+  // offsets are prefetched twice as far ahead as the bytes.
+  ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::Buffer> data,
+                        arrow::AllocateBuffer(total, pool));
+  uint8_t* out = data->mutable_data();
+  for (int64_t i = 0; i < n; ++i) {
+    if (i + 2 * kPrefetchDistance < n) {
+      __builtin_prefetch(offsets + ids[i + 2 * kPrefetchDistance]);
+    }
+    if (i + kPrefetchDistance < n) {
+      __builtin_prefetch(bytes + offsets[ids[i + kPrefetchDistance]]);
+    }
+    const Offset begin = offsets[ids[i]];
+    std::memcpy(out + out_offsets[i], bytes + begin,
+                out_offsets[i + 1] - out_offsets[i]);
+  }
+
+  std::shared_ptr<arrow::Buffer> validity;
+  int64_t null_count = 0;
+  ARROW_RETURN_NOT_OK(
+      GatherValidity(values, ids, n, pool, &validity, &null_count));
+  return arrow::MakeArray(arrow::ArrayData::Make(
+      values.type, n,
+      {std::move(validity), std::move(out_offsets_buffer), std::move(data)},
+      null_count));
+}
+
+// Bytes per value if `type` is gathered as fixed-width values, else 0.
+int32_t FixedByteWidth(const arrow::DataType& type) {
+  if (type.id() == arrow::Type::DICTIONARY ||
+      type.id() == arrow::Type::EXTENSION ||
+      !arrow::is_fixed_width(type.id())) {
+    return 0;
+  }
+  const int bit_width =
+      static_cast<const arrow::FixedWidthType&>(type).bit_width();
+  return bit_width > 0 && bit_width % 8 == 0 ? bit_width / 8 : 0;
+}
+
+}  // namespace
+
+arrow::Result<std::shared_ptr<arrow::Array>> Gather(
+    const arrow::Array& values, const arrow::Array& row_ids,
+    arrow::MemoryPool* pool) {
+  if (row_ids.type_id() == arrow::Type::UINT64 && row_ids.null_count() == 0) {
+    const uint64_t* ids =
+        static_cast<const arrow::UInt64Array&>(row_ids).raw_values();
+    const int64_t n = row_ids.length();
+    const auto& data = *values.data();
+    switch (values.type_id()) {
+      case arrow::Type::STRING:
+      case arrow::Type::BINARY:
+        return GatherBinary<int32_t>(data, ids, n, pool);
+      case arrow::Type::LARGE_STRING:
+      case arrow::Type::LARGE_BINARY:
+        return GatherBinary<int64_t>(data, ids, n, pool);
+      default:
+        break;
+    }
+    if (const int32_t byte_width = FixedByteWidth(*values.type())) {
+      return GatherFixedWidth(data, byte_width, ids, n, pool);
+    }
+  }
+  arrow::compute::ExecContext ctx(pool);
+  return arrow::compute::Take(values, row_ids,
+                              arrow::compute::TakeOptions::NoBoundsCheck(),
+                              &ctx);
+}
+
+int64_t GatheredBytes(const arrow::Array& array) {
+  int64_t bytes = 0;
+  for (const auto& buffer : array.data()->buffers) {
+    if (buffer != nullptr) bytes += buffer->size();
+  }
+  return bytes;
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,43 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+
+namespace whippet_sort {
+
+/// Returns the rows `row_ids` (UInt64, without nulls) of `values`, as
+/// arrow::compute::Take does, for the gather of the sorted output.
+///
+/// The row ids of a sort are random positions in the input column, so each
+/// row is a cache miss. Fixed-width values are copied with the SIMD row
+/// gather of the sort, and string and binary values with their own loop;
+/// both prefetch the source row a fixed distance ahead so the misses of
+/// consecutive rows overlap. Booleans, dictionaries and nested types are
+/// passed to Take.
+arrow::Result<std::shared_ptr<arrow::Array>> Gather(
+    const arrow::Array& values, const arrow::Array& row_ids,
+    arrow::MemoryPool* pool);
+
+/// Bytes of the value, offset and validity buffers of `array`, the bytes a
+/// gather writes.
+int64_t GatheredBytes(const arrow::Array& array);
+
+}  // namespace whippet_sort
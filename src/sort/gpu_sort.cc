@@ -0,0 +1,83 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "sort/gpu_sort.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace whippet_sort {
+
+namespace {
+
+// Device bytes per row besides the rows themselves: two buffers of 64-bit
+// key words and two of 32-bit row positions for the CUB double buffers, and
+// the 64-bit row ids copied back.
+constexpr int64_t kGpuBytesPerRow = 2 * 8 + 2 * 4 + 8;
+
+// CUB's scratch space and the CUDA context take this share of the free
+// memory at most.
+constexpr double kGpuMemoryHeadroom = 0.9;
+
+// Throughputs that set the GPU against the CPU sort in EstimateGpuSort().
+// Conservative for current data center GPUs: key words sorted per second by
+// one 64-bit key/32-bit value pass of CUB's radix sort, including the gather
+// of the next word.
+constexpr double kGpuWordsPerSecond = 1.5e9;
+// Normalized key bytes radix sorted and merged per second and sort thread,
+// measured on the TPC-H queries of the benchmark.
+constexpr double kCpuKeyBytesPerSecondPerThread = 0.25e9;
+
+int64_t Nanos(double seconds) { return static_cast<int64_t>(seconds * 1e9); }
+
+}  // namespace
+
+GpuSortEstimate EstimateGpuSort(const GpuDevice& device, int64_t num_rows,
+                                int32_t row_width, int32_t key_width,
+                                int num_threads) {
+  GpuSortEstimate estimate;
+  const double rows = static_cast<double>(num_rows);
+  const double device_bytes = rows * (row_width + kGpuBytesPerRow);
+  estimate.fits =
+      num_rows <= std::numeric_limits<int>::max() &&
+      device_bytes <= kGpuMemoryHeadroom * static_cast<double>(
+                                               device.free_memory);
+  if (device.host_to_device_bytes_per_second <= 0 ||
+      device.device_to_host_bytes_per_second <= 0) {
+    estimate.fits = false;
+    return estimate;
+  }
+  const int64_t words = (key_width + 7) / 8;
+  estimate.transfer_nanos =
+      Nanos(rows * row_width / device.host_to_device_bytes_per_second +
+            rows * sizeof(uint64_t) / device.device_to_host_bytes_per_second);
+  estimate.gpu_sort_nanos = Nanos(rows * words / kGpuWordsPerSecond);
+  estimate.cpu_sort_nanos =
+      Nanos(rows * key_width /
+            (kCpuKeyBytesPerSecondPerThread * std::max(num_threads, 1)));
+  return estimate;
+}
+
+#ifndef WHIPPET_CUDA
+
+const GpuDevice* GetGpuDevice() { return nullptr; }
+
+arrow::Status GpuSortRowIds(const NormalizedKeys&, uint64_t*, GpuSortTimes*) {
+  return arrow::Status::NotImplemented(
+      "the GPU sort needs a build with WHIPPET_ENABLE_CUDA");
+}
+
+#endif  // WHIPPET_CUDA
+
+}  // namespace whippet_sort
@@ -0,0 +1,84 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <arrow/status.h>
+
+#include "sort/key_normalizer.h"
+
+namespace whippet_sort {
+
+/// The CUDA device of the GPU sort, see GetGpuDevice().
+struct GpuDevice {
+  std::string name;
+  /// Device memory free when the device was first queried.
+  int64_t free_memory = 0;
+  /// Measured bandwidth of copies between pageable host memory, where the
+  /// normalized keys live, and the device.
+  double host_to_device_bytes_per_second = 0;
+  double device_to_host_bytes_per_second = 0;
+};
+
+/// The first CUDA device, queried and its transfers measured on the first
+/// call, then cached. Null if the library is built without
+/// WHIPPET_ENABLE_CUDA or the machine has no usable device.
+const GpuDevice* GetGpuDevice();
+
+/// Estimated wall times of sorting normalized keys on the GPU and on the
+/// sort threads.
+struct GpuSortEstimate {
+  /// The device could hold the keys and the buffers of the sort.
+  bool fits = false;
+  int64_t transfer_nanos = 0;
+  int64_t gpu_sort_nanos = 0;
+  int64_t cpu_sort_nanos = 0;
+
+  bool profitable() const {
+    return fits && transfer_nanos + gpu_sort_nanos < cpu_sort_nanos;
+  }
+};
+
+/// Estimates GpuSortRowIds() of `num_rows` rows of `row_width` bytes with
+/// `key_width` key bytes on `device` against a radix sort and merge on
+/// `num_threads` threads: the rows go to the device, one device radix sort
+/// pass per 8 key bytes, and the row ids come back.
+GpuSortEstimate EstimateGpuSort(const GpuDevice& device, int64_t num_rows,
+                                int32_t row_width, int32_t key_width,
+                                int num_threads);
+
+/// Time of the phases of a GpuSortRowIds().
+struct GpuSortTimes {
+  int64_t transfer_nanos = 0;
+  int64_t sort_nanos = 0;
+};
+
+/// Sorts normalized keys that carry their row ids on the GPU and writes the
+/// row ids in sorted order to `row_ids`. The keys must be exact (see
+/// KeyNormalizer::exact()), since ties on the normalized key are only broken
+/// by row id, as in the CPU sorts, and `keys` must hold the rows in row id
+/// order; it is left unchanged.
+///
+/// The rows are copied to the device as they are and sorted by a stable LSD
+/// radix sort of CUB over row positions, one 64-bit pass per 8 key bytes
+/// from the last to the first. Only the row ids are copied back, for the
+/// gather on the CPU. Returns OutOfMemory if the device cannot hold the sort,
+/// and NotImplemented without WHIPPET_ENABLE_CUDA.
+arrow::Status GpuSortRowIds(const NormalizedKeys& keys, uint64_t* row_ids,
+                            GpuSortTimes* times = nullptr);
+
+}  // namespace whippet_sort
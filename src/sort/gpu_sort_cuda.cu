@@ -0,0 +1,240 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+// The CUDA side of sort/gpu_sort.h, compiled with WHIPPET_ENABLE_CUDA only.
+
+#include "sort/gpu_sort.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <cub/device/device_radix_sort.cuh>
+#include <cuda_runtime.h>
+
+namespace whippet_sort {
+
+namespace {
+
+// Bytes copied each way to measure the transfer bandwidth.
+constexpr size_t kBandwidthProbeBytes = size_t{64} << 20;
+
+constexpr int kThreadsPerBlock = 256;
+
+using Clock = std::chrono::steady_clock;
+
+int64_t NanosSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                              start)
+      .count();
+}
+
+arrow::Status CudaStatus(cudaError_t error, const char* what) {
+  if (error == cudaSuccess) return arrow::Status::OK();
+  if (error == cudaErrorMemoryAllocation) {
+    return arrow::Status::OutOfMemory(what, ": ", cudaGetErrorString(error));
+  }
+  return arrow::Status::IOError(what, ": ", cudaGetErrorString(error));
+}
+
+#define WHIPPET_CUDA_RETURN_NOT_OK(expr) \
+  ARROW_RETURN_NOT_OK(CudaStatus((expr), #expr))
+
+// Device memory freed at the end of its scope.
+template <typename T>
+class DeviceBuffer {
+ public:
+  DeviceBuffer() = default;
+  ~DeviceBuffer() { cudaFree(data_); }
+  DeviceBuffer(const DeviceBuffer&) = delete;
+  DeviceBuffer& operator=(const DeviceBuffer&) = delete;
+
+  arrow::Status Allocate(size_t count) {
+    return CudaStatus(cudaMalloc(&data_, count * sizeof(T)), "cudaMalloc");
+  }
+  T* data() const { return data_; }
+
+ private:
+  T* data_ = nullptr;
+};
+
+int NumBlocks(int64_t num_rows) {
+  return static_cast<int>((num_rows + kThreadsPerBlock - 1) /
+                          kThreadsPerBlock);
+}
+
+__global__ void Iota(uint32_t* positions, int64_t num_rows) {
+  const int64_t i = blockIdx.x * int64_t{blockDim.x} + threadIdx.x;
+  if (i < num_rows) positions[i] = static_cast<uint32_t>(i);
+}
+
+// Loads `bytes` key bytes of every row at `positions`, starting at `offset`,
+// as a big-endian word aligned to the high bits, so that unsigned order of
+// the words is memcmp order of the bytes.
+__global__ void LoadKeyWords(const uint8_t* rows, int32_t row_width,
+                             const uint32_t* positions, int64_t num_rows,
+                             int32_t offset, int32_t bytes, uint64_t* words) {
+  const int64_t i = blockIdx.x * int64_t{blockDim.x} + threadIdx.x;
+  if (i >= num_rows) return;
+  const uint8_t* key = rows + int64_t{positions[i]} * row_width + offset;
+  uint64_t word = 0;
+  for (int32_t b = 0; b < bytes; ++b) {
+    word |= uint64_t{key[b]} << (56 - 8 * b);
+  }
+  words[i] = word;
+}
+
+// Replaces the sorted row positions by the row ids their rows carry.
+__global__ void LoadRowIds(const uint8_t* rows, int32_t row_width,
+                           const uint32_t* positions, int64_t num_rows,
+                           uint64_t* row_ids) {
+  const int64_t i = blockIdx.x * int64_t{blockDim.x} + threadIdx.x;
+  if (i >= num_rows) return;
+  const uint8_t* row = rows + int64_t{positions[i]} * row_width;
+  uint64_t id;
+  memcpy(&id, row + row_width - sizeof(id), sizeof(id));
+  row_ids[i] = id;
+}
+
+// Times one copy of kBandwidthProbeBytes in `kind` direction, in bytes per
+// second, or 0 if it fails.
+double MeasureCopy(void* dst, const void* src, cudaMemcpyKind kind) {
+  // The first copy pays for the lazy setup of the transfer path.
+  if (cudaMemcpy(dst, src, kBandwidthProbeBytes, kind) != cudaSuccess) {
+    return 0;
+  }
+  const auto start = Clock::now();
+  if (cudaMemcpy(dst, src, kBandwidthProbeBytes, kind) != cudaSuccess) {
+    return 0;
+  }
+  const double seconds = static_cast<double>(NanosSince(start)) / 1e9;
+  return seconds > 0 ? static_cast<double>(kBandwidthProbeBytes) / seconds : 0;
+}
+
+std::unique_ptr<GpuDevice> QueryGpuDevice() {
+  int num_devices = 0;
+  if (cudaGetDeviceCount(&num_devices) != cudaSuccess || num_devices == 0) {
+    return nullptr;
+  }
+  cudaDeviceProp properties;
+  if (cudaGetDeviceProperties(&properties, 0) != cudaSuccess ||
+      cudaSetDevice(0) != cudaSuccess) {
+    return nullptr;
+  }
+  auto device = std::make_unique<GpuDevice>();
+  device->name = properties.name;
+  size_t free_memory = 0;
+  size_t total_memory = 0;
+  if (cudaMemGetInfo(&free_memory, &total_memory) != cudaSuccess) {
+    return nullptr;
+  }
+  device->free_memory = static_cast<int64_t>(free_memory);
+
+  std::vector<uint8_t> host(kBandwidthProbeBytes, 1);
+  DeviceBuffer<uint8_t> probe;
+  if (!probe.Allocate(kBandwidthProbeBytes).ok()) return nullptr;
+  device->host_to_device_bytes_per_second =
+      MeasureCopy(probe.data(), host.data(), cudaMemcpyHostToDevice);
+  device->device_to_host_bytes_per_second =
+      MeasureCopy(host.data(), probe.data(), cudaMemcpyDeviceToHost);
+  return device;
+}
+
+}  // namespace
+
+const GpuDevice* GetGpuDevice() {
+  static const std::unique_ptr<GpuDevice> device = QueryGpuDevice();
+  return device.get();
+}
+
+arrow::Status GpuSortRowIds(const NormalizedKeys& keys, uint64_t* row_ids,
+                            GpuSortTimes* times) {
+  if (!keys.with_row_ids) {
+    return arrow::Status::Invalid("the GPU sort needs keys with row ids");
+  }
+  const int64_t num_rows = keys.num_rows;
+  if (num_rows == 0) return arrow::Status::OK();
+  // CUB counts the items of a sort in an int.
+  if (num_rows > std::numeric_limits<int>::max()) {
+    return arrow::Status::OutOfMemory("the GPU sort takes at most 2^31 - 1 "
+                                      "rows");
+  }
+  if (GetGpuDevice() == nullptr) {
+    return arrow::Status::IOError("no CUDA device");
+  }
+  GpuSortTimes local_times;
+  if (times == nullptr) times = &local_times;
+  const int32_t row_width = keys.row_width;
+  const size_t rows_bytes = static_cast<size_t>(num_rows) * row_width;
+  const auto n = static_cast<size_t>(num_rows);
+
+  DeviceBuffer<uint8_t> rows;
+  DeviceBuffer<uint64_t> words[2];
+  DeviceBuffer<uint32_t> positions[2];
+  ARROW_RETURN_NOT_OK(rows.Allocate(rows_bytes));
+  for (int i = 0; i < 2; ++i) {
+    ARROW_RETURN_NOT_OK(words[i].Allocate(n));
+    ARROW_RETURN_NOT_OK(positions[i].Allocate(n));
+  }
+  cub::DoubleBuffer<uint64_t> word_buffer(words[0].data(), words[1].data());
+  cub::DoubleBuffer<uint32_t> position_buffer(positions[0].data(),
+                                              positions[1].data());
+  size_t scratch_bytes = 0;
+  WHIPPET_CUDA_RETURN_NOT_OK(cub::DeviceRadixSort::SortPairs(
+      nullptr, scratch_bytes, word_buffer, position_buffer,
+      static_cast<int>(num_rows)));
+  DeviceBuffer<uint8_t> scratch;
+  ARROW_RETURN_NOT_OK(scratch.Allocate(scratch_bytes));
+
+  auto start = Clock::now();
+  WHIPPET_CUDA_RETURN_NOT_OK(cudaMemcpy(rows.data(), keys.data->data(),
+                                        rows_bytes, cudaMemcpyHostToDevice));
+  times->transfer_nanos += NanosSince(start);
+
+  // LSD over the key words: every pass is stable, so after the pass over the
+  // first word the rows are in key order, and ties in row id order.
+  start = Clock::now();
+  const int blocks = NumBlocks(num_rows);
+  Iota<<<blocks, kThreadsPerBlock>>>(position_buffer.Current(), num_rows);
+  for (int32_t offset = (keys.key_width - 1) / 8 * 8; offset >= 0;
+       offset -= 8) {
+    const int32_t bytes = std::min(8, keys.key_width - offset);
+    LoadKeyWords<<<blocks, kThreadsPerBlock>>>(
+        rows.data(), row_width, position_buffer.Current(), num_rows, offset,
+        bytes, word_buffer.Current());
+    WHIPPET_CUDA_RETURN_NOT_OK(cudaGetLastError());
+    WHIPPET_CUDA_RETURN_NOT_OK(cub::DeviceRadixSort::SortPairs(
+        scratch.data(), scratch_bytes, word_buffer, position_buffer,
+        static_cast<int>(num_rows), /*begin_bit=*/64 - 8 * bytes,
+        /*end_bit=*/64));
+  }
+  // The key words are no longer needed, so the ids go to one of them.
+  uint64_t* ids = word_buffer.Alternate();
+  LoadRowIds<<<blocks, kThreadsPerBlock>>>(
+      rows.data(), row_width, position_buffer.Current(), num_rows, ids);
+  WHIPPET_CUDA_RETURN_NOT_OK(cudaGetLastError());
+  WHIPPET_CUDA_RETURN_NOT_OK(cudaDeviceSynchronize());
+  times->sort_nanos += NanosSince(start);
+
+  start = Clock::now();
+  WHIPPET_CUDA_RETURN_NOT_OK(cudaMemcpy(row_ids, ids, n * sizeof(uint64_t),
+                                        cudaMemcpyDeviceToHost));
+  times->transfer_nanos += NanosSince(start);
+  return arrow::Status::OK();
+}
+
+}  // namespace whippet_sort
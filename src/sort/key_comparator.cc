@@ -0,0 +1,167 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "sort/key_comparator.h"
+
+#include <cmath>
+#include <string_view>
+
+#include <arrow/api.h>
+
+namespace whippet_sort {
+
+namespace {
+
+template <typename T>
+int Order(const T& a, const T& b) {
+  return a < b ? -1 : (b < a ? 1 : 0);
+}
+
+// Dates, times, timestamps and durations compare as their integer values.
+template <typename T>
+int CompareNumbers(const arrow::Array& a, int64_t i, const arrow::Array& b,
+                   int64_t j) {
+  return Order(a.data()->GetValues<T>(1)[i], b.data()->GetValues<T>(1)[j]);
+}
+
+template <typename T>
+int CompareFloats(const arrow::Array& a, int64_t i, const arrow::Array& b,
+                  int64_t j) {
+  const T x = a.data()->GetValues<T>(1)[i];
+  const T y = b.data()->GetValues<T>(1)[j];
+  const bool x_nan = std::isnan(x);
+  const bool y_nan = std::isnan(y);
+  if (x_nan || y_nan) return static_cast<int>(x_nan) - static_cast<int>(y_nan);
+  return Order(x, y);
+}
+
+template <typename ArrayType, typename DecimalType>
+int CompareDecimals(const arrow::Array& a, int64_t i, const arrow::Array& b,
+                    int64_t j) {
+  return Order(DecimalType(static_cast<const ArrayType&>(a).GetValue(i)),
+               DecimalType(static_cast<const ArrayType&>(b).GetValue(j)));
+}
+
+template <typename ArrayType>
+int CompareBytes(const arrow::Array& a, int64_t i, const arrow::Array& b,
+                 int64_t j) {
+  std::string_view x = static_cast<const ArrayType&>(a).GetView(i);
+  std::string_view y = static_cast<const ArrayType&>(b).GetView(j);
+  int cmp = x.compare(y);
+  return cmp < 0 ? -1 : (cmp > 0 ? 1 : 0);
+}
+
+int CompareBools(const arrow::Array& a, int64_t i, const arrow::Array& b,
+                 int64_t j) {
+  return Order(static_cast<const arrow::BooleanArray&>(a).Value(i),
+               static_cast<const arrow::BooleanArray&>(b).Value(j));
+}
+
+}  // namespace
+
+arrow::Result<KeyComparator> KeyComparator::Make(const SortSpec& spec,
+                                                 const arrow::Schema& schema) {
+  KeyComparator comparator;
+  for (const auto& key : spec) {
+    int column = schema.GetFieldIndex(key.column);
+    if (column < 0) {
+      return arrow::Status::KeyError("sort key '", key.column,
+                                     "' is not a column of the input");
+    }
+    const auto& type = *schema.field(column)->type();
+    CompareValues compare = nullptr;
+    switch (type.id()) {
+      case arrow::Type::BOOL:
+        compare = CompareBools;
+        break;
+      case arrow::Type::INT8:
+        compare = CompareNumbers<int8_t>;
+        break;
+      case arrow::Type::INT16:
+        compare = CompareNumbers<int16_t>;
+        break;
+      case arrow::Type::INT32:
+      case arrow::Type::DATE32:
+      case arrow::Type::TIME32:
+        compare = CompareNumbers<int32_t>;
+        break;
+      case arrow::Type::INT64:
+      case arrow::Type::DATE64:
+      case arrow::Type::TIME64:
+      case arrow::Type::TIMESTAMP:
+      case arrow::Type::DURATION:
+        compare = CompareNumbers<int64_t>;
+        break;
+      case arrow::Type::UINT8:
+        compare = CompareNumbers<uint8_t>;
+        break;
+      case arrow::Type::UINT16:
+        compare = CompareNumbers<uint16_t>;
+        break;
+      case arrow::Type::UINT32:
+        compare = CompareNumbers<uint32_t>;
+        break;
+      case arrow::Type::UINT64:
+        compare = CompareNumbers<uint64_t>;
+        break;
+      case arrow::Type::FLOAT:
+        compare = CompareFloats<float>;
+        break;
+      case arrow::Type::DOUBLE:
+        compare = CompareFloats<double>;
+        break;
+      case arrow::Type::DECIMAL128:
+        compare = CompareDecimals<arrow::Decimal128Array, arrow::Decimal128>;
+        break;
+      case arrow::Type::DECIMAL256:
+        compare = CompareDecimals<arrow::Decimal256Array, arrow::Decimal256>;
+        break;
+      case arrow::Type::FIXED_SIZE_BINARY:
+        compare = CompareBytes<arrow::FixedSizeBinaryArray>;
+        break;
+      case arrow::Type::STRING:
+      case arrow::Type::BINARY:
+        compare = CompareBytes<arrow::BinaryArray>;
+        break;
+      case arrow::Type::LARGE_STRING:
+      case arrow::Type::LARGE_BINARY:
+        compare = CompareBytes<arrow::LargeBinaryArray>;
+        break;
+      default:
+        return arrow::Status::NotImplemented("sorting on type ",
+                                             type.ToString());
+    }
+    comparator.columns_.push_back(column);
+    comparator.keys_.push_back({compare, !key.ascending(), key.nulls_first()});
+  }
+  return comparator;
+}
+
+int KeyComparator::Compare(const arrow::Array* const* a, int64_t i,
+                           const arrow::Array* const* b, int64_t j) const {
+  for (size_t k = 0; k < keys_.size(); ++k) {
+    const auto& key = keys_[k];
+    const bool a_null = a[k]->IsNull(i);
+    const bool b_null = b[k]->IsNull(j);
+    if (a_null || b_null) {
+      if (a_null && b_null) continue;
+      return a_null == key.nulls_first ? -1 : 1;
+    }
+    int cmp = key.compare(*a[k], i, *b[k], j);
+    if (cmp != 0) return key.descending ? -cmp : cmp;
+  }
+  return 0;
+}
+
+}  // namespace whippet_sort
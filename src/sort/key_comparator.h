@@ -0,0 +1,58 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+
+#include "sort/sort_spec.h"
+
+namespace whippet_sort {
+
+/// Compares rows of different batches on the ORDER BY keys, in the order of
+/// their normalized keys: nulls by null placement, -0.0 equal to 0.0 and NaN
+/// after all other floating point values. Used where rows of separately
+/// normalized inputs meet, e.g. when merging spilled runs.
+class KeyComparator {
+ public:
+  static arrow::Result<KeyComparator> Make(const SortSpec& spec,
+                                           const arrow::Schema& schema);
+
+  /// The schema index of each key, in ORDER BY order.
+  const std::vector<int>& columns() const { return columns_; }
+
+  /// Compares row `i` of the keys `a` with row `j` of the keys `b`. Both hold
+  /// the key arrays in ORDER BY order. Returns <0, 0 or >0.
+  int Compare(const arrow::Array* const* a, int64_t i,
+              const arrow::Array* const* b, int64_t j) const;
+
+ private:
+  using CompareValues = int (*)(const arrow::Array&, int64_t,
+                                const arrow::Array&, int64_t);
+
+  struct Key {
+    CompareValues compare;
+    bool descending;
+    bool nulls_first;
+  };
+
+  std::vector<int> columns_;
+  std::vector<Key> keys_;
+};
+
+}  // namespace whippet_sort
@@ -0,0 +1,650 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "sort/key_normalizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+#include <arrow/api.h>
+#include <arrow/util/bit_util.h>
+
+#include "sort/row_kernels.h"
+
+namespace whippet_sort {
+
+namespace {
+
+// Distinct prefixes beyond which a long string column is assumed to have
+// values that share a prefix, to bound the cost of checking.
+constexpr size_t kMaxDistinctPrefixes = 1 << 16;
+
+enum class Kind {
+  kBool,
+  kSigned,
+  kUnsigned,
+  kFloat,
+  kDouble,
+  kDecimal,
+  kFixedBinary,
+  kString,
+  kLargeString,
+};
+
+inline uint8_t ByteSwap(uint8_t v) { return v; }
+inline uint16_t ByteSwap(uint16_t v) { return __builtin_bswap16(v); }
+inline uint32_t ByteSwap(uint32_t v) { return __builtin_bswap32(v); }
+inline uint64_t ByteSwap(uint64_t v) { return __builtin_bswap64(v); }
+
+template <typename T>
+inline void StoreOrdered(T value, uint8_t* out) {
+  using U = std::make_unsigned_t<T>;
+  auto bits = static_cast<U>(value);
+  if constexpr (std::is_signed_v<T>) {
+    bits ^= static_cast<U>(U{1} << (sizeof(U) * 8 - 1));
+  }
+  bits = ByteSwap(bits);
+  std::memcpy(out, &bits, sizeof(U));
+}
+
+inline void StoreOrdered(float value, uint8_t* out) {
+  uint32_t bits;
+  if (value == 0) value = 0;  // -0.0 == 0.0
+  if (std::isnan(value)) value = std::numeric_limits<float>::quiet_NaN();
+  std::memcpy(&bits, &value, sizeof(bits));
+  bits = (bits & 0x80000000u) ? ~bits : bits ^ 0x80000000u;
+  StoreOrdered(bits, out);
+}
+
+inline void StoreOrdered(double value, uint8_t* out) {
+  uint64_t bits;
+  if (value == 0) value = 0;
+  if (std::isnan(value)) value = std::numeric_limits<double>::quiet_NaN();
+  std::memcpy(&bits, &value, sizeof(bits));
+  constexpr uint64_t kSignBit = 0x8000000000000000ull;
+  bits = (bits & kSignBit) ? ~bits : bits ^ kSignBit;
+  StoreOrdered(bits, out);
+}
+
+// The bits of an integer as an unsigned value of the same order.
+template <typename T>
+inline uint64_t OrderedBits(T value) {
+  if constexpr (std::is_signed_v<T>) {
+    return static_cast<uint64_t>(static_cast<int64_t>(value)) ^
+           (uint64_t{1} << 63);
+  } else {
+    return static_cast<uint64_t>(value);
+  }
+}
+
+// Stores the low `width` bytes of `value` big-endian; `width` is 1 to 8.
+inline void StorePacked(uint64_t value, int width, uint8_t* out) {
+  value = ByteSwap(value << (64 - 8 * width));
+  std::memcpy(out, &value, width);
+}
+
+std::string_view StringAt(const arrow::Array& array, Kind kind, int64_t i) {
+  if (kind == Kind::kLargeString) {
+    return static_cast<const arrow::LargeBinaryArray&>(array).GetView(i);
+  }
+  return static_cast<const arrow::BinaryArray&>(array).GetView(i);
+}
+
+}  // namespace
+
+struct KeyNormalizer::Column {
+  const arrow::Array* array = nullptr;
+  Kind kind = Kind::kSigned;
+  /// Width of the physical input values, for fixed-width kinds.
+  int byte_width = 0;
+  /// Encoded bytes of a value, without the null byte.
+  int value_width = 0;
+  /// For strings, the number of bytes of each value kept in the key.
+  int prefix_width = 0;
+  /// Whether the key is a string prefix that cannot decide the order alone.
+  bool truncated = false;
+  /// Whether a string key ends with the length, after a prefix holding all
+  /// of the value.
+  bool with_length = false;
+  bool has_null_byte = false;
+  bool descending = false;
+  bool nulls_first = false;
+  /// Whether the values are encoded as OrderedBits(value) - `base` in
+  /// value_width bytes, see KeyCompression::pack_integers. Decimals are
+  /// packed from the low 8 bytes, which hold the whole value.
+  bool packed = false;
+  uint64_t base = 0;
+  /// Whether the column is part of the normalized key, and at which offset.
+  bool in_key = false;
+  int offset = 0;
+
+  const uint8_t* fixed_values() const {
+    return array->data()->buffers[1]->data() + array->offset() * byte_width;
+  }
+};
+
+namespace {
+
+using Column = KeyNormalizer::Column;
+
+// Encodes rows [offset, offset + length) of one column to `dst`, `stride`
+// bytes apart. `encode_value(row, out)` writes the ascending value bytes.
+template <typename EncodeValue>
+void EncodeRows(const Column& c, int64_t offset, int64_t length, uint8_t* dst,
+                int32_t stride, EncodeValue&& encode_value) {
+  const auto& array = *c.array;
+  const uint8_t valid_byte = c.nulls_first ? 1 : 0;
+  for (int64_t i = 0; i < length; ++i, dst += stride) {
+    const int64_t row = offset + i;
+    uint8_t* value = dst;
+    if (c.has_null_byte) {
+      if (array.IsNull(row)) {
+        dst[0] = valid_byte ^ 1;
+        std::memset(dst + 1, 0, c.value_width);
+        continue;
+      }
+      dst[0] = valid_byte;
+      value = dst + 1;
+    }
+    encode_value(row, value);
+    if (c.descending) {
+      for (int j = 0; j < c.value_width; ++j) {
+        value[j] = static_cast<uint8_t>(~value[j]);
+      }
+    }
+  }
+}
+
+template <typename T>
+void EncodeFixed(const Column& c, int64_t offset, int64_t length, uint8_t* dst,
+                 int32_t stride) {
+  const T* values = reinterpret_cast<const T*>(c.fixed_values());
+  EncodeRows(c, offset, length, dst, stride, [&](int64_t row, uint8_t* out) {
+    StoreOrdered(values[row], out);
+  });
+}
+
+// The value of row `row` of a packed column, read as a T (int64_t for
+// decimals) from the start of its byte_width bytes.
+template <typename T>
+inline T PackedValueAt(const Column& c, const uint8_t* values, int64_t row) {
+  T value;
+  std::memcpy(&value, values + row * c.byte_width, sizeof(T));
+  return value;
+}
+
+template <typename T>
+void EncodePacked(const Column& c, int64_t offset, int64_t length,
+                  uint8_t* dst, int32_t stride) {
+  const uint8_t* values = c.fixed_values();
+  const uint64_t base = c.base;
+  const int width = c.value_width;
+  EncodeRows(c, offset, length, dst, stride, [&](int64_t row, uint8_t* out) {
+    StorePacked(OrderedBits(PackedValueAt<T>(c, values, row)) - base, width,
+                out);
+  });
+}
+
+// Calls `visit(T{})` with the type a packed column is read as.
+template <typename Visit>
+void VisitPackedType(const Column& c, Visit&& visit) {
+  if (c.kind == Kind::kDecimal) return visit(int64_t{});
+  const bool is_signed = c.kind == Kind::kSigned;
+  switch (c.byte_width) {
+    case 1:
+      return is_signed ? visit(int8_t{}) : visit(uint8_t{});
+    case 2:
+      return is_signed ? visit(int16_t{}) : visit(uint16_t{});
+    case 4:
+      return is_signed ? visit(int32_t{}) : visit(uint32_t{});
+    default:
+      return is_signed ? visit(int64_t{}) : visit(uint64_t{});
+  }
+}
+
+// Finds the smallest and largest OrderedBits() of the valid values of a
+// column that can be packed. Returns false if all values are null.
+bool ScanOrderedRange(const Column& c, uint64_t* min, uint64_t* max) {
+  const auto& array = *c.array;
+  const uint8_t* values = c.fixed_values();
+  uint64_t low = std::numeric_limits<uint64_t>::max();
+  uint64_t high = 0;
+  VisitPackedType(c, [&](auto type) {
+    using T = decltype(type);
+    if (array.null_count() == 0) {
+      for (int64_t i = 0; i < array.length(); ++i) {
+        const uint64_t bits = OrderedBits(PackedValueAt<T>(c, values, i));
+        low = std::min(low, bits);
+        high = std::max(high, bits);
+      }
+      return;
+    }
+    for (int64_t i = 0; i < array.length(); ++i) {
+      if (array.IsNull(i)) continue;
+      const uint64_t bits = OrderedBits(PackedValueAt<T>(c, values, i));
+      low = std::min(low, bits);
+      high = std::max(high, bits);
+    }
+  });
+  if (low > high) return false;
+  *min = low;
+  *max = high;
+  return true;
+}
+
+// Encodes a numeric column without nulls with the SIMD row kernels. Returns
+// false for the other columns.
+bool EncodeWithKernels(const Column& c, int64_t offset, int64_t length,
+                       uint8_t* dst, int32_t stride) {
+  if (c.has_null_byte) return false;
+  const auto& kernels = internal::GetRowKernels();
+  const uint8_t* values = c.fixed_values() + offset * c.byte_width;
+  switch (c.kind) {
+    case Kind::kSigned:
+    case Kind::kUnsigned: {
+      uint64_t flip =
+          c.kind == Kind::kSigned ? uint64_t{1} << (c.byte_width * 8 - 1) : 0;
+      if (c.descending) flip = ~flip;
+      kernels.encode_integers(values, length, c.byte_width, flip, dst, stride);
+      return true;
+    }
+    case Kind::kFloat:
+    case Kind::kDouble:
+      kernels.encode_floats(values, length, c.byte_width, c.descending, dst,
+                            stride);
+      return true;
+    default:
+      return false;
+  }
+}
+
+void EncodeColumn(const Column& c, int64_t offset, int64_t length,
+                  uint8_t* dst, int32_t stride) {
+  if (c.packed) {
+    VisitPackedType(c, [&](auto type) {
+      EncodePacked<decltype(type)>(c, offset, length, dst, stride);
+    });
+    return;
+  }
+  if (EncodeWithKernels(c, offset, length, dst, stride)) return;
+  switch (c.kind) {
+    case Kind::kBool: {
+      const uint8_t* bits = c.array->data()->buffers[1]->data();
+      const int64_t bit_offset = c.array->offset();
+      EncodeRows(c, offset, length, dst, stride,
+                 [&](int64_t row, uint8_t* out) {
+                   out[0] = arrow::bit_util::GetBit(bits, bit_offset + row);
+                 });
+      break;
+    }
+    case Kind::kSigned:
+      switch (c.byte_width) {
+        case 1:
+          EncodeFixed<int8_t>(c, offset, length, dst, stride);
+          break;
+        case 2:
+          EncodeFixed<int16_t>(c, offset, length, dst, stride);
+          break;
+        case 4:
+          EncodeFixed<int32_t>(c, offset, length, dst, stride);
+          break;
+        default:
+          EncodeFixed<int64_t>(c, offset, length, dst, stride);
+          break;
+      }
+      break;
+    case Kind::kUnsigned:
+      switch (c.byte_width) {
+        case 1:
+          EncodeFixed<uint8_t>(c, offset, length, dst, stride);
+          break;
+        case 2:
+          EncodeFixed<uint16_t>(c, offset, length, dst, stride);
+          break;
+        case 4:
+          EncodeFixed<uint32_t>(c, offset, length, dst, stride);
+          break;
+        default:
+          EncodeFixed<uint64_t>(c, offset, length, dst, stride);
+          break;
+      }
+      break;
+    case Kind::kFloat:
+      EncodeFixed<float>(c, offset, length, dst, stride);
+      break;
+    case Kind::kDouble:
+      EncodeFixed<double>(c, offset, length, dst, stride);
+      break;
+    case Kind::kDecimal: {
+      // Little-endian two's complement: reverse the bytes and flip the sign.
+      const uint8_t* values = c.fixed_values();
+      const int width = c.byte_width;
+      EncodeRows(c, offset, length, dst, stride,
+                 [&](int64_t row, uint8_t* out) {
+                   const uint8_t* value = values + row * width;
+                   for (int j = 0; j < width; ++j) {
+                     out[j] = value[width - 1 - j];
+                   }
+                   out[0] ^= 0x80;
+                 });
+      break;
+    }
+    case Kind::kFixedBinary: {
+      const uint8_t* values = c.fixed_values();
+      const int width = c.byte_width;
+      EncodeRows(c, offset, length, dst, stride,
+                 [&](int64_t row, uint8_t* out) {
+                   std::memcpy(out, values + row * width, width);
+                 });
+      break;
+    }
+    case Kind::kString:
+    case Kind::kLargeString: {
+      const int prefix = c.prefix_width;
+      const bool with_length = c.with_length;
+      EncodeRows(c, offset, length, dst, stride,
+                 [&](int64_t row, uint8_t* out) {
+                   auto value = StringAt(*c.array, c.kind, row);
+                   auto n = std::min<size_t>(value.size(), prefix);
+                   std::memcpy(out, value.data(), n);
+                   std::memset(out + n, 0, prefix - n);
+                   if (with_length) {
+                     out[prefix] = static_cast<uint8_t>(value.size());
+                   }
+                 });
+      break;
+    }
+  }
+}
+
+int64_t MaxStringLength(const arrow::Array& array, Kind kind) {
+  int64_t max_length = 0;
+  for (int64_t i = 0; i < array.length(); ++i) {
+    if (array.IsValid(i)) {
+      max_length =
+          std::max<int64_t>(max_length, StringAt(array, kind, i).size());
+    }
+  }
+  return max_length;
+}
+
+// Whether equal `prefix_width`-byte prefixes imply equal values, so the
+// zero-padded prefixes order the column without the rest of the values.
+bool PrefixDecides(const arrow::Array& array, Kind kind, int prefix_width) {
+  std::unordered_map<std::string_view, std::string_view> values;
+  for (int64_t i = 0; i < array.length(); ++i) {
+    if (array.IsNull(i)) continue;
+    auto value = StringAt(array, kind, i);
+    // Two prefixes encode the same once padded iff they match without their
+    // trailing NULs, e.g. "a" and "a\0".
+    auto prefix = value.substr(0, prefix_width);
+    while (!prefix.empty() && prefix.back() == '\0') prefix.remove_suffix(1);
+    auto [it, inserted] = values.emplace(prefix, value);
+    if (!inserted && it->second != value) return false;
+    if (values.size() > kMaxDistinctPrefixes) return false;
+  }
+  return true;
+}
+
+arrow::Status ClassifyType(const arrow::DataType& type, Column* c) {
+  switch (type.id()) {
+    case arrow::Type::BOOL:
+      c->kind = Kind::kBool;
+      c->value_width = 1;
+      return arrow::Status::OK();
+    case arrow::Type::INT8:
+    case arrow::Type::INT16:
+    case arrow::Type::INT32:
+    case arrow::Type::INT64:
+    case arrow::Type::DATE32:
+    case arrow::Type::DATE64:
+    case arrow::Type::TIME32:
+    case arrow::Type::TIME64:
+    case arrow::Type::TIMESTAMP:
+    case arrow::Type::DURATION:
+      c->kind = Kind::kSigned;
+      break;
+    case arrow::Type::UINT8:
+    case arrow::Type::UINT16:
+    case arrow::Type::UINT32:
+    case arrow::Type::UINT64:
+      c->kind = Kind::kUnsigned;
+      break;
+    case arrow::Type::FLOAT:
+      c->kind = Kind::kFloat;
+      break;
+    case arrow::Type::DOUBLE:
+      c->kind = Kind::kDouble;
+      break;
+    case arrow::Type::DECIMAL128:
+    case arrow::Type::DECIMAL256:
+      c->kind = Kind::kDecimal;
+      break;
+    case arrow::Type::FIXED_SIZE_BINARY:
+      c->kind = Kind::kFixedBinary;
+      break;
+    case arrow::Type::STRING:
+    case arrow::Type::BINARY:
+      c->kind = Kind::kString;
+      return arrow::Status::OK();
+    case arrow::Type::LARGE_STRING:
+    case arrow::Type::LARGE_BINARY:
+      c->kind = Kind::kLargeString;
+      return arrow::Status::OK();
+    default:
+      return arrow::Status::NotImplemented("sorting on type ", type.ToString());
+  }
+  c->byte_width =
+      static_cast<const arrow::FixedWidthType&>(type).bit_width() / 8;
+  c->value_width = c->byte_width;
+  return arrow::Status::OK();
+}
+
+// Packs an integer or narrow decimal column into the bytes its range needs,
+// if that is fewer than its encoding takes otherwise. `range` are known
+// bounds of the values, or null.
+void PlanPacking(const KeyRange* range, Column* c) {
+  if (c->kind == Kind::kDecimal) {
+    const auto& type =
+        static_cast<const arrow::DecimalType&>(*c->array->type());
+    if (type.precision() > 18) return;
+  } else if (c->kind != Kind::kSigned && c->kind != Kind::kUnsigned) {
+    return;
+  }
+  uint64_t min = 0;
+  uint64_t max = 0;
+  if (range != nullptr && c->kind == Kind::kSigned) {
+    min = OrderedBits(range->min);
+    max = OrderedBits(range->max);
+  } else if (range != nullptr && c->kind == Kind::kUnsigned &&
+             range->min >= 0) {
+    min = static_cast<uint64_t>(range->min);
+    max = static_cast<uint64_t>(range->max);
+  } else if (!ScanOrderedRange(*c, &min, &max)) {
+    // All null: any single byte will do.
+    min = max = 0;
+  }
+  if (max < min) return;
+  const int bits = 64 - __builtin_clzll((max - min) | 1);
+  const int width = (bits + 7) / 8;
+  if (width >= c->value_width) return;
+  c->packed = true;
+  c->base = min;
+  c->value_width = width;
+}
+
+}  // namespace
+
+KeyNormalizer::KeyNormalizer(const SortSpec& spec,
+                             std::vector<std::shared_ptr<arrow::Array>> keys)
+    : spec_(spec), keys_(std::move(keys)) {}
+
+KeyNormalizer::~KeyNormalizer() = default;
+
+arrow::Result<std::unique_ptr<KeyNormalizer>> KeyNormalizer::Make(
+    const SortSpec& spec, std::vector<std::shared_ptr<arrow::Array>> keys,
+    int string_prefix_width, KeyCompression compression) {
+  if (spec.empty() || spec.size() != keys.size()) {
+    return arrow::Status::Invalid("expect one key array per sort key, got ",
+                                  keys.size(), " for ", spec.size());
+  }
+  if (string_prefix_width <= 0 || string_prefix_width > 255) {
+    return arrow::Status::Invalid("string prefix width must be in [1, 255]");
+  }
+  for (const auto& key : keys) {
+    if (key->length() != keys.front()->length()) {
+      return arrow::Status::Invalid("sort key arrays differ in length");
+    }
+  }
+  std::unique_ptr<KeyNormalizer> normalizer(
+      new KeyNormalizer(spec, std::move(keys)));
+  if (!compression.ranges.empty() &&
+      compression.ranges.size() != normalizer->keys_.size()) {
+    return arrow::Status::Invalid("expect one key range per sort key");
+  }
+  ARROW_RETURN_NOT_OK(normalizer->Plan(string_prefix_width, compression));
+  return normalizer;
+}
+
+arrow::Status KeyNormalizer::Plan(int string_prefix_width,
+                                  const KeyCompression& compression) {
+  num_rows_ = keys_.front()->length();
+  tail_begin_ = static_cast<int>(keys_.size());
+  int offset = 0;
+  int uncompressed = 0;
+  bool in_key = true;
+  for (size_t k = 0; k < keys_.size(); ++k) {
+    Column c;
+    c.array = keys_[k].get();
+    c.descending = !spec_[k].ascending();
+    c.nulls_first = spec_[k].nulls_first();
+    ARROW_RETURN_NOT_OK(ClassifyType(*c.array->type(), &c));
+    if (c.kind == Kind::kString || c.kind == Kind::kLargeString) {
+      auto max_length = MaxStringLength(*c.array, c.kind);
+      c.with_length = max_length <= string_prefix_width;
+      c.prefix_width = static_cast<int>(
+          std::min<int64_t>(max_length, string_prefix_width));
+      c.truncated = !c.with_length &&
+                    !PrefixDecides(*c.array, c.kind, c.prefix_width);
+      c.value_width = c.prefix_width + (c.with_length ? 1 : 0);
+    }
+    const int value_width = c.value_width;
+    if (compression.pack_integers) {
+      const auto* range =
+          compression.ranges.empty() ? nullptr : &compression.ranges[k];
+      PlanPacking(range != nullptr && range->has_value() ? &**range : nullptr,
+                  &c);
+    }
+    c.has_null_byte = c.array->null_count() > 0;
+    if (in_key) {
+      c.in_key = true;
+      c.offset = offset;
+      offset += (c.has_null_byte ? 1 : 0) + c.value_width;
+      uncompressed += (c.has_null_byte ? 1 : 0) + value_width;
+      if (c.truncated) {
+        tail_begin_ = static_cast<int>(k);
+        in_key = false;
+      }
+    }
+    columns_.push_back(c);
+  }
+  key_width_ = offset;
+  uncompressed_key_width_ = uncompressed;
+  return arrow::Status::OK();
+}
+
+void KeyNormalizer::Normalize(int64_t offset, int64_t length, uint8_t* out,
+                              int32_t row_width) const {
+  for (const auto& c : columns_) {
+    if (c.in_key) {
+      EncodeColumn(c, offset, length, out + c.offset, row_width);
+    }
+  }
+}
+
+arrow::Result<NormalizedKeys> KeyNormalizer::Allocate(
+    arrow::MemoryPool* pool, bool with_row_ids) const {
+  NormalizedKeys keys;
+  keys.num_rows = num_rows_;
+  keys.key_width = key_width_;
+  keys.with_row_ids = with_row_ids;
+  keys.row_width = with_row_ids ? ((key_width_ + 7) / 8 * 8 + 8) : key_width_;
+  ARROW_ASSIGN_OR_RAISE(
+      keys.data, arrow::AllocateBuffer(num_rows_ * keys.row_width, pool));
+  return keys;
+}
+
+void KeyNormalizer::NormalizeRows(int64_t offset, int64_t length,
+                                  NormalizedKeys* keys) const {
+  uint8_t* out = keys->mutable_row(offset);
+  Normalize(offset, length, out, keys->row_width);
+  if (keys->with_row_ids) {
+    const int32_t row_width = keys->row_width;
+    const int32_t padding = row_width - 8 - key_width_;
+    for (int64_t i = 0; i < length; ++i) {
+      uint8_t* row = out + i * row_width;
+      const uint64_t row_id = static_cast<uint64_t>(offset + i);
+      std::memset(row + key_width_, 0, padding);
+      std::memcpy(row + row_width - 8, &row_id, sizeof(row_id));
+    }
+  }
+}
+
+arrow::Result<NormalizedKeys> KeyNormalizer::NormalizeAll(
+    arrow::MemoryPool* pool, bool with_row_ids) const {
+  ARROW_ASSIGN_OR_RAISE(auto keys, Allocate(pool, with_row_ids));
+  NormalizeRows(0, num_rows_, &keys);
+  return keys;
+}
+
+int KeyNormalizer::CompareTail(int64_t a, int64_t b) const {
+  // Large enough for any numeric or decimal value plus its null byte.
+  uint8_t left[64];
+  uint8_t right[64];
+  for (size_t k = tail_begin_; k < columns_.size(); ++k) {
+    const auto& c = columns_[k];
+    const bool a_null = c.array->IsNull(a);
+    const bool b_null = c.array->IsNull(b);
+    if (a_null || b_null) {
+      if (a_null && b_null) continue;
+      return (a_null == c.nulls_first) ? -1 : 1;
+    }
+    int cmp;
+    if (c.kind == Kind::kString || c.kind == Kind::kLargeString) {
+      cmp = StringAt(*c.array, c.kind, a)
+                .compare(StringAt(*c.array, c.kind, b));
+      if (c.descending) cmp = -cmp;
+    } else if (c.kind == Kind::kFixedBinary) {
+      cmp = std::memcmp(c.fixed_values() + a * c.byte_width,
+                        c.fixed_values() + b * c.byte_width, c.byte_width);
+      if (c.descending) cmp = -cmp;
+    } else {
+      // Reuse the key encoding for one value; both rows are valid, so any
+      // null byte compares equal.
+      EncodeColumn(c, a, 1, left, 0);
+      EncodeColumn(c, b, 1, right, 0);
+      cmp = std::memcmp(left, right,
+                        (c.has_null_byte ? 1 : 0) + c.value_width);
+    }
+    if (cmp != 0) return cmp;
+  }
+  return 0;
+}
+
+}  // namespace whippet_sort
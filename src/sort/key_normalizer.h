@@ -0,0 +1,164 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <arrow/buffer.h>
+#include <arrow/memory_pool.h>
+#include <arrow/result.h>
+#include <arrow/type_fwd.h>
+
+#include "sort/sort_spec.h"
+
+namespace whippet_sort {
+
+/// Row-major, fixed-width keys whose bytewise (memcmp) order is the ORDER BY
+/// order. Row i starts at byte i * row_width; its first key_width bytes are
+/// the key. With row ids, row_width is key_width rounded up to 8 bytes plus
+/// the row id in native byte order in the last 8 bytes, so the rows can be
+/// reordered in place.
+struct NormalizedKeys {
+  int64_t num_rows = 0;
+  int32_t key_width = 0;
+  int32_t row_width = 0;
+  bool with_row_ids = false;
+  std::shared_ptr<arrow::Buffer> data;
+
+  const uint8_t* row(int64_t i) const {
+    return data->data() + i * static_cast<int64_t>(row_width);
+  }
+  uint8_t* mutable_row(int64_t i) {
+    return data->mutable_data() + i * static_cast<int64_t>(row_width);
+  }
+  uint64_t row_id(int64_t i) const {
+    uint64_t id;
+    std::memcpy(&id, row(i) + row_width - sizeof(id), sizeof(id));
+    return id;
+  }
+};
+
+/// Bounds of the values of an integer key that are known without reading the
+/// values, e.g. from Parquet column statistics or the size of a dictionary.
+struct KeyRange {
+  int64_t min = 0;
+  int64_t max = 0;
+};
+
+/// How KeyNormalizer shrinks the normalized key, besides the string
+/// prefixes.
+struct KeyCompression {
+  /// Encodes integer keys, and decimal keys of at most 18 digits, as their
+  /// offset from the smallest value of the column, in the fewest bytes that
+  /// hold the range of the column.
+  bool pack_integers = true;
+  /// Known bounds per sort key, which must hold all values of the key;
+  /// missing ones are found by a pass over the column.
+  std::vector<std::optional<KeyRange>> ranges;
+};
+
+/// Encodes the sort keys of each row into one memcmp-comparable byte string.
+///
+/// Per key column, in ORDER BY order:
+/// - a null byte if the column has nulls, ordered by the null placement;
+/// - for packed integers and decimals, the offset from the column minimum in
+///   big-endian, in as few bytes as the range needs;
+/// - else the value in big-endian with the sign bit flipped for signed
+///   integers, dates, times, timestamps and decimals, and with the IEEE
+///   trick for floating points;
+/// - for strings, the first `string_prefix_width` bytes zero-padded, followed
+///   by the length if no value of the column is longer than the prefix;
+/// - all value bytes inverted for DESC.
+///
+/// A string column with values longer than the prefix cannot be decided from
+/// its prefix, unless no two distinct values of the column share a prefix
+/// (few distinct values, as in an enum-like column). Otherwise encoding stops
+/// after that column and the order of the rows that tie on the normalized key
+/// is decided by CompareTail, starting from that column.
+class KeyNormalizer {
+ public:
+  static constexpr int kDefaultStringPrefixWidth = 8;
+
+  /// `keys` holds one array per entry of `spec`.
+  static arrow::Result<std::unique_ptr<KeyNormalizer>> Make(
+      const SortSpec& spec, std::vector<std::shared_ptr<arrow::Array>> keys,
+      int string_prefix_width = kDefaultStringPrefixWidth,
+      KeyCompression compression = {});
+
+  ~KeyNormalizer();
+
+  int32_t key_width() const { return key_width_; }
+  /// The key width without KeyCompression, e.g. 16 bytes per decimal.
+  int32_t uncompressed_key_width() const { return uncompressed_key_width_; }
+  int64_t num_rows() const { return num_rows_; }
+
+  /// Whether the normalized key alone decides the order of all rows.
+  bool exact() const { return tail_begin_ == static_cast<int>(keys_.size()); }
+
+  /// Encodes rows [offset, offset + length) to `out`, `row_width` bytes apart.
+  /// `row_width` must be at least `key_width()`.
+  void Normalize(int64_t offset, int64_t length, uint8_t* out,
+                 int32_t row_width) const;
+
+  /// Allocates room for all rows, optionally with their row ids, without
+  /// encoding them.
+  arrow::Result<NormalizedKeys> Allocate(arrow::MemoryPool* pool,
+                                         bool with_row_ids) const;
+
+  /// Encodes rows [offset, offset + length) into their place in `keys`, which
+  /// comes from Allocate(). Disjoint ranges may be encoded concurrently.
+  void NormalizeRows(int64_t offset, int64_t length,
+                     NormalizedKeys* keys) const;
+
+  /// Encodes all rows, optionally followed by their row ids.
+  arrow::Result<NormalizedKeys> NormalizeAll(arrow::MemoryPool* pool,
+                                             bool with_row_ids = false) const;
+
+  /// Compares rows `a` and `b` on the keys the normalized key does not decide.
+  /// Only meaningful when the normalized keys of `a` and `b` are equal.
+  /// Returns <0, 0 or >0.
+  int CompareTail(int64_t a, int64_t b) const;
+
+  /// Encoding plan of one key column, defined in the .cc file.
+  struct Column;
+
+ private:
+  KeyNormalizer(const SortSpec& spec,
+                std::vector<std::shared_ptr<arrow::Array>> keys);
+
+  arrow::Status Plan(int string_prefix_width,
+                     const KeyCompression& compression);
+
+  SortSpec spec_;
+  std::vector<std::shared_ptr<arrow::Array>> keys_;
+  std::vector<Column> columns_;
+  int64_t num_rows_ = 0;
+  int32_t key_width_ = 0;
+  int32_t uncompressed_key_width_ = 0;
+  /// The first key that is not, or only partially, in the normalized key.
+  int tail_begin_ = 0;
+};
+
+/// Compares two normalized keys.
+inline int CompareNormalizedKeys(const uint8_t* a, const uint8_t* b,
+                                 int32_t key_width) {
+  return std::memcmp(a, b, key_width);
+}
+
+}  // namespace whippet_sort
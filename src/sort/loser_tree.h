@@ -0,0 +1,163 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace whippet_sort {
+
+/// A tournament (loser) tree over k sorted sources, for k-way merges.
+///
+/// `Sources` provides `bool Exhausted(int i) const` and `bool Less(int i,
+/// int j) const`, which compares the current heads of two non-exhausted
+/// sources and must be a strict order. After the head of source top() has
+/// been consumed, the caller advances that source and calls Replay(), which
+/// costs log2(k) comparisons.
+template <typename Sources>
+class LoserTree {
+ public:
+  LoserTree(int num_sources, const Sources* sources)
+      : num_sources_(num_sources), sources_(sources) {
+    leaves_ = 1;
+    while (leaves_ < num_sources_) leaves_ *= 2;
+    tree_.assign(leaves_, -1);
+    tree_[0] = Build(1);
+  }
+
+  /// The source with the smallest head, exhausted only if all sources are.
+  int top() const { return tree_[0]; }
+  bool empty() const { return Exhausted(tree_[0]); }
+
+  void Replay() {
+    int winner = tree_[0];
+    for (int node = (winner + leaves_) / 2; node >= 1; node /= 2) {
+      if (Beats(tree_[node], winner)) std::swap(tree_[node], winner);
+    }
+    tree_[0] = winner;
+  }
+
+ private:
+  bool Exhausted(int i) const {
+    return i >= num_sources_ || sources_->Exhausted(i);
+  }
+
+  bool Beats(int a, int b) const {
+    if (Exhausted(a)) return false;
+    if (Exhausted(b)) return true;
+    return sources_->Less(a, b);
+  }
+
+  // Plays the subtree rooted at `node`, stores the losers and returns the
+  // winner. Leaf i is node leaves_ + i; the padding leaves are exhausted.
+  int Build(int node) {
+    if (node >= leaves_) return node - leaves_;
+    int left = Build(2 * node);
+    int right = Build(2 * node + 1);
+    if (Beats(right, left)) std::swap(left, right);
+    tree_[node] = right;
+    return left;
+  }
+
+  int num_sources_;
+  int leaves_;
+  const Sources* sources_;
+  /// tree_[0] is the winner, tree_[1..leaves_) the loser of each match.
+  std::vector<int> tree_;
+};
+
+/// A loser tree that compares offset-value codes before rows.
+///
+/// Every head carries a code relative to a base row that sorts before it:
+/// heads with codes relative to the same base compare like their codes unless
+/// the codes are equal. Each match keeps its loser with the code relative to
+/// the winner, and along the path of the row that was just consumed all those
+/// winners are that row, so most matches of a replay compare two integers
+/// instead of two rows, and equal leading bytes are never looked at again.
+///
+/// `Sources` provides `bool Exhausted(int i) const`;
+/// `uint32_t Code(int i) const`, the code of head i relative to the row
+/// consumed from source i before it, or to a row before all rows for the
+/// first head; and `bool Resolve(int i, int j, uint32_t code, uint32_t*
+/// loser_code) const`, which compares two heads with the same `code`, returns
+/// whether head i sorts first and sets the code of the other head relative
+/// to it. Smaller codes sort first.
+template <typename Sources>
+class OvcLoserTree {
+ public:
+  OvcLoserTree(int num_sources, const Sources* sources)
+      : num_sources_(num_sources), sources_(sources) {
+    leaves_ = 1;
+    while (leaves_ < num_sources_) leaves_ *= 2;
+    tree_.assign(leaves_, Entry{-1, 0});
+    tree_[0] = Build(1);
+  }
+
+  int top() const { return tree_[0].source; }
+  bool empty() const { return Exhausted(tree_[0].source); }
+
+  void Replay() {
+    Entry winner = tree_[0];
+    if (!Exhausted(winner.source)) winner.code = sources_->Code(winner.source);
+    for (int node = (winner.source + leaves_) / 2; node >= 1; node /= 2) {
+      if (Beats(&tree_[node], &winner)) std::swap(tree_[node], winner);
+    }
+    tree_[0] = winner;
+  }
+
+ private:
+  struct Entry {
+    int source;
+    uint32_t code;
+  };
+
+  bool Exhausted(int i) const {
+    return i >= num_sources_ || sources_->Exhausted(i);
+  }
+
+  // Whether `a` sorts before `b`, both coded relative to the same row.
+  // Afterwards the loser is coded relative to the winner.
+  bool Beats(Entry* a, Entry* b) const {
+    if (Exhausted(a->source)) return false;
+    if (Exhausted(b->source)) return true;
+    if (a->code != b->code) return a->code < b->code;
+    uint32_t loser_code;
+    const bool a_wins =
+        sources_->Resolve(a->source, b->source, a->code, &loser_code);
+    (a_wins ? b : a)->code = loser_code;
+    return a_wins;
+  }
+
+  Entry Build(int node) {
+    if (node >= leaves_) {
+      const int source = node - leaves_;
+      return Entry{source, Exhausted(source) ? 0 : sources_->Code(source)};
+    }
+    Entry left = Build(2 * node);
+    Entry right = Build(2 * node + 1);
+    if (Beats(&right, &left)) std::swap(left, right);
+    tree_[node] = right;
+    return left;
+  }
+
+  int num_sources_;
+  int leaves_;
+  const Sources* sources_;
+  /// tree_[0] is the winner, tree_[1..leaves_) the loser of each match.
+  std::vector<Entry> tree_;
+};
+
+}  // namespace whippet_sort
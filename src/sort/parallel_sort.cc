@@ -0,0 +1,424 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "sort/parallel_sort.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#include <arrow/buffer.h>
+
+#include "common/numa.h"
+#include "sort/comparison_sort.h"
+#include "sort/counting_sort.h"
+#include "sort/loser_tree.h"
+#include "sort/radix_sort.h"
+#include "sort/row_kernels.h"
+
+namespace whippet_sort {
+
+namespace {
+
+// Samples taken from every run per merge partition to pick the splitters.
+constexpr int64_t kSamplesPerPartition = 16;
+
+// The total order on normalized rows with row ids.
+class RowComparator {
+ public:
+  RowComparator(const KeyNormalizer& normalizer, const NormalizedKeys& keys)
+      : normalizer_(normalizer),
+        key_width_(keys.key_width),
+        row_width_(keys.row_width) {}
+
+  uint64_t RowId(const uint8_t* row) const {
+    uint64_t id;
+    std::memcpy(&id, row + row_width_ - sizeof(id), sizeof(id));
+    return id;
+  }
+
+  bool Less(const uint8_t* a, const uint8_t* b) const {
+    int cmp = CompareNormalizedKeys(a, b, key_width_);
+    if (cmp != 0) return cmp < 0;
+    return TieLess(a, b);
+  }
+
+  /// Less() for rows with equal normalized keys.
+  bool TieLess(const uint8_t* a, const uint8_t* b) const {
+    int cmp;
+    const uint64_t a_id = RowId(a);
+    const uint64_t b_id = RowId(b);
+    if (!normalizer_.exact()) {
+      cmp = normalizer_.CompareTail(a_id, b_id);
+      if (cmp != 0) return cmp < 0;
+    }
+    return a_id < b_id;
+  }
+
+ private:
+  const KeyNormalizer& normalizer_;
+  const int32_t key_width_;
+  const int32_t row_width_;
+};
+
+// The first byte in [from, width) where `a` and `b` differ, or `width`.
+int32_t FirstDifference(const uint8_t* a, const uint8_t* b, int32_t from,
+                        int32_t width) {
+  int32_t i = from;
+  for (; i + 8 <= width; i += 8) {
+    uint64_t x;
+    uint64_t y;
+    std::memcpy(&x, a + i, sizeof(x));
+    std::memcpy(&y, b + i, sizeof(y));
+    if (x != y) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      return i + __builtin_ctzll(x ^ y) / 8;
+#else
+      return i + __builtin_clzll(x ^ y) / 8;
+#endif
+    }
+  }
+  while (i < width && a[i] == b[i]) ++i;
+  return i;
+}
+
+// The offset-value code of a row whose key first differs from the base row's
+// at byte `offset`: rows sharing more bytes with the base get smaller codes,
+// then rows with smaller values at the offset. 0 for equal keys.
+uint32_t OffsetValueCode(int32_t offset, const uint8_t* row,
+                         int32_t key_width) {
+  if (offset == key_width) return 0;
+  return (static_cast<uint32_t>(key_width - offset) << 8) | row[offset];
+}
+
+// The unmerged rows of each run within one merge partition, with the
+// offset-value code of each head relative to the row consumed before it.
+struct MergeCursors {
+  const RowComparator* comparator;
+  int32_t key_width;
+  int64_t row_width;
+  std::vector<const uint8_t*> heads;
+  std::vector<const uint8_t*> ends;
+  std::vector<uint32_t> codes;
+
+  void Add(const uint8_t* begin, const uint8_t* end) {
+    heads.push_back(begin);
+    ends.push_back(end);
+    // Relative to a row before all rows: no bytes in common.
+    codes.push_back(OffsetValueCode(0, begin, key_width));
+  }
+
+  // Consumes the head of run `i`.
+  void Advance(int i) {
+    const uint8_t* consumed = heads[i];
+    heads[i] += row_width;
+    if (Exhausted(i)) return;
+    const int32_t offset = FirstDifference(consumed, heads[i], 0, key_width);
+    codes[i] = OffsetValueCode(offset, heads[i], key_width);
+  }
+
+  bool Exhausted(int i) const { return heads[i] == ends[i]; }
+  uint32_t Code(int i) const { return codes[i]; }
+
+  bool Resolve(int i, int j, uint32_t code, uint32_t* loser_code) const {
+    const uint8_t* a = heads[i];
+    const uint8_t* b = heads[j];
+    // Equal codes mean equal bytes up to and including the coded offset.
+    const int32_t from =
+        code == 0 ? key_width : key_width - static_cast<int32_t>(code >> 8) + 1;
+    const int32_t offset = FirstDifference(a, b, from, key_width);
+    if (offset < key_width) {
+      const bool a_first = a[offset] < b[offset];
+      *loser_code = OffsetValueCode(offset, a_first ? b : a, key_width);
+      return a_first;
+    }
+    *loser_code = 0;
+    return comparator->TieLess(a, b);
+  }
+};
+
+}  // namespace
+
+ParallelSorter::ParallelSorter(const KeyNormalizer& normalizer,
+                               ThreadPool* threads, arrow::MemoryPool* pool)
+    : normalizer_(normalizer), threads_(threads), pool_(pool) {}
+
+arrow::Status ParallelSorter::Normalize(int64_t max_run_rows,
+                                       const std::vector<int64_t>& splits) {
+  const int64_t n = normalizer_.num_rows();
+  max_run_rows = std::max<int64_t>(max_run_rows, 1);
+  // Give every thread a run if the runs stay long enough to pay for the
+  // merge.
+  const int64_t min_runs = std::min<int64_t>(
+      threads_->num_threads(), (n + kMinRunRows - 1) / kMinRunRows);
+  // Each part between two splits gets its share of the runs.
+  std::vector<int64_t> bounds = {0};
+  for (int64_t split : splits) {
+    if (split > bounds.back() && split < n) bounds.push_back(split);
+  }
+  bounds.push_back(n);
+  run_offsets_.assign(1, 0);
+  for (size_t part = 0; part + 1 < bounds.size(); ++part) {
+    const int64_t begin = bounds[part];
+    const int64_t rows = bounds[part + 1] - begin;
+    const int64_t part_runs =
+        std::max({(rows + max_run_rows - 1) / max_run_rows,
+                  (rows * min_runs + n - 1) / std::max<int64_t>(n, 1),
+                  int64_t{1}});
+    for (int64_t i = 1; i <= part_runs; ++i) {
+      run_offsets_.push_back(begin + rows * i / part_runs);
+    }
+  }
+  const int64_t num_runs = this->num_runs();
+  // Each node gets a contiguous block of runs.
+  const int num_nodes = threads_->num_numa_nodes();
+  run_nodes_.assign(num_runs, -1);
+  if (num_nodes > 1) {
+    for (int64_t run = 0; run < num_runs; ++run) {
+      run_nodes_[run] = static_cast<int>(run * num_nodes / num_runs);
+    }
+  }
+
+  ARROW_ASSIGN_OR_RAISE(keys_, normalizer_.Allocate(pool_, true));
+  TaskGroup group(threads_);
+  for (int64_t run = 0; run < num_runs; ++run) {
+    if (num_nodes > 1) {
+      // Before the first write, so that the pages need not move later.
+      BindToNumaNode(keys_.mutable_row(run_offsets_[run]),
+                     run_rows(run) * keys_.row_width, run_nodes_[run]);
+    }
+    group.Spawn(
+        [this, run] {
+          normalizer_.NormalizeRows(run_offsets_[run], run_rows(run), &keys_);
+          return arrow::Status::OK();
+        },
+        run_nodes_[run]);
+  }
+  ARROW_RETURN_NOT_OK(group.Wait());
+  if (num_nodes > 1) {
+    numa_node_bytes_ = NumaNodeBytes(keys_.data->data(), keys_.data->size());
+  }
+  return arrow::Status::OK();
+}
+
+arrow::Status ParallelSorter::SortRuns(SortAlgorithm algorithm) {
+  if (algorithm == SortAlgorithm::kAuto) {
+    return arrow::Status::Invalid("no sort algorithm chosen for the runs");
+  }
+  if (algorithm == SortAlgorithm::kGpu) {
+    return arrow::Status::Invalid("the GPU sort sorts all rows, not runs");
+  }
+  TaskGroup group(threads_);
+  for (int64_t run = 0; run < num_runs(); ++run) {
+    group.Spawn([this, run, algorithm] { return SortRun(run, algorithm); },
+                run_nodes_[run]);
+  }
+  return group.Wait();
+}
+
+arrow::Status ParallelSorter::SortRun(int64_t run, SortAlgorithm algorithm) {
+  const int64_t offset = run_offsets_[run];
+  const int64_t length = run_rows(run);
+  if (length <= 1) return arrow::Status::OK();
+  const int64_t row_width = keys_.row_width;
+
+  if (algorithm == SortAlgorithm::kRadix ||
+      algorithm == SortAlgorithm::kCounting) {
+    NormalizedKeys run_keys = keys_;
+    run_keys.num_rows = length;
+    run_keys.data = arrow::SliceMutableBuffer(keys_.data, offset * row_width,
+                                              length * row_width);
+    if (algorithm == SortAlgorithm::kCounting) {
+      ARROW_ASSIGN_OR_RAISE(bool counted,
+                            CountingSort(&run_keys, normalizer_, pool_));
+      if (counted) return arrow::Status::OK();
+    }
+    return RadixSort(&run_keys, normalizer_, nullptr, pool_);
+  }
+
+  // Sort the row ids, then move the rows into sorted order for the merge.
+  std::vector<uint64_t> ids(length);
+  std::iota(ids.begin(), ids.end(), static_cast<uint64_t>(offset));
+  if (algorithm == SortAlgorithm::kRunMerge) {
+    // A run that already is in order stays where it is.
+    if (RunMergeSort(keys_, normalizer_, ids.data(), length) == 1) {
+      return arrow::Status::OK();
+    }
+  } else {
+    ComparisonSort(keys_, normalizer_, ids.data(), length);
+  }
+  ARROW_ASSIGN_OR_RAISE(auto sorted,
+                        arrow::AllocateBuffer(length * row_width, pool_));
+  uint8_t* out = sorted->mutable_data();
+  internal::GetRowKernels().gather_rows(keys_.row(0), ids.data(), length,
+                                        row_width, out);
+  std::memcpy(keys_.mutable_row(offset), out, length * row_width);
+  return arrow::Status::OK();
+}
+
+arrow::Status ParallelSorter::Merge(uint64_t* row_ids) {
+  const int64_t n = keys_.num_rows;
+  const int64_t row_width = keys_.row_width;
+  if (num_runs() == 1) {
+    return ParallelFor(threads_, n, kMinRunRows, [&](int64_t begin,
+                                                     int64_t end) {
+      internal::GetRowKernels().extract_row_ids(
+          keys_.row(begin), end - begin, row_width, row_ids + begin);
+      return arrow::Status::OK();
+    });
+  }
+  if (run_nodes_.front() != run_nodes_.back()) return MergeByNode(row_ids);
+  std::vector<SortedRows> runs;
+  for (int64_t run = 0; run < num_runs(); ++run) {
+    runs.push_back({keys_.row(run_offsets_[run]), run_rows(run)});
+  }
+  const int64_t num_partitions = std::max<int64_t>(
+      1, std::min<int64_t>(threads_->num_threads(), n / kMinRunRows));
+  return MergeRuns(runs, num_partitions, -1, nullptr, row_ids);
+}
+
+arrow::Status ParallelSorter::MergeByNode(uint64_t* row_ids) {
+  const int num_nodes = threads_->num_numa_nodes();
+  const int64_t row_width = keys_.row_width;
+  std::vector<std::vector<SortedRows>> node_runs(num_nodes);
+  for (int64_t run = 0; run < num_runs(); ++run) {
+    node_runs[run_nodes_[run]].push_back(
+        {keys_.row(run_offsets_[run]), run_rows(run)});
+  }
+
+  // Merge the runs of every node on its workers into memory of the node.
+  std::vector<std::shared_ptr<arrow::Buffer>> node_rows(num_nodes);
+  std::vector<SortedRows> merged;
+  TaskGroup group(threads_);
+  for (int node = 0; node < num_nodes; ++node) {
+    int64_t rows = 0;
+    for (const auto& run : node_runs[node]) rows += run.length;
+    if (rows == 0) continue;
+    ARROW_ASSIGN_OR_RAISE(node_rows[node],
+                          arrow::AllocateBuffer(rows * row_width, pool_));
+    uint8_t* out = node_rows[node]->mutable_data();
+    BindToNumaNode(out, rows * row_width, node);
+    merged.push_back({out, rows});
+    const int64_t num_partitions = std::max<int64_t>(
+        1, std::min<int64_t>(threads_->num_threads_on_node(node),
+                             rows / kMinRunRows));
+    group.Spawn(
+        [this, &node_runs, node, num_partitions, out] {
+          return MergeRuns(node_runs[node], num_partitions, node, out,
+                           nullptr);
+        },
+        node);
+  }
+  ARROW_RETURN_NOT_OK(group.Wait());
+
+  // Then merge the sorted rows of the nodes, the only reads across nodes.
+  const int64_t num_partitions = std::max<int64_t>(
+      1,
+      std::min<int64_t>(threads_->num_threads(), keys_.num_rows / kMinRunRows));
+  return MergeRuns(merged, num_partitions, -1, nullptr, row_ids);
+}
+
+arrow::Status ParallelSorter::MergeRuns(const std::vector<SortedRows>& runs,
+                                        int64_t num_partitions, int node,
+                                        uint8_t* out_rows, uint64_t* out_ids) {
+  const int64_t num_runs = static_cast<int64_t>(runs.size());
+  const int64_t row_width = keys_.row_width;
+  RowComparator comparator(normalizer_, keys_);
+  auto less = [&](const uint8_t* a, const uint8_t* b) {
+    return comparator.Less(a, b);
+  };
+
+  // Pick num_partitions - 1 splitters from evenly spaced samples of the runs.
+  std::vector<const uint8_t*> samples;
+  for (const auto& run : runs) {
+    const int64_t count =
+        std::min(run.length, kSamplesPerPartition * num_partitions);
+    for (int64_t i = 0; i < count; ++i) {
+      samples.push_back(run.rows + run.length * i / count * row_width);
+    }
+  }
+  std::sort(samples.begin(), samples.end(), less);
+
+  // cuts[p * num_runs + run] is the first row of `run` in partition p.
+  std::vector<int64_t> cuts((num_partitions + 1) * num_runs);
+  for (int64_t run = 0; run < num_runs; ++run) {
+    cuts[num_partitions * num_runs + run] = runs[run].length;
+  }
+  ARROW_RETURN_NOT_OK(ParallelFor(
+      threads_, num_partitions - 1, 1, [&](int64_t begin, int64_t end) {
+        for (int64_t p = begin + 1; p < end + 1; ++p) {
+          const uint8_t* splitter =
+              samples[samples.size() * p / num_partitions];
+          for (int64_t run = 0; run < num_runs; ++run) {
+            int64_t lo = 0;
+            int64_t hi = runs[run].length;
+            const uint8_t* rows = runs[run].rows;
+            while (lo < hi) {
+              int64_t mid = lo + (hi - lo) / 2;
+              if (less(rows + mid * row_width, splitter)) {
+                lo = mid + 1;
+              } else {
+                hi = mid;
+              }
+            }
+            cuts[p * num_runs + run] = lo;
+          }
+        }
+        return arrow::Status::OK();
+      }));
+
+  // Merge every partition into its place in the output.
+  TaskGroup group(threads_);
+  int64_t out_offset = 0;
+  for (int64_t p = 0; p < num_partitions; ++p) {
+    MergeCursors cursors{&comparator, keys_.key_width, row_width, {}, {}, {}};
+    int64_t partition_rows = 0;
+    for (int64_t run = 0; run < num_runs; ++run) {
+      const uint8_t* rows = runs[run].rows;
+      const int64_t begin = cuts[p * num_runs + run];
+      const int64_t end = cuts[(p + 1) * num_runs + run];
+      if (begin == end) continue;
+      cursors.Add(rows + begin * row_width, rows + end * row_width);
+      partition_rows += end - begin;
+    }
+    uint8_t* rows_out =
+        out_rows != nullptr ? out_rows + out_offset * row_width : nullptr;
+    uint64_t* ids_out = out_ids != nullptr ? out_ids + out_offset : nullptr;
+    out_offset += partition_rows;
+    group.Spawn(
+        [&comparator, cursors = std::move(cursors), rows_out, ids_out,
+         row_width]() mutable {
+          OvcLoserTree<MergeCursors> tree(
+              static_cast<int>(cursors.heads.size()), &cursors);
+          uint8_t* next_row = rows_out;
+          uint64_t* next_id = ids_out;
+          while (!tree.empty()) {
+            const int source = tree.top();
+            if (next_row != nullptr) {
+              std::memcpy(next_row, cursors.heads[source], row_width);
+              next_row += row_width;
+            } else {
+              *next_id++ = comparator.RowId(cursors.heads[source]);
+            }
+            cursors.Advance(source);
+            tree.Replay();
+          }
+          return arrow::Status::OK();
+        },
+        node);
+  }
+  return group.Wait();
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,114 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <arrow/memory_pool.h>
+#include <arrow/status.h>
+
+#include "common/thread_pool.h"
+#include "sort/key_normalizer.h"
+#include "sort/sort_algorithm.h"
+
+namespace whippet_sort {
+
+/// Sorts normalized keys on a thread pool: the rows are cut into contiguous
+/// runs that are normalized and sorted independently, one task per run, and
+/// the sorted runs are then merged by all threads at once.
+///
+/// The merge picks splitter rows from a sample of every run and cuts each run
+/// at the splitters by binary search, which yields one independent k-way
+/// merge per thread writing to a known offset of the output. Rows are
+/// ordered by normalized key, then CompareTail, then row id, so all rows are
+/// distinct and the result is the same as that of a single-threaded sort.
+///
+/// With a pool pinned to several NUMA nodes, the runs are split into one
+/// contiguous block per node: the normalized keys of each block are moved to
+/// its node, and its runs are normalized and sorted by the workers of that
+/// node. The merge then first merges the runs of each node on that node into
+/// memory of the node, and only the final merge of the per-node results
+/// reads across nodes. This holds the normalized keys twice during the
+/// merge.
+///
+/// Call Normalize(), SortRuns() and Merge() in this order; they are separate
+/// so that the caller can time each phase.
+class ParallelSorter {
+ public:
+  /// Runs shorter than this are not worth a task of their own.
+  static constexpr int64_t kMinRunRows = 64 * 1024;
+
+  ParallelSorter(const KeyNormalizer& normalizer, ThreadPool* threads,
+                 arrow::MemoryPool* pool);
+
+  /// Cuts the rows into runs of at most `max_run_rows` rows and at least one
+  /// run per thread if there are enough rows, then normalizes them. A run
+  /// starts at each row of the ascending `splits`, e.g. the first rows of the
+  /// files of a dataset, so that no run spans two of them.
+  arrow::Status Normalize(int64_t max_run_rows,
+                          const std::vector<int64_t>& splits = {});
+
+  /// Sorts every run with `algorithm`, which must not be kAuto or kGpu.
+  arrow::Status SortRuns(SortAlgorithm algorithm);
+
+  /// Writes the row ids of all rows in sorted order to `row_ids`.
+  arrow::Status Merge(uint64_t* row_ids);
+
+  int64_t num_runs() const {
+    return static_cast<int64_t>(run_offsets_.size()) - 1;
+  }
+  int64_t run_rows(int64_t run) const {
+    return run_offsets_[run + 1] - run_offsets_[run];
+  }
+  const NormalizedKeys& keys() const { return keys_; }
+
+  /// Bytes of normalized keys on each NUMA node after Normalize(), indexed
+  /// as NumaNodeCpus(), if the pool is pinned to several nodes; else empty.
+  const std::vector<int64_t>& numa_node_bytes() const {
+    return numa_node_bytes_;
+  }
+
+ private:
+  /// A sorted sequence of `length` rows of keys_.row_width bytes.
+  struct SortedRows {
+    const uint8_t* rows;
+    int64_t length;
+  };
+
+  arrow::Status SortRun(int64_t run, SortAlgorithm algorithm);
+
+  /// Merges `runs` in `num_partitions` independent parts, run on the workers
+  /// of `node` unless it is -1. Writes the merged rows to `out_rows` if it is
+  /// not null, else their row ids to `out_ids`.
+  arrow::Status MergeRuns(const std::vector<SortedRows>& runs,
+                          int64_t num_partitions, int node, uint8_t* out_rows,
+                          uint64_t* out_ids);
+
+  /// Merge() for runs on several NUMA nodes.
+  arrow::Status MergeByNode(uint64_t* row_ids);
+
+  const KeyNormalizer& normalizer_;
+  ThreadPool* threads_;
+  arrow::MemoryPool* pool_;
+  NormalizedKeys keys_;
+  /// Run i holds rows [run_offsets_[i], run_offsets_[i + 1]).
+  std::vector<int64_t> run_offsets_;
+  /// The NUMA node of each run, -1 if the pool is not pinned.
+  std::vector<int> run_nodes_;
+  std::vector<int64_t> numa_node_bytes_;
+};
+
+}  // namespace whippet_sort
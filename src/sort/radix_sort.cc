@@ -0,0 +1,238 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "sort/radix_sort.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <arrow/buffer.h>
+
+#include "common/cpu_features.h"
+#include "sort/radix_sort_kernels.h"
+
+namespace whippet_sort {
+
+namespace {
+
+// Buckets up to this size are insertion sorted instead of partitioned further.
+constexpr int64_t kInsertionSortThreshold = 24;
+// Keys up to this width are sorted LSD first, everything else MSD first.
+constexpr int32_t kMaxLsdKeyWidth = 8;
+
+const internal::RadixKernels& SelectKernels() {
+  switch (GetSimdLevel()) {
+#if defined(WHIPPET_SIMD_X86)
+    case SimdLevel::kAvx512:
+      return internal::GetRadixKernelsAvx512();
+    case SimdLevel::kAvx2:
+      return internal::GetRadixKernelsAvx2();
+#endif
+    default:
+      return internal::GetRadixKernelsNone();
+  }
+}
+
+class RadixSorter {
+ public:
+  RadixSorter(const KeyNormalizer& normalizer, int32_t key_width,
+              int32_t row_width, uint8_t* scratch)
+      : kernels_(SelectKernels()),
+        normalizer_(normalizer),
+        key_width_(key_width),
+        row_width_(row_width),
+        scratch_(scratch),
+        swap_row_(row_width) {}
+
+  void LsdSort(uint8_t* rows, int64_t n) {
+    std::vector<uint64_t> counts(static_cast<size_t>(key_width_) * 256);
+    kernels_.histogram_all(rows, n, row_width_, key_width_, counts.data());
+    uint8_t* src = rows;
+    uint8_t* dst = scratch_;
+    uint64_t offsets[256];
+    for (int32_t byte = key_width_ - 1; byte >= 0; --byte) {
+      const uint64_t* byte_counts = counts.data() + byte * 256;
+      if (IsConstant(byte_counts, src[byte], n)) continue;
+      PrefixSum(byte_counts, offsets);
+      kernels_.scatter(src, dst, n, row_width_, byte, offsets);
+      std::swap(src, dst);
+    }
+    if (src != rows) {
+      std::memcpy(rows, src, n * row_width_);
+    }
+    // LSD passes are stable and the rows start in row id order, so only the
+    // ties that the tail keys decide are left.
+    if (!normalizer_.exact()) {
+      SortTieRuns(rows, n);
+    }
+  }
+
+  /// Sorts `n` rows whose bytes before `byte` are all equal. `scratch` is the
+  /// part of the scratch buffer that lines up with `rows`.
+  void MsdSort(uint8_t* rows, uint8_t* scratch, int64_t n, int32_t byte) {
+    uint64_t counts[256];
+    uint64_t offsets[256];
+    while (true) {
+      if (n <= kInsertionSortThreshold) {
+        InsertionSort(rows, n, byte);
+        return;
+      }
+      if (byte == key_width_) {
+        SortTies(rows, n);
+        return;
+      }
+      kernels_.histogram(rows, n, row_width_, byte, counts);
+      if (IsConstant(counts, rows[byte], n)) {
+        ++byte;
+        continue;
+      }
+      PrefixSum(counts, offsets);
+      kernels_.scatter(rows, scratch, n, row_width_, byte, offsets);
+      std::memcpy(rows, scratch, n * row_width_);
+      int64_t start = 0;
+      for (int b = 0; b < 256; ++b) {
+        const auto count = static_cast<int64_t>(counts[b]);
+        if (count > 1) {
+          MsdSort(rows + start * row_width_, scratch + start * row_width_,
+                  count, byte + 1);
+        }
+        start += count;
+      }
+      return;
+    }
+  }
+
+ private:
+  static bool IsConstant(const uint64_t* counts, uint8_t first,
+                         int64_t n) {
+    return counts[first] == static_cast<uint64_t>(n);
+  }
+
+  static void PrefixSum(const uint64_t* counts, uint64_t* offsets) {
+    uint64_t sum = 0;
+    for (int b = 0; b < 256; ++b) {
+      offsets[b] = sum;
+      sum += counts[b];
+    }
+  }
+
+  uint64_t RowId(const uint8_t* row) const {
+    uint64_t id;
+    std::memcpy(&id, row + row_width_ - sizeof(id), sizeof(id));
+    return id;
+  }
+
+  void SetRowId(uint8_t* row, uint64_t id) const {
+    std::memcpy(row + row_width_ - sizeof(id), &id, sizeof(id));
+  }
+
+  /// Compares two rows whose bytes before `byte` are equal.
+  int Compare(const uint8_t* a, const uint8_t* b, int32_t byte) const {
+    int cmp = std::memcmp(a + byte, b + byte, key_width_ - byte);
+    if (cmp != 0) return cmp;
+    const uint64_t a_id = RowId(a);
+    const uint64_t b_id = RowId(b);
+    if (!normalizer_.exact()) {
+      cmp = normalizer_.CompareTail(a_id, b_id);
+      if (cmp != 0) return cmp;
+    }
+    return a_id < b_id ? -1 : (a_id > b_id ? 1 : 0);
+  }
+
+  void InsertionSort(uint8_t* rows, int64_t n, int32_t byte) {
+    uint8_t* tmp = swap_row_.data();
+    for (int64_t i = 1; i < n; ++i) {
+      uint8_t* row = rows + i * row_width_;
+      if (Compare(row - row_width_, row, byte) <= 0) continue;
+      std::memcpy(tmp, row, row_width_);
+      int64_t j = i;
+      for (; j > 0 && Compare(rows + (j - 1) * row_width_, tmp, byte) > 0;
+           --j) {
+        std::memcpy(rows + j * row_width_, rows + (j - 1) * row_width_,
+                    row_width_);
+      }
+      std::memcpy(rows + j * row_width_, tmp, row_width_);
+    }
+  }
+
+  /// Orders `n` rows with equal normalized keys. Only the row ids move.
+  void SortTies(uint8_t* rows, int64_t n) {
+    tie_ids_.resize(n);
+    for (int64_t i = 0; i < n; ++i) {
+      tie_ids_[i] = RowId(rows + i * row_width_);
+    }
+    if (normalizer_.exact()) {
+      std::sort(tie_ids_.begin(), tie_ids_.end());
+    } else {
+      std::sort(tie_ids_.begin(), tie_ids_.end(), [&](uint64_t a, uint64_t b) {
+        int cmp = normalizer_.CompareTail(a, b);
+        return cmp != 0 ? cmp < 0 : a < b;
+      });
+    }
+    for (int64_t i = 0; i < n; ++i) {
+      SetRowId(rows + i * row_width_, tie_ids_[i]);
+    }
+  }
+
+  void SortTieRuns(uint8_t* rows, int64_t n) {
+    int64_t begin = 0;
+    for (int64_t i = 1; i <= n; ++i) {
+      if (i == n || std::memcmp(rows + begin * row_width_,
+                                rows + i * row_width_, key_width_) != 0) {
+        if (i - begin > 1) SortTies(rows + begin * row_width_, i - begin);
+        begin = i;
+      }
+    }
+  }
+
+  const internal::RadixKernels& kernels_;
+  const KeyNormalizer& normalizer_;
+  const int32_t key_width_;
+  const int32_t row_width_;
+  uint8_t* scratch_;
+  std::vector<uint8_t> swap_row_;
+  std::vector<uint64_t> tie_ids_;
+};
+
+}  // namespace
+
+arrow::Status RadixSort(NormalizedKeys* keys, const KeyNormalizer& normalizer,
+                        uint64_t* row_ids, arrow::MemoryPool* pool) {
+  if (!keys->with_row_ids) {
+    return arrow::Status::Invalid("radix sort needs keys with row ids");
+  }
+  const int64_t n = keys->num_rows;
+  uint8_t* rows = keys->data->mutable_data();
+  if (n > 1) {
+    ARROW_ASSIGN_OR_RAISE(auto scratch,
+                          arrow::AllocateBuffer(n * keys->row_width, pool));
+    RadixSorter sorter(normalizer, keys->key_width, keys->row_width,
+                       scratch->mutable_data());
+    if (keys->key_width <= kMaxLsdKeyWidth) {
+      sorter.LsdSort(rows, n);
+    } else {
+      sorter.MsdSort(rows, scratch->mutable_data(), n, 0);
+    }
+  }
+  if (row_ids != nullptr) {
+    for (int64_t i = 0; i < n; ++i) {
+      row_ids[i] = keys->row_id(i);
+    }
+  }
+  return arrow::Status::OK();
+}
+
+}  // namespace whippet_sort
@@ -0,0 +1,42 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+
+#include <arrow/memory_pool.h>
+#include <arrow/status.h>
+
+#include "sort/key_normalizer.h"
+
+namespace whippet_sort {
+
+/// Radix sorts normalized keys that carry their row ids (see
+/// KeyNormalizer::NormalizeAll), reordering the rows of `keys` in place, and
+/// writes the row ids in sorted order to `row_ids` unless it is null.
+///
+/// Short keys (up to 8 bytes) use an LSD radix sort that counts every key
+/// byte in one pass; longer keys use an MSD radix sort that falls back to
+/// insertion sort for small buckets. Both skip the passes over key bytes that
+/// are the same in all rows, e.g. the high bytes of an integer column with a
+/// small range. Ties on the normalized key are broken by
+/// `normalizer.CompareTail` and then by row id, as in ComparisonSort.
+///
+/// The histogram and scatter kernels are chosen at runtime according to
+/// GetSimdLevel().
+arrow::Status RadixSort(NormalizedKeys* keys, const KeyNormalizer& normalizer,
+                        uint64_t* row_ids, arrow::MemoryPool* pool);
+
+}  // namespace whippet_sort
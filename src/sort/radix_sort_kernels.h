@@ -0,0 +1,47 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+
+namespace whippet_sort {
+namespace internal {
+
+/// The inner loops of the radix sort. They are compiled from
+/// radix_sort_kernels_impl.h once portably and once each for AVX2 and AVX-512,
+/// whose scatter is vectorized, and the widest one the CPU supports is picked
+/// at runtime.
+struct RadixKernels {
+  /// Counts byte `byte` of `n` rows that are `row_width` bytes apart into
+  /// `counts[256]`.
+  void (*histogram)(const uint8_t* rows, int64_t n, int32_t row_width,
+                    int32_t byte, uint64_t* counts);
+  /// Counts all bytes in [0, key_width) in a single pass over the rows into
+  /// `counts[key_width * 256]`.
+  void (*histogram_all)(const uint8_t* rows, int64_t n, int32_t row_width,
+                        int32_t key_width, uint64_t* counts);
+  /// Moves row i of `src` to row `offsets[src[i][byte]]++` of `dst`.
+  void (*scatter)(const uint8_t* src, uint8_t* dst, int64_t n,
+                  int32_t row_width, int32_t byte, uint64_t* offsets);
+};
+
+const RadixKernels& GetRadixKernelsNone();
+#if defined(WHIPPET_SIMD_X86)
+const RadixKernels& GetRadixKernelsAvx2();
+const RadixKernels& GetRadixKernelsAvx512();
+#endif
+
+}  // namespace internal
+}  // namespace whippet_sort
@@ -0,0 +1,166 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+// Radix sort kernels, included once by each radix_sort_kernels*.cc. Each of
+// those files is compiled with the instruction set flags of one SimdLevel.
+// With AVX2 or AVX-512 the scatter stages rows per bucket in cache-resident
+// buffers that are flushed to the output with full vector stores; the SSE4.2
+// and portable copies write each row in place. The histograms are scalar for
+// every level: byte-indexed counting has no vector form on x86, and gathering
+// the key bytes measured slower than the unrolled loads below. Everything here
+// lives in an anonymous namespace so the copies do not clash.
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "sort/radix_sort_kernels.h"
+
+namespace whippet_sort {
+namespace internal {
+namespace {
+
+#if defined(__AVX2__)
+// Bytes staged per bucket before the scatter flushes them, two cache lines.
+constexpr int32_t kStageBytes = 128;
+// Scatters of fewer rows write their rows directly, staging would not pay off.
+constexpr int64_t kMinStagedRows = 4096;
+#endif
+
+void Histogram(const uint8_t* rows, int64_t n, int32_t row_width, int32_t byte,
+               uint64_t* counts) {
+  // Four tables break the store-to-load dependency between rows with the
+  // same byte value, which is the common case for low-cardinality keys.
+  uint64_t tables[4][256] = {};
+  const uint8_t* p = rows + byte;
+  const int64_t stride = row_width;
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4, p += 4 * stride) {
+    ++tables[0][p[0]];
+    ++tables[1][p[stride]];
+    ++tables[2][p[2 * stride]];
+    ++tables[3][p[3 * stride]];
+  }
+  for (; i < n; ++i, p += stride) {
+    ++tables[0][p[0]];
+  }
+  for (int b = 0; b < 256; ++b) {
+    counts[b] = tables[0][b] + tables[1][b] + tables[2][b] + tables[3][b];
+  }
+}
+
+void HistogramAll(const uint8_t* rows, int64_t n, int32_t row_width,
+                  int32_t key_width, uint64_t* counts) {
+  std::memset(counts, 0, sizeof(uint64_t) * 256 * key_width);
+  const uint8_t* row = rows;
+  for (int64_t i = 0; i < n; ++i, row += row_width) {
+    for (int32_t j = 0; j < key_width; ++j) {
+      ++counts[j * 256 + row[j]];
+    }
+  }
+}
+
+#if defined(__AVX2__)
+/// Copies `bytes` bytes with full-width vector loads and stores.
+inline void CopyVectors(uint8_t* dst, const uint8_t* src, int64_t bytes) {
+#if defined(__AVX512BW__)
+  for (; bytes >= 64; bytes -= 64, src += 64, dst += 64) {
+    _mm512_storeu_si512(dst, _mm512_loadu_si512(src));
+  }
+  if (bytes > 0) {
+    const __mmask64 mask = _bzhi_u64(~uint64_t{0}, bytes);
+    _mm512_mask_storeu_epi8(dst, mask, _mm512_maskz_loadu_epi8(mask, src));
+  }
+#else
+  for (; bytes >= 32; bytes -= 32, src += 32, dst += 32) {
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(dst),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+  }
+  if (bytes > 0) std::memcpy(dst, src, bytes);
+#endif
+}
+
+/// ScatterFixed through per-bucket staging buffers. Each bucket writes whole
+/// staged lines to its output range, so the scatter touches 256 cache lines
+/// and TLB entries once per flush instead of once per row.
+template <int kRowWidth>
+void StagedScatter(const uint8_t* src, uint8_t* dst, int64_t n, int32_t byte,
+                   uint64_t* offsets) {
+  constexpr int32_t kRowsPerStage = kStageBytes / kRowWidth;
+  constexpr int32_t kFlushBytes = kRowsPerStage * kRowWidth;
+  alignas(64) static thread_local uint8_t stage[256 * kStageBytes];
+  int32_t fill[256] = {};
+  for (int64_t i = 0; i < n; ++i, src += kRowWidth) {
+    const uint8_t b = src[byte];
+    uint8_t* bucket = stage + b * kStageBytes;
+    std::memcpy(bucket + fill[b] * kRowWidth, src, kRowWidth);
+    if (++fill[b] == kRowsPerStage) {
+      CopyVectors(dst + offsets[b] * kRowWidth, bucket, kFlushBytes);
+      offsets[b] += kRowsPerStage;
+      fill[b] = 0;
+    }
+  }
+  for (int b = 0; b < 256; ++b) {
+    if (fill[b] == 0) continue;
+    CopyVectors(dst + offsets[b] * kRowWidth, stage + b * kStageBytes,
+                fill[b] * kRowWidth);
+    offsets[b] += fill[b];
+  }
+}
+#endif
+
+template <int kRowWidth>
+void ScatterFixed(const uint8_t* src, uint8_t* dst, int64_t n, int32_t byte,
+                  uint64_t* offsets) {
+#if defined(__AVX2__)
+  if (n >= kMinStagedRows) {
+    return StagedScatter<kRowWidth>(src, dst, n, byte, offsets);
+  }
+#endif
+  for (int64_t i = 0; i < n; ++i, src += kRowWidth) {
+    std::memcpy(dst + offsets[src[byte]]++ * kRowWidth, src, kRowWidth);
+  }
+}
+
+void Scatter(const uint8_t* src, uint8_t* dst, int64_t n, int32_t row_width,
+             int32_t byte, uint64_t* offsets) {
+  switch (row_width) {
+    case 16:
+      return ScatterFixed<16>(src, dst, n, byte, offsets);
+    case 24:
+      return ScatterFixed<24>(src, dst, n, byte, offsets);
+    case 32:
+      return ScatterFixed<32>(src, dst, n, byte, offsets);
+    case 40:
+      return ScatterFixed<40>(src, dst, n, byte, offsets);
+    case 48:
+      return ScatterFixed<48>(src, dst, n, byte, offsets);
+    case 64:
+      return ScatterFixed<64>(src, dst, n, byte, offsets);
+    default:
+      break;
+  }
+  for (int64_t i = 0; i < n; ++i, src += row_width) {
+    std::memcpy(dst + offsets[src[byte]]++ * row_width, src, row_width);
+  }
+}
+
+constexpr RadixKernels kKernels = {Histogram, HistogramAll, Scatter};
+
+}  // namespace
+}  // namespace internal
+}  // namespace whippet_sort
@@ -0,0 +1,50 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+#include "sort/row_kernels_impl.h"
+
+#include "common/cpu_features.h"
+
+namespace whippet_sort {
+namespace internal {
+
+namespace {
+
+const RowKernels& SelectRowKernels() {
+  switch (GetSimdLevel()) {
+#if defined(WHIPPET_SIMD_X86)
+    case SimdLevel::kAvx512:
+      return GetRowKernelsAvx512();
+    case SimdLevel::kAvx2:
+      return GetRowKernelsAvx2();
+    case SimdLevel::kSse42:
+      return GetRowKernelsSse42();
+#endif
+    default:
+      return GetRowKernelsNone();
+  }
+}
+
+}  // namespace
+
+const RowKernels& GetRowKernels() {
+  static const RowKernels& kernels = SelectRowKernels();
+  return kernels;
+}
+
+const RowKernels& GetRowKernelsNone() { return kKernels; }
+
+}  // namespace internal
+}  // namespace whippet_sort
@@ -0,0 +1,54 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+#pragma once
+
+#include <cstdint>
+
+namespace whippet_sort {
+namespace internal {
+
+/// Row-at-a-time loops of key normalization and of the sort's row moves, with
+/// one copy per SimdLevel like RadixKernels.
+struct RowKernels {
+  /// Encodes `n` integers of `byte_width` bytes (1, 2, 4 or 8) to `dst`,
+  /// `stride` bytes apart: each value XORed with the low `byte_width` bytes
+  /// of `flip`, in big-endian.
+  void (*encode_integers)(const uint8_t* values, int64_t n, int32_t byte_width,
+                          uint64_t flip, uint8_t* dst, int32_t stride);
+  /// Encodes `n` floats (`byte_width` 4) or doubles (8) in the order of their
+  /// values, with -0.0 as 0.0 and all NaNs last, inverted when `descending`.
+  void (*encode_floats)(const uint8_t* values, int64_t n, int32_t byte_width,
+                        bool descending, uint8_t* dst, int32_t stride);
+  /// Copies row `ids[i]` of `rows` to row i of `out`.
+  void (*gather_rows)(const uint8_t* rows, const uint64_t* ids, int64_t n,
+                      int32_t row_width, uint8_t* out);
+  /// Copies the row ids in the last 8 bytes of `n` rows to `out`.
+  void (*extract_row_ids)(const uint8_t* rows, int64_t n, int32_t row_width,
+                          uint64_t* out);
+};
+
+/// The kernels of GetSimdLevel().
+const RowKernels& GetRowKernels();
+
+const RowKernels& GetRowKernelsNone();
+#if defined(WHIPPET_SIMD_X86)
+const RowKernels& GetRowKernelsSse42();
+const RowKernels& GetRowKernelsAvx2();
+const RowKernels& GetRowKernelsAvx512();
+#endif
+
+}  // namespace internal
+}  // namespace whippet_sort
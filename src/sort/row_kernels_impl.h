@@ -0,0 +1,174 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+
+// Row kernels, included once by each row_kernels*.cc and compiled with the
+// instruction set flags of one SimdLevel, see radix_sort_kernels_impl.h.
+// The encoders work in blocks: the byte swaps and sign flips run over
+// contiguous values, where they vectorize, and only the strided stores into
+// the rows are scalar.
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "sort/row_kernels.h"
+
+namespace whippet_sort {
+namespace internal {
+namespace {
+
+constexpr int64_t kBlockRows = 256;
+// Rows ahead of the current one whose source row a gather prefetches.
+constexpr int64_t kGatherPrefetchDistance = 16;
+
+inline uint8_t ByteSwap(uint8_t v) { return v; }
+inline uint16_t ByteSwap(uint16_t v) { return __builtin_bswap16(v); }
+inline uint32_t ByteSwap(uint32_t v) { return __builtin_bswap32(v); }
+inline uint64_t ByteSwap(uint64_t v) { return __builtin_bswap64(v); }
+
+template <typename U>
+void StoreBlock(const U* block, int64_t n, uint8_t* dst, int32_t stride) {
+  for (int64_t i = 0; i < n; ++i, dst += stride) {
+    std::memcpy(dst, &block[i], sizeof(U));
+  }
+}
+
+template <typename U>
+void EncodeIntegersOf(const uint8_t* values, int64_t n, U flip, uint8_t* dst,
+                      int32_t stride) {
+  U block[kBlockRows];
+  for (int64_t begin = 0; begin < n; begin += kBlockRows) {
+    const int64_t m = std::min(kBlockRows, n - begin);
+    const uint8_t* src = values + begin * sizeof(U);
+    for (int64_t i = 0; i < m; ++i) {
+      U value;
+      std::memcpy(&value, src + i * sizeof(U), sizeof(U));
+      block[i] = ByteSwap(static_cast<U>(value ^ flip));
+    }
+    StoreBlock(block, m, dst + begin * stride, stride);
+  }
+}
+
+void EncodeIntegers(const uint8_t* values, int64_t n, int32_t byte_width,
+                    uint64_t flip, uint8_t* dst, int32_t stride) {
+  switch (byte_width) {
+    case 1:
+      return EncodeIntegersOf<uint8_t>(values, n, static_cast<uint8_t>(flip),
+                                       dst, stride);
+    case 2:
+      return EncodeIntegersOf<uint16_t>(values, n, static_cast<uint16_t>(flip),
+                                        dst, stride);
+    case 4:
+      return EncodeIntegersOf<uint32_t>(values, n, static_cast<uint32_t>(flip),
+                                        dst, stride);
+    default:
+      return EncodeIntegersOf<uint64_t>(values, n, flip, dst, stride);
+  }
+}
+
+template <typename F, typename U>
+void EncodeFloatsOf(const uint8_t* values, int64_t n, bool descending,
+                    uint8_t* dst, int32_t stride) {
+  constexpr U kSignBit = U{1} << (sizeof(U) * 8 - 1);
+  const F nan = std::numeric_limits<F>::quiet_NaN();
+  U nan_bits;
+  std::memcpy(&nan_bits, &nan, sizeof(U));
+  const U invert = descending ? static_cast<U>(~U{0}) : U{0};
+  U block[kBlockRows];
+  for (int64_t begin = 0; begin < n; begin += kBlockRows) {
+    const int64_t m = std::min(kBlockRows, n - begin);
+    const uint8_t* src = values + begin * sizeof(F);
+    for (int64_t i = 0; i < m; ++i) {
+      F value;
+      U bits;
+      std::memcpy(&value, src + i * sizeof(F), sizeof(F));
+      std::memcpy(&bits, &value, sizeof(U));
+      bits = value == 0 ? U{0} : bits;
+      bits = value != value ? nan_bits : bits;
+      const U mask = (bits & kSignBit) ? static_cast<U>(~U{0}) : kSignBit;
+      block[i] = ByteSwap(static_cast<U>(bits ^ mask ^ invert));
+    }
+    StoreBlock(block, m, dst + begin * stride, stride);
+  }
+}
+
+void EncodeFloats(const uint8_t* values, int64_t n, int32_t byte_width,
+                  bool descending, uint8_t* dst, int32_t stride) {
+  if (byte_width == 4) {
+    EncodeFloatsOf<float, uint32_t>(values, n, descending, dst, stride);
+  } else {
+    EncodeFloatsOf<double, uint64_t>(values, n, descending, dst, stride);
+  }
+}
+
+template <int kRowWidth>
+void GatherFixed(const uint8_t* rows, const uint64_t* ids, int64_t n,
+                 uint8_t* out) {
+  for (int64_t i = 0; i < n; ++i, out += kRowWidth) {
+    if (i + kGatherPrefetchDistance < n) {
+      __builtin_prefetch(rows + ids[i + kGatherPrefetchDistance] * kRowWidth);
+    }
+    std::memcpy(out, rows + ids[i] * kRowWidth, kRowWidth);
+  }
+}
+
+void GatherRows(const uint8_t* rows, const uint64_t* ids, int64_t n,
+                int32_t row_width, uint8_t* out) {
+  switch (row_width) {
+    case 1:
+      return GatherFixed<1>(rows, ids, n, out);
+    case 2:
+      return GatherFixed<2>(rows, ids, n, out);
+    case 4:
+      return GatherFixed<4>(rows, ids, n, out);
+    case 8:
+      return GatherFixed<8>(rows, ids, n, out);
+    case 16:
+      return GatherFixed<16>(rows, ids, n, out);
+    case 24:
+      return GatherFixed<24>(rows, ids, n, out);
+    case 32:
+      return GatherFixed<32>(rows, ids, n, out);
+    case 40:
+      return GatherFixed<40>(rows, ids, n, out);
+    case 48:
+      return GatherFixed<48>(rows, ids, n, out);
+    case 64:
+      return GatherFixed<64>(rows, ids, n, out);
+    default:
+      break;
+  }
+  for (int64_t i = 0; i < n; ++i, out += row_width) {
+    if (i + kGatherPrefetchDistance < n) {
+      __builtin_prefetch(rows + ids[i + kGatherPrefetchDistance] * row_width);
+    }
+    std::memcpy(out, rows + ids[i] * row_width, row_width);
+  }
+}
+
+void ExtractRowIds(const uint8_t* rows, int64_t n, int32_t row_width,
+                   uint64_t* out) {
+  const uint8_t* id = rows + row_width - sizeof(uint64_t);
+  for (int64_t i = 0; i < n; ++i, id += row_width) {
+    std::memcpy(&out[i], id, sizeof(uint64_t));
+  }
+}
+
+constexpr RowKernels kKernels = {EncodeIntegers, EncodeFloats, GatherRows,
+                                 ExtractRowIds};
+
+}  // namespace
+}  // namespace internal
+}  // namespace whippet_sort
@@ -0,0 +1,179 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "sort/sort_algorithm.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <arrow/status.h>
+
+#include "sort/counting_sort.h"
+
+namespace whippet_sort {
+
+namespace {
+
+// Below a few thousand rows per run the radix histograms cost more than they
+// save.
+constexpr int64_t kMinRadixSortRows = 4096;
+
+// Pairs of neighbouring rows compared to estimate the presortedness.
+constexpr int64_t kKeyOrderSamples = 1024;
+
+// A run merge pays off when there are few runs to find and merge: at most
+// one sampled pair in this many out of order, or, for input sorted the other
+// way, in order.
+constexpr int64_t kNearlySortedRatio = 256;
+
+// Keys that fit the buckets of a counting sort.
+constexpr int64_t kMaxCountingKeys = int64_t{1}
+                                     << (8 * kMaxCountingSortBytes);
+
+}  // namespace
+
+const char* SortAlgorithmName(SortAlgorithm algorithm) {
+  switch (algorithm) {
+    case SortAlgorithm::kAuto:
+      return "auto";
+    case SortAlgorithm::kComparison:
+      return "comparison";
+    case SortAlgorithm::kRadix:
+      return "radix";
+    case SortAlgorithm::kCounting:
+      return "counting";
+    case SortAlgorithm::kRunMerge:
+      return "run-merge";
+    case SortAlgorithm::kGpu:
+      return "gpu";
+  }
+  return "unknown";
+}
+
+arrow::Result<SortAlgorithm> ParseSortAlgorithm(const std::string& name) {
+  for (auto algorithm :
+       {SortAlgorithm::kAuto, SortAlgorithm::kComparison, SortAlgorithm::kRadix,
+        SortAlgorithm::kCounting, SortAlgorithm::kRunMerge,
+        SortAlgorithm::kGpu}) {
+    if (name == SortAlgorithmName(algorithm)) return algorithm;
+  }
+  return arrow::Status::Invalid("unknown sort algorithm '", name, "'");
+}
+
+void SampleKeyOrder(const NormalizedKeys& keys, const KeyNormalizer& normalizer,
+                    KeyProfile* profile) {
+  const int64_t num_rows = keys.num_rows;
+  const int32_t width = keys.key_width;
+  if (num_rows < 2) return;
+  const int64_t num_pairs = std::min(kKeyOrderSamples, num_rows - 1);
+  std::vector<uint8_t> varying(width, 0);
+  const uint8_t* first = keys.row(0);
+  for (int64_t i = 0; i < num_pairs; ++i) {
+    // Rows are in row id order before the sort, so a tie is in order.
+    const int64_t a = i * (num_rows - 1) / num_pairs;
+    const uint8_t* row_a = keys.row(a);
+    const uint8_t* row_b = keys.row(a + 1);
+    int cmp = CompareNormalizedKeys(row_a, row_b, width);
+    if (cmp == 0 && !normalizer.exact()) {
+      cmp = normalizer.CompareTail(a, a + 1);
+    }
+    if (cmp > 0) ++profile->num_sampled_descents;
+    for (int32_t byte = 0; byte < width; ++byte) {
+      varying[byte] |= row_a[byte] ^ first[byte];
+      varying[byte] |= row_b[byte] ^ first[byte];
+    }
+  }
+  profile->num_sampled_pairs += num_pairs;
+  profile->sampled_varying_bytes = static_cast<int32_t>(
+      width - std::count(varying.begin(), varying.end(), 0));
+}
+
+SortAlgorithmChoice ChooseSortAlgorithm(const KeyProfile& profile,
+                                        const GpuDevice* gpu) {
+  SortAlgorithmChoice choice;
+  if (profile.run_rows < kMinRadixSortRows) {
+    choice.algorithm = SortAlgorithm::kComparison;
+    choice.reason = "runs of " + std::to_string(profile.run_rows) +
+                    " rows, too few for radix passes";
+    return choice;
+  }
+  if (profile.num_sampled_pairs > 0 &&
+      profile.num_sampled_descents * kNearlySortedRatio <=
+          profile.num_sampled_pairs) {
+    choice.algorithm = SortAlgorithm::kRunMerge;
+    choice.reason = std::to_string(profile.num_sampled_descents) + " of " +
+                    std::to_string(profile.num_sampled_pairs) +
+                    " sampled neighbours out of order";
+    return choice;
+  }
+  // Ties count as in order, so this only holds for strictly descending runs,
+  // the ones the run merge reverses.
+  const int64_t num_sampled_ascents =
+      profile.num_sampled_pairs - profile.num_sampled_descents;
+  if (profile.num_sampled_pairs > 0 &&
+      num_sampled_ascents * kNearlySortedRatio <= profile.num_sampled_pairs) {
+    choice.algorithm = SortAlgorithm::kRunMerge;
+    choice.reason = std::to_string(profile.num_sampled_descents) + " of " +
+                    std::to_string(profile.num_sampled_pairs) +
+                    " sampled neighbours in reverse order";
+    return choice;
+  }
+  if (profile.exact && profile.max_distinct_keys >= 0 &&
+      profile.max_distinct_keys <= kMaxCountingKeys) {
+    const char* source = profile.distinct_keys_from_statistics
+                             ? (profile.distinct_keys_from_dictionaries
+                                    ? "statistics and dictionary sizes"
+                                    : "column statistics")
+                             : "dictionary sizes";
+    choice.algorithm = SortAlgorithm::kCounting;
+    choice.reason = "at most " + std::to_string(profile.max_distinct_keys) +
+                    " distinct keys by the " + source;
+    return choice;
+  }
+  if (profile.exact && profile.max_distinct_keys < 0 &&
+      profile.sampled_varying_bytes >= 0 &&
+      profile.sampled_varying_bytes <= kMaxCountingSortBytes) {
+    choice.algorithm = SortAlgorithm::kCounting;
+    choice.reason = "sampled keys differ in " +
+                    std::to_string(profile.sampled_varying_bytes) + " bytes";
+    return choice;
+  }
+  if (gpu != nullptr && profile.exact) {
+    const auto estimate =
+        EstimateGpuSort(*gpu, profile.num_rows, profile.row_width,
+                        profile.key_width, profile.num_threads);
+    if (estimate.profitable()) {
+      choice.algorithm = SortAlgorithm::kGpu;
+      choice.reason =
+          std::to_string(profile.num_rows) + " rows of " +
+          std::to_string(profile.key_width) + "-byte keys, estimated " +
+          std::to_string((estimate.transfer_nanos + estimate.gpu_sort_nanos) /
+                         1000000) +
+          " ms on " + gpu->name + " against " +
+          std::to_string(estimate.cpu_sort_nanos / 1000000) + " ms on " +
+          std::to_string(profile.num_threads) + " threads";
+      return choice;
+    }
+  }
+  choice.algorithm = SortAlgorithm::kRadix;
+  choice.reason = std::to_string(profile.key_width) + "-byte keys";
+  if (profile.num_sampled_pairs > 0) {
+    choice.reason += ", " + std::to_string(profile.num_sampled_descents) +
+                     " of " + std::to_string(profile.num_sampled_pairs) +
+                     " sampled neighbours out of order";
+  }
+  return choice;
+}
+
+}  // namespace whippet_sort
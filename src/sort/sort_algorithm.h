@@ -0,0 +1,95 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <arrow/result.h>
+
+#include "sort/gpu_sort.h"
+#include "sort/key_normalizer.h"
+
+namespace whippet_sort {
+
+/// How the normalized keys are sorted.
+enum class SortAlgorithm {
+  /// Let the engine pick per query, see ChooseSortAlgorithm().
+  kAuto,
+  /// std::sort over row ids, comparing normalized keys with memcmp.
+  kComparison,
+  /// MSD/LSD radix sort over the normalized key bytes.
+  kRadix,
+  /// One counting pass over the at most two key bytes in which the rows
+  /// differ, e.g. for few distinct values or small dictionaries. Runs whose
+  /// rows differ in more bytes are radix sorted.
+  kCounting,
+  /// Finds the ascending and descending runs already in the input and merges
+  /// them, for nearly sorted, reverse sorted or clustered input.
+  kRunMerge,
+  /// Sorts all rows at once with a radix sort on the GPU, see
+  /// GpuSortRowIds(), instead of runs on the sort threads. Needs exact keys
+  /// and a build with WHIPPET_ENABLE_CUDA.
+  kGpu,
+};
+
+const char* SortAlgorithmName(SortAlgorithm algorithm);
+
+arrow::Result<SortAlgorithm> ParseSortAlgorithm(const std::string& name);
+
+/// What is known about the keys of a sort before sorting them.
+struct KeyProfile {
+  /// Rows of the largest run, see ParallelSorter.
+  int64_t run_rows = 0;
+  /// Rows of all runs, and the threads that sort them.
+  int64_t num_rows = 0;
+  int num_threads = 1;
+  int32_t key_width = 0;
+  /// Bytes per row of the normalized keys, with the row id.
+  int32_t row_width = 0;
+  /// Whether the normalized key alone decides the order.
+  bool exact = false;
+  /// Upper bound of the distinct keys by the column statistics and the
+  /// dictionary sizes of the key columns, or -1 if unknown.
+  int64_t max_distinct_keys = -1;
+  bool distinct_keys_from_statistics = false;
+  bool distinct_keys_from_dictionaries = false;
+  /// Sampled pairs of neighbouring rows, and those of them out of order.
+  int64_t num_sampled_pairs = 0;
+  int64_t num_sampled_descents = 0;
+  /// Key bytes in which the sampled rows differ, or -1 if not sampled.
+  int32_t sampled_varying_bytes = -1;
+};
+
+/// Compares evenly spaced pairs of neighbouring rows of `keys`, before they
+/// are sorted, and fills in the sampled fields of `profile`.
+void SampleKeyOrder(const NormalizedKeys& keys, const KeyNormalizer& normalizer,
+                    KeyProfile* profile);
+
+struct SortAlgorithmChoice {
+  SortAlgorithm algorithm = SortAlgorithm::kComparison;
+  /// Why, for the query stats.
+  std::string reason;
+};
+
+/// Picks the algorithm for kAuto: comparison sort for short runs, run merge
+/// if nearly all sampled neighbours are in order, counting sort for few
+/// distinct exact keys, the GPU sort if there is a `gpu` and EstimateGpuSort()
+/// expects it to beat the sort threads on exact keys, and radix sort
+/// otherwise.
+SortAlgorithmChoice ChooseSortAlgorithm(const KeyProfile& profile,
+                                        const GpuDevice* gpu = nullptr);
+
+}  // namespace whippet_sort
@@ -0,0 +1,110 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "sort/sort_spec.h"
+
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+
+#include <arrow/status.h>
+
+namespace whippet_sort {
+
+namespace {
+
+std::vector<std::string> SplitWords(const std::string& text) {
+  std::vector<std::string> words;
+  std::istringstream in(text);
+  std::string word;
+  while (in >> word) {
+    words.push_back(word);
+  }
+  return words;
+}
+
+std::string ToUpper(std::string word) {
+  std::transform(word.begin(), word.end(), word.begin(),
+                 [](unsigned char c) { return std::toupper(c); });
+  return word;
+}
+
+arrow::Result<SortKey> ParseSortKey(const std::string& item) {
+  auto words = SplitWords(item);
+  if (words.empty()) {
+    return arrow::Status::Invalid("empty sort key in ORDER BY list");
+  }
+  SortKey key;
+  key.column = words[0];
+  size_t i = 1;
+  if (i < words.size()) {
+    auto word = ToUpper(words[i]);
+    if (word == "ASC") {
+      key.order = SortOrder::kAscending;
+      ++i;
+    } else if (word == "DESC") {
+      key.order = SortOrder::kDescending;
+      ++i;
+    }
+  }
+  if (i < words.size()) {
+    if (i + 2 != words.size() || ToUpper(words[i]) != "NULLS") {
+      return arrow::Status::Invalid("cannot parse sort key '", item, "'");
+    }
+    auto placement = ToUpper(words[i + 1]);
+    if (placement == "FIRST") {
+      key.null_placement = NullPlacement::kNullsFirst;
+    } else if (placement == "LAST") {
+      key.null_placement = NullPlacement::kNullsLast;
+    } else {
+      return arrow::Status::Invalid("expect NULLS FIRST or NULLS LAST in '",
+                                    item, "'");
+    }
+  }
+  return key;
+}
+
+}  // namespace
+
+std::string SortKey::ToString() const {
+  std::string out = column;
+  out += ascending() ? " ASC" : " DESC";
+  out += nulls_first() ? " NULLS FIRST" : " NULLS LAST";
+  return out;
+}
+
+arrow::Result<SortSpec> ParseSortSpec(const std::string& text) {
+  SortSpec spec;
+  std::istringstream in(text);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    ARROW_ASSIGN_OR_RAISE(auto key, ParseSortKey(item));
+    spec.push_back(std::move(key));
+  }
+  if (spec.empty()) {
+    return arrow::Status::Invalid("ORDER BY list is empty");
+  }
+  return spec;
+}
+
+std::string SortSpecToString(const SortSpec& spec) {
+  std::string out;
+  for (size_t i = 0; i < spec.size(); ++i) {
+    if (i > 0) out += ", ";
+    out += spec[i].ToString();
+  }
+  return out;
+}
+
+}  // namespace whippet_sort
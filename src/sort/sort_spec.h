@@ -0,0 +1,51 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <arrow/result.h>
+
+namespace whippet_sort {
+
+enum class SortOrder { kAscending, kDescending };
+
+enum class NullPlacement { kNullsFirst, kNullsLast };
+
+/// One ORDER BY item, e.g. `L_SHIPMODE DESC NULLS FIRST`.
+struct SortKey {
+  std::string column;
+  SortOrder order = SortOrder::kAscending;
+  NullPlacement null_placement = NullPlacement::kNullsLast;
+
+  bool ascending() const { return order == SortOrder::kAscending; }
+  bool nulls_first() const {
+    return null_placement == NullPlacement::kNullsFirst;
+  }
+
+  std::string ToString() const;
+};
+
+using SortSpec = std::vector<SortKey>;
+
+/// Parses a comma-separated ORDER BY list in the SQL syntax used by the
+/// benchmark queries, e.g. "L_SHIPMODE DESC, L_SHIPINSTRUCT, L_RETURNFLAG".
+/// Keywords are case-insensitive; column names are kept verbatim.
+arrow::Result<SortSpec> ParseSortSpec(const std::string& text);
+
+std::string SortSpecToString(const SortSpec& spec);
+
+}  // namespace whippet_sort
@@ -0,0 +1,380 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+// Command line front end of the engine, e.g.
+//   whippet_sort -i data/tpch/s1/lineitem.parquet -o sorted.parquet
+//       -k "L_SHIPMODE DESC, L_SHIPINSTRUCT"
+
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <arrow/memory_pool.h>
+#include <arrow/status.h>
+#include <arrow/util/compression.h>
+
+#include "engine/distributed_sort.h"
+#include "engine/incremental_merge.h"
+#include "engine/parquet_sorter.h"
+#include "io/parquet_input.h"
+#include "sort/key_normalizer.h"
+#include "sort/sort_algorithm.h"
+#include "sort/sort_spec.h"
+
+namespace {
+
+struct Args {
+  std::string input;
+  std::string output;
+  std::string sort_keys;
+  std::string compression = "snappy";
+  int64_t row_group_size = 1024 * 1024;
+  std::string algorithm = "auto";
+  bool use_threads = true;
+  bool prefetch = true;
+  bool memory_map = true;
+  bool perf_counters = false;
+  bool use_arena = true;
+  /// New files to insert into the sorted input.
+  std::vector<std::string> inserts;
+  /// Distributed sort: more shards of this rank, this rank, the number of
+  /// ranks and the directory they exchange their rows in.
+  std::vector<std::string> shards;
+  int rank = 0;
+  int num_ranks = 1;
+  std::string exchange_directory;
+  bool background_write = true;
+  bool write_page_index = true;
+  int num_threads = 0;
+  bool pin_numa = false;
+  int64_t run_size = 1024 * 1024;
+  int64_t memory_limit = 0;
+  int64_t limit = 0;
+  int64_t stream_batch_rows = 0;
+  std::string spill_directory;
+  std::string spill_compression = "lz4";
+  std::string index_directory;
+  int64_t index_max_bytes = int64_t{4} << 30;
+  bool index_prefix_reuse = false;
+  bool sort_dictionary_codes = true;
+  bool compress_keys = true;
+  bool use_gpu = true;
+  int string_prefix_width =
+      whippet_sort::KeyNormalizer::kDefaultStringPrefixWidth;
+};
+
+void PrintUsage(const char* program) {
+  std::cerr
+      << "usage: " << program
+      << " -i <input.parquet> -o <output.parquet> -k <order by list>\n"
+      << "options:\n"
+      << "  -i, --input <path>          Parquet file to sort, or a directory\n"
+      << "                              or glob of files with one schema\n"
+      << "  -o, --output <path>         sorted Parquet file to write\n"
+      << "  -k, --keys <list>           ORDER BY list, e.g.\n"
+      << "                              \"L_SHIPMODE DESC, L_SHIPINSTRUCT\"\n"
+      << "      --insert <path>         insert the rows of this file into\n"
+      << "                              the sorted input, keeping its order;\n"
+      << "                              repeatable, -k is then optional\n"
+      << "      --exchange-dir <path>   sort as one rank of a distributed\n"
+      << "                              sort, exchanging rows in this shared\n"
+      << "                              directory; -o gets the rows of the\n"
+      << "                              key range of this rank\n"
+      << "      --rank <i>              this rank, of --num-ranks\n"
+      << "      --num-ranks <n>         processes of the distributed sort\n"
+      << "      --shard <path>          another input of this rank;\n"
+      << "                              repeatable\n"
+      << "  -c, --compression <codec>   snappy, lz4, zstd or uncompressed\n"
+      << "                              (default: snappy)\n"
+      << "  -r, --row-group-size <n>    output rows per row group\n"
+      << "  -p, --string-prefix <n>     string key bytes in the sort key\n"
+      << "  -a, --algorithm <name>      auto, comparison, radix, counting,\n"
+      << "                              run-merge or gpu\n"
+      << "  -l, --limit <n>             write only the first n sorted rows\n"
+      << "      --stream <n>            read the sorted rows as a stream of\n"
+      << "                              n-row batches instead of writing\n"
+      << "                              them; -o is then optional\n"
+      << "  -t, --threads <n>           sort threads (default: all cores)\n"
+      << "      --run-size <n>          maximum rows per sorted run\n"
+      << "      --pin-numa              pin sort threads to NUMA nodes\n"
+      << "  -m, --memory-limit <bytes>  sort externally above this size,\n"
+      << "                              e.g. 8G (default: no limit)\n"
+      << "      --spill-dir <path>      directory of the spill files\n"
+      << "      --spill-compression <c> lz4, zstd or uncompressed\n"
+      << "      --index-dir <path>      reuse and keep the sorted order of\n"
+      << "                              input files in this directory\n"
+      << "      --index-max-size <b>    evict old indexes above this size\n"
+      << "                              (default: 4G)\n"
+      << "      --index-prefix          also reuse indexes on more keys; ties\n"
+      << "                              then lose their input order\n"
+      << "      --no-threads            decode with a single thread\n"
+      << "      --no-prefetch           do not read ahead while sorting\n"
+      << "      --no-mmap               read the input instead of mapping it\n"
+      << "      --perf-counters         count hardware events per phase\n"
+      << "      --no-arena              allocate sort buffers one by one\n"
+      << "      --no-background-write   write row groups in the foreground\n"
+      << "      --no-page-index         write no column or offset indexes\n"
+      << "      --no-dictionary-codes   decode dictionary keys before sort\n"
+      << "      --no-key-compression    encode integer keys at full width\n"
+      << "      --no-gpu                never pick the GPU sort with -a auto\n";
+}
+
+// Parses a byte count with an optional K, M or G suffix. Returns -1 if
+// `value` is not one.
+int64_t ParseBytes(const std::string& value) {
+  char* end = nullptr;
+  int64_t bytes = std::strtoll(value.c_str(), &end, 10);
+  if (end == value.c_str() || bytes < 0) return -1;
+  switch (std::toupper(static_cast<unsigned char>(*end))) {
+    case '\0':
+      return bytes;
+    case 'K':
+      bytes <<= 10;
+      break;
+    case 'M':
+      bytes <<= 20;
+      break;
+    case 'G':
+      bytes <<= 30;
+      break;
+    default:
+      return -1;
+  }
+  return end[1] == '\0' ? bytes : -1;
+}
+
+bool ParseArgs(int argc, char** argv, Args* args) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto next = [&](std::string* value) {
+      if (i + 1 >= argc) return false;
+      *value = argv[++i];
+      return true;
+    };
+    std::string value;
+    if (arg == "-i" || arg == "--input") {
+      if (!next(&args->input)) return false;
+    } else if (arg == "-o" || arg == "--output") {
+      if (!next(&args->output)) return false;
+    } else if (arg == "-k" || arg == "--keys") {
+      if (!next(&args->sort_keys)) return false;
+    } else if (arg == "--insert") {
+      if (!next(&value)) return false;
+      args->inserts.push_back(value);
+    } else if (arg == "--exchange-dir") {
+      if (!next(&args->exchange_directory)) return false;
+    } else if (arg == "--rank") {
+      if (!next(&value)) return false;
+      args->rank = std::atoi(value.c_str());
+      if (args->rank < 0) return false;
+    } else if (arg == "--num-ranks") {
+      if (!next(&value)) return false;
+      args->num_ranks = std::atoi(value.c_str());
+      if (args->num_ranks <= 0) return false;
+    } else if (arg == "--shard") {
+      if (!next(&value)) return false;
+      args->shards.push_back(value);
+    } else if (arg == "-c" || arg == "--compression") {
+      if (!next(&args->compression)) return false;
+    } else if (arg == "-r" || arg == "--row-group-size") {
+      if (!next(&value)) return false;
+      args->row_group_size = std::atoll(value.c_str());
+      if (args->row_group_size <= 0) return false;
+    } else if (arg == "-p" || arg == "--string-prefix") {
+      if (!next(&value)) return false;
+      args->string_prefix_width = std::atoi(value.c_str());
+    } else if (arg == "-a" || arg == "--algorithm") {
+      if (!next(&args->algorithm)) return false;
+    } else if (arg == "-l" || arg == "--limit") {
+      if (!next(&value)) return false;
+      args->limit = std::atoll(value.c_str());
+      if (args->limit <= 0) return false;
+    } else if (arg == "--stream") {
+      if (!next(&value)) return false;
+      args->stream_batch_rows = std::atoll(value.c_str());
+      if (args->stream_batch_rows <= 0) return false;
+    } else if (arg == "-t" || arg == "--threads") {
+      if (!next(&value)) return false;
+      args->num_threads = std::atoi(value.c_str());
+      if (args->num_threads < 0) return false;
+    } else if (arg == "--run-size") {
+      if (!next(&value)) return false;
+      args->run_size = std::atoll(value.c_str());
+      if (args->run_size <= 0) return false;
+    } else if (arg == "--pin-numa") {
+      args->pin_numa = true;
+    } else if (arg == "-m" || arg == "--memory-limit") {
+      if (!next(&value)) return false;
+      args->memory_limit = ParseBytes(value);
+      if (args->memory_limit < 0) return false;
+    } else if (arg == "--spill-dir") {
+      if (!next(&args->spill_directory)) return false;
+    } else if (arg == "--spill-compression") {
+      if (!next(&args->spill_compression)) return false;
+    } else if (arg == "--index-dir") {
+      if (!next(&args->index_directory)) return false;
+    } else if (arg == "--index-max-size") {
+      if (!next(&value)) return false;
+      args->index_max_bytes = ParseBytes(value);
+      if (args->index_max_bytes < 0) return false;
+    } else if (arg == "--index-prefix") {
+      args->index_prefix_reuse = true;
+    } else if (arg == "--no-threads") {
+      args->use_threads = false;
+    } else if (arg == "--no-background-write") {
+      args->background_write = false;
+    } else if (arg == "--no-page-index") {
+      args->write_page_index = false;
+    } else if (arg == "--no-arena") {
+      args->use_arena = false;
+    } else if (arg == "--perf-counters") {
+      args->perf_counters = true;
+    } else if (arg == "--no-prefetch") {
+      args->prefetch = false;
+    } else if (arg == "--no-mmap") {
+      args->memory_map = false;
+    } else if (arg == "--no-dictionary-codes") {
+      args->sort_dictionary_codes = false;
+    } else if (arg == "--no-key-compression") {
+      args->compress_keys = false;
+    } else if (arg == "--no-gpu") {
+      args->use_gpu = false;
+    } else {
+      return false;
+    }
+  }
+  if (!args->exchange_directory.empty()) {
+    return (!args->input.empty() || !args->shards.empty()) &&
+           !args->output.empty() && !args->sort_keys.empty() &&
+           args->inserts.empty() && args->rank < args->num_ranks;
+  }
+  if (args->stream_batch_rows > 0) {
+    return !args->input.empty() && args->output.empty() &&
+           args->shards.empty() && !args->sort_keys.empty() &&
+           args->inserts.empty();
+  }
+  return !args->input.empty() && !args->output.empty() &&
+         args->shards.empty() &&
+         (!args->sort_keys.empty() || !args->inserts.empty());
+}
+
+arrow::Status Run(const Args& args) {
+  whippet_sort::SortOptions options;
+  if (!args.sort_keys.empty()) {
+    ARROW_ASSIGN_OR_RAISE(options.sort_keys,
+                          whippet_sort::ParseSortSpec(args.sort_keys));
+  }
+  // Parquet has no LZ4 frame format; its LZ4 codec is LZ4_RAW.
+  ARROW_ASSIGN_OR_RAISE(
+      options.output_compression,
+      arrow::util::Codec::GetCompressionType(
+          args.compression == "lz4" ? "lz4_raw" : args.compression));
+  options.output_row_group_size = args.row_group_size;
+  options.use_threads = args.use_threads;
+  options.prefetch = args.prefetch;
+  options.memory_map = args.memory_map;
+  options.perf_counters = args.perf_counters;
+  options.use_arena = args.use_arena;
+  options.background_write = args.background_write;
+  options.write_page_index = args.write_page_index;
+  options.num_threads = args.num_threads;
+  options.pin_threads_to_numa_nodes = args.pin_numa;
+  options.run_size = args.run_size;
+  options.memory_limit = args.memory_limit;
+  options.limit = args.limit;
+  options.spill_directory = args.spill_directory;
+  ARROW_ASSIGN_OR_RAISE(
+      options.spill_compression,
+      arrow::util::Codec::GetCompressionType(args.spill_compression));
+  options.index_directory = args.index_directory;
+  options.index_max_bytes = args.index_max_bytes;
+  options.index_prefix_reuse = args.index_prefix_reuse;
+  options.sort_dictionary_codes = args.sort_dictionary_codes;
+  options.compress_keys = args.compress_keys;
+  options.use_gpu = args.use_gpu;
+  options.string_prefix_width = args.string_prefix_width;
+  ARROW_ASSIGN_OR_RAISE(options.algorithm,
+                        whippet_sort::ParseSortAlgorithm(args.algorithm));
+
+  whippet_sort::ParquetSorter sorter(std::move(options));
+  if (!args.exchange_directory.empty()) {
+    whippet_sort::DistributedSortOptions distributed;
+    distributed.rank = args.rank;
+    distributed.num_ranks = args.num_ranks;
+    distributed.exchange_directory = args.exchange_directory;
+    std::vector<std::string> shards;
+    if (!args.input.empty()) shards.push_back(args.input);
+    shards.insert(shards.end(), args.shards.begin(), args.shards.end());
+    std::cout << "ORDER BY " << whippet_sort::SortSpecToString(
+                                    sorter.options().sort_keys)
+              << std::endl;
+    ARROW_ASSIGN_OR_RAISE(
+        auto stats, sorter.SortDistributed(shards, args.output, distributed));
+    std::cout << stats.ToString() << std::endl;
+    return arrow::Status::OK();
+  }
+  if (!args.inserts.empty()) {
+    // The order is the one recorded in the sorted file, which --keys may
+    // leave out.
+    ARROW_ASSIGN_OR_RAISE(
+        auto sorted, whippet_sort::ParquetInput::Open(
+                         args.input, arrow::default_memory_pool()));
+    ARROW_ASSIGN_OR_RAISE(auto spec,
+                          whippet_sort::SortSpecFromMetadata(*sorted));
+    sorted.reset();
+    std::cout << "ORDER BY " << whippet_sort::SortSpecToString(spec)
+              << std::endl;
+    ARROW_ASSIGN_OR_RAISE(
+        auto stats, sorter.Insert(args.input, args.inserts, args.output));
+    std::cout << stats.ToString() << std::endl;
+    return arrow::Status::OK();
+  }
+  std::cout << "ORDER BY " << whippet_sort::SortSpecToString(
+                                  sorter.options().sort_keys)
+            << std::endl;
+  if (args.stream_batch_rows > 0) {
+    whippet_sort::StreamOptions stream_options;
+    stream_options.batch_rows = args.stream_batch_rows;
+    ARROW_ASSIGN_OR_RAISE(auto stream,
+                          sorter.SortStream(args.input, stream_options));
+    std::shared_ptr<arrow::RecordBatch> batch;
+    do {
+      ARROW_RETURN_NOT_OK(stream->ReadNext(&batch));
+    } while (batch != nullptr);
+    std::cout << stream->stats().ToString() << std::endl;
+    return arrow::Status::OK();
+  }
+  ARROW_ASSIGN_OR_RAISE(auto stats, sorter.Sort(args.input, args.output));
+  std::cout << stats.ToString() << std::endl;
+  return arrow::Status::OK();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Args args;
+  if (!ParseArgs(argc, argv, &args)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  auto status = Run(args);
+  if (!status.ok()) {
+    std::cerr << status.ToString() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,155 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "common/arena_pool.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <arrow/memory_pool.h>
+#include <gtest/gtest.h>
+
+#include "test/test_util.h"
+
+namespace whippet_sort {
+namespace {
+
+constexpr int64_t kChunkSize = 1 << 20;
+constexpr int64_t kAlignment = 64;
+
+ArenaOptions SmallChunks() {
+  ArenaOptions options;
+  options.chunk_size = kChunkSize;
+  options.huge_pages = false;
+  return options;
+}
+
+TEST(ArenaMemoryPoolTest, CountsAllocatedBytes) {
+  ArenaMemoryPool pool(SmallChunks());
+  uint8_t* a;
+  uint8_t* b;
+  ASSERT_OK(pool.Allocate(1000, kAlignment, &a));
+  ASSERT_OK(pool.Allocate(3000, kAlignment, &b));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % kAlignment, 0);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(b) % kAlignment, 0);
+  EXPECT_EQ(pool.bytes_allocated(), 4000);
+  EXPECT_EQ(pool.num_allocations(), 2);
+  pool.Free(a, 1000, kAlignment);
+  EXPECT_EQ(pool.bytes_allocated(), 3000);
+  pool.Free(b, 3000, kAlignment);
+  EXPECT_EQ(pool.bytes_allocated(), 0);
+  EXPECT_EQ(pool.max_memory(), 4000);
+  EXPECT_EQ(pool.total_bytes_allocated(), 4000);
+}
+
+TEST(ArenaMemoryPoolTest, FreeingTheLastBufferRewindsIt) {
+  ArenaMemoryPool pool(SmallChunks());
+  uint8_t* keep;
+  uint8_t* last;
+  ASSERT_OK(pool.Allocate(1000, kAlignment, &keep));
+  ASSERT_OK(pool.Allocate(1000, kAlignment, &last));
+  pool.Free(last, 1000, kAlignment);
+  uint8_t* again;
+  ASSERT_OK(pool.Allocate(1000, kAlignment, &again));
+  EXPECT_EQ(again, last);
+  pool.Free(again, 1000, kAlignment);
+  pool.Free(keep, 1000, kAlignment);
+}
+
+TEST(ArenaMemoryPoolTest, ChunkRewindsOnceAllItsBuffersAreFreed) {
+  ArenaMemoryPool pool(SmallChunks());
+  // Fill the first chunk, then start a second one that stays in use.
+  constexpr int64_t kSize = kChunkSize / 5 - kAlignment;
+  std::vector<uint8_t*> first(5);
+  for (auto& buffer : first) {
+    ASSERT_OK(pool.Allocate(kSize, kAlignment, &buffer));
+  }
+  uint8_t* second;
+  ASSERT_OK(pool.Allocate(kSize, kAlignment, &second));
+  EXPECT_EQ(pool.reserved_bytes(), 2 * kChunkSize);
+
+  // Free the first chunk out of order: freeing its last buffer gives back
+  // only that buffer, and the chunk rewinds once first[2] is freed too.
+  for (int i : {1, 3, 0, 4}) pool.Free(first[i], kSize, kAlignment);
+  uint8_t* reused;
+  ASSERT_OK(pool.Allocate(kSize, kAlignment, &reused));
+  EXPECT_NE(reused, first[0]);
+  pool.Free(reused, kSize, kAlignment);
+  pool.Free(first[2], kSize, kAlignment);
+  ASSERT_OK(pool.Allocate(kSize, kAlignment, &reused));
+  EXPECT_EQ(reused, first[0]);
+  EXPECT_EQ(pool.reserved_bytes(), 2 * kChunkSize);
+
+  pool.Free(reused, kSize, kAlignment);
+  pool.Free(second, kSize, kAlignment);
+  EXPECT_EQ(pool.bytes_allocated(), 0);
+}
+
+TEST(ArenaMemoryPoolTest, LargeBuffersGoBackToTheParentWhenFreed) {
+  ArenaMemoryPool pool(SmallChunks());
+  uint8_t* small;
+  ASSERT_OK(pool.Allocate(1000, kAlignment, &small));
+  const int64_t reserved = pool.reserved_bytes();
+  EXPECT_EQ(reserved, kChunkSize);
+
+  // A buffer that fits no chunk and is more than a quarter of one gets a
+  // chunk of its own, even while other buffers are live.
+  uint8_t* large;
+  ASSERT_OK(pool.Allocate(2 * kChunkSize, kAlignment, &large));
+  EXPECT_GT(pool.reserved_bytes(), reserved + kChunkSize);
+  std::memset(large, 1, 2 * kChunkSize);
+  pool.Free(large, 2 * kChunkSize, kAlignment);
+  EXPECT_EQ(pool.reserved_bytes(), reserved);
+  pool.Free(small, 1000, kAlignment);
+  EXPECT_EQ(pool.reserved_bytes(), reserved);
+}
+
+TEST(ArenaMemoryPoolTest, IdleChunksBeyondTheRetainedBytesAreReleased) {
+  ArenaOptions options = SmallChunks();
+  options.max_retained_bytes = kChunkSize;
+  ArenaMemoryPool pool(options);
+  constexpr int64_t kSize = kChunkSize / 4 - kAlignment;
+  std::vector<uint8_t*> buffers(12);
+  for (auto& buffer : buffers) {
+    ASSERT_OK(pool.Allocate(kSize, kAlignment, &buffer));
+  }
+  EXPECT_EQ(pool.reserved_bytes(), 3 * kChunkSize);
+  for (auto* buffer : buffers) pool.Free(buffer, kSize, kAlignment);
+  EXPECT_EQ(pool.reserved_bytes(), kChunkSize);
+}
+
+TEST(ArenaMemoryPoolTest, ReallocateGrowsTheLastBufferInPlace) {
+  ArenaMemoryPool pool(SmallChunks());
+  uint8_t* buffer;
+  ASSERT_OK(pool.Allocate(100, kAlignment, &buffer));
+  std::memset(buffer, 7, 100);
+  uint8_t* grown = buffer;
+  ASSERT_OK(pool.Reallocate(100, 5000, kAlignment, &grown));
+  EXPECT_EQ(grown, buffer);
+  EXPECT_EQ(pool.bytes_allocated(), 5000);
+
+  uint8_t* other;
+  ASSERT_OK(pool.Allocate(100, kAlignment, &other));
+  ASSERT_OK(pool.Reallocate(5000, 10000, kAlignment, &grown));
+  EXPECT_NE(grown, buffer);
+  EXPECT_EQ(grown[99], 7);
+  EXPECT_EQ(pool.bytes_allocated(), 10100);
+  pool.Free(grown, 10000, kAlignment);
+  pool.Free(other, 100, kAlignment);
+  EXPECT_EQ(pool.bytes_allocated(), 0);
+}
+
+}  // namespace
+}  // namespace whippet_sort
@@ -0,0 +1,135 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "engine/distributed_sort.h"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <arrow/api.h>
+#include <gtest/gtest.h>
+
+#include "test/test_util.h"
+
+namespace whippet_sort {
+namespace {
+
+const SortSpec kSpec = {
+    {"k", SortOrder::kAscending, NullPlacement::kNullsLast}};
+
+std::shared_ptr<arrow::Table> KeyTable(
+    const std::vector<std::optional<int64_t>>& keys) {
+  return arrow::Table::Make(arrow::schema({arrow::field("k", arrow::int64())}),
+                            {BuildArray<arrow::Int64Builder>(keys)});
+}
+
+std::shared_ptr<arrow::Table> WeightedSamples(
+    const std::vector<std::optional<int64_t>>& keys,
+    const std::vector<std::optional<double>>& weights) {
+  return arrow::Table::Make(
+      arrow::schema({arrow::field("k", arrow::int64()),
+                     arrow::field(kSampleWeightColumn, arrow::float64())}),
+      {BuildArray<arrow::Int64Builder>(keys),
+       BuildArray<arrow::DoubleBuilder>(weights)});
+}
+
+std::vector<int64_t> Keys(const arrow::Table& table) {
+  std::vector<int64_t> keys;
+  for (const auto& chunk : table.GetColumnByName("k")->chunks()) {
+    const auto& values = static_cast<const arrow::Int64Array&>(*chunk);
+    for (int64_t i = 0; i < values.length(); ++i) {
+      keys.push_back(values.Value(i));
+    }
+  }
+  return keys;
+}
+
+TEST(ChooseSplittersTest, EqualWeightsPickEvenlySpacedSamples) {
+  ASSERT_OK_AND_ASSIGN(
+      auto splitters,
+      ChooseSplitters(KeyTable({10, 20, 30, 40, 50, 60, 70, 80}), 4));
+  EXPECT_EQ(Keys(*splitters), (std::vector<int64_t>{30, 50, 70}));
+  EXPECT_EQ(splitters->num_columns(), 1);
+}
+
+TEST(ChooseSplittersTest, HeavySamplesMoveTheSplitters) {
+  // The samples of a rank with many more rows than the others stand for
+  // more rows each, so the splitter moves into their range.
+  ASSERT_OK_AND_ASSIGN(auto unweighted,
+                       ChooseSplitters(KeyTable({10, 20, 30, 40}), 2));
+  EXPECT_EQ(Keys(*unweighted), (std::vector<int64_t>{30}));
+
+  ASSERT_OK_AND_ASSIGN(
+      auto weighted,
+      ChooseSplitters(WeightedSamples({10, 20, 30, 40}, {1, 1, 1, 97}), 2));
+  EXPECT_EQ(Keys(*weighted), (std::vector<int64_t>{40}));
+  EXPECT_EQ(weighted->schema()->GetFieldIndex(kSampleWeightColumn), -1);
+}
+
+TEST(ChooseSplittersTest, NoSamplesGiveNoSplitters) {
+  ASSERT_OK_AND_ASSIGN(auto splitters, ChooseSplitters(KeyTable({}), 3));
+  EXPECT_EQ(splitters->num_rows(), 0);
+}
+
+TEST(PartitionBoundsTest, RowsUpToEachSplitterGoToItsRank) {
+  auto sorted = KeyTable({1, 2, 2, 3, 5, 5, 8, 9});
+  ASSERT_OK_AND_ASSIGN(
+      auto bounds,
+      PartitionBounds(*sorted, *KeyTable({2, 5}), kSpec, 3,
+                      arrow::default_memory_pool()));
+  // Rows that tie with a splitter stay with the rank before it.
+  EXPECT_EQ(bounds, (std::vector<int64_t>{0, 3, 6, 8}));
+}
+
+TEST(PartitionBoundsTest, SplittersOutsideTheRowsLeaveRanksEmpty) {
+  auto sorted = KeyTable({4, 5, 6});
+  ASSERT_OK_AND_ASSIGN(
+      auto bounds,
+      PartitionBounds(*sorted, *KeyTable({0, 1, 10}), kSpec, 4,
+                      arrow::default_memory_pool()));
+  EXPECT_EQ(bounds, (std::vector<int64_t>{0, 0, 0, 3, 3}));
+}
+
+TEST(PartitionBoundsTest, NullsFollowTheNullPlacement) {
+  auto sorted = KeyTable({1, 4, std::nullopt, std::nullopt});
+  ASSERT_OK_AND_ASSIGN(
+      auto bounds,
+      PartitionBounds(*sorted, *KeyTable({4}), kSpec, 2,
+                      arrow::default_memory_pool()));
+  EXPECT_EQ(bounds, (std::vector<int64_t>{0, 2, 4}));
+
+  ASSERT_OK_AND_ASSIGN(
+      bounds, PartitionBounds(*sorted, *KeyTable({std::nullopt}), kSpec, 2,
+                              arrow::default_memory_pool()));
+  EXPECT_EQ(bounds, (std::vector<int64_t>{0, 4, 4}));
+}
+
+TEST(SampleKeysTest, SamplesCarryTheRowsTheyStandFor) {
+  auto sorted = KeyTable({1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+  ASSERT_OK_AND_ASSIGN(
+      auto samples,
+      SampleKeys(*sorted, kSpec, 4, arrow::default_memory_pool()));
+  ASSERT_EQ(samples->num_rows(), 4);
+  EXPECT_EQ(Keys(*samples), (std::vector<int64_t>{2, 4, 7, 9}));
+  auto weights = samples->GetColumnByName(kSampleWeightColumn);
+  ASSERT_NE(weights, nullptr);
+  const auto& values =
+      static_cast<const arrow::DoubleArray&>(*weights->chunk(0));
+  EXPECT_DOUBLE_EQ(values.Value(0), 2.5);
+}
+
+}  // namespace
+}  // namespace whippet_sort
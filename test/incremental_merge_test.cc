@@ -0,0 +1,149 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "engine/incremental_merge.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+#include <gtest/gtest.h>
+
+#include "io/parquet_input.h"
+#include "test/test_util.h"
+
+namespace whippet_sort {
+namespace {
+
+constexpr int64_t kNumRows = 1000;
+constexpr int64_t kRowGroupRows = 100;
+
+const SortKey kFirstKey{"k", SortOrder::kAscending, NullPlacement::kNullsLast};
+
+/// The steps of a plan in one line, e.g. "new[0,1) copy{0} merge{1,2}[1,3)".
+std::string Describe(const std::vector<InsertStep>& steps) {
+  std::string text;
+  for (const auto& step : steps) {
+    if (!text.empty()) text += " ";
+    switch (step.kind) {
+      case InsertStep::Kind::kNewRows:
+        text += "new";
+        break;
+      case InsertStep::Kind::kCopy:
+        text += "copy";
+        break;
+      case InsertStep::Kind::kMerge:
+        text += "merge";
+        break;
+    }
+    if (!step.row_groups.empty()) {
+      text += "{";
+      for (size_t i = 0; i < step.row_groups.size(); ++i) {
+        if (i > 0) text += ",";
+        text += std::to_string(step.row_groups[i]);
+      }
+      text += "}";
+    }
+    if (step.kind != InsertStep::Kind::kCopy) {
+      text += "[" + std::to_string(step.new_begin) + "," +
+              std::to_string(step.new_end) + ")";
+    }
+  }
+  return text;
+}
+
+class PlanInsertTest : public ::testing::Test {
+ protected:
+  /// Writes a file sorted by "k" in row groups of kRowGroupRows rows, with
+  /// key(i) as the key of row i, and opens it.
+  std::unique_ptr<ParquetInput> WriteSorted(
+      const std::function<int64_t(int64_t)>& key) {
+    std::vector<std::optional<int64_t>> keys;
+    for (int64_t i = 0; i < kNumRows; ++i) keys.push_back(key(i));
+    return Write(arrow::Table::Make(
+        arrow::schema({arrow::field("k", arrow::int64())}),
+        {BuildArray<arrow::Int64Builder>(keys)}));
+  }
+
+  std::unique_ptr<ParquetInput> Write(
+      const std::shared_ptr<arrow::Table>& table) {
+    const std::string path = directory_.File("sorted.parquet");
+    auto status = WriteParquet(*table, path, kRowGroupRows);
+    EXPECT_TRUE(status.ok()) << status.ToString();
+    return ParquetInput::Open(path, arrow::default_memory_pool())
+        .ValueOrDie();
+  }
+
+  ScratchDirectory directory_;
+};
+
+std::shared_ptr<arrow::Array> NewKeys(
+    const std::vector<std::optional<int64_t>>& keys) {
+  return BuildArray<arrow::Int64Builder>(keys);
+}
+
+TEST_F(PlanInsertTest, KeepsRowGroupsNoNewRowSortsInto) {
+  auto input = WriteSorted([](int64_t row) { return row; });
+  ASSERT_EQ(input->num_row_groups(), 10);
+  ASSERT_OK_AND_ASSIGN(
+      auto steps, PlanInsert(*input, kFirstKey, NewKeys({-5, 150, 151, 1500}),
+                             arrow::default_memory_pool()));
+  EXPECT_EQ(Describe(steps),
+            "new[0,1) copy{0} merge{1}[1,3) copy{2} copy{3} copy{4} copy{5} "
+            "copy{6} copy{7} copy{8} copy{9} new[3,4)");
+}
+
+TEST_F(PlanInsertTest, WritesNewRowsBetweenRowGroupsOnTheirOwn) {
+  // Even keys only, so 199 sorts between row groups 0 and 1.
+  auto input = WriteSorted([](int64_t row) { return 2 * row; });
+  ASSERT_OK_AND_ASSIGN(auto steps,
+                       PlanInsert(*input, kFirstKey, NewKeys({199, 199}),
+                                  arrow::default_memory_pool()));
+  EXPECT_EQ(Describe(steps),
+            "copy{0} new[0,2) copy{1} copy{2} copy{3} copy{4} copy{5} "
+            "copy{6} copy{7} copy{8} copy{9}");
+}
+
+TEST_F(PlanInsertTest, MergesRowGroupsThatTouchOnTheFirstKey) {
+  // Row groups 0 to 2 share their boundary keys 33 and 66; row group 3
+  // starts at 100, after the 99 that row group 2 ends with.
+  auto input = WriteSorted([](int64_t row) { return row / 3; });
+  ASSERT_OK_AND_ASSIGN(auto steps,
+                       PlanInsert(*input, kFirstKey, NewKeys({10}),
+                                  arrow::default_memory_pool()));
+  EXPECT_EQ(Describe(steps),
+            "merge{0,1,2}[0,1) copy{3} copy{4} copy{5} copy{6} copy{7} "
+            "copy{8} copy{9}");
+}
+
+TEST_F(PlanInsertTest, MergesAllRowGroupsOnFloatingPointKeys) {
+  std::vector<std::optional<double>> keys;
+  for (int64_t i = 0; i < kNumRows; ++i) keys.push_back(0.5 * i);
+  auto input = Write(arrow::Table::Make(
+      arrow::schema({arrow::field("k", arrow::float64())}),
+      {BuildArray<arrow::DoubleBuilder>(keys)}));
+  auto new_keys =
+      BuildArray<arrow::DoubleBuilder>(std::vector<std::optional<double>>{1e9});
+  ASSERT_OK_AND_ASSIGN(auto steps,
+                       PlanInsert(*input, kFirstKey, new_keys,
+                                  arrow::default_memory_pool()));
+  EXPECT_EQ(Describe(steps), "merge{0,1,2,3,4,5,6,7,8,9}[0,1)");
+}
+
+}  // namespace
+}  // namespace whippet_sort
@@ -0,0 +1,201 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "sort/key_normalizer.h"
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+#include <gtest/gtest.h>
+
+#include "test/test_util.h"
+
+namespace whippet_sort {
+namespace {
+
+using std::nullopt;
+
+constexpr double kNaN = std::numeric_limits<double>::quiet_NaN();
+constexpr double kInfinity = std::numeric_limits<double>::infinity();
+
+const SortKey kAllKeys[] = {
+    {"k", SortOrder::kAscending, NullPlacement::kNullsLast},
+    {"k", SortOrder::kAscending, NullPlacement::kNullsFirst},
+    {"k", SortOrder::kDescending, NullPlacement::kNullsLast},
+    {"k", SortOrder::kDescending, NullPlacement::kNullsFirst},
+};
+
+std::unique_ptr<KeyNormalizer> MakeNormalizer(
+    const SortKey& key, std::shared_ptr<arrow::Array> array,
+    KeyCompression compression = {}) {
+  return KeyNormalizer::Make({key}, {std::move(array)},
+                             KeyNormalizer::kDefaultStringPrefixWidth,
+                             std::move(compression))
+      .ValueOrDie();
+}
+
+template <typename T>
+std::vector<uint64_t> ExpectedOrder(const std::vector<std::optional<T>>& values,
+                                    const SortKey& key) {
+  return StableOrder(static_cast<int64_t>(values.size()),
+                     [&](int64_t a, int64_t b) {
+                       return CompareValues(values[a], values[b], key);
+                     });
+}
+
+TEST(KeyNormalizerTest, SignedIntegersOrderByValue) {
+  const std::vector<std::optional<int32_t>> values = {
+      0,    -1,  1,   std::numeric_limits<int32_t>::min(),
+      std::numeric_limits<int32_t>::max(), -100, 100, -1};
+  auto array = BuildArray<arrow::Int32Builder>(values);
+  for (bool pack : {false, true}) {
+    KeyCompression compression;
+    compression.pack_integers = pack;
+    for (const auto& key : kAllKeys) {
+      auto normalizer = MakeNormalizer(key, array, compression);
+      EXPECT_TRUE(normalizer->exact());
+      EXPECT_EQ(NormalizedOrder(*normalizer), ExpectedOrder(values, key))
+          << key.ToString() << (pack ? " packed" : "");
+    }
+  }
+}
+
+TEST(KeyNormalizerTest, PackedIntegersTakeTheBytesOfTheirRange) {
+  const std::vector<std::optional<int64_t>> values = {1200, 1000, nullopt,
+                                                      1100, 1000, 1199};
+  auto array = BuildArray<arrow::Int64Builder>(values);
+  for (const auto& key : kAllKeys) {
+    auto normalizer = MakeNormalizer(key, array);
+    // A null byte and one byte for the offsets 0 to 200.
+    EXPECT_EQ(normalizer->key_width(), 2) << key.ToString();
+    EXPECT_EQ(normalizer->uncompressed_key_width(), 9) << key.ToString();
+    EXPECT_EQ(NormalizedOrder(*normalizer), ExpectedOrder(values, key))
+        << key.ToString();
+  }
+
+  // A known range replaces the one of the values, wider as it may be.
+  KeyCompression compression;
+  compression.ranges = {KeyRange{0, 100000}};
+  auto normalizer = MakeNormalizer(kAllKeys[0], array, compression);
+  EXPECT_EQ(normalizer->key_width(), 4);
+  EXPECT_EQ(NormalizedOrder(*normalizer), ExpectedOrder(values, kAllKeys[0]));
+}
+
+TEST(KeyNormalizerTest, NullsFollowPlacementInBothOrders) {
+  const std::vector<std::optional<int64_t>> values = {
+      5, nullopt, -3, 7, nullopt, 0, -3, int64_t{1} << 40};
+  auto array = BuildArray<arrow::Int64Builder>(values);
+  for (const auto& key : kAllKeys) {
+    auto normalizer = MakeNormalizer(key, array);
+    const auto order = NormalizedOrder(*normalizer);
+    EXPECT_EQ(order, ExpectedOrder(values, key)) << key.ToString();
+    const bool null_first = !values[order.front()].has_value();
+    EXPECT_EQ(null_first, key.nulls_first()) << key.ToString();
+  }
+}
+
+TEST(KeyNormalizerTest, FloatsOrderNaNAfterNumbers) {
+  // -0.0 ties with 0.0, and NaNs of either sign tie with each other.
+  const std::vector<std::optional<double>> values = {
+      1.5,  -0.0, 0.0,       kNaN,    -kInfinity, kInfinity,
+      -2.5, -kNaN, nullopt,  1e-300,  -1e300,     0.0};
+  auto array = BuildArray<arrow::DoubleBuilder>(values);
+  for (const auto& key : kAllKeys) {
+    auto normalizer = MakeNormalizer(key, array);
+    EXPECT_EQ(NormalizedOrder(*normalizer), ExpectedOrder(values, key))
+        << key.ToString();
+  }
+}
+
+TEST(KeyNormalizerTest, ShortStringsCarryTheirLength) {
+  // No value is longer than the prefix, so the length decides between
+  // values that are equal once zero-padded.
+  const std::vector<std::optional<std::string>> values = {
+      "b", "a", "", std::string("a\0", 2), "ab", nullopt, "a", "\xff"};
+  auto array = BuildArray<arrow::StringBuilder>(values);
+  for (const auto& key : kAllKeys) {
+    auto normalizer = MakeNormalizer(key, array);
+    EXPECT_TRUE(normalizer->exact());
+    EXPECT_EQ(NormalizedOrder(*normalizer), ExpectedOrder(values, key))
+        << key.ToString();
+  }
+}
+
+TEST(KeyNormalizerTest, DistinctPrefixesDecideLongStrings) {
+  const std::vector<std::optional<std::string>> values = {
+      "cherry_blossom", "apple_turnover", "banana_split_royale",
+      "apple_turnover", nullopt,          "cherry_blossom"};
+  auto array = BuildArray<arrow::StringBuilder>(values);
+  for (const auto& key : kAllKeys) {
+    auto normalizer = MakeNormalizer(key, array);
+    EXPECT_TRUE(normalizer->exact());
+    EXPECT_EQ(NormalizedOrder(*normalizer), ExpectedOrder(values, key))
+        << key.ToString();
+  }
+}
+
+TEST(KeyNormalizerTest, SharedPrefixesLeaveTheRestToTheTail) {
+  const std::vector<std::optional<std::string>> values = {
+      "shared__prefix_b", "shared__prefix_a", "shared__",
+      "shared__prefix_a", "shared_",          nullopt,
+      "shared__prefix",   "shared__prefix_c"};
+  auto array = BuildArray<arrow::StringBuilder>(values);
+  for (const auto& key : kAllKeys) {
+    auto normalizer = MakeNormalizer(key, array);
+    EXPECT_FALSE(normalizer->exact());
+    EXPECT_EQ(NormalizedOrder(*normalizer), ExpectedOrder(values, key))
+        << key.ToString();
+  }
+}
+
+TEST(KeyNormalizerTest, PrefixesDifferingInTrailingNulsCollide) {
+  // "a" and "a\0" encode the same zero-padded prefix, and a longer value
+  // leaves out the length, so only the tail can tell them apart.
+  const std::vector<std::optional<std::string>> values = {
+      std::string("a\0", 2), "a", "abcdefghijkl", "a", std::string("a\0", 2)};
+  auto array = BuildArray<arrow::StringBuilder>(values);
+  for (const auto& key : kAllKeys) {
+    auto normalizer = MakeNormalizer(key, array);
+    EXPECT_FALSE(normalizer->exact());
+    EXPECT_EQ(NormalizedOrder(*normalizer), ExpectedOrder(values, key))
+        << key.ToString();
+  }
+}
+
+TEST(KeyNormalizerTest, LaterKeysBreakTies) {
+  const std::vector<std::optional<int32_t>> first = {2, 1, 2, nullopt, 1, 2};
+  const std::vector<std::optional<std::string>> second = {
+      "x", "y", "w", "z", nullopt, "x"};
+  const SortSpec spec = {
+      {"a", SortOrder::kDescending, NullPlacement::kNullsLast},
+      {"b", SortOrder::kAscending, NullPlacement::kNullsFirst}};
+  ASSERT_OK_AND_ASSIGN(
+      auto normalizer,
+      KeyNormalizer::Make(spec, {BuildArray<arrow::Int32Builder>(first),
+                                 BuildArray<arrow::StringBuilder>(second)}));
+  const auto expected = StableOrder(
+      static_cast<int64_t>(first.size()), [&](int64_t a, int64_t b) {
+        const int cmp = CompareValues(first[a], first[b], spec[0]);
+        return cmp != 0 ? cmp : CompareValues(second[a], second[b], spec[1]);
+      });
+  EXPECT_EQ(NormalizedOrder(*normalizer), expected);
+}
+
+}  // namespace
+}  // namespace whippet_sort
@@ -0,0 +1,233 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "engine/parquet_sorter.h"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+#include <gtest/gtest.h>
+
+#include "engine/incremental_merge.h"
+#include "io/parquet_input.h"
+#include "sort/sort_algorithm.h"
+#include "test/test_util.h"
+
+namespace whippet_sort {
+namespace {
+
+constexpr int64_t kRowGroupRows = 1000;
+
+/// Rows of an integer key with nulls and many ties, a string key, and a
+/// payload column that tells the rows apart.
+struct Rows {
+  std::vector<std::optional<int64_t>> key;
+  std::vector<std::optional<std::string>> name;
+  std::vector<std::optional<int64_t>> payload;
+
+  int64_t size() const { return static_cast<int64_t>(key.size()); }
+
+  void Append(const Rows& other) {
+    key.insert(key.end(), other.key.begin(), other.key.end());
+    name.insert(name.end(), other.name.begin(), other.name.end());
+    payload.insert(payload.end(), other.payload.begin(), other.payload.end());
+  }
+
+  std::shared_ptr<arrow::Table> ToTable() const {
+    return arrow::Table::Make(
+        arrow::schema({arrow::field("key", arrow::int64()),
+                       arrow::field("name", arrow::utf8()),
+                       arrow::field("payload", arrow::int64())}),
+        {BuildArray<arrow::Int64Builder>(key),
+         BuildArray<arrow::StringBuilder>(name),
+         BuildArray<arrow::Int64Builder>(payload)});
+  }
+};
+
+Rows MakeRows(int64_t num_rows, uint64_t seed, int64_t first_payload = 0) {
+  std::mt19937_64 random(seed);
+  std::uniform_int_distribution<int64_t> key(-100, 100);
+  std::uniform_int_distribution<int> name(0, 20);
+  std::bernoulli_distribution is_null(0.05);
+  Rows rows;
+  for (int64_t i = 0; i < num_rows; ++i) {
+    rows.key.push_back(is_null(random) ? std::nullopt
+                                       : std::optional(key(random)));
+    rows.name.push_back("name_" + std::to_string(name(random)));
+    rows.payload.push_back(first_payload + i);
+  }
+  return rows;
+}
+
+/// The payload of `rows` in the order std::stable_sort gives them by `spec`,
+/// which may only sort on "key" and "name".
+std::vector<std::optional<int64_t>> ExpectedPayload(const Rows& rows,
+                                                    const SortSpec& spec) {
+  const auto order = StableOrder(rows.size(), [&](int64_t a, int64_t b) {
+    for (const auto& key : spec) {
+      const int cmp = key.column == "key"
+                          ? CompareValues(rows.key[a], rows.key[b], key)
+                          : CompareValues(rows.name[a], rows.name[b], key);
+      if (cmp != 0) return cmp;
+    }
+    return 0;
+  });
+  std::vector<std::optional<int64_t>> payload;
+  for (uint64_t row : order) payload.push_back(rows.payload[row]);
+  return payload;
+}
+
+class ParquetSorterTest : public ::testing::Test {
+ protected:
+  /// Writes `rows` to the file `name` and returns its path.
+  std::string WriteInput(const Rows& rows,
+                         const std::string& name = "input.parquet") {
+    const std::string path = directory_.File(name);
+    EXPECT_TRUE(WriteParquet(*rows.ToTable(), path, kRowGroupRows).ok());
+    return path;
+  }
+
+  ScratchDirectory directory_;
+};
+
+TEST_F(ParquetSorterTest, SortWritesAllRowsInOrder) {
+  const Rows rows = MakeRows(5 * kRowGroupRows + 17, 1);
+  const std::string input = WriteInput(rows);
+  SortOptions options;
+  ASSERT_OK_AND_ASSIGN(options.sort_keys,
+                       ParseSortSpec("key DESC NULLS FIRST, name"));
+  options.output_row_group_size = 1500;
+  const SortSpec spec = options.sort_keys;
+  ParquetSorter sorter(options);
+
+  const std::string output = directory_.File("output.parquet");
+  ASSERT_OK_AND_ASSIGN(auto stats, sorter.Sort(input, output));
+  EXPECT_EQ(stats.num_rows, rows.size());
+  EXPECT_EQ(stats.num_key_columns, 2);
+  EXPECT_EQ(stats.num_payload_columns, 1);
+
+  ASSERT_OK_AND_ASSIGN(auto sorted, ReadParquet(output));
+  EXPECT_TRUE(sorted->schema()->Equals(*rows.ToTable()->schema()));
+  EXPECT_EQ(
+      (ColumnValues<arrow::Int64Array, int64_t>(*sorted, "payload")),
+      ExpectedPayload(rows, spec));
+}
+
+TEST_F(ParquetSorterTest, InsertsIntoItsOwnOutput) {
+  Rows rows = MakeRows(3 * kRowGroupRows, 3);
+  SortOptions options;
+  // "key" twice: the file records three sort keys on two columns.
+  ASSERT_OK_AND_ASSIGN(options.sort_keys,
+                       ParseSortSpec("key NULLS FIRST, name, key DESC"));
+  const SortSpec spec = options.sort_keys;
+  ParquetSorter sorter(options);
+  const std::string sorted = directory_.File("sorted.parquet");
+  ASSERT_OK(sorter.Sort(WriteInput(rows), sorted).status());
+
+  // Without sort keys, each insert learns the order from its input, which
+  // for the second one is the output of the first.
+  ParquetSorter inserter{SortOptions{}};
+  const Rows first = MakeRows(700, 4, rows.size());
+  const std::string once = directory_.File("once.parquet");
+  ASSERT_OK_AND_ASSIGN(
+      auto stats,
+      inserter.Insert(sorted, {WriteInput(first, "first.parquet")}, once));
+  rows.Append(first);
+  EXPECT_EQ(stats.num_rows, rows.size());
+  EXPECT_EQ(stats.num_key_columns, 2);
+  EXPECT_EQ(stats.num_payload_columns, 1);
+
+  const Rows second = MakeRows(900, 5, rows.size());
+  const std::string twice = directory_.File("twice.parquet");
+  ASSERT_OK_AND_ASSIGN(
+      stats,
+      inserter.Insert(once, {WriteInput(second, "second.parquet")}, twice));
+  rows.Append(second);
+  EXPECT_EQ(stats.num_rows, rows.size());
+
+  ASSERT_OK_AND_ASSIGN(
+      auto output, ParquetInput::Open(twice, arrow::default_memory_pool()));
+  ASSERT_OK_AND_ASSIGN(auto recorded, SortSpecFromMetadata(*output));
+  EXPECT_EQ(SortSpecToString(recorded), SortSpecToString(spec));
+  // Rows that tie keep the older ones first.
+  ASSERT_OK_AND_ASSIGN(auto table, ReadParquet(twice));
+  EXPECT_EQ((ColumnValues<arrow::Int64Array, int64_t>(*table, "payload")),
+            ExpectedPayload(rows, spec));
+}
+
+TEST_F(ParquetSorterTest, BoundsDistinctKeysBeforeThePayloadPrefetch) {
+  // The statistics are read before the payload prefetch shares the reader,
+  // which ThreadSanitizer would flag otherwise.
+  const Rows rows = MakeRows(6 * kRowGroupRows, 6);
+  SortOptions options;
+  ASSERT_OK_AND_ASSIGN(options.sort_keys, ParseSortSpec("key"));
+  options.prefetch = true;
+  options.algorithm = SortAlgorithm::kAuto;
+  options.num_threads = 1;
+  const SortSpec spec = options.sort_keys;
+  ParquetSorter sorter(options);
+
+  const std::string output = directory_.File("output.parquet");
+  ASSERT_OK_AND_ASSIGN(auto stats, sorter.Sort(WriteInput(rows), output));
+  EXPECT_EQ(stats.sort_algorithm, "counting");
+  EXPECT_NE(stats.sort_algorithm_reason.find("column statistics"),
+            std::string::npos)
+      << stats.sort_algorithm_reason;
+  EXPECT_EQ(stats.num_payload_columns, 2);
+  ASSERT_OK_AND_ASSIGN(auto sorted, ReadParquet(output));
+  EXPECT_EQ((ColumnValues<arrow::Int64Array, int64_t>(*sorted, "payload")),
+            ExpectedPayload(rows, spec));
+}
+
+TEST_F(ParquetSorterTest, PacksKeysByStatisticsBeforeThePayloadPrefetch) {
+  // As above, for the key ranges that pack the keys.
+  const Rows rows = MakeRows(6 * kRowGroupRows, 7);
+  SortOptions options;
+  ASSERT_OK_AND_ASSIGN(options.sort_keys, ParseSortSpec("key DESC"));
+  options.prefetch = true;
+  options.compress_keys = true;
+  options.algorithm = SortAlgorithm::kRadix;
+  const SortSpec spec = options.sort_keys;
+  ParquetSorter sorter(options);
+
+  const std::string output = directory_.File("output.parquet");
+  ASSERT_OK_AND_ASSIGN(auto stats, sorter.Sort(WriteInput(rows), output));
+  // A null byte and one byte for the 201 values of the statistics range.
+  EXPECT_EQ(stats.normalized_key_width, 2);
+  EXPECT_EQ(stats.uncompressed_key_width, 9);
+  ASSERT_OK_AND_ASSIGN(auto sorted, ReadParquet(output));
+  EXPECT_EQ((ColumnValues<arrow::Int64Array, int64_t>(*sorted, "payload")),
+            ExpectedPayload(rows, spec));
+}
+
+TEST_F(ParquetSorterTest, RejectsMissingKeys) {
+  const std::string input = WriteInput(MakeRows(10, 2));
+  SortOptions options;
+  ASSERT_OK_AND_ASSIGN(options.sort_keys, ParseSortSpec("missing"));
+  ParquetSorter sorter(options);
+  EXPECT_FALSE(sorter.Sort(input, directory_.File("output.parquet")).ok());
+
+  ParquetSorter no_keys{SortOptions{}};
+  EXPECT_TRUE(no_keys.Sort(input, directory_.File("output.parquet"))
+                  .status()
+                  .IsInvalid());
+}
+
+}  // namespace
+}  // namespace whippet_sort
@@ -0,0 +1,82 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#include "engine/sort_permutation.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include <arrow/api.h>
+#include <gtest/gtest.h>
+
+#include "test/test_util.h"
+
+namespace whippet_sort {
+namespace {
+
+std::shared_ptr<arrow::Array> RowIdArray(const std::vector<uint64_t>& ids) {
+  std::vector<std::optional<uint64_t>> values(ids.begin(), ids.end());
+  return BuildArray<arrow::UInt64Builder>(values);
+}
+
+TEST(PackRowIdsTest, PacksIdsRelativeToTheirRowGroup) {
+  const std::vector<uint64_t> ids = {9, 0, 4, 2, 3, 10, 7};
+  ASSERT_OK_AND_ASSIGN(auto permutation,
+                       PackRowIds(*RowIdArray(ids), {0, 3, 10, 11},
+                                  arrow::default_memory_pool()));
+  ASSERT_EQ(permutation.num_rows(), 7);
+  // The longest row group has 7 rows, which need 3 bits.
+  EXPECT_EQ(permutation.row_bits, 3);
+  EXPECT_EQ(permutation.packed_row_ids->type_id(), arrow::Type::UINT32);
+  const std::vector<int> row_groups = {1, 0, 1, 0, 1, 2, 1};
+  const std::vector<int64_t> rows = {6, 0, 1, 2, 0, 0, 4};
+  for (int64_t i = 0; i < permutation.num_rows(); ++i) {
+    EXPECT_EQ(permutation.row_group(i), row_groups[i]) << i;
+    EXPECT_EQ(permutation.row_in_group(i), rows[i]) << i;
+    EXPECT_EQ(permutation.row_id(i), static_cast<int64_t>(ids[i])) << i;
+  }
+}
+
+TEST(PackRowIdsTest, WidensToUInt64WhenIdsNeedMoreThan32Bits) {
+  const int64_t big = int64_t{1} << 40;
+  const std::vector<uint64_t> ids = {static_cast<uint64_t>(big) + 1, 5,
+                                     static_cast<uint64_t>(big)};
+  ASSERT_OK_AND_ASSIGN(auto permutation,
+                       PackRowIds(*RowIdArray(ids), {0, big, big + 2},
+                                  arrow::default_memory_pool()));
+  EXPECT_EQ(permutation.row_bits, 40);
+  EXPECT_EQ(permutation.packed_row_ids->type_id(), arrow::Type::UINT64);
+  for (int64_t i = 0; i < permutation.num_rows(); ++i) {
+    EXPECT_EQ(permutation.row_id(i), static_cast<int64_t>(ids[i])) << i;
+  }
+  EXPECT_EQ(permutation.row_group(0), 1);
+  EXPECT_EQ(permutation.row_in_group(0), 1);
+}
+
+TEST(PackRowIdsTest, RejectsOtherArrays) {
+  auto signed_ids = BuildArray<arrow::Int64Builder>(
+      std::vector<std::optional<int64_t>>{0, 1});
+  EXPECT_TRUE(PackRowIds(*signed_ids, {0, 2}, arrow::default_memory_pool())
+                  .status()
+                  .IsInvalid());
+  auto with_null = BuildArray<arrow::UInt64Builder>(
+      std::vector<std::optional<uint64_t>>{0, std::nullopt});
+  EXPECT_TRUE(PackRowIds(*with_null, {0, 2}, arrow::default_memory_pool())
+                  .status()
+                  .IsInvalid());
+}
+
+}  // namespace
+}  // namespace whippet_sort
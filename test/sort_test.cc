@@ -0,0 +1,252 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+// The run sorts and the parallel sort with its merge, each against
+// std::stable_sort of the same rows.
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+#include <gtest/gtest.h>
+
+#include "common/thread_pool.h"
+#include "sort/counting_sort.h"
+#include "sort/key_normalizer.h"
+#include "sort/parallel_sort.h"
+#include "sort/radix_sort.h"
+#include "sort/sort_algorithm.h"
+#include "test/test_util.h"
+
+namespace whippet_sort {
+namespace {
+
+/// Rows of three keys: an integer with few distinct values and nulls, one
+/// over the whole int64 range, and a string whose values share a prefix
+/// longer than the normalized one.
+struct Rows {
+  std::vector<std::optional<int64_t>> narrow;
+  std::vector<std::optional<int64_t>> wide;
+  std::vector<std::optional<std::string>> text;
+
+  int64_t size() const { return static_cast<int64_t>(narrow.size()); }
+};
+
+Rows MakeRows(int64_t num_rows, uint64_t seed) {
+  std::mt19937_64 random(seed);
+  std::uniform_int_distribution<int64_t> narrow(-50, 50);
+  std::uniform_int_distribution<int64_t> wide(
+      std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+  std::uniform_int_distribution<int> suffix(0, 999);
+  std::bernoulli_distribution is_null(0.05);
+  Rows rows;
+  for (int64_t i = 0; i < num_rows; ++i) {
+    rows.narrow.push_back(is_null(random) ? std::nullopt
+                                          : std::optional(narrow(random)));
+    rows.wide.push_back(wide(random));
+    rows.text.push_back(is_null(random)
+                            ? std::nullopt
+                            : std::optional("shared__prefix_" +
+                                            std::to_string(suffix(random))));
+  }
+  return rows;
+}
+
+/// A sort of `rows` on some of their columns, with the order std::stable_sort
+/// gives them.
+struct Query {
+  SortSpec spec;
+  std::vector<std::shared_ptr<arrow::Array>> keys;
+  std::vector<uint64_t> expected;
+};
+
+enum class Keys { kNarrow, kWide, kNarrowAndText };
+
+Query MakeQuery(const Rows& rows, Keys keys) {
+  Query query;
+  const SortKey narrow{"narrow", SortOrder::kDescending,
+                       NullPlacement::kNullsFirst};
+  const SortKey wide{"wide", SortOrder::kAscending, NullPlacement::kNullsLast};
+  const SortKey text{"text", SortOrder::kAscending, NullPlacement::kNullsLast};
+  switch (keys) {
+    case Keys::kNarrow:
+      query.spec = {narrow};
+      query.keys = {BuildArray<arrow::Int64Builder>(rows.narrow)};
+      query.expected = StableOrder(rows.size(), [&](int64_t a, int64_t b) {
+        return CompareValues(rows.narrow[a], rows.narrow[b], narrow);
+      });
+      break;
+    case Keys::kWide:
+      query.spec = {wide};
+      query.keys = {BuildArray<arrow::Int64Builder>(rows.wide)};
+      query.expected = StableOrder(rows.size(), [&](int64_t a, int64_t b) {
+        return CompareValues(rows.wide[a], rows.wide[b], wide);
+      });
+      break;
+    case Keys::kNarrowAndText:
+      query.spec = {narrow, text};
+      query.keys = {BuildArray<arrow::Int64Builder>(rows.narrow),
+                    BuildArray<arrow::StringBuilder>(rows.text)};
+      query.expected = StableOrder(rows.size(), [&](int64_t a, int64_t b) {
+        const int cmp = CompareValues(rows.narrow[a], rows.narrow[b], narrow);
+        return cmp != 0 ? cmp : CompareValues(rows.text[a], rows.text[b], text);
+      });
+      break;
+  }
+  return query;
+}
+
+TEST(RadixSortTest, MatchesStableSort) {
+  // Enough rows for the staged scatter of the SIMD kernels.
+  const Rows rows = MakeRows(20000, 1);
+  for (Keys keys : {Keys::kNarrow, Keys::kWide, Keys::kNarrowAndText}) {
+    const Query query = MakeQuery(rows, keys);
+    ASSERT_OK_AND_ASSIGN(auto normalizer,
+                         KeyNormalizer::Make(query.spec, query.keys));
+    ASSERT_OK_AND_ASSIGN(
+        auto normalized,
+        normalizer->NormalizeAll(arrow::default_memory_pool(), true));
+    std::vector<uint64_t> row_ids(rows.size());
+    ASSERT_OK(RadixSort(&normalized, *normalizer, row_ids.data(),
+                        arrow::default_memory_pool()));
+    EXPECT_EQ(row_ids, query.expected) << SortSpecToString(query.spec);
+    EXPECT_EQ(RowIds(normalized), query.expected)
+        << SortSpecToString(query.spec);
+  }
+}
+
+TEST(RadixSortTest, SortsFewRows) {
+  for (int64_t num_rows : {0, 1, 2, 3, 17}) {
+    const Rows rows = MakeRows(num_rows, 2);
+    const Query query = MakeQuery(rows, Keys::kNarrowAndText);
+    ASSERT_OK_AND_ASSIGN(auto normalizer,
+                         KeyNormalizer::Make(query.spec, query.keys));
+    ASSERT_OK_AND_ASSIGN(
+        auto normalized,
+        normalizer->NormalizeAll(arrow::default_memory_pool(), true));
+    ASSERT_OK(RadixSort(&normalized, *normalizer, nullptr,
+                        arrow::default_memory_pool()));
+    EXPECT_EQ(RowIds(normalized), query.expected) << num_rows << " rows";
+  }
+}
+
+TEST(CountingSortTest, MatchesStableSortOnFewValues) {
+  const Rows rows = MakeRows(20000, 3);
+  const Query query = MakeQuery(rows, Keys::kNarrow);
+  ASSERT_OK_AND_ASSIGN(auto normalizer,
+                       KeyNormalizer::Make(query.spec, query.keys));
+  ASSERT_OK_AND_ASSIGN(
+      auto normalized,
+      normalizer->NormalizeAll(arrow::default_memory_pool(), true));
+  ASSERT_OK_AND_ASSIGN(bool counted,
+                       CountingSort(&normalized, *normalizer,
+                                    arrow::default_memory_pool()));
+  EXPECT_TRUE(counted);
+  EXPECT_EQ(RowIds(normalized), query.expected);
+}
+
+TEST(CountingSortTest, DeclinesKeysDifferingInMoreBytes) {
+  const Rows rows = MakeRows(1000, 4);
+  for (Keys keys : {Keys::kWide, Keys::kNarrowAndText}) {
+    const Query query = MakeQuery(rows, keys);
+    ASSERT_OK_AND_ASSIGN(auto normalizer,
+                         KeyNormalizer::Make(query.spec, query.keys));
+    ASSERT_OK_AND_ASSIGN(
+        auto normalized,
+        normalizer->NormalizeAll(arrow::default_memory_pool(), true));
+    ASSERT_OK_AND_ASSIGN(bool counted,
+                         CountingSort(&normalized, *normalizer,
+                                      arrow::default_memory_pool()));
+    EXPECT_FALSE(counted) << SortSpecToString(query.spec);
+    std::vector<uint64_t> unchanged(rows.size());
+    std::iota(unchanged.begin(), unchanged.end(), uint64_t{0});
+    EXPECT_EQ(RowIds(normalized), unchanged);
+  }
+}
+
+class ParallelSorterMergeTest
+    : public ::testing::TestWithParam<SortAlgorithm> {};
+
+TEST_P(ParallelSorterMergeTest, MergedRunsMatchStableSort) {
+  // More rows than ParallelSorter::kMinRunRows per thread, so that the merge
+  // is cut into partitions.
+  const Rows rows = MakeRows(4 * ParallelSorter::kMinRunRows + 123, 5);
+  ThreadPoolOptions thread_options;
+  thread_options.num_threads = 4;
+  ThreadPool threads(thread_options);
+  for (Keys keys : {Keys::kNarrow, Keys::kWide, Keys::kNarrowAndText}) {
+    const Query query = MakeQuery(rows, keys);
+    ASSERT_OK_AND_ASSIGN(auto normalizer,
+                         KeyNormalizer::Make(query.spec, query.keys));
+    ParallelSorter sorter(*normalizer, &threads, arrow::default_memory_pool());
+    ASSERT_OK(sorter.Normalize(/*max_run_rows=*/10000));
+    EXPECT_GT(sorter.num_runs(), 1);
+    ASSERT_OK(sorter.SortRuns(GetParam()));
+    std::vector<uint64_t> row_ids(rows.size());
+    ASSERT_OK(sorter.Merge(row_ids.data()));
+    EXPECT_EQ(row_ids, query.expected) << SortSpecToString(query.spec);
+  }
+}
+
+TEST_P(ParallelSorterMergeTest, RunsDoNotSpanSplits) {
+  const Rows rows = MakeRows(30000, 6);
+  ThreadPoolOptions thread_options;
+  thread_options.num_threads = 2;
+  ThreadPool threads(thread_options);
+  const Query query = MakeQuery(rows, Keys::kNarrowAndText);
+  ASSERT_OK_AND_ASSIGN(auto normalizer,
+                       KeyNormalizer::Make(query.spec, query.keys));
+  ParallelSorter sorter(*normalizer, &threads, arrow::default_memory_pool());
+  ASSERT_OK(sorter.Normalize(/*max_run_rows=*/1 << 20, {7000, 19000}));
+  ASSERT_EQ(sorter.num_runs(), 3);
+  EXPECT_EQ(sorter.run_rows(0), 7000);
+  EXPECT_EQ(sorter.run_rows(1), 12000);
+  ASSERT_OK(sorter.SortRuns(GetParam()));
+  std::vector<uint64_t> row_ids(rows.size());
+  ASSERT_OK(sorter.Merge(row_ids.data()));
+  EXPECT_EQ(row_ids, query.expected);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Algorithms, ParallelSorterMergeTest,
+    ::testing::Values(SortAlgorithm::kComparison, SortAlgorithm::kRadix,
+                      SortAlgorithm::kCounting, SortAlgorithm::kRunMerge),
+    [](const ::testing::TestParamInfo<SortAlgorithm>& info) {
+      // Test names allow neither '-' nor other punctuation.
+      std::string name = SortAlgorithmName(info.param);
+      std::replace(name.begin(), name.end(), '-', '_');
+      return name;
+    });
+
+TEST(ParallelSorterTest, RejectsAlgorithmsThatDoNotSortRuns) {
+  const Rows rows = MakeRows(100, 7);
+  ThreadPool threads;
+  const Query query = MakeQuery(rows, Keys::kNarrow);
+  ASSERT_OK_AND_ASSIGN(auto normalizer,
+                       KeyNormalizer::Make(query.spec, query.keys));
+  ParallelSorter sorter(*normalizer, &threads, arrow::default_memory_pool());
+  ASSERT_OK(sorter.Normalize(1000));
+  EXPECT_TRUE(sorter.SortRuns(SortAlgorithm::kAuto).IsInvalid());
+  EXPECT_TRUE(sorter.SortRuns(SortAlgorithm::kGpu).IsInvalid());
+}
+
+}  // namespace
+}  // namespace whippet_sort
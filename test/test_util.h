@@ -0,0 +1,192 @@
+// Copyright 2024 Whippet Sort
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+#pragma once
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <gtest/gtest.h>
+#include <parquet/arrow/writer.h>
+
+#include "io/parquet_input.h"
+#include "sort/key_normalizer.h"
+#include "sort/sort_spec.h"
+
+#define WHIPPET_CONCAT_IMPL(x, y) x##y
+#define WHIPPET_CONCAT(x, y) WHIPPET_CONCAT_IMPL(x, y)
+
+/// Fails the test unless the arrow::Status `expr` is OK.
+#define ASSERT_OK(expr)                                \
+  do {                                                 \
+    const ::arrow::Status _status = (expr);            \
+    ASSERT_TRUE(_status.ok()) << _status.ToString();   \
+  } while (false)
+
+#define ASSERT_OK_AND_ASSIGN_IMPL(result, lhs, rexpr)             \
+  auto result = (rexpr);                                          \
+  ASSERT_TRUE(result.ok()) << result.status().ToString();         \
+  lhs = std::move(result).ValueUnsafe()
+
+/// Fails the test unless the arrow::Result `rexpr` is OK, else assigns its
+/// value to `lhs`.
+#define ASSERT_OK_AND_ASSIGN(lhs, rexpr) \
+  ASSERT_OK_AND_ASSIGN_IMPL(WHIPPET_CONCAT(_result_, __LINE__), lhs, rexpr)
+
+namespace whippet_sort {
+
+/// Builds an array with `Builder` from `values`, nullopt standing for null.
+template <typename Builder, typename T>
+std::shared_ptr<arrow::Array> BuildArray(
+    const std::vector<std::optional<T>>& values) {
+  Builder builder;
+  for (const auto& value : values) {
+    auto status = value.has_value() ? builder.Append(*value)
+                                    : builder.AppendNull();
+    EXPECT_TRUE(status.ok()) << status.ToString();
+  }
+  std::shared_ptr<arrow::Array> array;
+  auto status = builder.Finish(&array);
+  EXPECT_TRUE(status.ok()) << status.ToString();
+  return array;
+}
+
+/// Compares two values of `key` as ORDER BY does: nulls by the null
+/// placement, -0.0 equal to 0.0, NaN after all numbers, and the values
+/// reversed for DESC. Returns <0, 0 or >0.
+template <typename T>
+int CompareValues(const std::optional<T>& a, const std::optional<T>& b,
+                  const SortKey& key) {
+  if (!a.has_value() || !b.has_value()) {
+    if (!a.has_value() && !b.has_value()) return 0;
+    return !a.has_value() == key.nulls_first() ? -1 : 1;
+  }
+  int cmp;
+  if constexpr (std::is_floating_point_v<T>) {
+    const bool a_nan = std::isnan(*a);
+    const bool b_nan = std::isnan(*b);
+    cmp = a_nan || b_nan ? static_cast<int>(a_nan) - static_cast<int>(b_nan)
+                         : (*a < *b ? -1 : (*b < *a ? 1 : 0));
+  } else {
+    cmp = *a < *b ? -1 : (*b < *a ? 1 : 0);
+  }
+  return key.ascending() ? cmp : -cmp;
+}
+
+/// Row ids 0 to `num_rows` - 1 sorted with std::stable_sort by `compare`,
+/// which returns <0, 0 or >0: the order every sort of the library must
+/// produce.
+template <typename Compare>
+std::vector<uint64_t> StableOrder(int64_t num_rows, Compare compare) {
+  std::vector<uint64_t> ids(num_rows);
+  std::iota(ids.begin(), ids.end(), uint64_t{0});
+  std::stable_sort(ids.begin(), ids.end(), [&](uint64_t a, uint64_t b) {
+    return compare(static_cast<int64_t>(a), static_cast<int64_t>(b)) < 0;
+  });
+  return ids;
+}
+
+/// Row ids of the rows of `normalizer` ordered by their normalized keys,
+/// ties broken by CompareTail and then by row id, as the sorts do.
+inline std::vector<uint64_t> NormalizedOrder(const KeyNormalizer& normalizer) {
+  auto keys = normalizer.NormalizeAll(arrow::default_memory_pool());
+  const NormalizedKeys& rows = keys.ValueOrDie();
+  return StableOrder(rows.num_rows, [&](int64_t a, int64_t b) {
+    const int cmp =
+        CompareNormalizedKeys(rows.row(a), rows.row(b), rows.key_width);
+    return cmp != 0 ? cmp : normalizer.CompareTail(a, b);
+  });
+}
+
+/// The row ids of normalized keys with row ids, in their current order.
+inline std::vector<uint64_t> RowIds(const NormalizedKeys& keys) {
+  std::vector<uint64_t> ids(keys.num_rows);
+  for (int64_t i = 0; i < keys.num_rows; ++i) ids[i] = keys.row_id(i);
+  return ids;
+}
+
+/// A directory of its own for each test, removed with everything in it when
+/// the test ends.
+class ScratchDirectory {
+ public:
+  ScratchDirectory() {
+    const auto* test = ::testing::UnitTest::GetInstance()->current_test_info();
+    path_ = std::filesystem::temp_directory_path() /
+            ("whippet_sort_" + std::string(test->test_suite_name()) + "_" +
+             test->name() + "_" + std::to_string(getpid()));
+    std::filesystem::remove_all(path_);
+    std::filesystem::create_directories(path_);
+  }
+  ~ScratchDirectory() { std::filesystem::remove_all(path_); }
+
+  /// The path of the file `name` in the directory.
+  std::string File(const std::string& name) const {
+    return (path_ / name).string();
+  }
+
+ private:
+  std::filesystem::path path_;
+};
+
+/// Writes `table` to the Parquet file `path` in row groups of
+/// `row_group_rows` rows, with the default writer properties.
+inline arrow::Status WriteParquet(const arrow::Table& table,
+                                  const std::string& path,
+                                  int64_t row_group_rows) {
+  ARROW_ASSIGN_OR_RAISE(auto file, arrow::io::FileOutputStream::Open(path));
+  ARROW_RETURN_NOT_OK(parquet::arrow::WriteTable(
+      table, arrow::default_memory_pool(), file, row_group_rows));
+  return file->Close();
+}
+
+/// Decodes all rows of the Parquet file `path`.
+inline arrow::Result<std::shared_ptr<arrow::Table>> ReadParquet(
+    const std::string& path) {
+  ARROW_ASSIGN_OR_RAISE(
+      auto input, ParquetInput::Open(path, arrow::default_memory_pool()));
+  std::vector<int> row_groups(input->num_row_groups());
+  std::iota(row_groups.begin(), row_groups.end(), 0);
+  return input->ReadRowGroups(row_groups);
+}
+
+/// The values of the column `name` of `table`, nullopt standing for null,
+/// read with the `ArrayType` of the column.
+template <typename ArrayType, typename T>
+std::vector<std::optional<T>> ColumnValues(const arrow::Table& table,
+                                           const std::string& name) {
+  std::vector<std::optional<T>> values;
+  for (const auto& chunk : table.GetColumnByName(name)->chunks()) {
+    const auto& array = static_cast<const ArrayType&>(*chunk);
+    for (int64_t i = 0; i < array.length(); ++i) {
+      values.push_back(array.IsNull(i) ? std::nullopt
+                                       : std::optional<T>(array.GetView(i)));
+    }
+  }
+  return values;
+}
+}  // namespace whippet_sort